@@ -85,7 +85,8 @@ print_inode_entry(struct nffs_inode_entry *inode_entry, int indent)
                          &area_idx, &area_offset);
 
     rc = nffs_flash_read(area_idx,
-                         area_offset + sizeof (struct nffs_disk_inode),
+                         area_offset + sizeof (struct nffs_disk_inode) +
+                             inode.ni_inline_len,
                          name, inode.ni_filename_len);
     assert(rc == 0);
 
@@ -121,10 +122,13 @@ print_nffs_inode(int idx, uint32_t off)
 
     memset(filename, 0, sizeof(filename));
     len = min(sizeof(filename) - 1, ndi.ndi_filename_len);
-    rc = nffs_flash_read(idx, off + sizeof(ndi), filename, len);
+    rc = nffs_flash_read(idx,
+                         off + sizeof(ndi) + nffs_inode_disk_inline_len(&ndi),
+                         filename, len);
     printf("      %x-%d inode %d/%d %s\n",
       off, ndi.ndi_filename_len, ndi.ndi_id, ndi.ndi_seq, filename);
-    return sizeof(ndi) + ndi.ndi_filename_len;
+    return sizeof(ndi) + nffs_inode_disk_inline_len(&ndi) +
+           ndi.ndi_filename_len;
 }
 
 static int
@@ -136,8 +140,10 @@ print_nffs_block(int idx, uint32_t off)
     rc = nffs_flash_read(idx, off, &ndb, sizeof(ndb));
     assert(rc == 0);
 
-    printf("      %x-%d block %u/%u belongs to %u\n",
-      off, ndb.ndb_data_len, ndb.ndb_id, ndb.ndb_seq, ndb.ndb_inode_id);
+    printf("      %x-%d %sblock %u/%u belongs to %u\n",
+      off, ndb.ndb_data_len,
+      ndb.ndb_magic == NFFS_BLOCK_MAGIC_COMPRESSED ? "compressed " : "",
+      ndb.ndb_id, ndb.ndb_seq, ndb.ndb_inode_id);
     return sizeof(ndb) + ndb.ndb_data_len;
 }
 
@@ -150,11 +156,13 @@ print_nffs_object(int idx, uint32_t off)
     rc = nffs_flash_read(idx, off, &magic, sizeof(magic));
     assert(rc == 0);
 
-    switch (magic) {
-    case NFFS_INODE_MAGIC:
+    if (nffs_inode_magic_is_set(magic)) {
         return print_nffs_inode(idx, off);
+    }
 
+    switch (magic) {
     case NFFS_BLOCK_MAGIC:
+    case NFFS_BLOCK_MAGIC_COMPRESSED:
         return print_nffs_block(idx, off);
         break;
 
@@ -173,17 +181,19 @@ print_nffs_area(int idx)
 {
     struct nffs_area *area;
     struct nffs_disk_area darea;
+    uint32_t hdr_len;
     int off;
     int rc;
 
     area = &nffs_areas[idx];
     rc = nffs_flash_read(idx, 0, &darea, sizeof(darea));
     assert(rc == 0);
-    if (!nffs_area_magic_is_set(&darea)) {
+    if (!nffs_area_magic_is_set(&darea) ||
+        nffs_area_from_disk(&darea, &hdr_len) != 0) {
         printf("Area header corrupt!\n");
         return;
     }
-    off = sizeof (struct nffs_disk_area);
+    off = hdr_len;
     while (off < area->na_cur) {
         off += print_nffs_object(idx, off);
     }
@@ -337,6 +347,7 @@ main(int argc, char **argv)
     }
 
     os_init();
+    cnt = MAX_AREAS - 1;
     rc = flash_area_to_nffs_desc(FLASH_AREA_NFFS, &cnt, area_descs);
     assert(rc == 0);
 
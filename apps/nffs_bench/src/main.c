@@ -0,0 +1,506 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Repeatable NFFS benchmarks on top of the native flash simulator.  Each
+ * benchmark starts from a freshly formatted file system and prints a single
+ * line of JSON describing the elapsed time and the flash traffic it caused,
+ * so the output of two builds can be compared mechanically.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include "../src/nffs_priv.h"
+#include <os/os.h>
+#include <fs/fs.h>
+#include <nffs/nffs.h>
+#include <hal/hal_flash.h>
+#include <util/crc16.h>
+#ifdef ARCH_sim
+#include <mcu/mcu_sim.h>
+#include <mcu/native_flash.h>
+#endif
+
+/* Four 128 kB sectors of the simulated flash. */
+static const struct nffs_area_desc bench_area_descs[] = {
+    { 0x00020000, 128 * 1024 },
+    { 0x00040000, 128 * 1024 },
+    { 0x00060000, 128 * 1024 },
+    { 0x00080000, 128 * 1024 },
+    { 0, 0 },
+};
+
+#define BENCH_FILE_SIZE         (64 * 1024)
+#define BENCH_CHUNK_SIZE        256
+#define BENCH_RAND_IO_SIZE      64
+#define BENCH_RAND_OPS          512
+#define BENCH_LOG_ENTRY_SIZE    48
+#define BENCH_LOG_ENTRIES       1024
+#define BENCH_SMALL_FILE_SIZE   32
+#define BENCH_CRC_ROUNDS        64
+
+static const char *progname;
+static const char *bench_only;
+static int bench_num_files = 100;
+static unsigned int bench_seed = 1;
+static uint8_t bench_buf[BENCH_CHUNK_SIZE];
+
+/* Timings of a typical internal NOR flash (-m): ~16 us per 32-bit word and
+ * about one second per 128 kB sector erase.
+ */
+static const struct native_flash_model bench_flash_model = {
+    .nfm_prog_ns_per_byte = 4000,
+    .nfm_erase_us = 1000000,
+    .nfm_nor = 1,
+};
+
+/** Snapshot taken when a benchmark's measured section begins. */
+struct bench_mark {
+    struct timespec bm_time;
+    uint64_t bm_flash_us;
+    STATS_SECT_DECL(nffs_stats) bm_stats;
+};
+
+static void
+bench_begin(struct bench_mark *mark)
+{
+    mark->bm_stats = nffs_stats;
+    mark->bm_flash_us = native_flash_model_time_us();
+    clock_gettime(CLOCK_MONOTONIC, &mark->bm_time);
+}
+
+/**
+ * Ends a measured section and prints its results as one JSON object.
+ *
+ * @param mark              The snapshot taken by bench_begin().
+ * @param name              The benchmark name.
+ * @param ops               The number of file system operations performed.
+ * @param bytes             The number of bytes of file data read or written.
+ */
+static void
+bench_end(const struct bench_mark *mark, const char *name, uint32_t ops,
+          uint32_t bytes)
+{
+    struct timespec now;
+    uint64_t usecs;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (uint64_t)(now.tv_sec - mark->bm_time.tv_sec) * 1000000 +
+            (now.tv_nsec - mark->bm_time.tv_nsec) / 1000;
+
+#define BENCH_DELTA(field) \
+    (nffs_stats.STATS_SECT_VAR(field) - mark->bm_stats.STATS_SECT_VAR(field))
+
+    printf("{\"bench\":\"%s\",\"ops\":%" PRIu32 ",\"bytes\":%" PRIu32
+           ",\"usecs\":%" PRIu64 ",\"flash_usecs\":%" PRIu64
+           ",\"flash_reads\":%" PRIu32
+           ",\"flash_read_bytes\":%" PRIu32 ",\"flash_writes\":%" PRIu32
+           ",\"flash_write_bytes\":%" PRIu32 ",\"erases\":%" PRIu32
+           ",\"gc_runs\":%" PRIu32 ",\"gc_bytes\":%" PRIu32 "}\n",
+           name, ops, bytes, usecs,
+           native_flash_model_time_us() - mark->bm_flash_us,
+           BENCH_DELTA(flash_reads), BENCH_DELTA(flash_read_bytes),
+           BENCH_DELTA(flash_writes), BENCH_DELTA(flash_write_bytes),
+           BENCH_DELTA(erases), BENCH_DELTA(gc_runs), BENCH_DELTA(gc_bytes));
+
+#undef BENCH_DELTA
+}
+
+static void
+bench_format(void)
+{
+    int rc;
+
+    rc = nffs_format(bench_area_descs);
+    assert(rc == 0);
+}
+
+static void
+bench_fill_buf(uint32_t seq)
+{
+    int i;
+
+    for (i = 0; i < sizeof bench_buf; i++) {
+        bench_buf[i] = seq + i;
+    }
+}
+
+static void
+bench_write_file(const char *path, uint32_t size)
+{
+    struct fs_file *file;
+    uint32_t off;
+    int rc;
+
+    rc = fs_open(path, FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    assert(rc == 0);
+
+    for (off = 0; off < size; off += BENCH_CHUNK_SIZE) {
+        bench_fill_buf(off);
+        rc = fs_write(file, bench_buf, BENCH_CHUNK_SIZE);
+        assert(rc == 0);
+    }
+
+    rc = fs_close(file);
+    assert(rc == 0);
+}
+
+static void
+bench_seq_write(void)
+{
+    struct bench_mark mark;
+
+    bench_format();
+
+    bench_begin(&mark);
+    bench_write_file("/seq", BENCH_FILE_SIZE);
+    bench_end(&mark, "seq_write", BENCH_FILE_SIZE / BENCH_CHUNK_SIZE,
+              BENCH_FILE_SIZE);
+}
+
+static void
+bench_seq_read(void)
+{
+    struct bench_mark mark;
+    struct fs_file *file;
+    uint32_t total;
+    uint32_t len;
+    uint32_t ops;
+    int rc;
+
+    bench_format();
+    bench_write_file("/seq", BENCH_FILE_SIZE);
+
+    rc = fs_open("/seq", FS_ACCESS_READ, &file);
+    assert(rc == 0);
+
+    bench_begin(&mark);
+    total = 0;
+    ops = 0;
+    do {
+        rc = fs_read(file, sizeof bench_buf, bench_buf, &len);
+        assert(rc == 0);
+        total += len;
+        ops++;
+    } while (len > 0);
+    bench_end(&mark, "seq_read", ops, total);
+
+    fs_close(file);
+}
+
+static void
+bench_rand_io(int write)
+{
+    struct bench_mark mark;
+    struct fs_file *file;
+    uint32_t off;
+    uint32_t len;
+    int rc;
+    int i;
+
+    bench_format();
+    bench_write_file("/rand", BENCH_FILE_SIZE);
+
+    rc = fs_open("/rand", write ? FS_ACCESS_WRITE : FS_ACCESS_READ, &file);
+    assert(rc == 0);
+
+    srand(bench_seed);
+    bench_begin(&mark);
+    for (i = 0; i < BENCH_RAND_OPS; i++) {
+        off = rand() % (BENCH_FILE_SIZE - BENCH_RAND_IO_SIZE);
+        rc = fs_seek(file, off);
+        assert(rc == 0);
+
+        if (write) {
+            bench_fill_buf(i);
+            rc = fs_write(file, bench_buf, BENCH_RAND_IO_SIZE);
+        } else {
+            rc = fs_read(file, BENCH_RAND_IO_SIZE, bench_buf, &len);
+            assert(len == BENCH_RAND_IO_SIZE);
+        }
+        assert(rc == 0);
+    }
+    bench_end(&mark, write ? "rand_write" : "rand_read", BENCH_RAND_OPS,
+              BENCH_RAND_OPS * BENCH_RAND_IO_SIZE);
+
+    fs_close(file);
+}
+
+static void
+bench_rand_read(void)
+{
+    bench_rand_io(0);
+}
+
+static void
+bench_rand_write(void)
+{
+    bench_rand_io(1);
+}
+
+static void
+bench_create_small_files(int count)
+{
+    struct fs_file *file;
+    char path[16];
+    int rc;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        rc = fs_open(path, FS_ACCESS_WRITE, &file);
+        assert(rc == 0);
+        bench_fill_buf(i);
+        rc = fs_write(file, bench_buf, BENCH_SMALL_FILE_SIZE);
+        assert(rc == 0);
+        rc = fs_close(file);
+        assert(rc == 0);
+    }
+}
+
+static void
+bench_small_files(void)
+{
+    struct bench_mark mark;
+    char path[16];
+    int rc;
+    int i;
+
+    bench_format();
+
+    bench_begin(&mark);
+    bench_create_small_files(bench_num_files);
+    bench_end(&mark, "small_create", bench_num_files,
+              bench_num_files * BENCH_SMALL_FILE_SIZE);
+
+    bench_begin(&mark);
+    for (i = 0; i < bench_num_files; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        rc = fs_unlink(path);
+        assert(rc == 0);
+    }
+    bench_end(&mark, "small_delete", bench_num_files, 0);
+}
+
+static void
+bench_append_log(void)
+{
+    struct bench_mark mark;
+    struct fs_file *file;
+    int rc;
+    int i;
+
+    bench_format();
+
+    rc = fs_open("/log", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    assert(rc == 0);
+
+    bench_begin(&mark);
+    for (i = 0; i < BENCH_LOG_ENTRIES; i++) {
+        bench_fill_buf(i);
+        rc = fs_write(file, bench_buf, BENCH_LOG_ENTRY_SIZE);
+        assert(rc == 0);
+    }
+    rc = fs_close(file);
+    assert(rc == 0);
+    bench_end(&mark, "append_log", BENCH_LOG_ENTRIES,
+              BENCH_LOG_ENTRIES * BENCH_LOG_ENTRY_SIZE);
+}
+
+static void
+bench_mount(void)
+{
+    struct bench_mark mark;
+    int rc;
+
+    bench_format();
+    bench_create_small_files(bench_num_files);
+    bench_write_file("/seq", BENCH_FILE_SIZE);
+
+    bench_begin(&mark);
+    rc = nffs_detect(bench_area_descs);
+    assert(rc == 0);
+    bench_end(&mark, "mount", 1, 0);
+}
+
+static void
+bench_gc_full(void)
+{
+    struct bench_mark mark;
+    uint32_t garbage;
+    uint32_t target;
+    int num_gcs;
+    int rc;
+    int i;
+
+    bench_format();
+
+    /* Keep one live file and fill most of the disk with superseded copies of
+     * a second one, without triggering collection.
+     */
+    bench_write_file("/live", BENCH_FILE_SIZE / 4);
+    target = (nffs_num_areas - 1) * bench_area_descs[0].nad_length / 2;
+    for (garbage = 0; garbage < target; garbage += BENCH_FILE_SIZE / 4) {
+        bench_write_file("/churn", BENCH_FILE_SIZE / 4);
+    }
+
+    /* Collect every non-scratch area once. */
+    num_gcs = nffs_num_areas - 1;
+    bench_begin(&mark);
+    for (i = 0; i < num_gcs; i++) {
+        rc = nffs_gc(NULL);
+        assert(rc == 0);
+    }
+    bench_end(&mark, "gc_full", num_gcs, 0);
+}
+
+/**
+ * Measures the CRC kernels NFFS uses to validate every object, independent
+ * of flash access.
+ */
+static void
+bench_crc16(void)
+{
+    static uint8_t buf[BENCH_FILE_SIZE];
+    struct bench_mark mark;
+    volatile uint16_t crc;
+    int i;
+
+    for (i = 0; i < sizeof buf; i++) {
+        buf[i] = rand();
+    }
+
+    bench_begin(&mark);
+    for (i = 0; i < BENCH_CRC_ROUNDS; i++) {
+        crc = crc16_ccitt_bytewise(0, buf, sizeof buf);
+    }
+    bench_end(&mark, "crc16_bytewise", BENCH_CRC_ROUNDS,
+              BENCH_CRC_ROUNDS * sizeof buf);
+
+    bench_begin(&mark);
+    for (i = 0; i < BENCH_CRC_ROUNDS; i++) {
+        crc = crc16_ccitt(0, buf, sizeof buf);
+    }
+    bench_end(&mark, "crc16", BENCH_CRC_ROUNDS,
+              BENCH_CRC_ROUNDS * sizeof buf);
+
+    (void)crc;
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(void);
+} bench_table[] = {
+    { "seq_write", bench_seq_write },
+    { "seq_read", bench_seq_read },
+    { "rand_read", bench_rand_read },
+    { "rand_write", bench_rand_write },
+    { "small_files", bench_small_files },
+    { "append_log", bench_append_log },
+    { "mount", bench_mount },
+    { "gc_full", bench_gc_full },
+    { "crc16", bench_crc16 },
+};
+
+static void
+usage(int rc)
+{
+    int i;
+
+    printf("%s [-b bench] [-f flash_file] [-m] [-n num_files] [-s seed]\n",
+           progname);
+    printf("  Runs NFFS benchmarks on the simulated flash; one JSON object\n");
+    printf("  per line is written to stdout.\n");
+    printf("   -b: run only the named benchmark:");
+    for (i = 0; i < sizeof bench_table / sizeof bench_table[0]; i++) {
+        printf(" %s", bench_table[i].name);
+    }
+    printf("\n");
+    printf("   -f: flash_file is the name of the flash image file\n");
+    printf("   -m: model NOR program and erase times; flash_usecs reports\n");
+    printf("       the virtual time charged by the flash\n");
+    printf("   -n: number of files for the small-file and mount benchmarks\n");
+    printf("   -s: seed for the random read/write offsets\n");
+    exit(rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    int found;
+    int rc;
+    int ch;
+    int i;
+
+    progname = argv[0];
+
+    while ((ch = getopt(argc, argv, "b:f:mn:s:")) != -1) {
+        switch (ch) {
+        case 'b':
+            bench_only = optarg;
+            break;
+        case 'f':
+            native_flash_file = optarg;
+            break;
+        case 'm':
+            native_flash_model_set(&bench_flash_model);
+            break;
+        case 'n':
+            bench_num_files = atoi(optarg);
+            break;
+        case 's':
+            bench_seed = strtoul(optarg, NULL, 0);
+            break;
+        case '?':
+        default:
+            usage(1);
+        }
+    }
+
+    os_init();
+
+    rc = hal_flash_init();
+    assert(rc == 0);
+
+    /* Leave enough room for the largest benchmark. */
+    nffs_config.nc_num_inodes = bench_num_files + 64;
+    nffs_config.nc_num_blocks = 4096;
+
+    rc = nffs_init();
+    assert(rc == 0);
+
+    found = 0;
+    for (i = 0; i < sizeof bench_table / sizeof bench_table[0]; i++) {
+        if (bench_only == NULL || strcmp(bench_only, bench_table[i].name) == 0) {
+            bench_table[i].fn();
+            found = 1;
+        }
+    }
+
+    if (!found) {
+        usage(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,770 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host tool for producing NFFS images for manufacturing.
+ *
+ * An image is built by writing disk objects directly, rather than by
+ * replaying file system operations: every file's data is laid out in blocks
+ * of the maximum size, small files can be stored inline in their inodes, and
+ * directory entries are written in sorted order.  The result never needs
+ * garbage collection and restores with the minimum number of objects.
+ *
+ * The tool can also verify an existing image (object CRCs, mount, and a full
+ * read of every file) and report how much of each area is live, dead or free.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../src/nffs_priv.h"
+#include <os/os.h>
+#include <fs/fs.h>
+#include <nffs/nffs.h>
+#include <hal/hal_flash.h>
+#include <hal/flash_map.h>
+#ifdef ARCH_sim
+#include <mcu/mcu_sim.h>
+#endif
+
+#define IMAGE_MAX_AREAS         16
+#define IMAGE_PATH_MAX          1024
+
+static struct nffs_area_desc image_area_descs[IMAGE_MAX_AREAS];
+
+static const char *progname;
+static const char *image_src_dir;
+static const char *image_out_file;
+static int image_verify;
+static int image_usage;
+
+/** Per-area tallies gathered by image_scan(). */
+struct image_area_usage {
+    uint32_t iau_hdr;           /* Size of the area header. */
+    uint32_t iau_live;          /* Bytes in objects the file system uses. */
+    uint32_t iau_dead;          /* Bytes in superseded or deleted objects. */
+    uint32_t iau_corrupt;       /* Number of objects with a bad CRC. */
+    uint32_t iau_inodes;        /* Number of live inodes. */
+    uint32_t iau_blocks;        /* Number of live data blocks. */
+};
+
+static void usage(int rc);
+
+/**
+ * Writes a new inode directly to flash.
+ *
+ * @param is_dir                1 for a directory; 0 for a regular file.
+ * @param parent_id             The ID of the parent directory.
+ * @param name                  The entry's name.
+ * @param inline_data           Data to store in the inode; NULL if none.
+ * @param inline_len            The length of the inline data.
+ * @param out_id                On success, the new inode's ID gets written
+ *                                  here.
+ *
+ * @return                      0 on success; FS_E[...] on failure.
+ */
+static int
+image_write_inode(int is_dir, uint32_t parent_id, const char *name,
+                  const void *inline_data, uint8_t inline_len,
+                  uint32_t *out_id)
+{
+    struct nffs_disk_inode disk_inode;
+    uint32_t offset;
+    uint8_t area_idx;
+    int name_len;
+    int rc;
+
+    name_len = strlen(name);
+    if (name_len > NFFS_FILENAME_MAX_LEN) {
+        return FS_EINVAL;
+    }
+
+    rc = nffs_misc_reserve_space(sizeof disk_inode + inline_len + name_len,
+                                 &area_idx, &offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    memset(&disk_inode, 0xff, sizeof disk_inode);
+    if (inline_len != 0) {
+        disk_inode.ndi_magic = NFFS_INODE_MAGIC_INLINE | inline_len;
+    } else {
+        disk_inode.ndi_magic = NFFS_INODE_MAGIC;
+    }
+    if (is_dir) {
+        disk_inode.ndi_id = nffs_hash_next_dir_id++;
+    } else {
+        disk_inode.ndi_id = nffs_hash_next_file_id++;
+    }
+    disk_inode.ndi_seq = 0;
+    disk_inode.ndi_parent_id = parent_id;
+    disk_inode.ndi_flags = 0xff;
+    disk_inode.ndi_filename_len = name_len;
+    nffs_crc_disk_inode_fill(&disk_inode, inline_data, name);
+
+    rc = nffs_inode_write_disk(&disk_inode, inline_data, name, area_idx,
+                               offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    *out_id = disk_inode.ndi_id;
+    return 0;
+}
+
+/**
+ * Writes a file's contents as a chain of maximum-size data blocks.
+ */
+static int
+image_write_blocks(uint32_t inode_id, const uint8_t *data, uint32_t len)
+{
+    struct nffs_disk_block disk_block;
+    uint32_t prev_id;
+    uint32_t offset;
+    uint8_t area_idx;
+    uint16_t chunk;
+    int rc;
+
+    prev_id = NFFS_ID_NONE;
+    while (len > 0) {
+        if (len > nffs_block_max_data_sz) {
+            chunk = nffs_block_max_data_sz;
+        } else {
+            chunk = len;
+        }
+
+        memset(&disk_block, 0xff, sizeof disk_block);
+        disk_block.ndb_magic = NFFS_BLOCK_MAGIC;
+        disk_block.ndb_id = nffs_hash_next_block_id++;
+        disk_block.ndb_seq = 0;
+        disk_block.ndb_inode_id = inode_id;
+        disk_block.ndb_prev_id = prev_id;
+        disk_block.ndb_data_len = chunk;
+        nffs_crc_disk_block_fill(&disk_block, data);
+
+        rc = nffs_block_write_disk(&disk_block, data, &area_idx, &offset);
+        if (rc != 0) {
+            return rc;
+        }
+
+        prev_id = disk_block.ndb_id;
+        data += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int
+image_read_host_file(const char *path, uint8_t **out_data, uint32_t *out_len)
+{
+    struct stat st;
+    uint8_t *data;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL || fstat(fileno(fp), &st) != 0) {
+        perror(path);
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return -1;
+    }
+
+    data = malloc(st.st_size + 1);
+    assert(data != NULL);
+    if (fread(data, 1, st.st_size, fp) != st.st_size) {
+        perror(path);
+        fclose(fp);
+        free(data);
+        return -1;
+    }
+    fclose(fp);
+
+    *out_data = data;
+    *out_len = st.st_size;
+    return 0;
+}
+
+static int
+image_add_file(uint32_t parent_id, const char *name, const char *src_path)
+{
+    uint32_t inode_id;
+    uint32_t len;
+    uint8_t *data;
+    int rc;
+
+    rc = image_read_host_file(src_path, &data, &len);
+    if (rc != 0) {
+        return FS_EINVAL;
+    }
+
+    if (len > 0 && len <= nffs_config.nc_inline_data_max) {
+        rc = image_write_inode(0, parent_id, name, data, len, &inode_id);
+    } else {
+        rc = image_write_inode(0, parent_id, name, NULL, 0, &inode_id);
+        if (rc == 0) {
+            rc = image_write_blocks(inode_id, data, len);
+        }
+    }
+
+    free(data);
+    return rc;
+}
+
+static int
+image_skip_dot(const struct dirent *entry)
+{
+    return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+/**
+ * Determines the type (DT_DIR, DT_REG, ...) of a directory entry.  Some
+ * host file systems don't fill in d_type; stat() the entry in that case.
+ */
+static int
+image_entry_type(const struct dirent *entry, const char *path)
+{
+    struct stat st;
+
+    if (entry->d_type != DT_UNKNOWN) {
+        return entry->d_type;
+    }
+
+    if (stat(path, &st) != 0) {
+        return DT_UNKNOWN;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return DT_DIR;
+    }
+    if (S_ISREG(st.st_mode)) {
+        return DT_REG;
+    }
+    return DT_UNKNOWN;
+}
+
+/**
+ * Adds the contents of a host directory, in name order, beneath the
+ * specified NFFS directory.
+ */
+static int
+image_add_dir(uint32_t dir_id, const char *src)
+{
+    struct dirent **entries;
+    char path[IMAGE_PATH_MAX];
+    uint32_t child_id;
+    int num_entries;
+    int type;
+    int rc;
+    int i;
+
+    num_entries = scandir(src, &entries, image_skip_dot, alphasort);
+    if (num_entries < 0) {
+        perror(src);
+        return FS_EINVAL;
+    }
+
+    rc = 0;
+    for (i = 0; i < num_entries; i++) {
+        snprintf(path, sizeof path, "%s/%s", src, entries[i]->d_name);
+        if (rc == 0) {
+            type = image_entry_type(entries[i], path);
+            if (type == DT_DIR) {
+                rc = image_write_inode(1, dir_id, entries[i]->d_name, NULL, 0,
+                                       &child_id);
+                if (rc == 0) {
+                    rc = image_add_dir(child_id, path);
+                }
+            } else if (type == DT_REG) {
+                rc = image_add_file(dir_id, entries[i]->d_name, path);
+                if (rc != 0) {
+                    fprintf(stderr, "%s: error %d\n", path, rc);
+                }
+            } else {
+                fprintf(stderr, "Skipping %s\n", path);
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return rc;
+}
+
+static int
+image_build(const char *src)
+{
+    int rc;
+
+    rc = nffs_format(image_area_descs);
+    if (rc != 0) {
+        fprintf(stderr, "nffs_format() failed: %d\n", rc);
+        return rc;
+    }
+
+    return image_add_dir(NFFS_ID_ROOT_DIR, src);
+}
+
+static uint32_t
+image_object_size(uint32_t magic, const void *hdr)
+{
+    const struct nffs_disk_inode *disk_inode;
+    const struct nffs_disk_block *disk_block;
+
+    if (nffs_inode_magic_is_set(magic)) {
+        disk_inode = hdr;
+        return sizeof *disk_inode + nffs_inode_disk_inline_len(disk_inode) +
+               disk_inode->ndi_filename_len;
+    } else {
+        disk_block = hdr;
+        return sizeof *disk_block + disk_block->ndb_data_len;
+    }
+}
+
+/**
+ * Walks every object in an area, checking its CRC and classifying it as live
+ * or dead.  Liveness is only meaningful once the image is mounted; before
+ * that, every object counts as dead.
+ */
+static void
+image_scan_area(uint8_t area_idx, uint32_t end, struct image_area_usage *usage)
+{
+    struct nffs_disk_object obj;
+    struct nffs_disk_area disk_area;
+    struct nffs_hash_entry *entry;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t magic;
+    uint32_t id;
+    int rc;
+
+    memset(usage, 0, sizeof *usage);
+
+    rc = nffs_flash_read(area_idx, 0, &disk_area, sizeof disk_area);
+    if (rc != 0 || nffs_area_from_disk(&disk_area, &offset) != 0) {
+        usage->iau_corrupt++;
+        return;
+    }
+    usage->iau_hdr = offset;
+
+    while (offset + sizeof magic <= end) {
+        rc = nffs_flash_read(area_idx, offset, &magic, sizeof magic);
+        if (rc != 0 || magic == 0xffffffff) {
+            break;
+        }
+
+        if (nffs_inode_magic_is_set(magic)) {
+            rc = nffs_inode_read_disk(area_idx, offset,
+                                      &obj.ndo_disk_inode);
+            if (rc == 0) {
+                rc = nffs_crc_disk_inode_validate(&obj.ndo_disk_inode,
+                                                  area_idx, offset);
+            }
+            id = obj.ndo_disk_inode.ndi_id;
+        } else if (magic == NFFS_BLOCK_MAGIC ||
+                   magic == NFFS_BLOCK_MAGIC_COMPRESSED) {
+            rc = nffs_block_read_disk(area_idx, offset, &obj.ndo_disk_block);
+            if (rc == 0) {
+                rc = nffs_crc_disk_block_validate(&obj.ndo_disk_block,
+                                                  area_idx, offset);
+            }
+            id = obj.ndo_disk_block.ndb_id;
+        } else {
+            /* Unknown object; the rest of the area cannot be parsed. */
+            usage->iau_corrupt++;
+            usage->iau_dead += end - offset;
+            break;
+        }
+
+        size = image_object_size(magic, &obj.ndo_disk_inode);
+        if (rc == FS_ECORRUPT) {
+            usage->iau_corrupt++;
+        }
+
+        entry = nffs_hash_find(id);
+        if (rc == 0 && entry != NULL &&
+            entry->nhe_flash_loc == nffs_flash_loc(area_idx, offset)) {
+
+            usage->iau_live += size;
+            if (nffs_hash_id_is_inode(id)) {
+                usage->iau_inodes++;
+            } else {
+                usage->iau_blocks++;
+            }
+        } else {
+            usage->iau_dead += size;
+        }
+
+        offset += size;
+    }
+}
+
+static void
+image_print_usage(void)
+{
+    struct image_area_usage usage;
+    const struct nffs_area *area;
+    int i;
+
+    printf("area  offset      length  erases      live      dead      free"
+           "  inodes  blocks  corrupt\n");
+    for (i = 0; i < nffs_num_areas; i++) {
+        area = nffs_areas + i;
+        if (i == nffs_scratch_area_idx) {
+            printf("%4d  0x%08" PRIx32 " %7" PRIu32 " %7" PRIu32
+                   "   scratch\n",
+                   i, area->na_offset, area->na_length, area->na_erase_cnt);
+            continue;
+        }
+
+        image_scan_area(i, area->na_cur, &usage);
+        printf("%4d  0x%08" PRIx32 " %7" PRIu32 " %7" PRIu32 " %9" PRIu32
+               " %9" PRIu32 " %9" PRIu32 " %7" PRIu32 " %7" PRIu32
+               " %8" PRIu32 "\n",
+               i, area->na_offset, area->na_length, area->na_erase_cnt,
+               usage.iau_live + usage.iau_hdr, usage.iau_dead,
+               area->na_length - area->na_cur, usage.iau_inodes,
+               usage.iau_blocks, usage.iau_corrupt);
+    }
+}
+
+/**
+ * Reads a file from the image in full, comparing it against the host copy
+ * if one is given.
+ */
+static int
+image_verify_file(const char *path, const char *src_path)
+{
+    static uint8_t buf[4096];
+    struct fs_file *file;
+    uint32_t total;
+    uint32_t len;
+    uint32_t host_len;
+    uint8_t *host_data;
+    int rc;
+
+    host_data = NULL;
+    if (src_path != NULL &&
+        image_read_host_file(src_path, &host_data, &host_len) != 0) {
+
+        return -1;
+    }
+
+    rc = fs_open(path, FS_ACCESS_READ, &file);
+    if (rc != 0) {
+        fprintf(stderr, "%s: open failed: %d\n", path, rc);
+        free(host_data);
+        return rc;
+    }
+
+    total = 0;
+    while (1) {
+        rc = fs_read(file, sizeof buf, buf, &len);
+        if (rc != 0) {
+            fprintf(stderr, "%s: read failed: %d\n", path, rc);
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        if (host_data != NULL &&
+            (total + len > host_len ||
+             memcmp(host_data + total, buf, len) != 0)) {
+
+            fprintf(stderr, "%s: contents differ at offset %" PRIu32 "\n",
+                    path, total);
+            rc = -1;
+            break;
+        }
+        total += len;
+    }
+
+    if (rc == 0 && host_data != NULL && total != host_len) {
+        fprintf(stderr, "%s: length %" PRIu32 ", expected %" PRIu32 "\n",
+                path, total, host_len);
+        rc = -1;
+    }
+
+    fs_close(file);
+    free(host_data);
+    return rc;
+}
+
+/**
+ * Recursively reads every file beneath an image directory.
+ *
+ * @return                      The number of files that failed to verify.
+ */
+static int
+image_verify_dir(const char *path, const char *src_path)
+{
+    struct fs_dirent *dirent;
+    struct fs_dir *dir;
+    char child[IMAGE_PATH_MAX];
+    char child_src[IMAGE_PATH_MAX];
+    char name[NFFS_FILENAME_MAX_LEN + 1];
+    uint8_t name_len;
+    int errors;
+    int rc;
+
+    rc = fs_opendir(path[0] == '\0' ? "/" : path, &dir);
+    if (rc != 0) {
+        fprintf(stderr, "%s: opendir failed: %d\n", path, rc);
+        return 1;
+    }
+
+    errors = 0;
+    while (fs_readdir(dir, &dirent) == 0) {
+        rc = fs_dirent_name(dirent, sizeof name, name, &name_len);
+        assert(rc == 0);
+
+        snprintf(child, sizeof child, "%s/%s", path, name);
+        if (src_path != NULL) {
+            snprintf(child_src, sizeof child_src, "%s/%s", src_path, name);
+        }
+
+        if (fs_dirent_is_dir(dirent)) {
+            /* lost+found is created by the file system, not the source. */
+            if (path[0] == '\0' && strcmp(name, "lost+found") == 0) {
+                errors += image_verify_dir(child, NULL);
+            } else {
+                errors += image_verify_dir(child,
+                                           src_path ? child_src : NULL);
+            }
+        } else if (image_verify_file(child,
+                                     src_path ? child_src : NULL) != 0) {
+            errors++;
+        }
+    }
+    fs_closedir(dir);
+
+    return errors;
+}
+
+/**
+ * Checks the CRC of every object in the image.  This runs before the image
+ * is mounted, since restoring a damaged image discards the bad objects.
+ *
+ * @return                      The number of corrupt objects found.
+ */
+static int
+image_verify_objects(void)
+{
+    struct image_area_usage usage;
+    struct nffs_disk_area disk_area;
+    int num_areas;
+    int errors;
+    int rc;
+    int i;
+
+    for (num_areas = 0;
+         image_area_descs[num_areas].nad_length != 0;
+         num_areas++) {
+    }
+
+    rc = nffs_misc_set_num_areas(num_areas);
+    assert(rc == 0);
+    for (i = 0; i < num_areas; i++) {
+        memset(nffs_areas + i, 0, sizeof nffs_areas[i]);
+        nffs_areas[i].na_offset = image_area_descs[i].nad_offset;
+        nffs_areas[i].na_length = image_area_descs[i].nad_length;
+        nffs_areas[i].na_flash_id = image_area_descs[i].nad_flash_id;
+    }
+
+    errors = 0;
+    for (i = 0; i < num_areas; i++) {
+        rc = nffs_flash_read(i, 0, &disk_area, sizeof disk_area);
+        if (rc != 0 || !nffs_area_magic_is_set(&disk_area) ||
+            nffs_area_from_disk(&disk_area, NULL) != 0) {
+
+            fprintf(stderr, "area %d: bad header\n", i);
+            errors++;
+        } else if (!nffs_area_is_scratch(&disk_area)) {
+            image_scan_area(i, nffs_areas[i].na_length, &usage);
+            if (usage.iau_corrupt != 0) {
+                fprintf(stderr, "area %d: %" PRIu32 " corrupt object(s)\n",
+                        i, usage.iau_corrupt);
+            }
+            errors += usage.iau_corrupt;
+        }
+    }
+
+    return errors;
+}
+
+static int
+image_write_out(const char *filename)
+{
+    static uint8_t buf[4096];
+    const struct nffs_area_desc *nad;
+    uint32_t start;
+    uint32_t end;
+    uint32_t off;
+    uint32_t len;
+    FILE *fp;
+    int rc;
+    int i;
+
+    start = UINT32_MAX;
+    end = 0;
+    for (i = 0; image_area_descs[i].nad_length != 0; i++) {
+        nad = image_area_descs + i;
+        if (nad->nad_offset < start) {
+            start = nad->nad_offset;
+        }
+        if (nad->nad_offset + nad->nad_length > end) {
+            end = nad->nad_offset + nad->nad_length;
+        }
+    }
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    rc = 0;
+    for (off = start; off < end; off += len) {
+        len = min(sizeof buf, end - off);
+        rc = hal_flash_read(image_area_descs[0].nad_flash_id, off, buf, len);
+        if (rc != 0 || fwrite(buf, 1, len, fp) != len) {
+            fprintf(stderr, "%s: write failed\n", filename);
+            rc = -1;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return rc;
+}
+
+static void
+usage(int rc)
+{
+    printf("%s [-d dir] [-f flash_file] [-i inline_max] [-o image_file] "
+           "[-u] [-v]\n", progname);
+    printf("  Builds, verifies and inspects NFFS images\n");
+    printf("   -d: build a compacted image from the contents of dir\n");
+    printf("   -f: flash_file is the name of the flash image file\n");
+    printf("   -i: store files of up to inline_max bytes in their inodes\n");
+    printf("   -o: write the raw NFFS region of the flash to image_file\n");
+    printf("   -u: print per-area utilisation\n");
+    printf("   -v: verify object CRCs and read back every file\n");
+    exit(rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    int errors;
+    int rc;
+    int ch;
+    int cnt;
+
+    progname = argv[0];
+
+    while ((ch = getopt(argc, argv, "d:f:i:o:uv")) != -1) {
+        switch (ch) {
+        case 'd':
+            image_src_dir = optarg;
+            break;
+        case 'f':
+            native_flash_file = optarg;
+            break;
+        case 'i':
+            nffs_config.nc_inline_data_max = atoi(optarg);
+            break;
+        case 'o':
+            image_out_file = optarg;
+            break;
+        case 'u':
+            image_usage = 1;
+            break;
+        case 'v':
+            image_verify = 1;
+            break;
+        case '?':
+        default:
+            usage(1);
+        }
+    }
+
+    os_init();
+
+    /* Leave room for the terminating entry. */
+    cnt = IMAGE_MAX_AREAS - 1;
+    rc = flash_area_to_nffs_desc(FLASH_AREA_NFFS, &cnt, image_area_descs);
+    assert(rc == 0);
+
+    rc = hal_flash_init();
+    assert(rc == 0);
+
+    /* Enough objects to mount the largest image the flash area can hold. */
+    nffs_config.nc_num_inodes = 1024;
+    nffs_config.nc_num_blocks = 4096;
+
+    rc = nffs_init();
+    assert(rc == 0);
+
+    if (image_src_dir != NULL) {
+        rc = image_build(image_src_dir);
+        if (rc != 0) {
+            return 1;
+        }
+    }
+
+    if (image_verify) {
+        /* Don't mount a damaged image; restore would rewrite it. */
+        errors = image_verify_objects();
+        if (errors != 0) {
+            printf("verify: %d error(s)\n", errors);
+            return 1;
+        }
+    }
+
+    /* Mount the image from scratch, exactly as a device would. */
+    rc = nffs_detect(image_area_descs);
+    if (rc != 0) {
+        fprintf(stderr, "nffs_detect() failed: %d\n", rc);
+        return 1;
+    }
+
+    if (image_verify) {
+        errors += image_verify_dir("", image_src_dir);
+        printf("verify: %d error(s)\n", errors);
+        if (errors != 0) {
+            return 1;
+        }
+    }
+
+    if (image_usage) {
+        image_print_usage();
+    }
+
+    if (image_out_file != NULL && image_write_out(image_out_file) != 0) {
+        return 1;
+    }
+
+    return 0;
+}
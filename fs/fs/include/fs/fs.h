@@ -29,11 +29,39 @@
 struct fs_file;
 struct fs_dir;
 struct fs_dirent;
+struct os_mbuf;
+
+/*
+ * One segment of a vectored read or write.
+ */
+struct fs_iovec {
+    void *fiv_base;
+    uint32_t fiv_len;
+};
 
 int fs_open(const char *filename, uint8_t access_flags, struct fs_file **);
 int fs_close(struct fs_file *);
 int fs_read(struct fs_file *, uint32_t len, void *out_data, uint32_t *out_len);
+
+/*
+ * Zero-copy read of memory-mapped storage.  The returned data is not
+ * protected from garbage collection; once done with it, and before the next
+ * fs_read_direct() on the same handle, call fs_read_direct_release().  If that
+ * returns FS_ESTALE, the data was erased while in use; seek back and read it
+ * again.
+ */
+int fs_read_direct(struct fs_file *, uint32_t len, const void **out_data,
+  uint32_t *out_len);
+int fs_read_direct_release(struct fs_file *);
+
 int fs_write(struct fs_file *, const void *data, int len);
+int fs_readv(struct fs_file *, const struct fs_iovec *iov, int iovcnt,
+  uint32_t *out_len);
+int fs_writev(struct fs_file *, const struct fs_iovec *iov, int iovcnt);
+int fs_read_mbuf(struct fs_file *, uint32_t len, struct os_mbuf *om,
+  uint32_t *out_len);
+int fs_write_mbuf(struct fs_file *, const struct os_mbuf *om);
+int fs_flush(struct fs_file *);
 int fs_seek(struct fs_file *, uint32_t offset);
 uint32_t fs_getpos(const struct fs_file *);
 int fs_filelen(const struct fs_file *, uint32_t *out_len);
@@ -56,6 +84,8 @@ int fs_dirent_is_dir(const struct fs_dirent *);
 #define FS_ACCESS_WRITE         0x02
 #define FS_ACCESS_APPEND        0x04
 #define FS_ACCESS_TRUNCATE      0x08
+#define FS_ACCESS_BUFFERED      0x10    /* Coalesce appends in RAM. */
+#define FS_ACCESS_COMPRESS      0x20    /* Compress data of a new file. */
 
 /*
  * File access return codes.
@@ -74,5 +104,7 @@ int fs_dirent_is_dir(const struct fs_dirent *);
 #define FS_EEXIST       11  /* File or directory already exists */
 #define FS_EACCESS      12  /* Operation prohibited by file open mode */
 #define FS_EUNINIT      13  /* File system not initialized */
+#define FS_EUNSUPP      14  /* Operation not supported */
+#define FS_ESTALE       15  /* Directly read data was erased */
 
 #endif
@@ -0,0 +1,62 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef __FS_AIO_H__
+#define __FS_AIO_H__
+
+#include <inttypes.h>
+#include "os/os.h"
+#include "fs/fs.h"
+
+/*
+ * Asynchronous file I/O.  Requests are queued to a dedicated worker task,
+ * which performs them in submission order and then calls the request's
+ * completion callback from its own context.
+ */
+#define FS_AIO_OP_READ          1
+#define FS_AIO_OP_WRITE         2
+
+/* Use the file's current position rather than an explicit offset. */
+#define FS_AIO_OFFSET_CUR       UINT32_MAX
+
+struct fs_aio;
+typedef void fs_aio_fn(struct fs_aio *aio);
+
+struct fs_aio {
+    /* Set by the caller before submitting. */
+    uint8_t fa_op;
+    struct fs_file *fa_file;
+    uint32_t fa_offset;
+    const struct fs_iovec *fa_iov;
+    int fa_iovcnt;
+    fs_aio_fn *fa_cb;
+    void *fa_arg;
+
+    /* Filled in before the callback is called. */
+    int fa_rc;
+    uint32_t fa_out_len;
+
+    /* Internal. */
+    struct os_event fa_ev;
+};
+
+int fs_aio_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size);
+int fs_aio_submit(struct fs_aio *aio);
+
+#endif
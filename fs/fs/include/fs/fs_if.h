@@ -29,7 +29,15 @@ struct fs_ops {
     int (*f_close)(struct fs_file *file);
     int (*f_read)(struct fs_file *file, uint32_t len, void *out_data,
       uint32_t *out_len);
+    int (*f_read_direct)(struct fs_file *file, uint32_t len,
+      const void **out_data, uint32_t *out_len);
+    int (*f_read_direct_release)(struct fs_file *file);
     int (*f_write)(struct fs_file *file, const void *data, int len);
+    int (*f_readv)(struct fs_file *file, const struct fs_iovec *iov,
+      int iovcnt, uint32_t *out_len);
+    int (*f_writev)(struct fs_file *file, const struct fs_iovec *iov,
+      int iovcnt);
+    int (*f_flush)(struct fs_file *file);
 
     int (*f_seek)(struct fs_file *file, uint32_t offset);
     uint32_t (*f_getpos)(const struct fs_file *file);
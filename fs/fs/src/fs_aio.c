@@ -0,0 +1,150 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include "os/os.h"
+#include "fs/fs.h"
+#include "fs/fs_aio.h"
+
+#define FS_AIO_EVENT_T_REQ      OS_EVENT_T_PERUSER
+
+static struct os_task fs_aio_task;
+static struct os_eventq fs_aio_evq;
+static int fs_aio_started;
+
+static void
+fs_aio_process(struct fs_aio *aio)
+{
+    uint32_t len;
+    int rc;
+    int i;
+
+    aio->fa_out_len = 0;
+
+    if (aio->fa_offset != FS_AIO_OFFSET_CUR) {
+        rc = fs_seek(aio->fa_file, aio->fa_offset);
+        if (rc != 0) {
+            goto done;
+        }
+    }
+
+    switch (aio->fa_op) {
+    case FS_AIO_OP_READ:
+        rc = fs_readv(aio->fa_file, aio->fa_iov, aio->fa_iovcnt,
+                      &aio->fa_out_len);
+        break;
+
+    case FS_AIO_OP_WRITE:
+        rc = fs_writev(aio->fa_file, aio->fa_iov, aio->fa_iovcnt);
+        if (rc == 0) {
+            len = 0;
+            for (i = 0; i < aio->fa_iovcnt; i++) {
+                len += aio->fa_iov[i].fiv_len;
+            }
+            aio->fa_out_len = len;
+        }
+        break;
+
+    default:
+        rc = FS_EINVAL;
+        break;
+    }
+
+done:
+    aio->fa_rc = rc;
+    if (aio->fa_cb != NULL) {
+        aio->fa_cb(aio);
+    }
+}
+
+static void
+fs_aio_task_handler(void *arg)
+{
+    struct os_event *ev;
+
+    while (1) {
+        ev = os_eventq_get(&fs_aio_evq);
+        assert(ev->ev_type == FS_AIO_EVENT_T_REQ);
+        fs_aio_process(ev->ev_arg);
+    }
+}
+
+/**
+ * Queues an asynchronous read or write.  The request structure and the
+ * buffers it describes must remain valid until the completion callback has
+ * been called.  Requests for the same file are performed in the order they
+ * are submitted.
+ *
+ * @param aio               The request to queue.
+ *
+ * @return                  0 on success;
+ *                          FS_EUNINIT if the worker task is not running;
+ *                          FS_EINVAL if the request is malformed or already
+ *                              queued.
+ */
+int
+fs_aio_submit(struct fs_aio *aio)
+{
+    if (!fs_aio_started) {
+        return FS_EUNINIT;
+    }
+
+    if (aio->fa_file == NULL || aio->fa_iovcnt < 0 ||
+        (aio->fa_iovcnt > 0 && aio->fa_iov == NULL) ||
+        (aio->fa_op != FS_AIO_OP_READ && aio->fa_op != FS_AIO_OP_WRITE)) {
+
+        return FS_EINVAL;
+    }
+
+    if (OS_EVENT_QUEUED(&aio->fa_ev)) {
+        return FS_EINVAL;
+    }
+
+    aio->fa_ev.ev_type = FS_AIO_EVENT_T_REQ;
+    aio->fa_ev.ev_arg = aio;
+    os_eventq_put(&fs_aio_evq, &aio->fa_ev);
+
+    return 0;
+}
+
+/**
+ * Starts the worker task that performs asynchronous file I/O.
+ *
+ * @param prio              The priority of the worker task.
+ * @param stack             The worker task's stack.
+ * @param stack_size        The size of the stack, in os_stack_t units.
+ *
+ * @return                  0 on success; FS_EOS on failure.
+ */
+int
+fs_aio_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size)
+{
+    int rc;
+
+    os_eventq_init(&fs_aio_evq);
+
+    rc = os_task_init(&fs_aio_task, "fs_aio", fs_aio_task_handler, NULL,
+                      prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    fs_aio_started = 1;
+    return 0;
+}
@@ -39,12 +39,91 @@ fs_read(struct fs_file *file, uint32_t len, void *out_data, uint32_t *out_len)
     return fs_root_ops->f_read(file, len, out_data, out_len);
 }
 
+int
+fs_read_direct(struct fs_file *file, uint32_t len, const void **out_data,
+  uint32_t *out_len)
+{
+    if (fs_root_ops->f_read_direct == NULL) {
+        return FS_EUNSUPP;
+    }
+    return fs_root_ops->f_read_direct(file, len, out_data, out_len);
+}
+
+int
+fs_read_direct_release(struct fs_file *file)
+{
+    if (fs_root_ops->f_read_direct_release == NULL) {
+        return 0;
+    }
+    return fs_root_ops->f_read_direct_release(file);
+}
+
 int
 fs_write(struct fs_file *file, const void *data, int len)
 {
     return fs_root_ops->f_write(file, data, len);
 }
 
+int
+fs_readv(struct fs_file *file, const struct fs_iovec *iov, int iovcnt,
+  uint32_t *out_len)
+{
+    uint32_t total;
+    uint32_t len;
+    int rc;
+    int i;
+
+    if (fs_root_ops->f_readv != NULL) {
+        return fs_root_ops->f_readv(file, iov, iovcnt, out_len);
+    }
+
+    /* Emulate with one read per segment; stop at end of file. */
+    total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        rc = fs_root_ops->f_read(file, iov[i].fiv_len, iov[i].fiv_base, &len);
+        if (rc != 0) {
+            return rc;
+        }
+        total += len;
+        if (len < iov[i].fiv_len) {
+            break;
+        }
+    }
+
+    if (out_len != NULL) {
+        *out_len = total;
+    }
+    return 0;
+}
+
+int
+fs_writev(struct fs_file *file, const struct fs_iovec *iov, int iovcnt)
+{
+    int rc;
+    int i;
+
+    if (fs_root_ops->f_writev != NULL) {
+        return fs_root_ops->f_writev(file, iov, iovcnt);
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        rc = fs_root_ops->f_write(file, iov[i].fiv_base, iov[i].fiv_len);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int
+fs_flush(struct fs_file *file)
+{
+    if (fs_root_ops->f_flush == NULL) {
+        return 0;
+    }
+    return fs_root_ops->f_flush(file);
+}
+
 int
 fs_seek(struct fs_file *file, uint32_t offset)
 {
@@ -0,0 +1,146 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stddef.h>
+#include "os/os.h"
+#include "os/os_mbuf.h"
+#include "fs/fs.h"
+
+/** Maximum number of mbuf segments passed to a single vectored write. */
+#define FS_MBUF_IOV_MAX     8
+
+/**
+ * Reads data from the current offset of a file and appends it to an mbuf
+ * chain.  Data is read straight into the chain's trailing space; additional
+ * mbufs are allocated from the chain's pool as needed.  If the file contains
+ * less data than requested, everything up to the end of the file is read and
+ * a success code is returned.
+ *
+ * @param file              The file to read from.
+ * @param len               The number of bytes to attempt to read.
+ * @param om                The mbuf chain to append to.
+ * @param out_len           On success, the number of bytes actually read gets
+ *                              written here.  Pass null if you don't care.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOMEM if the mbuf pool is exhausted;
+ *                          other nonzero on failure.
+ */
+int
+fs_read_mbuf(struct fs_file *file, uint32_t len, struct os_mbuf *om,
+  uint32_t *out_len)
+{
+    struct os_mbuf *prev;
+    struct os_mbuf *last;
+    uint32_t read_len;
+    uint32_t total;
+    uint32_t chunk;
+    int rc;
+
+    prev = NULL;
+    last = om;
+    while (SLIST_NEXT(last, om_next) != NULL) {
+        last = SLIST_NEXT(last, om_next);
+    }
+
+    total = 0;
+    rc = 0;
+    while (total < len) {
+        chunk = OS_MBUF_TRAILINGSPACE(last);
+        if (chunk == 0) {
+            prev = last;
+            last = os_mbuf_get(om->om_omp, 0);
+            if (last == NULL) {
+                rc = FS_ENOMEM;
+                break;
+            }
+            SLIST_NEXT(prev, om_next) = last;
+            chunk = OS_MBUF_TRAILINGSPACE(last);
+        }
+        if (chunk > len - total) {
+            chunk = len - total;
+        }
+
+        rc = fs_read(file, chunk, last->om_data + last->om_len, &read_len);
+        if (rc != 0) {
+            break;
+        }
+
+        last->om_len += read_len;
+        if (OS_MBUF_IS_PKTHDR(om)) {
+            OS_MBUF_PKTHDR(om)->omp_len += read_len;
+        }
+        total += read_len;
+
+        if (read_len < chunk) {
+            /* End of file. */
+            break;
+        }
+    }
+
+    /* Don't leave an empty mbuf at the end of the chain. */
+    if (prev != NULL && last != NULL && last->om_len == 0) {
+        SLIST_NEXT(prev, om_next) = NULL;
+        os_mbuf_free(last);
+    }
+
+    if (out_len != NULL) {
+        *out_len = total;
+    }
+    return rc;
+}
+
+/**
+ * Writes the contents of an mbuf chain to the current offset of a file.  The
+ * chain's segments are passed to the file system as a vectored write, so no
+ * intermediate copy is made.
+ *
+ * @param file              The file to write to.
+ * @param om                The mbuf chain to write.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+int
+fs_write_mbuf(struct fs_file *file, const struct os_mbuf *om)
+{
+    struct fs_iovec iov[FS_MBUF_IOV_MAX];
+    int iovcnt;
+    int rc;
+
+    while (om != NULL) {
+        iovcnt = 0;
+        while (om != NULL && iovcnt < FS_MBUF_IOV_MAX) {
+            if (om->om_len > 0) {
+                iov[iovcnt].fiv_base = om->om_data;
+                iov[iovcnt].fiv_len = om->om_len;
+                iovcnt++;
+            }
+            om = SLIST_NEXT(om, om_next);
+        }
+
+        if (iovcnt > 0) {
+            rc = fs_writev(file, iov, iovcnt);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -22,10 +22,14 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include "os/os.h"
 
 #define NFFS_FILENAME_MAX_LEN   256  /* Does not require null terminator. */
 #define NFFS_MAX_AREAS          256
 
+/** Disables read-ahead when assigned to nffs_config.nc_read_ahead_blocks. */
+#define NFFS_READ_AHEAD_NONE    UINT32_MAX
+
 struct nffs_config {
     /** Maximum number of inodes; default=1024. */
     uint32_t nc_num_inodes;
@@ -44,10 +48,120 @@ struct nffs_config {
 
     /** Data block cache size; default=64. */
     uint32_t nc_num_cache_blocks;
+
+    /**
+     * Number of data blocks to prefetch into the cache when a file is being
+     * read sequentially; default=4, maximum=8.  NFFS_READ_AHEAD_NONE
+     * disables read-ahead.
+     */
+    uint32_t nc_read_ahead_blocks;
+
+    /**
+     * Free space, in bytes, below which the background garbage collection
+     * task starts compacting areas; default=8192.
+     */
+    uint32_t nc_gc_low_water;
+
+    /**
+     * Number of bytes the background garbage collection task copies before
+     * releasing the file system lock; default=1024.
+     */
+    uint32_t nc_gc_step_size;
+
+    /**
+     * Maximum age, in milliseconds, of unflushed data in the write buffer of
+     * a file opened with FS_ACCESS_BUFFERED; default=1000.
+     */
+    uint32_t nc_write_buf_timeout;
+
+    /**
+     * Initial number of object hash table buckets, rounded down to a power of
+     * two; default=256.
+     */
+    uint32_t nc_num_hash_buckets;
+
+    /**
+     * Average bucket chain length above which the hash table grows, one
+     * bucket at a time; default=0 (fixed size).
+     */
+    uint32_t nc_hash_max_load;
+
+    /**
+     * Largest file, in bytes, whose contents are stored inside its inode
+     * rather than in a separate data block; default=0 (disabled),
+     * maximum=64.
+     */
+    uint32_t nc_inline_data_max;
 };
 
 extern struct nffs_config nffs_config;
 
+/** Data block cache counters; see nffs_cache_get_stats(). */
+struct nffs_cache_stats {
+    /** Lookups satisfied by an already-cached block. */
+    uint32_t ncs_hits;
+
+    /** Lookups that required reading block headers from flash. */
+    uint32_t ncs_misses;
+
+    /** Cached blocks discarded to stay within the cache budget. */
+    uint32_t ncs_evictions;
+
+    /** Blocks cached by sequential read-ahead. */
+    uint32_t ncs_prefetches;
+
+    /** Prefetched blocks that were subsequently used. */
+    uint32_t ncs_prefetch_hits;
+};
+
+/** Object hash table statistics; see nffs_hash_get_stats(). */
+struct nffs_hash_stats {
+    /** Number of buckets currently in use. */
+    uint32_t nhs_num_buckets;
+
+    /** Number of inodes and data blocks in the table. */
+    uint32_t nhs_num_entries;
+
+    /** Number of buckets with no entries. */
+    uint32_t nhs_empty_buckets;
+
+    /** Length of the longest bucket chain. */
+    uint32_t nhs_max_chain;
+
+    /** Buckets split to grow the table. */
+    uint32_t nhs_splits;
+
+    /** Lookups performed; reset with the counters. */
+    uint32_t nhs_lookups;
+
+    /**
+     * Entries examined by those lookups; nhs_probes / nhs_lookups is the
+     * average search length.
+     */
+    uint32_t nhs_probes;
+};
+
+/**
+ * Data compression counters; see nffs_compress_get_stats().  The achieved
+ * compression ratio is nzs_bytes_in / nzs_bytes_out.
+ */
+struct nffs_compress_stats {
+    /**
+     * Bytes of file data written to files created with FS_ACCESS_COMPRESS,
+     * including data rewritten by garbage collection.
+     */
+    uint32_t nzs_bytes_in;
+
+    /** Bytes of flash used to store that data, excluding block headers. */
+    uint32_t nzs_bytes_out;
+
+    /** Data blocks stored compressed. */
+    uint32_t nzs_blocks_compressed;
+
+    /** Data blocks stored uncompressed because compression did not help. */
+    uint32_t nzs_blocks_raw;
+};
+
 struct nffs_area_desc {
     uint32_t nad_offset;    /* Flash offset of start of area. */
     uint32_t nad_length;    /* Size of area, in bytes. */
@@ -57,5 +171,11 @@ struct nffs_area_desc {
 int nffs_init(void);
 int nffs_detect(const struct nffs_area_desc *area_descs);
 int nffs_format(const struct nffs_area_desc *area_descs);
+int nffs_gc_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size);
+int nffs_cache_set_budget(uint32_t num_blocks, uint8_t read_ahead);
+void nffs_cache_get_stats(struct nffs_cache_stats *out_stats, int reset);
+void nffs_compress_get_stats(struct nffs_compress_stats *out_stats,
+                             int reset);
+void nffs_hash_get_stats(struct nffs_hash_stats *out_stats, int reset);
 
 #endif
@@ -22,8 +22,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "hal/hal_flash.h"
+#include "hal/hal_cputime.h"
 #include "os/os_mempool.h"
 #include "os/os_mutex.h"
+#include "os/os_sem.h"
 #include "os/os_malloc.h"
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
@@ -51,7 +53,31 @@ void *nffs_dir_mem;
 struct nffs_inode_entry *nffs_root_dir;
 struct nffs_inode_entry *nffs_lost_found_dir;
 
+/**
+ * The file system lock is a reader/writer lock.  Operations that only read
+ * file data (read, seek, length queries) take it shared and run concurrently;
+ * everything else, including garbage collection, takes it exclusively.
+ *
+ * A writer holds nffs_mutex for the duration of its operation.  A reader
+ * passes through nffs_mutex only to register itself, so readers queue behind
+ * a pending writer rather than starving it.  Once it owns the mutex, the
+ * writer waits on nffs_reader_sem until the registered readers have left.
+ *
+ * Shared-mode readers still modify the block cache and reorder hash chains;
+ * those structures are serialized by nffs_cache_mutex, which readers drop
+ * while reading data from flash.
+ */
 static struct os_mutex nffs_mutex;
+static struct os_sem nffs_reader_sem;
+static uint16_t nffs_num_readers;
+static uint8_t nffs_writer_waiting;
+
+struct os_mutex nffs_cache_mutex;
+
+/** How often the idle background garbage collector checks for work. */
+#define NFFS_GC_TASK_IDLE_TICKS     (OS_TICKS_PER_SEC)
+
+static struct os_task nffs_gc_task;
 
 static struct log_handler nffs_log_console_handler;
 struct log nffs_log;
@@ -61,7 +87,15 @@ static int nffs_open(const char *path, uint8_t access_flags,
 static int nffs_close(struct fs_file *fs_file);
 static int nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
   uint32_t *out_len);
+static int nffs_read_direct(struct fs_file *fs_file, uint32_t len,
+  const void **out_data, uint32_t *out_len);
+static int nffs_read_direct_release(struct fs_file *fs_file);
 static int nffs_write(struct fs_file *fs_file, const void *data, int len);
+static int nffs_readv(struct fs_file *fs_file, const struct fs_iovec *iov,
+  int iovcnt, uint32_t *out_len);
+static int nffs_writev(struct fs_file *fs_file, const struct fs_iovec *iov,
+  int iovcnt);
+static int nffs_flush(struct fs_file *fs_file);
 static int nffs_seek(struct fs_file *fs_file, uint32_t offset);
 static uint32_t nffs_getpos(const struct fs_file *fs_file);
 static int nffs_file_len(const struct fs_file *fs_file, uint32_t *out_len);
@@ -79,7 +113,12 @@ static const struct fs_ops nffs_ops = {
     .f_open = nffs_open,
     .f_close = nffs_close,
     .f_read = nffs_read,
+    .f_read_direct = nffs_read_direct,
+    .f_read_direct_release = nffs_read_direct_release,
     .f_write = nffs_write,
+    .f_readv = nffs_readv,
+    .f_writev = nffs_writev,
+    .f_flush = nffs_flush,
 
     .f_seek = nffs_seek,
     .f_getpos = nffs_getpos,
@@ -102,10 +141,26 @@ static const struct fs_ops nffs_ops = {
 static void
 nffs_lock(void)
 {
+    os_sr_t sr;
     int rc;
 
     rc = os_mutex_pend(&nffs_mutex, 0xffffffff);
     assert(rc == 0 || rc == OS_NOT_STARTED);
+
+    /* New readers are now held off; wait for the current ones to leave. */
+    while (1) {
+        OS_ENTER_CRITICAL(sr);
+        if (nffs_num_readers == 0) {
+            nffs_writer_waiting = 0;
+            OS_EXIT_CRITICAL(sr);
+            break;
+        }
+        nffs_writer_waiting = 1;
+        OS_EXIT_CRITICAL(sr);
+
+        rc = os_sem_pend(&nffs_reader_sem, OS_TIMEOUT_NEVER);
+        assert(rc == 0 || rc == OS_NOT_STARTED);
+    }
 }
 
 static void
@@ -117,6 +172,77 @@ nffs_unlock(void)
     assert(rc == 0 || rc == OS_NOT_STARTED);
 }
 
+static void
+nffs_lock_shared(void)
+{
+    os_sr_t sr;
+    int rc;
+
+    rc = os_mutex_pend(&nffs_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+
+    OS_ENTER_CRITICAL(sr);
+    nffs_num_readers++;
+    OS_EXIT_CRITICAL(sr);
+
+    rc = os_mutex_release(&nffs_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static void
+nffs_unlock_shared(void)
+{
+    os_sr_t sr;
+    int wake;
+    int rc;
+
+    OS_ENTER_CRITICAL(sr);
+    assert(nffs_num_readers > 0);
+    nffs_num_readers--;
+    wake = nffs_num_readers == 0 && nffs_writer_waiting;
+    OS_EXIT_CRITICAL(sr);
+
+    if (wake) {
+        rc = os_sem_release(&nffs_reader_sem);
+        assert(rc == 0 || rc == OS_NOT_STARTED);
+    }
+}
+
+/**
+ * Locks the file system for reading the specified file.  The lock is shared
+ * unless the file's write buffer holds data; such data must be flushed
+ * before the file is read, which requires exclusive access.
+ *
+ * @param file              The file about to be read.
+ *
+ * @return                  1 if the lock was taken exclusively; 0 if shared.
+ *                              Pass this to nffs_unlock_file_read().
+ */
+static int
+nffs_lock_file_read(const struct nffs_file *file)
+{
+    /* Only the handle's owner can fill its write buffer, so this check does
+     * not race with other tasks.
+     */
+    if (file->nf_wbuf_len > 0) {
+        nffs_lock();
+        return 1;
+    }
+
+    nffs_lock_shared();
+    return 0;
+}
+
+static void
+nffs_unlock_file_read(int exclusive)
+{
+    if (exclusive) {
+        nffs_unlock();
+    } else {
+        nffs_unlock_shared();
+    }
+}
+
 /**
  * Opens a file at the specified path.  The result of opening a nonexistent
  * file depends on the access flags specified.  All intermediate directories
@@ -131,6 +257,24 @@ nffs_unlock(void)
  *   "a"  -  FS_ACCESS_WRITE | FS_ACCESS_APPEND
  *   "a+" -  FS_ACCESS_READ | FS_ACCESS_WRITE | FS_ACCESS_APPEND
  *
+ * Any mode which includes FS_ACCESS_WRITE may additionally specify
+ * FS_ACCESS_BUFFERED.  For such a file handle, writes which extend the file
+ * are coalesced in a RAM buffer of up to one maximum-size data block before
+ * being written to flash.  Buffered data is not visible to other file
+ * handles, and is lost on power failure, until it is flushed.  The buffer is
+ * flushed when it fills up, when the handle is read from, seeked, or closed,
+ * when the write pattern stops being sequential, on an explicit fs_flush(),
+ * and when the data has been buffered for longer than
+ * nffs_config.nc_write_buf_timeout (the latter requires the background task;
+ * see nffs_gc_task_init()).
+ *
+ * Any mode which includes FS_ACCESS_WRITE may also specify FS_ACCESS_COMPRESS.
+ * If the open creates the file (including by truncation), the file's data
+ * blocks are stored compressed whenever that saves space.  The flag is
+ * recorded in the file's inode, so it persists for the life of the file; it
+ * has no effect when opening an existing file.  Compressed data cannot be
+ * read with fs_read_direct().
+ *
  * @param path              The path of the file to open.
  * @param access_flags      Flags controlling file access; see above table.
  * @param out_file          On success, a pointer to the newly-created file
@@ -141,9 +285,11 @@ nffs_unlock(void)
 static int
 nffs_open(const char *path, uint8_t access_flags, struct fs_file **out_fs_file)
 {
+    uint32_t start;
     int rc;
     struct nffs_file *out_file;
 
+    start = cputime_get32();
     nffs_lock();
 
     if (!nffs_misc_ready()) {
@@ -160,6 +306,8 @@ done:
     nffs_unlock();
     if (rc != 0) {
         *out_fs_file = NULL;
+    } else {
+        NFFS_STATS_LATENCY(open, start);
     }
     return rc;
 }
@@ -203,12 +351,13 @@ nffs_close(struct fs_file *fs_file)
 static int
 nffs_seek(struct fs_file *fs_file, uint32_t offset)
 {
+    int exclusive;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
-    nffs_lock();
+    exclusive = nffs_lock_file_read(file);
     rc = nffs_file_seek(file, offset);
-    nffs_unlock();
+    nffs_unlock_file_read(exclusive);
 
     return rc;
 }
@@ -226,9 +375,9 @@ nffs_getpos(const struct fs_file *fs_file)
     uint32_t offset;
     const struct nffs_file *file = (const struct nffs_file *)fs_file;
 
-    nffs_lock();
+    nffs_lock_shared();
     offset = file->nf_offset;
-    nffs_unlock();
+    nffs_unlock_shared();
 
     return offset;
 }
@@ -248,9 +397,17 @@ nffs_file_len(const struct fs_file *fs_file, uint32_t *out_len)
     int rc;
     const struct nffs_file *file = (const struct nffs_file *)fs_file;
 
-    nffs_lock();
+    nffs_lock_shared();
     rc = nffs_inode_data_len(file->nf_inode_entry, out_len);
-    nffs_unlock();
+    if (rc == 0 && file->nf_wbuf_len > 0) {
+        /* Account for data still sitting in the write buffer. */
+        if (file->nf_access_flags & FS_ACCESS_APPEND) {
+            *out_len += file->nf_wbuf_len;
+        } else if (file->nf_wbuf_off + file->nf_wbuf_len > *out_len) {
+            *out_len = file->nf_wbuf_off + file->nf_wbuf_len;
+        }
+    }
+    nffs_unlock_shared();
 
     return rc;
 }
@@ -271,12 +428,76 @@ static int
 nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
           uint32_t *out_len)
 {
+    uint32_t start;
+    int exclusive;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
-    nffs_lock();
+    start = cputime_get32();
+    exclusive = nffs_lock_file_read(file);
     rc = nffs_file_read(file, len, out_data, out_len);
-    nffs_unlock();
+    nffs_unlock_file_read(exclusive);
+
+    if (rc == 0) {
+        NFFS_STATS_LATENCY(read, start);
+    }
+
+    return rc;
+}
+
+/**
+ * Retrieves a pointer to the data at the current offset of the specified file
+ * without copying it.  The returned region is limited to a single data block;
+ * call repeatedly to stream a file.  Garbage collection does not wait for the
+ * caller, so the data may be erased while the pointer is held; after
+ * consuming it, call fs_read_direct_release() to find out whether it was
+ * intact.
+ *
+ * @param file              The file to read from.
+ * @param len               The maximum number of bytes to retrieve.
+ * @param out_data          On success, a pointer to the data gets written
+ *                              here.
+ * @param out_len           On success, the number of bytes available at the
+ *                              returned pointer gets written here; 0 at end
+ *                              of file.
+ *
+ * @return                  0 on success;
+ *                          FS_EUNSUPP if the flash is not memory mapped;
+ *                          other nonzero on failure.
+ */
+static int
+nffs_read_direct(struct fs_file *fs_file, uint32_t len, const void **out_data,
+                 uint32_t *out_len)
+{
+    int exclusive;
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    exclusive = nffs_lock_file_read(file);
+    rc = nffs_file_read_direct(file, len, out_data, out_len);
+    nffs_unlock_file_read(exclusive);
+
+    return rc;
+}
+
+/**
+ * Releases the pointer most recently returned by fs_read_direct() for the
+ * specified file.
+ *
+ * @param file              The file whose pointer to release.
+ *
+ * @return                  0 if the data was intact while it was held;
+ *                          FS_ESTALE if garbage collection erased it.
+ */
+static int
+nffs_read_direct_release(struct fs_file *fs_file)
+{
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    nffs_lock_shared();
+    rc = nffs_file_read_direct_release(file);
+    nffs_unlock_shared();
 
     return rc;
 }
@@ -293,9 +514,11 @@ nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
 static int
 nffs_write(struct fs_file *fs_file, const void *data, int len)
 {
+    uint32_t start;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
+    start = cputime_get32();
     nffs_lock();
 
     if (!nffs_misc_ready()) {
@@ -312,6 +535,116 @@ nffs_write(struct fs_file *fs_file, const void *data, int len)
 
 done:
     nffs_unlock();
+    if (rc == 0) {
+        NFFS_STATS_LATENCY(write, start);
+    }
+    return rc;
+}
+
+/**
+ * Reads data from the specified file into a sequence of buffers.  The whole
+ * operation is performed under a single acquisition of the file system lock,
+ * so no other writer can modify the file part way through.  Reading stops
+ * early at the end of the file.
+ *
+ * @param file              The file to read from.
+ * @param iov               The destination buffers, filled in order.
+ * @param iovcnt            The number of entries in iov.
+ * @param out_len           On success, the total number of bytes read gets
+ *                              written here.  Pass null if you don't care.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_readv(struct fs_file *fs_file, const struct fs_iovec *iov, int iovcnt,
+           uint32_t *out_len)
+{
+    uint32_t total;
+    uint32_t len;
+    int exclusive;
+    int rc;
+    int i;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    total = 0;
+    rc = 0;
+
+    exclusive = nffs_lock_file_read(file);
+    for (i = 0; i < iovcnt; i++) {
+        rc = nffs_file_read(file, iov[i].fiv_len, iov[i].fiv_base, &len);
+        if (rc != 0) {
+            break;
+        }
+        total += len;
+        if (len < iov[i].fiv_len) {
+            break;
+        }
+    }
+    nffs_unlock_file_read(exclusive);
+
+    if (rc == 0 && out_len != NULL) {
+        *out_len = total;
+    }
+
+    return rc;
+}
+
+/**
+ * Writes a sequence of buffers to the current offset of the specified file
+ * handle.  The buffers are written under a single acquisition of the file
+ * system lock, so they land contiguously in the file.
+ *
+ * @param file              The file to write to.
+ * @param iov               The source buffers, written in order.
+ * @param iovcnt            The number of entries in iov.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_writev(struct fs_file *fs_file, const struct fs_iovec *iov, int iovcnt)
+{
+    int rc;
+    int i;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    nffs_lock();
+
+    if (!nffs_misc_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = 0;
+    for (i = 0; i < iovcnt; i++) {
+        rc = nffs_write_to_file(file, iov[i].fiv_base, iov[i].fiv_len);
+        if (rc != 0) {
+            goto done;
+        }
+    }
+
+done:
+    nffs_unlock();
+    return rc;
+}
+
+/**
+ * Commits any data in the specified file's write buffer to flash.  This is a
+ * no-op for files that were not opened with FS_ACCESS_BUFFERED.
+ *
+ * @param file              The file to flush.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_flush(struct fs_file *fs_file)
+{
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    nffs_lock();
+    rc = nffs_write_buf_flush(file);
+    nffs_unlock();
+
     return rc;
 }
 
@@ -526,13 +859,13 @@ nffs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
     int rc;
     struct nffs_dirent *dirent = (struct nffs_dirent *)fs_dirent;
 
-    nffs_lock();
+    nffs_lock_shared();
 
     assert(dirent != NULL && dirent->nde_inode_entry != NULL);
     rc = nffs_inode_read_filename(dirent->nde_inode_entry, max_len, out_name,
                                   out_name_len);
 
-    nffs_unlock();
+    nffs_unlock_shared();
 
     return rc;
 }
@@ -552,12 +885,12 @@ nffs_dirent_is_dir(const struct fs_dirent *fs_dirent)
     uint32_t id;
     const struct nffs_dirent *dirent = (const struct nffs_dirent *)fs_dirent;
 
-    nffs_lock();
+    nffs_lock_shared();
 
     assert(dirent != NULL && dirent->nde_inode_entry != NULL);
     id = dirent->nde_inode_entry->nie_hash_entry.nhe_id;
 
-    nffs_unlock();
+    nffs_unlock_shared();
 
     return nffs_hash_id_is_dir(id);
 }
@@ -608,6 +941,150 @@ nffs_detect(const struct nffs_area_desc *area_descs)
     return rc;
 }
 
+/**
+ * Adjusts the data block cache at runtime.
+ *
+ * @param num_blocks        The maximum number of data blocks to keep cached;
+ *                              between 1 and nffs_config.nc_num_cache_blocks.
+ *                              Shrinking the budget discards cached blocks
+ *                              immediately.
+ * @param read_ahead        The number of blocks to prefetch when a file is
+ *                              read sequentially; 0 disables read-ahead.
+ *                              Capped at NFFS_CACHE_READ_AHEAD_MAX.
+ *
+ * @return                  0 on success;
+ *                          FS_EINVAL if the budget is out of range.
+ */
+int
+nffs_cache_set_budget(uint32_t num_blocks, uint8_t read_ahead)
+{
+    int rc;
+
+    nffs_lock();
+
+    rc = nffs_cache_set_block_budget(num_blocks);
+    if (rc == 0) {
+        if (read_ahead > NFFS_CACHE_READ_AHEAD_MAX) {
+            read_ahead = NFFS_CACHE_READ_AHEAD_MAX;
+        }
+        nffs_cache_read_ahead = read_ahead;
+    }
+
+    nffs_unlock();
+
+    return rc;
+}
+
+/**
+ * Retrieves the data block cache counters.
+ *
+ * @param out_stats         The counters get written here.
+ * @param reset             Whether to zero the counters after reading them.
+ */
+void
+nffs_cache_get_stats(struct nffs_cache_stats *out_stats, int reset)
+{
+    nffs_lock();
+
+    *out_stats = nffs_cache_stats;
+    if (reset) {
+        memset(&nffs_cache_stats, 0, sizeof nffs_cache_stats);
+    }
+
+    nffs_unlock();
+}
+
+/**
+ * Retrieves the data compression counters.
+ *
+ * @param out_stats         The counters get written here.
+ * @param reset             Whether to zero the counters after reading them.
+ */
+void
+nffs_compress_get_stats(struct nffs_compress_stats *out_stats, int reset)
+{
+    nffs_lock();
+
+    *out_stats = nffs_compress_stats;
+    if (reset) {
+        memset(&nffs_compress_stats, 0, sizeof nffs_compress_stats);
+    }
+
+    nffs_unlock();
+}
+
+/**
+ * Retrieves statistics about the object hash table, including bucket chain
+ * lengths.  This walks the entire table.
+ *
+ * @param out_stats         The statistics get written here.
+ * @param reset             Whether to zero the lookup and split counters
+ *                              after reading them.
+ */
+void
+nffs_hash_get_stats(struct nffs_hash_stats *out_stats, int reset)
+{
+    nffs_lock();
+    nffs_hash_read_stats(out_stats, reset);
+    nffs_unlock();
+}
+
+static void
+nffs_gc_task_handler(void *arg)
+{
+    int more;
+
+    while (1) {
+        nffs_lock();
+        if (nffs_misc_ready()) {
+            nffs_write_buf_flush_expired();
+            more = nffs_gc_background();
+        } else {
+            more = 0;
+        }
+        nffs_unlock();
+
+        /* The lock is released between increments so that foreground
+         * operations only ever wait for a single bounded step.
+         */
+        if (!more) {
+            os_time_delay(NFFS_GC_TASK_IDLE_TICKS);
+        }
+    }
+}
+
+/**
+ * Starts the optional background garbage collection task.  When the free
+ * space in the file system drops below nffs_config.nc_gc_low_water, this task
+ * compacts areas in increments of roughly nffs_config.nc_gc_step_size bytes,
+ * releasing the file system lock between increments.  This reduces the
+ * likelihood that a foreground write needs to perform a full garbage
+ * collection cycle itself.  The task also flushes file write buffers whose
+ * contents are older than nffs_config.nc_write_buf_timeout.
+ *
+ * The task should be given a lower priority than any task that uses the file
+ * system.
+ *
+ * @param prio              The priority of the garbage collection task.
+ * @param stack             The task's stack.
+ * @param stack_size        The size of the task's stack, in os_stack_t units.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+int
+nffs_gc_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size)
+{
+    int rc;
+
+    rc = os_task_init(&nffs_gc_task, "nffs_gc", nffs_gc_task_handler, NULL,
+                      prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    return 0;
+}
+
 /**
  * Initializes internal nffs memory and data structures.  This must be called
  * before any nffs operations are attempted.
@@ -623,11 +1100,32 @@ nffs_init(void)
 
     nffs_cache_clear();
 
+    nffs_cache_block_budget = nffs_config.nc_num_cache_blocks;
+    if (nffs_config.nc_read_ahead_blocks == NFFS_READ_AHEAD_NONE) {
+        nffs_cache_read_ahead = 0;
+    } else if (nffs_config.nc_read_ahead_blocks > NFFS_CACHE_READ_AHEAD_MAX) {
+        nffs_cache_read_ahead = NFFS_CACHE_READ_AHEAD_MAX;
+    } else {
+        nffs_cache_read_ahead = nffs_config.nc_read_ahead_blocks;
+    }
+
     rc = os_mutex_init(&nffs_mutex);
     if (rc != 0) {
         return FS_EOS;
     }
 
+    rc = os_mutex_init(&nffs_cache_mutex);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = os_sem_init(&nffs_reader_sem, 0);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+    nffs_num_readers = 0;
+    nffs_writer_waiting = 0;
+
     free(nffs_file_mem);
     nffs_file_mem = malloc(
         OS_MEMPOOL_BYTES(nffs_config.nc_num_files, sizeof (struct nffs_file)));
@@ -679,6 +1177,11 @@ nffs_init(void)
     log_console_handler_init(&nffs_log_console_handler);
     log_register("nffs", &nffs_log, &nffs_log_console_handler);
 
+    rc = nffs_stats_init();
+    if (rc != 0) {
+        return rc;
+    }
+
     rc = nffs_misc_reset();
     if (rc != 0) {
         return rc;
@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
@@ -54,9 +55,67 @@ nffs_area_to_disk(const struct nffs_area *area,
     memset(out_disk_area, 0, sizeof *out_disk_area);
     nffs_area_set_magic(out_disk_area);
     out_disk_area->nda_length = area->na_length;
-    out_disk_area->nda_ver = NFFS_AREA_VER;
+    out_disk_area->nda_ver = area->na_ver;
     out_disk_area->nda_gc_seq = area->na_gc_seq;
-    out_disk_area->nda_id = area->na_id;
+    if (area->na_ver == NFFS_AREA_VER_0) {
+        ((uint8_t *)out_disk_area)[NFFS_AREA_OFFSET_ID_0] = area->na_id;
+    } else {
+        out_disk_area->nda_erase_cnt = area->na_erase_cnt;
+        out_disk_area->nda_id = area->na_id;
+    }
+}
+
+/**
+ * Returns the size of an area's header, i.e., the offset of its first object.
+ */
+uint32_t
+nffs_area_hdr_len(const struct nffs_area *area)
+{
+    if (area->na_ver == NFFS_AREA_VER_0) {
+        return NFFS_AREA_HDR_SZ_0;
+    } else {
+        return sizeof (struct nffs_disk_area);
+    }
+}
+
+/**
+ * Converts an area header read from flash to the current layout, in place.
+ * A version 0 header gets an erase count of 0; its version number is left
+ * intact so that callers can tell the area needs to be rewritten.
+ *
+ * @param disk_area             The header to convert.
+ * @param out_hdr_len           On success, the offset of the area's first
+ *                                  object gets written here.  Pass NULL if
+ *                                  you don't care.
+ *
+ * @return                      0 on success;
+ *                              FS_ECORRUPT if the header version is unknown.
+ */
+int
+nffs_area_from_disk(struct nffs_disk_area *disk_area, uint32_t *out_hdr_len)
+{
+    uint32_t hdr_len;
+
+    switch (disk_area->nda_ver) {
+    case NFFS_AREA_VER:
+        hdr_len = sizeof *disk_area;
+        break;
+
+    case NFFS_AREA_VER_0:
+        disk_area->nda_id = ((uint8_t *)disk_area)[NFFS_AREA_OFFSET_ID_0];
+        disk_area->nda_erase_cnt = 0;
+        hdr_len = NFFS_AREA_HDR_SZ_0;
+        break;
+
+    default:
+        return FS_ECORRUPT;
+    }
+
+    if (out_hdr_len != NULL) {
+        *out_hdr_len = hdr_len;
+    }
+
+    return 0;
 }
 
 uint32_t
@@ -65,6 +124,41 @@ nffs_area_free_space(const struct nffs_area *area)
     return area->na_length - area->na_cur;
 }
 
+/**
+ * Recalculates the erase count summary in the nffs statistics from the
+ * per-area erase counts.  Called whenever an area is erased or the set of
+ * areas changes.
+ */
+void
+nffs_area_wear_update(void)
+{
+    uint64_t total;
+    uint32_t min;
+    uint32_t max;
+    int i;
+
+    if (nffs_num_areas == 0) {
+        return;
+    }
+
+    min = UINT32_MAX;
+    max = 0;
+    total = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (nffs_areas[i].na_erase_cnt < min) {
+            min = nffs_areas[i].na_erase_cnt;
+        }
+        if (nffs_areas[i].na_erase_cnt > max) {
+            max = nffs_areas[i].na_erase_cnt;
+        }
+        total += nffs_areas[i].na_erase_cnt;
+    }
+
+    nffs_stats.serase_min = min;
+    nffs_stats.serase_max = max;
+    nffs_stats.serase_avg = total / nffs_num_areas;
+}
+
 /**
  * Finds a corrupt scratch area.  An area is indentified as a corrupt scratch
  * area if it and another area share the same ID.  Among two areas with the
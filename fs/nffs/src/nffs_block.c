@@ -20,10 +20,32 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
+#include "os/os_malloc.h"
 #include "testutil/testutil.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
+
+/**
+ * The block work buffer, allocated on first use.  It consists of two parts:
+ *     o The most recently decompressed data block.  Flash is only ever erased
+ *       during garbage collection (or formatting), so a block's flash location
+ *       and the garbage collection count uniquely identify its contents.  This
+ *       part is also the workspace for compression, and it has room for a
+ *       compressed stream to be read in behind its decompressed output.
+ *     o The staging area, which holds a block being written until it is in
+ *       flash.  Garbage collection never touches this part, so a write may
+ *       trigger a collection cycle while its block is staged.
+ */
+#define NFFS_BLOCK_ZBUF_CACHE_SZ                                        \
+    (NFFS_BLOCK_MAX_DATA_SZ_MAX + NFFS_BLOCK_MAX_DATA_SZ_MAX / 32 + 2)
+#define NFFS_BLOCK_ZBUF_SZ                                              \
+    (NFFS_BLOCK_ZBUF_CACHE_SZ + NFFS_BLOCK_MAX_DATA_SZ_MAX)
+
+static uint8_t *nffs_block_zbuf;
+static uint32_t nffs_block_zbuf_loc;
+static unsigned int nffs_block_zbuf_gc_count;
+static uint16_t nffs_block_zbuf_len;
 
 struct nffs_hash_entry *
 nffs_block_entry_alloc(void)
@@ -95,7 +117,9 @@ nffs_block_read_disk(uint8_t area_idx, uint32_t area_offset,
     if (rc != 0) {
         return rc;
     }
-    if (out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC) {
+    if (out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC &&
+        out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC_COMPRESSED) {
+
         return FS_EUNEXP;
     }
 
@@ -152,14 +176,32 @@ nffs_block_write_disk(const struct nffs_disk_block *disk_block,
     return 0;
 }
 
-static void
+static int
 nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
-                             const struct nffs_disk_block *disk_block)
+                             const struct nffs_disk_block *disk_block,
+                             uint8_t area_idx, uint32_t area_offset)
 {
+    uint16_t data_len;
+    int rc;
+
     out_block->nb_seq = disk_block->ndb_seq;
     out_block->nb_inode_entry = NULL;
     out_block->nb_prev = NULL;
-    out_block->nb_data_len = disk_block->ndb_data_len;
+    out_block->nb_disk_len = disk_block->ndb_data_len;
+
+    if (disk_block->ndb_magic == NFFS_BLOCK_MAGIC_COMPRESSED) {
+        /* The uncompressed length precedes the compressed data. */
+        rc = nffs_flash_read(area_idx, area_offset + sizeof *disk_block,
+                             &data_len, sizeof data_len);
+        if (rc != 0) {
+            return rc;
+        }
+        out_block->nb_data_len = data_len;
+    } else {
+        out_block->nb_data_len = disk_block->ndb_data_len;
+    }
+
+    return 0;
 }
 
 /**
@@ -170,23 +212,29 @@ nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
  * indicates file system corruption.  In this case, the resulting block is
  * populated with all valid references, and an FS_ECORRUPT code is returned.
  *
- * @param out_block             The resulting block is written here (regardless
- *                                  of this function's return code).
+ * @param out_block             The resulting block is written here (unless a
+ *                                  flash error occurs).
  * @param disk_block            The source disk record to convert.
+ * @param area_idx              The area containing the disk record.
+ * @param area_offset           The offset of the disk record within its area.
  *
  * @return                      0 if the block was successfully constructed;
  *                              FS_ECORRUPT if one or more pointers could not
- *                                  be filled in due to file system corruption.
+ *                                  be filled in due to file system corruption;
+ *                              other nonzero on flash error.
  */
 static int
 nffs_block_from_disk(struct nffs_block *out_block,
-                     const struct nffs_disk_block *disk_block)
+                     const struct nffs_disk_block *disk_block,
+                     uint8_t area_idx, uint32_t area_offset)
 {
     int rc;
 
-    rc = 0;
-
-    nffs_block_from_disk_no_ptrs(out_block, disk_block);
+    rc = nffs_block_from_disk_no_ptrs(out_block, disk_block, area_idx,
+                                      area_offset);
+    if (rc != 0) {
+        return rc;
+    }
 
     out_block->nb_inode_entry = nffs_hash_find_inode(disk_block->ndb_inode_id);
     if (out_block->nb_inode_entry == NULL) {
@@ -335,7 +383,11 @@ nffs_block_from_hash_entry_no_ptrs(struct nffs_block *out_block,
     }
 
     out_block->nb_hash_entry = block_entry;
-    nffs_block_from_disk_no_ptrs(out_block, &disk_block);
+    rc = nffs_block_from_disk_no_ptrs(out_block, &disk_block, area_idx,
+                                      area_offset);
+    if (rc != 0) {
+        return rc;
+    }
 
     return 0;
 }
@@ -380,10 +432,199 @@ nffs_block_from_hash_entry(struct nffs_block *out_block,
     }
 
     out_block->nb_hash_entry = block_entry;
-    rc = nffs_block_from_disk(out_block, &disk_block);
+    rc = nffs_block_from_disk(out_block, &disk_block, area_idx, area_offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Indicates whether the specified data block is stored compressed.
+ */
+int
+nffs_block_is_compressed(const struct nffs_block *block)
+{
+    return block->nb_disk_len != block->nb_data_len;
+}
+
+static int
+nffs_block_zbuf_alloc(void)
+{
+    if (nffs_block_zbuf == NULL) {
+        nffs_block_zbuf = malloc(NFFS_BLOCK_ZBUF_SZ);
+        if (nffs_block_zbuf == NULL) {
+            return FS_ENOMEM;
+        }
+        nffs_block_zbuf_loc = NFFS_FLASH_LOC_NONE;
+    }
+
+    return 0;
+}
+
+/**
+ * Retrieves the staging area of the block work buffer.  A block can be
+ * assembled here and passed to nffs_block_encode() in place.
+ *
+ * @return                      A buffer of NFFS_BLOCK_MAX_DATA_SZ_MAX bytes;
+ *                              NULL if the work buffer could not be
+ *                                  allocated.
+ */
+uint8_t *
+nffs_block_zbuf_stage(void)
+{
+    if (nffs_block_zbuf_alloc() != 0) {
+        return NULL;
+    }
+
+    return nffs_block_zbuf + NFFS_BLOCK_ZBUF_CACHE_SZ;
+}
+
+/**
+ * Selects the on-disk representation of a data block's contents.  If
+ * compression is requested and it makes the block smaller, the block is
+ * stored compressed; otherwise it is stored as-is.  The disk block's magic
+ * number and data length are filled in accordingly; the caller still needs to
+ * fill in the CRC.
+ *
+ * @param disk_block            The header of the block being written.
+ * @param data                  The uncompressed block contents.
+ * @param data_len              The number of bytes of uncompressed data.
+ * @param compress              Whether to attempt compression.
+ * @param dst                   Receives the compressed payload; must hold
+ *                                  data_len bytes and may be the same buffer
+ *                                  as data.  If null, the block is stored
+ *                                  uncompressed.
+ * @param out_payload           On return, points to the bytes to write after
+ *                                  the block header (either data or dst).
+ */
+void
+nffs_block_encode(struct nffs_disk_block *disk_block, const void *data,
+                  uint16_t data_len, int compress, void *dst,
+                  const void **out_payload)
+{
+    uint8_t *buf;
+    int zlen;
+
+    disk_block->ndb_magic = NFFS_BLOCK_MAGIC;
+    disk_block->ndb_data_len = data_len;
+    *out_payload = data;
+
+    if (!compress) {
+        return;
+    }
+
+    /* Compression must save at least one byte, or it isn't worth it.  The
+     * stream is built in the decompression part of the work buffer and then
+     * copied out, since dst may alias data.  If there is no work buffer, just
+     * store the data uncompressed.
+     */
+    nffs_cache_lock();
+
+    zlen = 0;
+    if (dst != NULL && data_len > NFFS_BLOCK_COMPRESSED_HDR_SZ + 1 &&
+        nffs_block_zbuf_alloc() == 0) {
+
+        nffs_block_zbuf_loc = NFFS_FLASH_LOC_NONE;
+        buf = nffs_block_zbuf;
+        zlen = nffs_compress(data, data_len,
+                             buf + NFFS_BLOCK_COMPRESSED_HDR_SZ,
+                             data_len - 1 - NFFS_BLOCK_COMPRESSED_HDR_SZ);
+        if (zlen != 0) {
+            memcpy(buf, &data_len, sizeof data_len);
+            memcpy(dst, buf, NFFS_BLOCK_COMPRESSED_HDR_SZ + zlen);
+        }
+    }
+
+    nffs_cache_unlock();
+
+    nffs_compress_stats.nzs_bytes_in += data_len;
+    if (zlen == 0) {
+        nffs_compress_stats.nzs_bytes_out += data_len;
+        nffs_compress_stats.nzs_blocks_raw++;
+        return;
+    }
+
+    disk_block->ndb_magic = NFFS_BLOCK_MAGIC_COMPRESSED;
+    disk_block->ndb_data_len = NFFS_BLOCK_COMPRESSED_HDR_SZ + zlen;
+    *out_payload = dst;
+
+    nffs_compress_stats.nzs_bytes_out += disk_block->ndb_data_len;
+    nffs_compress_stats.nzs_blocks_compressed++;
+}
+
+/**
+ * Discards the block work buffer.
+ */
+void
+nffs_block_zbuf_clear(void)
+{
+    free(nffs_block_zbuf);
+    nffs_block_zbuf = NULL;
+    nffs_block_zbuf_loc = NFFS_FLASH_LOC_NONE;
+}
+
+/**
+ * Decompresses the specified block into the decompressed block buffer, unless
+ * it is already there.
+ */
+static int
+nffs_block_zbuf_fill(const struct nffs_block *block)
+{
+    const void *zdata;
+    uint32_t flash_loc;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    uint8_t *zbuf;
+    int zlen;
+    int rc;
+
+    flash_loc = block->nb_hash_entry->nhe_flash_loc;
+    if (nffs_block_zbuf != NULL &&
+        nffs_block_zbuf_loc == flash_loc &&
+        nffs_block_zbuf_gc_count == nffs_gc_count) {
+
+        return 0;
+    }
+
+    rc = nffs_block_zbuf_alloc();
     if (rc != 0) {
         return rc;
     }
+    nffs_block_zbuf_loc = NFFS_FLASH_LOC_NONE;
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_block) +
+                   NFFS_BLOCK_COMPRESSED_HDR_SZ;
+    zlen = block->nb_disk_len - NFFS_BLOCK_COMPRESSED_HDR_SZ;
+    if (zlen > NFFS_BLOCK_MAX_DATA_SZ_MAX) {
+        return FS_ECORRUPT;
+    }
+
+    /* Decompress straight out of flash if it is memory mapped.  Otherwise,
+     * read the stream into the end of the buffer and decompress it in place;
+     * the output never overtakes the unread input by more than one control
+     * byte per literal run, and the buffer has that much slack.
+     */
+    rc = nffs_flash_mmap(area_idx, area_offset, zlen, &zdata);
+    if (rc == FS_EUNSUPP) {
+        zbuf = nffs_block_zbuf + NFFS_BLOCK_ZBUF_CACHE_SZ - zlen;
+        rc = nffs_flash_read(area_idx, area_offset, zbuf, zlen);
+        zdata = zbuf;
+    }
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (nffs_decompress(zdata, zlen, nffs_block_zbuf,
+                        NFFS_BLOCK_MAX_DATA_SZ_MAX) != block->nb_data_len) {
+        return FS_ECORRUPT;
+    }
+
+    nffs_block_zbuf_loc = flash_loc;
+    nffs_block_zbuf_gc_count = nffs_gc_count;
+    nffs_block_zbuf_len = block->nb_data_len;
 
     return 0;
 }
@@ -396,6 +637,19 @@ nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
     uint8_t area_idx;
     int rc;
 
+    if (nffs_block_is_compressed(block)) {
+        /* The decompression buffer is shared by all readers. */
+        nffs_cache_lock();
+        rc = nffs_block_zbuf_fill(block);
+        if (rc == 0) {
+            assert(offset + length <= nffs_block_zbuf_len);
+            memcpy(dst, nffs_block_zbuf + offset, length);
+        }
+        nffs_cache_unlock();
+
+        return rc;
+    }
+
     nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
                          &area_idx, &area_offset);
     area_offset += sizeof (struct nffs_disk_block);
@@ -408,3 +662,29 @@ nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
 
     return 0;
 }
+
+int
+nffs_block_mmap_data(const struct nffs_block *block, uint16_t offset,
+                     uint16_t length, const void **out_ptr)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    /* Compressed data must be decompressed into RAM first. */
+    if (nffs_block_is_compressed(block)) {
+        return FS_EUNSUPP;
+    }
+
+    nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
+                         &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_block);
+    area_offset += offset;
+
+    rc = nffs_flash_mmap(area_idx, area_offset, length, out_ptr);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return 0;
+}
@@ -26,13 +26,64 @@ TAILQ_HEAD(nffs_cache_inode_list, nffs_cache_inode);
 static struct nffs_cache_inode_list nffs_cache_inode_list =
     TAILQ_HEAD_INITIALIZER(nffs_cache_inode_list);
 
-static void nffs_cache_reclaim_blocks(void);
+/** Maximum number of blocks that may be cached at once. */
+uint32_t nffs_cache_block_budget;
+
+/** Number of blocks to prefetch during sequential reads; 0 = disabled. */
+uint8_t nffs_cache_read_ahead;
+
+struct nffs_cache_stats nffs_cache_stats;
+
+/**
+ * Incremented whenever a cached block or inode is added or discarded.  A
+ * reader that drops nffs_cache_mutex uses this to tell whether its cache
+ * pointers are still valid when it reacquires the mutex.
+ */
+uint32_t nffs_cache_gen;
+
+static int nffs_cache_reclaim_blocks(const struct nffs_cache_inode *keep);
+
+static uint32_t
+nffs_cache_num_blocks(void)
+{
+    return nffs_cache_block_pool.mp_num_blocks -
+           nffs_cache_block_pool.mp_num_free;
+}
+
+/**
+ * Locks the block cache.  While the file system is locked exclusively, this
+ * is unnecessary.  While it is locked for reading, several tasks may be
+ * inside nffs at once; this mutex must then be held whenever the cache, the
+ * decompressed block buffer, or the hash table (whose lookups reorder bucket
+ * chains) is accessed.
+ */
+void
+nffs_cache_lock(void)
+{
+    int rc;
+
+    rc = os_mutex_pend(&nffs_cache_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+void
+nffs_cache_unlock(void)
+{
+    int rc;
+
+    rc = os_mutex_release(&nffs_cache_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
 
 static struct nffs_cache_block *
 nffs_cache_block_alloc(void)
 {
     struct nffs_cache_block *entry;
 
+    if (nffs_cache_num_blocks() >= nffs_cache_block_budget) {
+        return NULL;
+    }
+
     entry = os_memblock_get(&nffs_cache_block_pool);
     if (entry != NULL) {
         memset(entry, 0, sizeof *entry);
@@ -56,7 +107,7 @@ nffs_cache_block_acquire(void)
 
     cache_block = nffs_cache_block_alloc();
     if (cache_block == NULL) {
-        nffs_cache_reclaim_blocks();
+        nffs_cache_reclaim_blocks(NULL);
         cache_block = nffs_cache_block_alloc();
     }
 
@@ -65,6 +116,27 @@ nffs_cache_block_acquire(void)
     return cache_block;
 }
 
+/**
+ * Allocates a cache block for read-ahead.  Unlike nffs_cache_block_acquire(),
+ * this never discards blocks belonging to the specified inode; if no block can
+ * be obtained without doing so, null is returned.
+ */
+static struct nffs_cache_block *
+nffs_cache_block_acquire_prefetch(const struct nffs_cache_inode *cache_inode)
+{
+    struct nffs_cache_block *cache_block;
+
+    cache_block = nffs_cache_block_alloc();
+    if (cache_block == NULL) {
+        if (nffs_cache_reclaim_blocks(cache_inode) != 0) {
+            return NULL;
+        }
+        cache_block = nffs_cache_block_alloc();
+    }
+
+    return cache_block;
+}
+
 static int
 nffs_cache_block_populate(struct nffs_cache_block *cache_block,
                           struct nffs_hash_entry *block_entry,
@@ -97,15 +169,24 @@ nffs_cache_inode_alloc(void)
     return entry;
 }
 
-static void
+static int
 nffs_cache_inode_free_blocks(struct nffs_cache_inode *cache_inode)
 {
     struct nffs_cache_block *cache_block;
+    int num_freed;
 
+    num_freed = 0;
     while ((cache_block = TAILQ_FIRST(&cache_inode->nci_block_list)) != NULL) {
         TAILQ_REMOVE(&cache_inode->nci_block_list, cache_block, ncb_link);
         nffs_cache_block_free(cache_block);
+        num_freed++;
+    }
+
+    if (num_freed > 0) {
+        nffs_cache_gen++;
     }
+
+    return num_freed;
 }
 
 static void
@@ -114,6 +195,7 @@ nffs_cache_inode_free(struct nffs_cache_inode *entry)
     if (entry != NULL) {
         nffs_cache_inode_free_blocks(entry);
         os_memblock_put(&nffs_cache_inode_pool, entry);
+        nffs_cache_gen++;
     }
 }
 
@@ -128,6 +210,8 @@ nffs_cache_inode_acquire(void)
         assert(entry != NULL);
 
         TAILQ_REMOVE(&nffs_cache_inode_list, entry, nci_link);
+        nffs_cache_stats.ncs_evictions +=
+            nffs_cache_inode_free_blocks(entry);
         nffs_cache_inode_free(entry);
 
         entry = nffs_cache_inode_alloc();
@@ -214,20 +298,33 @@ nffs_cache_inode_range(const struct nffs_cache_inode *cache_inode,
                cache_block->ncb_block.nb_data_len;
 }
 
-static void
-nffs_cache_reclaim_blocks(void)
+/**
+ * Frees the cached blocks of the least recently used inode that has any.
+ *
+ * @param keep                  An inode whose blocks must not be freed; null
+ *                                  if any inode may be reclaimed from.  If
+ *                                  null, this function always succeeds.
+ *
+ * @return                      0 if blocks were freed; FS_ENOMEM otherwise.
+ */
+static int
+nffs_cache_reclaim_blocks(const struct nffs_cache_inode *keep)
 {
     struct nffs_cache_inode *cache_inode;
 
     TAILQ_FOREACH_REVERSE(cache_inode, &nffs_cache_inode_list,
                           nffs_cache_inode_list, nci_link) {
-        if (!TAILQ_EMPTY(&cache_inode->nci_block_list)) {
-            nffs_cache_inode_free_blocks(cache_inode);
-            return;
+        if (cache_inode != keep &&
+            !TAILQ_EMPTY(&cache_inode->nci_block_list)) {
+
+            nffs_cache_stats.ncs_evictions +=
+                nffs_cache_inode_free_blocks(cache_inode);
+            return 0;
         }
     }
 
-    assert(0);
+    assert(keep != NULL);
+    return FS_ENOMEM;
 }
 
 void
@@ -340,6 +437,7 @@ nffs_cache_insert_block(struct nffs_cache_inode *cache_inode,
     } else {
         TAILQ_INSERT_HEAD(&cache_inode->nci_block_list, cache_block, ncb_link);
     }
+    nffs_cache_gen++;
 
     nffs_cache_log_insert_block(cache_inode, cache_block, tail);
 }
@@ -362,6 +460,11 @@ nffs_cache_insert_block(struct nffs_cache_inode *cache_inode,
  *         list.
  *      b. Else, clear the cache, and populate it with the single entry
  *         corresponding to the requested block.
+ *     In either case, if the inode is being read sequentially
+ *     (nci_read_ahead != 0), the blocks that follow the requested one are
+ *     appended to the cache as well.  These blocks get read anyway while
+ *     scanning backwards from the end of the file, so caching them saves a
+ *     full scan per block when the file is streamed.
  *
  * @param cache_inode           The cached file inode to seek within.
  * @param seek_offset           The file offset to seek to.
@@ -375,15 +478,20 @@ int
 nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
                 struct nffs_cache_block **out_cache_block)
 {
+    struct nffs_cache_block *ahead_block;
     struct nffs_cache_block *cache_block;
     struct nffs_hash_entry *last_cached_entry;
     struct nffs_hash_entry *block_entry;
     struct nffs_hash_entry *pred_entry;
+    struct nffs_block ahead[NFFS_CACHE_READ_AHEAD_MAX];
     struct nffs_block block;
+    uint32_t ahead_start[NFFS_CACHE_READ_AHEAD_MAX];
     uint32_t cache_start;
     uint32_t cache_end;
     uint32_t block_start;
     uint32_t block_end;
+    int num_ahead;
+    int i;
     int rc;
 
     /* Empty files have no blocks that can be cached. */
@@ -391,7 +499,19 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
         return FS_ENOENT;
     }
 
+    num_ahead = 0;
+
     nffs_cache_inode_range(cache_inode, &cache_start, &cache_end);
+    if (cache_end != 0 &&
+        seek_offset >= cache_start && seek_offset < cache_end) {
+
+        nffs_cache_stats.ncs_hits++;
+        STATS_INC(nffs_stats, cache_hits);
+    } else {
+        nffs_cache_stats.ncs_misses++;
+        STATS_INC(nffs_stats, cache_misses);
+    }
+
     if (cache_end != 0 && seek_offset < cache_start) {
         /* Seeking prior to cache.  Iterate backwards from cache start. */
         cache_block = TAILQ_FIRST(&cache_inode->nci_block_list);
@@ -451,6 +571,22 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
 
             block_start = block_end - block.nb_data_len;
             pred_entry = block.nb_prev;
+
+            if (block_start > seek_offset && cache_inode->nci_read_ahead > 0) {
+                /* Remember the blocks immediately following the requested
+                 * one so they can be prefetched.  Shift out the most
+                 * distant block once the window is full.
+                 */
+                if (num_ahead == cache_inode->nci_read_ahead) {
+                    num_ahead--;
+                    memmove(ahead, ahead + 1, num_ahead * sizeof *ahead);
+                    memmove(ahead_start, ahead_start + 1,
+                            num_ahead * sizeof *ahead_start);
+                }
+                ahead[num_ahead] = block;
+                ahead_start[num_ahead] = block_start;
+                num_ahead++;
+            }
         }
 
         if (block_start <= seek_offset) {
@@ -476,6 +612,23 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
                     nffs_cache_inode_free_blocks(cache_inode);
                     nffs_cache_insert_block(cache_inode, cache_block, 0);
                 }
+
+                /* Append the read-ahead window, nearest block first. */
+                for (i = num_ahead - 1; i >= 0; i--) {
+                    ahead_block =
+                        nffs_cache_block_acquire_prefetch(cache_inode);
+                    if (ahead_block == NULL) {
+                        break;
+                    }
+                    ahead_block->ncb_block = ahead[i];
+                    ahead_block->ncb_file_offset = ahead_start[i];
+                    ahead_block->ncb_prefetched = 1;
+                    nffs_cache_insert_block(cache_inode, ahead_block, 1);
+                    nffs_cache_stats.ncs_prefetches++;
+                }
+            } else if (cache_block->ncb_prefetched) {
+                cache_block->ncb_prefetched = 0;
+                nffs_cache_stats.ncs_prefetch_hits++;
             }
 
             if (out_cache_block != NULL) {
@@ -509,3 +662,30 @@ nffs_cache_clear(void)
         nffs_cache_inode_free(entry);
     }
 }
+
+/**
+ * Changes the number of data blocks that may be cached at once.  If more
+ * blocks than the new budget are currently cached, blocks are discarded
+ * immediately, least recently used inodes first.
+ *
+ * @param num_blocks            The new budget; must be between 1 and the size
+ *                                  of the block cache pool
+ *                                  (nffs_config.nc_num_cache_blocks).
+ *
+ * @return                      0 on success; FS_EINVAL if the budget is out
+ *                                  of range.
+ */
+int
+nffs_cache_set_block_budget(uint32_t num_blocks)
+{
+    if (num_blocks == 0 || num_blocks > nffs_config.nc_num_cache_blocks) {
+        return FS_EINVAL;
+    }
+
+    nffs_cache_block_budget = num_blocks;
+    while (nffs_cache_num_blocks() > nffs_cache_block_budget) {
+        nffs_cache_reclaim_blocks(NULL);
+    }
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#include "nffs/nffs.h"
+#include "nffs_priv.h"
+
+/*
+ * A small LZ77 codec for data block contents (the LZF stream format).  The
+ * compressed stream is a sequence of control bytes, each followed by its
+ * operands:
+ *
+ *     000LLLLL                    Literal run: the next L + 1 bytes are
+ *                                 copied to the output as-is.
+ *     LLLOOOOO OOOOOOOO           Back reference (L = 1..6): copy L + 2 bytes
+ *                                 starting O + 1 bytes before the current
+ *                                 end of output.
+ *     111OOOOO LLLLLLLL OOOOOOOO  Long back reference: copy L + 9 bytes.
+ *
+ * Compression uses a 256-entry hash table of recent three-byte sequences; it
+ * needs no heap and decompression needs no state at all.
+ */
+
+#define NFFS_COMPRESS_HASH_BITS     8
+#define NFFS_COMPRESS_HASH_SZ       (1 << NFFS_COMPRESS_HASH_BITS)
+#define NFFS_COMPRESS_HASH_NONE     0xffff
+#define NFFS_COMPRESS_MAX_LIT       32
+#define NFFS_COMPRESS_MAX_OFF       (1 << 13)
+#define NFFS_COMPRESS_MAX_REF       (7 + 255 + 2)
+
+struct nffs_compress_stats nffs_compress_stats;
+
+static uint16_t nffs_compress_htab[NFFS_COMPRESS_HASH_SZ];
+
+static int
+nffs_compress_hash(const uint8_t *p)
+{
+    uint32_t v;
+
+    v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return ((v * 2654435761u) >> (32 - NFFS_COMPRESS_HASH_BITS)) &
+           (NFFS_COMPRESS_HASH_SZ - 1);
+}
+
+/**
+ * Compresses a buffer.
+ *
+ * @param src                   The data to compress.
+ * @param src_len               The number of bytes to compress.
+ * @param dst                   The compressed stream gets written here.
+ * @param dst_len               The size of the destination buffer.
+ *
+ * @return                      The length of the compressed stream;
+ *                              0 if it does not fit in the destination.
+ */
+int
+nffs_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_len)
+{
+    int lit_len;
+    int ref_len;
+    int max_len;
+    int src_off;
+    int ref_off;
+    int dst_off;
+    int dist;
+    int hash;
+
+    if (src_len == 0 || dst_len < 2) {
+        return 0;
+    }
+
+    memset(nffs_compress_htab, 0xff, sizeof nffs_compress_htab);
+
+    /* Reserve a control byte for the first literal run. */
+    dst_off = 1;
+    lit_len = 0;
+    src_off = 0;
+
+    while (src_off < src_len) {
+        ref_len = 0;
+        if (src_off + 2 < src_len) {
+            hash = nffs_compress_hash(src + src_off);
+            ref_off = nffs_compress_htab[hash];
+            nffs_compress_htab[hash] = src_off;
+
+            if (ref_off != NFFS_COMPRESS_HASH_NONE &&
+                src_off - ref_off <= NFFS_COMPRESS_MAX_OFF &&
+                memcmp(src + ref_off, src + src_off, 3) == 0) {
+
+                max_len = src_len - src_off;
+                if (max_len > NFFS_COMPRESS_MAX_REF) {
+                    max_len = NFFS_COMPRESS_MAX_REF;
+                }
+                ref_len = 3;
+                while (ref_len < max_len &&
+                       src[ref_off + ref_len] == src[src_off + ref_len]) {
+                    ref_len++;
+                }
+            }
+        }
+
+        if (ref_len == 0) {
+            /* Literal byte. */
+            if (dst_off + 1 > dst_len) {
+                return 0;
+            }
+            dst[dst_off++] = src[src_off++];
+            lit_len++;
+            if (lit_len == NFFS_COMPRESS_MAX_LIT) {
+                /* Close the run and reserve a control byte for the next. */
+                dst[dst_off - lit_len - 1] = lit_len - 1;
+                lit_len = 0;
+                if (dst_off + 1 > dst_len) {
+                    return 0;
+                }
+                dst_off++;
+            }
+            continue;
+        }
+
+        /* Close the current literal run, or drop its unused control byte. */
+        if (lit_len > 0) {
+            dst[dst_off - lit_len - 1] = lit_len - 1;
+        } else {
+            dst_off--;
+        }
+
+        /* Back reference, followed by a control byte for the next run. */
+        dist = src_off - ref_off - 1;
+        if (dst_off + 4 > dst_len) {
+            return 0;
+        }
+        if (ref_len - 2 < 7) {
+            dst[dst_off++] = ((ref_len - 2) << 5) | (dist >> 8);
+        } else {
+            dst[dst_off++] = (7 << 5) | (dist >> 8);
+            dst[dst_off++] = ref_len - 2 - 7;
+        }
+        dst[dst_off++] = dist;
+        dst_off++;
+        lit_len = 0;
+
+        src_off += ref_len;
+    }
+
+    if (lit_len > 0) {
+        dst[dst_off - lit_len - 1] = lit_len - 1;
+    } else {
+        dst_off--;
+    }
+
+    return dst_off;
+}
+
+/**
+ * Decompresses a buffer produced by nffs_compress().
+ *
+ * @param src                   The compressed stream.
+ * @param src_len               The length of the compressed stream.
+ * @param dst                   The decompressed data gets written here.
+ * @param dst_len               The size of the destination buffer.
+ *
+ * @return                      The number of bytes decompressed;
+ *                              -1 if the stream is malformed or does not fit
+ *                                  in the destination.
+ */
+int
+nffs_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_len)
+{
+    int src_off;
+    int dst_off;
+    int ref_off;
+    int len;
+    uint8_t ctrl;
+
+    src_off = 0;
+    dst_off = 0;
+
+    while (src_off < src_len) {
+        ctrl = src[src_off++];
+        if (ctrl < NFFS_COMPRESS_MAX_LIT) {
+            len = ctrl + 1;
+            if (src_off + len > src_len || dst_off + len > dst_len) {
+                return -1;
+            }
+            /* The stream may be being decompressed in place. */
+            memmove(dst + dst_off, src + src_off, len);
+            src_off += len;
+            dst_off += len;
+        } else {
+            len = ctrl >> 5;
+            if (len == 7) {
+                if (src_off >= src_len) {
+                    return -1;
+                }
+                len += src[src_off++];
+            }
+            if (src_off >= src_len) {
+                return -1;
+            }
+            ref_off = dst_off - ((ctrl & 0x1f) << 8) - src[src_off++] - 1;
+            len += 2;
+            if (ref_off < 0 || dst_off + len > dst_len) {
+                return -1;
+            }
+
+            /* The source and destination may overlap; copy bytewise. */
+            while (len-- > 0) {
+                dst[dst_off++] = dst[ref_off++];
+            }
+        }
+    }
+
+    return dst_off;
+}
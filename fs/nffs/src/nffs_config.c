@@ -18,6 +18,7 @@
  */
 
 #include "nffs/nffs.h"
+#include "nffs_priv.h"
 
 struct nffs_config nffs_config;
 
@@ -27,7 +28,12 @@ const struct nffs_config nffs_config_dflt = {
     .nc_num_files = 4,
     .nc_num_cache_inodes = 4,
     .nc_num_cache_blocks = 64,
+    .nc_read_ahead_blocks = 4,
     .nc_num_dirs = 4,
+    .nc_gc_low_water = 8192,
+    .nc_gc_step_size = 1024,
+    .nc_write_buf_timeout = 1000,
+    .nc_num_hash_buckets = 256,
 };
 
 void
@@ -48,7 +54,28 @@ nffs_config_init(void)
     if (nffs_config.nc_num_cache_blocks == 0) {
         nffs_config.nc_num_cache_blocks = nffs_config_dflt.nc_num_cache_blocks;
     }
+    if (nffs_config.nc_read_ahead_blocks == 0) {
+        nffs_config.nc_read_ahead_blocks =
+            nffs_config_dflt.nc_read_ahead_blocks;
+    }
     if (nffs_config.nc_num_dirs == 0) {
         nffs_config.nc_num_dirs = nffs_config_dflt.nc_num_dirs;
     }
+    if (nffs_config.nc_gc_low_water == 0) {
+        nffs_config.nc_gc_low_water = nffs_config_dflt.nc_gc_low_water;
+    }
+    if (nffs_config.nc_gc_step_size == 0) {
+        nffs_config.nc_gc_step_size = nffs_config_dflt.nc_gc_step_size;
+    }
+    if (nffs_config.nc_write_buf_timeout == 0) {
+        nffs_config.nc_write_buf_timeout =
+            nffs_config_dflt.nc_write_buf_timeout;
+    }
+    if (nffs_config.nc_num_hash_buckets == 0) {
+        nffs_config.nc_num_hash_buckets =
+            nffs_config_dflt.nc_num_hash_buckets;
+    }
+    if (nffs_config.nc_inline_data_max > NFFS_INODE_INLINE_MAX) {
+        nffs_config.nc_inline_data_max = NFFS_INODE_INLINE_MAX;
+    }
 }
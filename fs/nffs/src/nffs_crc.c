@@ -19,16 +19,23 @@
 
 
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 int
 nffs_crc_flash(uint16_t initial_crc, uint8_t area_idx, uint32_t area_offset,
                uint32_t len, uint16_t *out_crc)
 {
+    const void *ptr;
     uint32_t chunk_len;
     uint16_t crc;
     int rc;
 
+    /* Memory-mapped flash can be checksummed in place. */
+    if (len > 0 && nffs_flash_mmap(area_idx, area_offset, len, &ptr) == 0) {
+        *out_crc = crc16_ccitt(initial_crc, ptr, len);
+        return 0;
+    }
+
     crc = initial_crc;
 
     /* Copy data in chunks small enough to fit in the flash buffer. */
@@ -134,8 +141,11 @@ nffs_crc_disk_inode(const struct nffs_disk_inode *disk_inode,
 
     crc = nffs_crc_disk_inode_hdr(disk_inode);
 
+    /* Inline data, if any, immediately precedes the filename. */
     rc = nffs_crc_flash(crc, area_idx, area_offset + sizeof *disk_inode,
-                        disk_inode->ndi_filename_len, &crc);
+                        nffs_inode_disk_inline_len(disk_inode) +
+                            disk_inode->ndi_filename_len,
+                        &crc);
     if (rc != 0) {
         return rc;
     }
@@ -165,11 +175,13 @@ nffs_crc_disk_inode_validate(const struct nffs_disk_inode *disk_inode,
 
 void
 nffs_crc_disk_inode_fill(struct nffs_disk_inode *disk_inode,
-                         const char *filename)
+                         const void *inline_data, const char *filename)
 {
     uint16_t crc16;
 
     crc16 = nffs_crc_disk_inode_hdr(disk_inode);
+    crc16 = crc16_ccitt(crc16, inline_data,
+                        nffs_inode_disk_inline_len(disk_inode));
     crc16 = crc16_ccitt(crc16, filename, disk_inode->ndi_filename_len);
 
     disk_inode->ndi_crc16 = crc16;
@@ -19,9 +19,13 @@
 
 #include <assert.h>
 #include <string.h>
+#include "os/os_malloc.h"
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
 
+/** List of open files that have a write buffer. */
+struct nffs_file_list nffs_wbuf_files = SLIST_HEAD_INITIALIZER(nffs_wbuf_files);
+
 static struct nffs_file *
 nffs_file_alloc(void)
 {
@@ -30,6 +34,7 @@ nffs_file_alloc(void)
     file = os_memblock_get(&nffs_file_pool);
     if (file != NULL) {
         memset(file, 0, sizeof *file);
+        file->nf_direct_area_idx = NFFS_AREA_ID_NONE;
     }
 
     return file;
@@ -59,6 +64,7 @@ nffs_file_free(struct nffs_file *file)
  * @param filename_len          The length of the filename, in characters.
  * @param is_dir                1 if this is a directory; 0 if it is a normal
  *                                  file.
+ * @param flags                 The new inode's NFFS_INODE_F_[...] flags.
  * @param out_inode_entry       On success, this points to the inode
  *                                  corresponding to the new file.
  *
@@ -66,7 +72,7 @@ nffs_file_free(struct nffs_file *file)
  */
 int
 nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
-              uint8_t filename_len, int is_dir,
+              uint8_t filename_len, int is_dir, uint8_t flags,
               struct nffs_inode_entry **out_inode_entry)
 {
     struct nffs_disk_inode disk_inode;
@@ -99,10 +105,11 @@ nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
     } else {
         disk_inode.ndi_parent_id = parent->nie_hash_entry.nhe_id;
     }
+    disk_inode.ndi_flags = ~flags;
     disk_inode.ndi_filename_len = filename_len;
-    nffs_crc_disk_inode_fill(&disk_inode, filename);
+    nffs_crc_disk_inode_fill(&disk_inode, NULL, filename);
 
-    rc = nffs_inode_write_disk(&disk_inode, filename, area_idx, offset);
+    rc = nffs_inode_write_disk(&disk_inode, NULL, filename, area_idx, offset);
     if (rc != 0) {
         goto err;
     }
@@ -150,6 +157,7 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
     struct nffs_inode_entry *parent;
     struct nffs_inode_entry *inode;
     struct nffs_file *file;
+    uint8_t inode_flags;
     int rc;
 
     file = NULL;
@@ -159,7 +167,9 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
         rc = FS_EINVAL;
         goto err;
     }
-    if (access_flags & (FS_ACCESS_APPEND | FS_ACCESS_TRUNCATE) &&
+    if (access_flags &
+            (FS_ACCESS_APPEND | FS_ACCESS_TRUNCATE | FS_ACCESS_BUFFERED |
+             FS_ACCESS_COMPRESS) &&
         !(access_flags & FS_ACCESS_WRITE)) {
 
         rc = FS_EINVAL;
@@ -178,6 +188,15 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
         goto err;
     }
 
+    /* Compression is a property of the file; it only takes effect if this
+     * open creates the file.
+     */
+    if (access_flags & FS_ACCESS_COMPRESS) {
+        inode_flags = NFFS_INODE_F_COMPRESS;
+    } else {
+        inode_flags = 0;
+    }
+
     nffs_path_parser_new(&parser, path);
     rc = nffs_path_find(&parser, &inode, &parent);
     if (rc == FS_ENOENT && parser.npp_token_type == NFFS_PATH_TOKEN_LEAF) {
@@ -195,7 +214,7 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
 
         /* Create a new file at the specified path. */
         rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len, 0,
-                           &file->nf_inode_entry);
+                           inode_flags, &file->nf_inode_entry);
         if (rc != 0) {
             goto err;
         }
@@ -214,7 +233,7 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
              */
             nffs_path_unlink(path);
             rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len,
-                               0, &file->nf_inode_entry);
+                               0, inode_flags, &file->nf_inode_entry);
             if (rc != 0) {
                 goto err;
             }
@@ -240,6 +259,16 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
     file->nf_inode_entry->nie_refcnt++;
     file->nf_access_flags = access_flags;
 
+    /* A write buffer is a best-effort optimization; if there is insufficient
+     * heap for one, the file is simply unbuffered.
+     */
+    if (access_flags & FS_ACCESS_BUFFERED) {
+        file->nf_wbuf = malloc(nffs_block_max_data_sz);
+        if (file->nf_wbuf != NULL) {
+            SLIST_INSERT_HEAD(&nffs_wbuf_files, file, nf_wbuf_next);
+        }
+    }
+
     *out_file = file;
 
     return 0;
@@ -252,7 +281,8 @@ err:
 /**
  * Positions a file's read and write pointer at the specified offset.  The
  * offset is expressed as the number of bytes from the start of the file (i.e.,
- * seeking to 0 places the pointer at the first byte in the file).
+ * seeking to 0 places the pointer at the first byte in the file).  Any data
+ * in the file's write buffer is flushed first.
  *
  * @param file              The file to reposition.
  * @param offset            The offset from the start of the file to seek to.
@@ -265,6 +295,11 @@ nffs_file_seek(struct nffs_file *file, uint32_t offset)
     uint32_t len;
     int rc;
 
+    rc = nffs_write_buf_flush(file);
+    if (rc != 0) {
+        return rc;
+    }
+
     rc = nffs_inode_data_len(file->nf_inode_entry, &len);
     if (rc != 0) {
         return rc;
@@ -306,6 +341,11 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
         return FS_EACCESS;
     }
 
+    rc = nffs_write_buf_flush(file);
+    if (rc != 0) {
+        return rc;
+    }
+
     rc = nffs_inode_read(file->nf_inode_entry, file->nf_offset, len, out_data,
                         &bytes_read);
     if (rc != 0) {
@@ -320,11 +360,107 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
     return 0;
 }
 
+/**
+ * Retrieves a read-only pointer to the data at the current position of the
+ * specified file and advances the position past it.  No data is copied; this
+ * requires memory-mapped flash.  At most one data block's worth of data is
+ * returned per call.
+ *
+ * Garbage collection is free to erase the area holding the returned data
+ * while the caller still uses the pointer.  The handle remembers the area's
+ * erase count so that nffs_file_read_direct_release() can report whether this
+ * happened.
+ *
+ * @param file              The file to read from.
+ * @param len               The maximum number of bytes to retrieve.
+ * @param out_data          On success, a pointer to the data gets written
+ *                              here.
+ * @param out_len           On success, the number of bytes available at the
+ *                              returned pointer gets written here; 0 at end
+ *                              of file.
+ *
+ * @return                  0 on success;
+ *                          FS_EUNSUPP if the flash is not memory mapped;
+ *                          other nonzero on failure.
+ */
+int
+nffs_file_read_direct(struct nffs_file *file, uint32_t len,
+                      const void **out_data, uint32_t *out_len)
+{
+    uint32_t bytes_read;
+    uint8_t area_idx;
+    int rc;
+
+    if (!nffs_misc_ready()) {
+        return FS_EUNINIT;
+    }
+
+    if (!(file->nf_access_flags & FS_ACCESS_READ)) {
+        return FS_EACCESS;
+    }
+
+    nffs_file_read_direct_release(file);
+
+    rc = nffs_write_buf_flush(file);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_inode_read_direct(file->nf_inode_entry, file->nf_offset, len,
+                                out_data, &bytes_read, &area_idx);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (bytes_read > 0) {
+        file->nf_direct_area_idx = area_idx;
+        file->nf_direct_erase_cnt = nffs_areas[area_idx].na_erase_cnt;
+    }
+
+    file->nf_offset += bytes_read;
+    *out_len = bytes_read;
+
+    return 0;
+}
+
+/**
+ * Releases the pointer most recently returned by nffs_file_read_direct() for
+ * the specified file and checks whether the data it referenced survived.
+ * This is a no-op if the file does not hold such a pointer.
+ *
+ * @param file              The file whose pointer to release.
+ *
+ * @return                  0 if the data was intact for as long as the
+ *                              pointer was held;
+ *                          FS_ESTALE if its area was erased in the meantime.
+ */
+int
+nffs_file_read_direct_release(struct nffs_file *file)
+{
+    uint8_t area_idx;
+
+    area_idx = file->nf_direct_area_idx;
+    if (area_idx == NFFS_AREA_ID_NONE) {
+        return 0;
+    }
+
+    file->nf_direct_area_idx = NFFS_AREA_ID_NONE;
+    if (nffs_areas[area_idx].na_erase_cnt != file->nf_direct_erase_cnt) {
+        return FS_ESTALE;
+    }
+
+    return 0;
+}
+
 /**
  * Closes the specified file and invalidates the file handle.  If the file has
  * already been unlinked, and this is the last open handle to the file, this
  * operation causes the file to be deleted.
  *
+ * If the file has a write buffer, its contents are flushed first.  The handle
+ * is invalidated even if the flush fails; in that case the buffered data is
+ * lost and the flush error is returned.
+ *
  * @param file              The file handle to close.
  *
  * @return                  0 on success; nonzero on failure.
@@ -332,8 +468,19 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
 int
 nffs_file_close(struct nffs_file *file)
 {
+    int flush_rc;
     int rc;
 
+    nffs_file_read_direct_release(file);
+
+    flush_rc = 0;
+    if (file->nf_wbuf != NULL) {
+        flush_rc = nffs_write_buf_flush(file);
+        SLIST_REMOVE(&nffs_wbuf_files, file, nffs_file, nf_wbuf_next);
+        free(file->nf_wbuf);
+        file->nf_wbuf = NULL;
+    }
+
     rc = nffs_inode_dec_refcnt(file->nf_inode_entry);
     if (rc != 0) {
         return rc;
@@ -344,5 +491,5 @@ nffs_file_close(struct nffs_file *file)
         return rc;
     }
 
-    return 0;
+    return flush_rc;
 }
@@ -60,6 +60,48 @@ nffs_flash_read(uint8_t area_idx, uint32_t area_offset, void *data,
         return FS_EHW;
     }
 
+    STATS_INC(nffs_stats, flash_reads);
+    STATS_INCN(nffs_stats, flash_read_bytes, len);
+
+    return 0;
+}
+
+/**
+ * Retrieves a pointer through which a chunk of flash can be read directly.
+ * This is only possible if the underlying flash is memory mapped.
+ *
+ * @param area_idx              The index of the area to map.
+ * @param area_offset           The offset within the area to map.
+ * @param len                   The number of bytes to map.
+ * @param out_ptr               On success, a pointer to the flash contents
+ *                                  gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_EOFFSET on an attempt to map an invalid
+ *                                  address range;
+ *                              FS_EUNSUPP if the flash is not memory mapped.
+ */
+int
+nffs_flash_mmap(uint8_t area_idx, uint32_t area_offset, uint32_t len,
+                const void **out_ptr)
+{
+    const struct nffs_area *area;
+    int rc;
+
+    assert(area_idx < nffs_num_areas);
+
+    area = nffs_areas + area_idx;
+
+    if (area_offset + len > area->na_length) {
+        return FS_EOFFSET;
+    }
+
+    rc = hal_flash_mmap(area->na_flash_id, area->na_offset + area_offset, len,
+                        out_ptr);
+    if (rc != 0) {
+        return FS_EUNSUPP;
+    }
+
     return 0;
 }
 
@@ -101,6 +143,9 @@ nffs_flash_write(uint8_t area_idx, uint32_t area_offset, const void *data,
         return FS_EHW;
     }
 
+    STATS_INC(nffs_stats, flash_writes);
+    STATS_INCN(nffs_stats, flash_write_bytes, len);
+
     area->na_cur = area_offset + len;
 
     return 0;
@@ -25,8 +25,8 @@
 
 /**
  * Turns a scratch area into a non-scratch area.  If the specified area is not
- * actually a scratch area, this function falls back to a slower full format
- * operation.
+ * actually a scratch area, or if its header version differs from the area's
+ * na_ver, this function falls back to a slower full format operation.
  */
 int
 nffs_format_from_scratch_area(uint8_t area_idx, uint8_t area_id)
@@ -41,14 +41,19 @@ nffs_format_from_scratch_area(uint8_t area_idx, uint8_t area_id)
     }
 
     nffs_areas[area_idx].na_id = area_id;
-    if (!nffs_area_is_scratch(&disk_area)) {
+
+    if (nffs_area_from_disk(&disk_area, NULL) != 0 ||
+        disk_area.nda_ver != nffs_areas[area_idx].na_ver ||
+        !nffs_area_is_scratch(&disk_area)) {
+
         rc = nffs_format_area(area_idx, 0);
         if (rc != 0) {
             return rc;
         }
     } else {
         disk_area.nda_id = area_id;
-        rc = nffs_flash_write(area_idx, NFFS_AREA_OFFSET_ID,
+        rc = nffs_flash_write(area_idx,
+                              nffs_area_hdr_len(nffs_areas + area_idx) - 1,
                               &disk_area.nda_id, sizeof disk_area.nda_id);
         if (rc != 0) {
             return rc;
@@ -59,7 +64,8 @@ nffs_format_from_scratch_area(uint8_t area_idx, uint8_t area_id)
 }
 
 /**
- * Formats a single scratch area.
+ * Formats a single scratch area.  The header is written in the version
+ * indicated by the area's na_ver.
  */
 int
 nffs_format_area(uint8_t area_idx, int is_scratch)
@@ -70,20 +76,22 @@ nffs_format_area(uint8_t area_idx, int is_scratch)
     int rc;
 
     area = nffs_areas + area_idx;
+    write_len = nffs_area_hdr_len(area);
 
     rc = hal_flash_erase(area->na_flash_id, area->na_offset, area->na_length);
     if (rc != 0) {
         return FS_EHW;
     }
     area->na_cur = 0;
+    area->na_erase_cnt++;
+    STATS_INC(nffs_stats, erases);
+    nffs_area_wear_update();
 
     nffs_area_to_disk(area, &disk_area);
 
     if (is_scratch) {
         nffs_areas[area_idx].na_id = NFFS_AREA_ID_NONE;
-        write_len = sizeof disk_area - sizeof disk_area.nda_id;
-    } else {
-        write_len = sizeof disk_area;
+        write_len--;
     }
 
     rc = nffs_flash_write(area_idx, 0, &disk_area.nda_magic, write_len);
@@ -106,6 +114,7 @@ nffs_format_area(uint8_t area_idx, int is_scratch)
 int
 nffs_format_full(const struct nffs_area_desc *area_descs)
 {
+    struct nffs_disk_area disk_area;
     int rc;
     int i;
 
@@ -138,6 +147,16 @@ nffs_format_full(const struct nffs_area_desc *area_descs)
         nffs_areas[i].na_flash_id = area_descs[i].nad_flash_id;
         nffs_areas[i].na_cur = 0;
         nffs_areas[i].na_gc_seq = 0;
+        nffs_areas[i].na_ver = NFFS_AREA_VER;
+
+        /* Erase counts survive a reformat. */
+        nffs_areas[i].na_erase_cnt = 0;
+        rc = nffs_flash_read(i, 0, &disk_area, sizeof disk_area);
+        if (rc == 0 && nffs_area_magic_is_set(&disk_area) &&
+            nffs_area_from_disk(&disk_area, NULL) == 0) {
+
+            nffs_areas[i].na_erase_cnt = disk_area.nda_erase_cnt;
+        }
 
         if (i == nffs_scratch_area_idx) {
             nffs_areas[i].na_id = NFFS_AREA_ID_NONE;
@@ -157,7 +176,7 @@ nffs_format_full(const struct nffs_area_desc *area_descs)
     }
 
     /* Create root directory. */
-    rc = nffs_file_new(NULL, "", 0, 1, &nffs_root_dir);
+    rc = nffs_file_new(NULL, "", 0, 1, 0, &nffs_root_dir);
     if (rc != 0) {
         goto err;
     }
@@ -23,6 +23,7 @@
 #include "testutil/testutil.h"
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
+#include "hal/hal_cputime.h"
 
 /**
  * Keeps track of the number of garbage collections performed.  The exact
@@ -31,6 +32,23 @@
  */
 unsigned int nffs_gc_count;
 
+/**
+ * Index of the source area of the garbage collection cycle in progress;
+ * NFFS_AREA_ID_NONE if no cycle is in progress.
+ */
+uint8_t nffs_gc_from_area_idx = NFFS_AREA_ID_NONE;
+
+/** The next hash bucket to be processed by the cycle in progress. */
+static int nffs_gc_next_bucket;
+
+/**
+ * Whether the cycle in progress may collate runs of blocks into new blocks.
+ * Incremental cycles only copy blocks: a collated block could be superseded
+ * between increments, and a reset would then resurrect the blocks it replaced
+ * from the source area without any inode referencing them.
+ */
+static int nffs_gc_collate;
+
 static int
 nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
                     uint8_t to_area_idx)
@@ -51,6 +69,7 @@ nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
     }
 
     entry->nhe_flash_loc = nffs_flash_loc(to_area_idx, to_area_offset);
+    STATS_INCN(nffs_stats, gc_bytes, object_size);
 
     return 0;
 }
@@ -66,7 +85,7 @@ nffs_gc_copy_inode(struct nffs_inode_entry *inode_entry, uint8_t to_area_idx)
     if (rc != 0) {
         return rc;
     }
-    copy_len = sizeof (struct nffs_disk_inode) + inode.ni_filename_len;
+    copy_len = nffs_inode_disk_size(&inode);
 
     rc = nffs_gc_copy_object(&inode_entry->nie_hash_entry, copy_len,
                              to_area_idx);
@@ -78,13 +97,19 @@ nffs_gc_copy_inode(struct nffs_inode_entry *inode_entry, uint8_t to_area_idx)
 }
 
 /**
- * Selects the most appropriate area for garbage collection.
+ * Selects the most appropriate area for garbage collection.  Areas are
+ * normally collected in round-robin order.  The collected area is erased and
+ * becomes the next scratch area, so if an area has been erased
+ * NFFS_GC_WEAR_DELTA or more times less than the round-robin choice, it is
+ * collected instead; this evens out wear left behind by reformats and
+ * interrupted cycles.
  *
  * @return                  The ID of the area to garbage collect.
  */
 static uint16_t
 nffs_gc_select_area(void)
 {
+    const struct nffs_area *best;
     const struct nffs_area *area;
     uint8_t best_area_idx;
     int8_t diff;
@@ -97,13 +122,19 @@ nffs_gc_select_area(void)
         }
 
         area = nffs_areas + i;
-        if (area->na_length > nffs_areas[best_area_idx].na_length) {
+        best = nffs_areas + best_area_idx;
+        if (area->na_length > best->na_length) {
             best_area_idx = i;
         } else if (best_area_idx == nffs_scratch_area_idx) {
             best_area_idx = i;
+        } else if (area->na_erase_cnt + NFFS_GC_WEAR_DELTA <=
+                   best->na_erase_cnt) {
+            best_area_idx = i;
+        } else if (best->na_erase_cnt + NFFS_GC_WEAR_DELTA <=
+                   area->na_erase_cnt) {
+            /* Current choice is much less worn; keep it. */
         } else {
-            diff = nffs_areas[i].na_gc_seq -
-                   nffs_areas[best_area_idx].na_gc_seq;
+            diff = area->na_gc_seq - best->na_gc_seq;
             if (diff < 0) {
                 best_area_idx = i;
             }
@@ -136,7 +167,7 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
             return rc;
         }
 
-        copy_len = sizeof (struct nffs_disk_block) + block.nb_data_len;
+        copy_len = sizeof (struct nffs_disk_block) + block.nb_disk_len;
         rc = nffs_gc_copy_object(entry, copy_len, to_area_idx);
         if (rc != 0) {
             return rc;
@@ -166,7 +197,10 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
  *                                  that should be processed.
  *
  * @return                      0 on success;
- *                              FS_ENOMEM if there is insufficient heap;
+ *                              FS_ENOMEM if there is insufficient heap, or if
+ *                                  the collated block would not be smaller
+ *                                  than its constituents (possible only for
+ *                                  compressed files);
  *                              other nonzero on failure.
  */
 static int
@@ -175,15 +209,18 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
                             struct nffs_hash_entry **inout_next)
 {
     struct nffs_disk_block disk_block;
+    struct nffs_hash_entry *first_prev;
     struct nffs_hash_entry *entry;
     struct nffs_area *to_area;
     struct nffs_block last_block;
     struct nffs_block block;
+    struct nffs_inode inode;
+    const void *payload;
     uint32_t to_area_offset;
-    uint32_t from_area_offset;
     uint32_t data_offset;
+    uint32_t disk_len;
     uint8_t *data;
-    uint8_t from_area_idx;
+    int compress;
     int rc;
 
     memset(&last_block, 0, sizeof last_block);
@@ -194,10 +231,13 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
         goto done;
     }
 
-    memset(&last_block, 0, sizeof(last_block));
-    
     to_area = nffs_areas + to_area_idx;
 
+    /* Read the contents of each block in the chain, and tally the disk space
+     * they occupy.
+     */
+    compress = 0;
+    disk_len = 0;
     entry = last_entry;
     data_offset = data_len;
     while (data_offset > 0) {
@@ -207,46 +247,79 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
         }
         data_offset -= block.nb_data_len;
 
-        nffs_flash_loc_expand(block.nb_hash_entry->nhe_flash_loc,
-                              &from_area_idx, &from_area_offset);
-        from_area_offset += sizeof disk_block;
-        rc = nffs_flash_read(from_area_idx, from_area_offset,
-                             data + data_offset, block.nb_data_len);
+        rc = nffs_block_read_data(&block, 0, block.nb_data_len,
+                                  data + data_offset);
         if (rc != 0) {
             goto done;
         }
 
-        if (entry != last_entry) {
-            if (inout_next != NULL && *inout_next == entry) {
-                *inout_next = SLIST_NEXT(entry, nhe_next);
-            }
-            nffs_block_delete_from_ram(entry);
-        } else {
+        disk_len += sizeof disk_block + block.nb_disk_len;
+        if (nffs_block_is_compressed(&block)) {
+            compress = 1;
+        }
+
+        if (entry == last_entry) {
             last_block = block;
         }
         entry = block.nb_prev;
     }
+    first_prev = entry;
     
     /* we had better have found the last block */
     assert(last_block.nb_hash_entry);
 
+    if (!compress) {
+        rc = nffs_inode_from_entry(&inode, last_block.nb_inode_entry);
+        if (rc != 0) {
+            goto done;
+        }
+        compress = inode.ni_flags & NFFS_INODE_F_COMPRESS;
+    }
+
     /* The resulting block should inherit its ID from its last constituent
      * block (this is the ID referenced by the parent inode and subsequent data
      * block).  The previous ID gets inherited from the first constituent
      * block.
      */
     memset(&disk_block, 0, sizeof disk_block);
-    disk_block.ndb_magic = NFFS_BLOCK_MAGIC;
     disk_block.ndb_id = last_block.nb_hash_entry->nhe_id;
     disk_block.ndb_seq = last_block.nb_seq + 1;
     disk_block.ndb_inode_id = last_block.nb_inode_entry->nie_hash_entry.nhe_id;
-    if (entry == NULL) {
+    if (first_prev == NULL) {
         disk_block.ndb_prev_id = NFFS_ID_NONE;
     } else {
-        disk_block.ndb_prev_id = entry->nhe_id;
+        disk_block.ndb_prev_id = first_prev->nhe_id;
+    }
+    nffs_block_encode(&disk_block, data, data_len, compress, data, &payload);
+    nffs_crc_disk_block_fill(&disk_block, payload);
+
+    /* The destination area is only guaranteed to have room for the blocks
+     * being moved.  Compressing the collated data could conceivably produce a
+     * larger block than the compressed constituents; if so, let the caller
+     * copy the blocks individually.
+     */
+    if (sizeof disk_block + disk_block.ndb_data_len > disk_len) {
+        rc = FS_ENOMEM;
+        goto done;
+    }
+
+    /* The constituent blocks other than the last get absorbed into the new
+     * block.
+     */
+    entry = last_block.nb_prev;
+    while (entry != first_prev) {
+        rc = nffs_block_from_hash_entry(&block, entry);
+        if (rc != 0) {
+            goto done;
+        }
+
+        if (inout_next != NULL && *inout_next == entry) {
+            *inout_next = SLIST_NEXT(entry, nhe_next);
+        }
+        nffs_block_delete_from_ram(entry);
+
+        entry = block.nb_prev;
     }
-    disk_block.ndb_data_len = data_len;
-    nffs_crc_disk_block_fill(&disk_block, data);
 
     to_area_offset = to_area->na_cur;
     rc = nffs_flash_write(to_area_idx, to_area_offset,
@@ -256,7 +329,7 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
     }
 
     rc = nffs_flash_write(to_area_idx, to_area_offset + sizeof disk_block,
-                          data, data_len);
+                          payload, disk_block.ndb_data_len);
     if (rc != 0) {
         goto done;
     }
@@ -276,8 +349,8 @@ done:
 /**
  * Moves a chain of blocks from one area to another.  This function attempts to
  * collate the blocks into a single new block in the destination area.  If
- * there is insufficient heap memory do to this, the function falls back to
- * copying each block separately.
+ * there is insufficient heap memory do to this, or if the cycle in progress is
+ * incremental, the function falls back to copying each block separately.
  *
  * @param last_entry            The last block entry in the chain.
  * @param multiple_blocks       0=single block; 1=more than one block.
@@ -301,9 +374,10 @@ nffs_gc_block_chain(struct nffs_hash_entry *last_entry, int multiple_blocks,
 {
     int rc;
 
-    if (!multiple_blocks) {
+    if (!multiple_blocks || !nffs_gc_collate) {
         /* If there is only one block, collation has the same effect as a
-         * simple copy.  Just perform the more efficient copy.
+         * simple copy.  Just perform the more efficient copy.  Incremental
+         * cycles always copy.
          */
         rc = nffs_gc_block_chain_copy(last_entry, data_len, to_area_idx);
     } else {
@@ -397,6 +471,183 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
     return 0;
 }
 
+/**
+ * Begins a garbage collection cycle: selects the source area and converts the
+ * scratch area into the destination area.  Until the cycle is finished, the
+ * source area is excluded from space reservation so that no new objects get
+ * written to it.
+ *
+ * @param collate           1 if runs of blocks may be collated; 0 if the
+ *                              cycle will be interleaved with other writes
+ *                              and blocks must only be copied.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+static int
+nffs_gc_begin(int collate)
+{
+    struct nffs_area *from_area;
+    struct nffs_area *to_area;
+    uint8_t from_area_idx;
+    int rc;
+
+    from_area_idx = nffs_gc_select_area();
+    from_area = nffs_areas + from_area_idx;
+    to_area = nffs_areas + nffs_scratch_area_idx;
+
+    /* Objects from a version 0 area are copied behind a current header,
+     * which is larger.  If they might not fit, the destination keeps the old
+     * format; it gets upgraded by a later cycle.
+     */
+    if (from_area->na_ver == NFFS_AREA_VER_0 &&
+        from_area->na_cur - NFFS_AREA_HDR_SZ_0 >
+        to_area->na_length - sizeof (struct nffs_disk_area)) {
+
+        to_area->na_ver = NFFS_AREA_VER_0;
+    } else {
+        to_area->na_ver = NFFS_AREA_VER;
+    }
+
+    rc = nffs_format_from_scratch_area(nffs_scratch_area_idx,
+                                       nffs_areas[from_area_idx].na_id);
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_gc_from_area_idx = from_area_idx;
+    nffs_gc_next_bucket = 0;
+    nffs_gc_collate = collate;
+
+    return 0;
+}
+
+/**
+ * Copies all objects belonging to a single hash bucket out of the source area
+ * of the garbage collection cycle in progress.
+ *
+ * @param bucket            The index of the hash bucket to process.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+static int
+nffs_gc_bucket(int bucket)
+{
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *next;
+    struct nffs_inode_entry *inode_entry;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    entry = SLIST_FIRST(nffs_hash + bucket);
+    while (entry != NULL) {
+        next = SLIST_NEXT(entry, nhe_next);
+
+        if (nffs_hash_id_is_inode(entry->nhe_id)) {
+            /* The inode gets copied if it is in the source area. */
+            nffs_flash_loc_expand(entry->nhe_flash_loc,
+                                  &area_idx, &area_offset);
+            inode_entry = (struct nffs_inode_entry *)entry;
+            if (area_idx == nffs_gc_from_area_idx) {
+                rc = nffs_gc_copy_inode(inode_entry, nffs_scratch_area_idx);
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+
+            /* If the inode is a file, all constituent data blocks that are
+             * resident in the source area get copied.
+             */
+            if (nffs_hash_id_is_file(entry->nhe_id)) {
+                rc = nffs_gc_inode_blocks(inode_entry, nffs_gc_from_area_idx,
+                                          nffs_scratch_area_idx, &next);
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+        }
+
+        entry = next;
+    }
+
+    return 0;
+}
+
+/**
+ * Completes the garbage collection cycle in progress.  Every hash bucket must
+ * already have been processed.  The source area gets erased and becomes the
+ * new scratch area.
+ *
+ * @param out_area_idx      On success, the index of the destination area gets
+ *                              written here.  Pass null if you do not need
+ *                              this information.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+static int
+nffs_gc_finish(uint8_t *out_area_idx)
+{
+    struct nffs_area *from_area;
+    struct nffs_area *to_area;
+    uint8_t from_area_idx;
+    int rc;
+
+    from_area_idx = nffs_gc_from_area_idx;
+    from_area = nffs_areas + from_area_idx;
+    to_area = nffs_areas + nffs_scratch_area_idx;
+
+    /* The amount of written data should never increase as a result of a gc
+     * cycle.
+     */
+    assert(to_area->na_cur - nffs_area_hdr_len(to_area) <=
+           from_area->na_cur - nffs_area_hdr_len(from_area));
+
+    /* Turn the source area into the new scratch area. */
+    from_area->na_gc_seq++;
+    from_area->na_ver = NFFS_AREA_VER;
+    rc = nffs_format_area(from_area_idx, 1);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (out_area_idx != NULL) {
+        *out_area_idx = nffs_scratch_area_idx;
+    }
+
+    nffs_scratch_area_idx = from_area_idx;
+    nffs_gc_from_area_idx = NFFS_AREA_ID_NONE;
+
+    /* Garbage collection renders the cache invalid:
+     *     o All cached blocks are now invalid; drop them.
+     *     o Flash locations of inodes may have changed; the cached inodes need
+     *       updated to reflect this.
+     */
+    rc = nffs_cache_inode_refresh();
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Increment the garbage collection counter so that client code knows to
+     * reset its pointers to cached objects.
+     */
+    nffs_gc_count++;
+    STATS_INC(nffs_stats, gc_runs);
+
+    return 0;
+}
+
+/**
+ * Indicates whether an incremental garbage collection cycle has been started
+ * but not yet finished.
+ *
+ * @return                  1 if a cycle is in progress; 0 otherwise.
+ */
+int
+nffs_gc_in_progress(void)
+{
+    return nffs_gc_from_area_idx != NFFS_AREA_ID_NONE;
+}
+
 /**
  * Triggers a garbage collection cycle.  This is implemented as follows:
  *
@@ -427,6 +678,10 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
  *      number is incremented prior to rewriting the header.  This area is now
  *      the new scratch sector.
  *
+ * If an incremental cycle (see nffs_gc_step()) is already in progress, this
+ * function completes that cycle rather than starting a new one; the remaining
+ * blocks are copied without being consolidated.
+ *
  * NOTE:
  *     Garbage collection invalidates all cached data blocks.  Whenever this
  *     function is called, all existing nffs_cache_block pointers are rendered
@@ -448,97 +703,193 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
 int
 nffs_gc(uint8_t *out_area_idx)
 {
-    struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *next;
-    struct nffs_area *from_area;
-    struct nffs_area *to_area;
-    struct nffs_inode_entry *inode_entry;
-    uint32_t area_offset;
-    uint8_t from_area_idx;
-    uint8_t area_idx;
+    uint32_t start;
     int rc;
-    int i;
 
-    from_area_idx = nffs_gc_select_area();
-    from_area = nffs_areas + from_area_idx;
-    to_area = nffs_areas + nffs_scratch_area_idx;
+    start = cputime_get32();
 
-    rc = nffs_format_from_scratch_area(nffs_scratch_area_idx,
-                                       from_area->na_id);
-    if (rc != 0) {
-        return rc;
+    if (!nffs_gc_in_progress()) {
+        rc = nffs_gc_begin(1);
+        if (rc != 0) {
+            return rc;
+        }
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        entry = SLIST_FIRST(nffs_hash + i);
-        while (entry != NULL) {
-            next = SLIST_NEXT(entry, nhe_next);
-
-            if (nffs_hash_id_is_inode(entry->nhe_id)) {
-                /* The inode gets copied if it is in the source area. */
-                nffs_flash_loc_expand(entry->nhe_flash_loc,
-                                      &area_idx, &area_offset);
-                inode_entry = (struct nffs_inode_entry *)entry;
-                if (area_idx == from_area_idx) {
-                    rc = nffs_gc_copy_inode(inode_entry,
-                                            nffs_scratch_area_idx);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                }
+    while (nffs_gc_next_bucket < nffs_hash_size) {
+        rc = nffs_gc_bucket(nffs_gc_next_bucket);
+        if (rc != 0) {
+            return rc;
+        }
+        nffs_gc_next_bucket++;
+    }
 
-                /* If the inode is a file, all constituent data blocks that are
-                 * resident in the source area get copied.
-                 */
-                if (nffs_hash_id_is_file(entry->nhe_id)) {
-                    rc = nffs_gc_inode_blocks(inode_entry, from_area_idx,
-                                              nffs_scratch_area_idx, &next);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                }
-            }
+    rc = nffs_gc_finish(out_area_idx);
+    if (rc == 0) {
+        NFFS_STATS_LATENCY(gc, start);
+    }
 
-            entry = next;
+    return rc;
+}
+
+/**
+ * Performs a bounded increment of garbage collection work.  If no cycle is in
+ * progress, a new one is started.  Hash buckets are then processed until at
+ * least the specified number of bytes has been copied into the destination
+ * area, or until every bucket has been processed, in which case the cycle is
+ * finished.
+ *
+ * Between increments, the file system may be freely modified.  Objects written
+ * in the meantime never land in the source area, so they are unaffected by
+ * the eventual erase.  Blocks are copied individually rather than collated,
+ * so every object in the destination area keeps its ID and sequence number.
+ * A system reset between increments is therefore indistinguishable from a
+ * reset in the middle of a regular cycle, and is repaired on the next
+ * restore.
+ *
+ * @param max_bytes         The copy budget for this increment, in bytes.  The
+ *                              budget is checked after each hash bucket, so
+ *                              it may be exceeded by the size of one bucket's
+ *                              objects.
+ * @param out_done          On success, 1 gets written here if the cycle was
+ *                              finished; 0 if more work remains.  Pass null
+ *                              if you do not need this information.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+int
+nffs_gc_step(uint32_t max_bytes, int *out_done)
+{
+    uint32_t start_cur;
+    int rc;
+
+    if (!nffs_gc_in_progress()) {
+        rc = nffs_gc_begin(0);
+        if (rc != 0) {
+            return rc;
         }
     }
 
-    /* The amount of written data should never increase as a result of a gc
-     * cycle.
-     */
-    assert(to_area->na_cur <= from_area->na_cur);
+    start_cur = nffs_areas[nffs_scratch_area_idx].na_cur;
+    while (nffs_gc_next_bucket < nffs_hash_size &&
+           nffs_areas[nffs_scratch_area_idx].na_cur - start_cur < max_bytes) {
 
-    /* Turn the source area into the new scratch area. */
-    from_area->na_gc_seq++;
-    rc = nffs_format_area(from_area_idx, 1);
-    if (rc != 0) {
-        return rc;
+        rc = nffs_gc_bucket(nffs_gc_next_bucket);
+        if (rc != 0) {
+            return rc;
+        }
+        nffs_gc_next_bucket++;
     }
 
-    if (out_area_idx != NULL) {
-        *out_area_idx = nffs_scratch_area_idx;
+    if (nffs_gc_next_bucket >= nffs_hash_size) {
+        rc = nffs_gc_finish(NULL);
+        if (rc != 0) {
+            return rc;
+        }
+        if (out_done != NULL) {
+            *out_done = 1;
+        }
+        return 0;
     }
 
-    nffs_scratch_area_idx = from_area_idx;
-
-    /* Garbage collection renders the cache invalid:
-     *     o All cached blocks are now invalid; drop them.
-     *     o Flash locations of inodes may have changed; the cached inodes need
-     *       updated to reflect this.
+    /* Copied objects have moved to the destination area, and the caller
+     * will release the file system lock before the next increment; drop all
+     * cached blocks now.
      */
     rc = nffs_cache_inode_refresh();
     if (rc != 0) {
         return rc;
     }
 
-    /* Increment the garbage collection counter so that client code knows to
-     * reset its pointers to cached objects.
-     */
-    nffs_gc_count++;
-
+    if (out_done != NULL) {
+        *out_done = 0;
+    }
     return 0;
 }
 
+/**
+ * Calculates the amount of free space available for new objects; i.e., the
+ * free space in all areas other than the scratch area and the source area of
+ * an in-progress garbage collection cycle.
+ */
+uint32_t
+nffs_gc_free_space(void)
+{
+    uint32_t space;
+    int i;
+
+    space = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx && i != nffs_gc_from_area_idx) {
+            space += nffs_area_free_space(nffs_areas + i);
+        }
+    }
+
+    return space;
+}
+
+/**
+ * Performs one increment of background garbage collection.  A new cycle is
+ * only started when free space drops below the configured low-water mark.  If
+ * a full rotation through the areas fails to free any space, no new cycles
+ * are started until the amount of free space changes.
+ *
+ * @return                  1 if more background work remains;
+ *                          0 if the collector is idle.
+ */
+int
+nffs_gc_background(void)
+{
+    /** Free space at the start of the current background cycle. */
+    static uint32_t start_free;
+
+    /** Number of consecutive background cycles that freed nothing. */
+    static uint8_t fruitless_cycles;
+
+    /** Free space when the collector gave up; resume on any change. */
+    static uint32_t idle_free;
+
+    uint32_t free_space;
+    int done;
+    int rc;
+
+    if (!nffs_gc_in_progress()) {
+        free_space = nffs_gc_free_space();
+        if (free_space >= nffs_config.nc_gc_low_water) {
+            fruitless_cycles = 0;
+            return 0;
+        }
+
+        if (fruitless_cycles >= nffs_num_areas - 1) {
+            if (free_space == idle_free) {
+                return 0;
+            }
+            fruitless_cycles = 0;
+        }
+
+        start_free = free_space;
+    }
+
+    rc = nffs_gc_step(nffs_config.nc_gc_step_size, &done);
+    if (rc != 0) {
+        NFFS_LOG(ERROR, "background gc failed; rc=%d\n", rc);
+        return 0;
+    }
+
+    if (!done) {
+        return 1;
+    }
+
+    free_space = nffs_gc_free_space();
+    if (free_space > start_free) {
+        fruitless_cycles = 0;
+    } else {
+        fruitless_cycles++;
+        idle_free = free_space;
+    }
+
+    return free_space < nffs_config.nc_gc_low_water;
+}
+
 /**
  * Repeatedly performs garbage collection cycles until there is enough free
  * space to accommodate an object of the specified size.  If there still isn't
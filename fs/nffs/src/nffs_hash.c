@@ -20,11 +20,35 @@
 #include <stddef.h>
 #include <string.h>
 #include <assert.h>
+#include "os/os_malloc.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
 
 struct nffs_hash_list *nffs_hash;
 
+/**
+ * The table grows by linear hashing: buckets are split one at a time, in
+ * order, each split doubling the range of one bucket.  A round ends when every
+ * bucket present at its start has been split.
+ */
+
+/** Number of buckets in use; nffs_hash_base + nffs_hash_split. */
+uint32_t nffs_hash_size;
+
+/** Number of buckets at the start of the current round; a power of two. */
+static uint32_t nffs_hash_base;
+
+/** Index of the next bucket to split. */
+static uint32_t nffs_hash_split;
+
+/** Number of buckets allocated. */
+static uint32_t nffs_hash_capacity;
+
+static uint32_t nffs_hash_num_entries;
+static uint32_t nffs_hash_num_splits;
+static uint32_t nffs_hash_num_lookups;
+static uint32_t nffs_hash_num_probes;
+
 uint32_t nffs_hash_next_dir_id;
 uint32_t nffs_hash_next_file_id;
 uint32_t nffs_hash_next_block_id;
@@ -53,10 +77,36 @@ nffs_hash_id_is_block(uint32_t id)
     return id >= NFFS_ID_BLOCK_MIN && id < NFFS_ID_BLOCK_MAX;
 }
 
-static int
+/**
+ * Scrambles an object ID so that every bit of the ID affects the low-order
+ * bits used to select a bucket.  This is the MurmurHash3 finalizer.
+ */
+static uint32_t
+nffs_hash_mix(uint32_t id)
+{
+    id ^= id >> 16;
+    id *= 0x85ebca6b;
+    id ^= id >> 13;
+    id *= 0xc2b2ae35;
+    id ^= id >> 16;
+
+    return id;
+}
+
+static uint32_t
 nffs_hash_fn(uint32_t id)
 {
-    return id % NFFS_HASH_SIZE;
+    uint32_t hash;
+    uint32_t idx;
+
+    hash = nffs_hash_mix(id);
+    idx = hash & (nffs_hash_base - 1);
+    if (idx < nffs_hash_split) {
+        /* Bucket already split this round; use one more bit. */
+        idx = hash & (nffs_hash_base * 2 - 1);
+    }
+
+    return idx;
 }
 
 struct nffs_hash_entry *
@@ -65,13 +115,16 @@ nffs_hash_find(uint32_t id)
     struct nffs_hash_entry *entry;
     struct nffs_hash_entry *prev;
     struct nffs_hash_list *list;
-    int idx;
+    uint32_t idx;
 
     idx = nffs_hash_fn(id);
     list = nffs_hash + idx;
 
+    nffs_hash_num_lookups++;
+
     prev = NULL;
     SLIST_FOREACH(entry, list, nhe_next) {
+        nffs_hash_num_probes++;
         if (entry->nhe_id == id) {
             /* Put entry at the front of the list. */
             if (prev != NULL) {
@@ -113,39 +166,179 @@ void
 nffs_hash_insert(struct nffs_hash_entry *entry)
 {
     struct nffs_hash_list *list;
-    int idx;
+    uint32_t idx;
 
     idx = nffs_hash_fn(entry->nhe_id);
     list = nffs_hash + idx;
 
     SLIST_INSERT_HEAD(list, entry, nhe_next);
+    nffs_hash_num_entries++;
 }
 
 void
 nffs_hash_remove(struct nffs_hash_entry *entry)
 {
     struct nffs_hash_list *list;
-    int idx;
+    uint32_t idx;
 
     idx = nffs_hash_fn(entry->nhe_id);
     list = nffs_hash + idx;
 
     SLIST_REMOVE(list, entry, nffs_hash_entry, nhe_next);
+    nffs_hash_num_entries--;
+}
+
+/**
+ * Splits the next bucket in the current round, moving roughly half its
+ * entries into a new bucket at the end of the table.
+ *
+ * @return                      0 on success; FS_ENOMEM if the table could not
+ *                                  be enlarged.
+ */
+static int
+nffs_hash_split_bucket(void)
+{
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *next;
+    struct nffs_hash_list *list;
+    struct nffs_hash_list *grown;
+    uint32_t idx;
+
+    if (nffs_hash_size == nffs_hash_capacity) {
+        grown = realloc(nffs_hash, nffs_hash_base * 2 * sizeof *nffs_hash);
+        if (grown == NULL) {
+            return FS_ENOMEM;
+        }
+        nffs_hash = grown;
+        nffs_hash_capacity = nffs_hash_base * 2;
+    }
+
+    list = nffs_hash + nffs_hash_split;
+    entry = SLIST_FIRST(list);
+    SLIST_INIT(list);
+    SLIST_INIT(nffs_hash + nffs_hash_size);
+
+    nffs_hash_split++;
+    nffs_hash_size++;
+
+    while (entry != NULL) {
+        next = SLIST_NEXT(entry, nhe_next);
+        idx = nffs_hash_fn(entry->nhe_id);
+        SLIST_INSERT_HEAD(nffs_hash + idx, entry, nhe_next);
+        entry = next;
+    }
+
+    if (nffs_hash_split == nffs_hash_base) {
+        nffs_hash_base *= 2;
+        nffs_hash_split = 0;
+    }
+
+    nffs_hash_num_splits++;
+
+    return 0;
+}
+
+/**
+ * Grows the hash table while its average chain length exceeds
+ * nffs_config.nc_hash_max_load.  Splitting rearranges bucket contents, so
+ * this must not be called while the table is being iterated.  It does nothing
+ * while a garbage collection cycle is in progress, since the cycle tracks its
+ * position by bucket index.
+ *
+ * @param max_splits            The maximum number of buckets to split.  This
+ *                                  bounds the work done by a single call.
+ */
+void
+nffs_hash_grow(int max_splits)
+{
+    int i;
+
+    if (nffs_config.nc_hash_max_load == 0 || nffs_gc_in_progress()) {
+        return;
+    }
+
+    for (i = 0; i < max_splits; i++) {
+        if (nffs_hash_num_entries <=
+            nffs_hash_size * nffs_config.nc_hash_max_load) {
+
+            break;
+        }
+
+        if (nffs_hash_split_bucket() != 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * Fills in the hash table statistics.  Chain lengths are measured by walking
+ * the entire table.
+ *
+ * @param out_stats             The statistics get written here.
+ * @param reset                 Whether to zero the lookup counters after
+ *                                  reading them.
+ */
+void
+nffs_hash_read_stats(struct nffs_hash_stats *out_stats, int reset)
+{
+    struct nffs_hash_entry *entry;
+    uint32_t chain;
+    uint32_t i;
+
+    memset(out_stats, 0, sizeof *out_stats);
+
+    for (i = 0; i < nffs_hash_size; i++) {
+        chain = 0;
+        SLIST_FOREACH(entry, nffs_hash + i, nhe_next) {
+            chain++;
+        }
+
+        if (chain == 0) {
+            out_stats->nhs_empty_buckets++;
+        }
+        if (chain > out_stats->nhs_max_chain) {
+            out_stats->nhs_max_chain = chain;
+        }
+    }
+
+    out_stats->nhs_num_buckets = nffs_hash_size;
+    out_stats->nhs_num_entries = nffs_hash_num_entries;
+    out_stats->nhs_splits = nffs_hash_num_splits;
+    out_stats->nhs_lookups = nffs_hash_num_lookups;
+    out_stats->nhs_probes = nffs_hash_num_probes;
+
+    if (reset) {
+        nffs_hash_num_splits = 0;
+        nffs_hash_num_lookups = 0;
+        nffs_hash_num_probes = 0;
+    }
 }
 
 int
 nffs_hash_init(void)
 {
-    int i;
+    uint32_t i;
 
     free(nffs_hash);
 
-    nffs_hash = malloc(NFFS_HASH_SIZE * sizeof *nffs_hash);
+    /* Round the configured bucket count down to a power of two. */
+    nffs_hash_base = 1;
+    while (nffs_hash_base * 2 <= nffs_config.nc_num_hash_buckets) {
+        nffs_hash_base *= 2;
+    }
+    nffs_hash_split = 0;
+    nffs_hash_size = nffs_hash_base;
+    nffs_hash_capacity = nffs_hash_base;
+    nffs_hash_num_entries = 0;
+
+    nffs_hash = malloc(nffs_hash_capacity * sizeof *nffs_hash);
     if (nffs_hash == NULL) {
+        nffs_hash_size = 0;
+        nffs_hash_capacity = 0;
         return FS_ENOMEM;
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         SLIST_INIT(nffs_hash + i);
     }
 
@@ -24,7 +24,7 @@
 #include "os/os_mempool.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 /* Partition the flash buffer into two equal halves; used for filename
  * comparisons.
@@ -87,7 +87,33 @@ nffs_inode_entry_reserve(struct nffs_inode_entry **out_inode_entry)
 uint32_t
 nffs_inode_disk_size(const struct nffs_inode *inode)
 {
-    return sizeof (struct nffs_disk_inode) + inode->ni_filename_len;
+    return sizeof (struct nffs_disk_inode) + inode->ni_inline_len +
+           inode->ni_filename_len;
+}
+
+/**
+ * Indicates whether the specified value is a valid inode magic number, with or
+ * without inline data.
+ */
+int
+nffs_inode_magic_is_set(uint32_t magic)
+{
+    return magic == NFFS_INODE_MAGIC ||
+           (magic & ~0xff) == NFFS_INODE_MAGIC_INLINE;
+}
+
+/**
+ * Retrieves the number of inline data bytes stored with the specified disk
+ * inode.
+ */
+uint8_t
+nffs_inode_disk_inline_len(const struct nffs_disk_inode *disk_inode)
+{
+    if ((disk_inode->ndi_magic & ~0xff) == NFFS_INODE_MAGIC_INLINE) {
+        return disk_inode->ndi_magic & 0xff;
+    } else {
+        return 0;
+    }
 }
 
 int
@@ -101,7 +127,7 @@ nffs_inode_read_disk(uint8_t area_idx, uint32_t offset,
     if (rc != 0) {
         return rc;
     }
-    if (out_disk_inode->ndi_magic != NFFS_INODE_MAGIC) {
+    if (!nffs_inode_magic_is_set(out_disk_inode->ndi_magic)) {
         return FS_EUNEXP;
     }
 
@@ -110,9 +136,11 @@ nffs_inode_read_disk(uint8_t area_idx, uint32_t offset,
 
 int
 nffs_inode_write_disk(const struct nffs_disk_inode *disk_inode,
-                      const char *filename, uint8_t area_idx,
-                      uint32_t area_offset)
+                      const void *inline_data, const char *filename,
+                      uint8_t area_idx, uint32_t area_offset)
 {
+    uint32_t offset;
+    uint8_t inline_len;
     int rc;
 
     rc = nffs_flash_write(area_idx, area_offset, disk_inode,
@@ -120,9 +148,19 @@ nffs_inode_write_disk(const struct nffs_disk_inode *disk_inode,
     if (rc != 0) {
         return rc;
     }
+    offset = area_offset + sizeof *disk_inode;
+
+    inline_len = nffs_inode_disk_inline_len(disk_inode);
+    if (inline_len != 0) {
+        rc = nffs_flash_write(area_idx, offset, inline_data, inline_len);
+        if (rc != 0) {
+            return rc;
+        }
+        offset += inline_len;
+    }
 
     if (disk_inode->ndi_filename_len != 0) {
-        rc = nffs_flash_write(area_idx, area_offset + sizeof *disk_inode,
+        rc = nffs_flash_write(area_idx, offset,
                               filename, disk_inode->ndi_filename_len);
         if (rc != 0) {
             return rc;
@@ -145,6 +183,11 @@ nffs_inode_calc_data_length(struct nffs_inode_entry *inode_entry,
 
     assert(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
 
+    if (nffs_inode_has_inline_data(inode_entry)) {
+        *out_len = inode_entry->nie_inline_len;
+        return 0;
+    }
+
     *out_len = 0;
 
     cur = inode_entry->nie_last_block_entry;
@@ -168,14 +211,16 @@ nffs_inode_data_len(struct nffs_inode_entry *inode_entry, uint32_t *out_len)
     struct nffs_cache_inode *cache_inode;
     int rc;
 
+    nffs_cache_lock();
+
     rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
-    if (rc != 0) {
-        return rc;
+    if (rc == 0) {
+        *out_len = cache_inode->nci_file_size;
     }
 
-    *out_len = cache_inode->nci_file_size;
+    nffs_cache_unlock();
 
-    return 0;
+    return rc;
 }
 
 int
@@ -204,6 +249,8 @@ nffs_inode_from_entry(struct nffs_inode *out_inode,
         out_inode->ni_parent = nffs_hash_find_inode(disk_inode.ndi_parent_id);
     }
     out_inode->ni_filename_len = disk_inode.ndi_filename_len;
+    out_inode->ni_flags = ~disk_inode.ndi_flags;
+    out_inode->ni_inline_len = nffs_inode_disk_inline_len(&disk_inode);
 
     if (out_inode->ni_filename_len > NFFS_SHORT_FILENAME_LEN) {
         cached_name_len = NFFS_SHORT_FILENAME_LEN;
@@ -211,7 +258,9 @@ nffs_inode_from_entry(struct nffs_inode *out_inode,
         cached_name_len = out_inode->ni_filename_len;
     }
     if (cached_name_len != 0) {
-        rc = nffs_flash_read(area_idx, area_offset + sizeof disk_inode,
+        rc = nffs_flash_read(area_idx,
+                             area_offset + sizeof disk_inode +
+                                 out_inode->ni_inline_len,
                              out_inode->ni_filename, cached_name_len);
         if (rc != 0) {
             return rc;
@@ -426,10 +475,11 @@ nffs_inode_delete_from_disk(struct nffs_inode *inode)
     disk_inode.ndi_id = inode->ni_inode_entry->nie_hash_entry.nhe_id;
     disk_inode.ndi_seq = inode->ni_seq;
     disk_inode.ndi_parent_id = NFFS_ID_NONE;
+    disk_inode.ndi_flags = 0xff;
     disk_inode.ndi_filename_len = 0;
-    nffs_crc_disk_inode_fill(&disk_inode, "");
+    nffs_crc_disk_inode_fill(&disk_inode, NULL, "");
 
-    rc = nffs_inode_write_disk(&disk_inode, "", area_idx, offset);
+    rc = nffs_inode_write_disk(&disk_inode, NULL, "", area_idx, offset);
     if (rc != 0) {
         return rc;
     }
@@ -480,16 +530,117 @@ nffs_inode_is_ancestor(struct nffs_inode_entry *anc,
     return 0;
 }
 
+static int
+nffs_inode_read_filename_chunk(const struct nffs_inode *inode,
+                               uint8_t filename_offset, void *buf, int len)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    assert(filename_offset + len <= inode->ni_filename_len);
+
+    nffs_flash_loc_expand(inode->ni_inode_entry->nie_hash_entry.nhe_flash_loc,
+                          &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_inode) + inode->ni_inline_len +
+                   filename_offset;
+
+    rc = nffs_flash_read(area_idx, area_offset, buf, len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a new version of an inode, superseding the current one.  The inode's
+ * parent and flags are written as they appear in the supplied inode.
+ *
+ * @param inode                 The inode to rewrite.  On success, its sequence
+ *                                  number is incremented.
+ * @param filename              The new filename; null to keep the current
+ *                                  one.
+ * @param inline_data           The file contents to store in the inode.
+ * @param inline_len            The length of inline_data; 0 for none.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_inode_write_version(struct nffs_inode *inode, const char *filename,
+                         const void *inline_data, uint8_t inline_len)
+{
+    struct nffs_disk_inode disk_inode;
+    struct nffs_inode_entry *inode_entry;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int filename_len;
+    int rc;
+
+    inode_entry = inode->ni_inode_entry;
+
+    if (filename != NULL) {
+        filename_len = strlen(filename);
+    } else {
+        filename_len = inode->ni_filename_len;
+    }
+
+    rc = nffs_misc_reserve_space(sizeof disk_inode + inline_len + filename_len,
+                                 &area_idx, &area_offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (filename == NULL) {
+        /* Read the current filename only now; reserving space may have
+         * triggered garbage collection, which moves the inode and uses the
+         * flash buffer.
+         */
+        rc = nffs_inode_read_filename_chunk(inode, 0, nffs_flash_buf,
+                                            filename_len);
+        if (rc != 0) {
+            return rc;
+        }
+        filename = (char *)nffs_flash_buf;
+    }
+
+    if (inline_len != 0) {
+        disk_inode.ndi_magic = NFFS_INODE_MAGIC_INLINE | inline_len;
+    } else {
+        disk_inode.ndi_magic = NFFS_INODE_MAGIC;
+    }
+    disk_inode.ndi_id = inode_entry->nie_hash_entry.nhe_id;
+    disk_inode.ndi_seq = inode->ni_seq + 1;
+    disk_inode.ndi_parent_id = nffs_inode_parent_id(inode);
+    disk_inode.ndi_flags = ~inode->ni_flags;
+    disk_inode.ndi_filename_len = filename_len;
+    nffs_crc_disk_inode_fill(&disk_inode, inline_data, filename);
+
+    rc = nffs_inode_write_disk(&disk_inode, inline_data, filename, area_idx,
+                               area_offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    inode_entry->nie_hash_entry.nhe_flash_loc =
+        nffs_flash_loc(area_idx, area_offset);
+    inode_entry->nie_inline_len = inline_len;
+
+    inode->ni_seq++;
+    inode->ni_filename_len = filename_len;
+    inode->ni_inline_len = inline_len;
+
+    return 0;
+}
+
 int
 nffs_inode_rename(struct nffs_inode_entry *inode_entry,
                   struct nffs_inode_entry *new_parent,
                   const char *new_filename)
 {
-    struct nffs_disk_inode disk_inode;
+    uint8_t inline_data[NFFS_INODE_INLINE_MAX];
     struct nffs_inode inode;
-    uint32_t area_offset;
-    uint8_t area_idx;
-    int filename_len;
+    uint8_t inline_len;
     int ancestor;
     int rc;
 
@@ -520,67 +671,89 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
         inode.ni_parent = new_parent;
     }
 
-    if (new_filename != NULL) {
-        filename_len = strlen(new_filename);
-    } else {
-        filename_len = inode.ni_filename_len;
-        nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
-                              &area_idx, &area_offset);
-        rc = nffs_flash_read(area_idx,
-                             area_offset + sizeof (struct nffs_disk_inode),
-                             nffs_flash_buf, filename_len);
+    /* A file without data blocks carries its contents over to the new
+     * version of its inode.
+     */
+    inline_len = 0;
+    if (nffs_inode_has_inline_data(inode_entry)) {
+        inline_len = inode_entry->nie_inline_len;
+        rc = nffs_inode_read_inline(inode_entry, 0, inline_len, inline_data);
         if (rc != 0) {
             return rc;
         }
-
-        new_filename = (char *)nffs_flash_buf;
-    }
-
-    rc = nffs_misc_reserve_space(sizeof disk_inode + filename_len,
-                                 &area_idx, &area_offset);
-    if (rc != 0) {
-        return rc;
-    }
-
-    disk_inode.ndi_magic = NFFS_INODE_MAGIC;
-    disk_inode.ndi_id = inode_entry->nie_hash_entry.nhe_id;
-    disk_inode.ndi_seq = inode.ni_seq + 1;
-    disk_inode.ndi_parent_id = nffs_inode_parent_id(&inode);
-    disk_inode.ndi_filename_len = filename_len;
-    nffs_crc_disk_inode_fill(&disk_inode, new_filename);
-
-    rc = nffs_inode_write_disk(&disk_inode, new_filename, area_idx,
-                               area_offset);
-    if (rc != 0) {
-        return rc;
     }
 
-    inode_entry->nie_hash_entry.nhe_flash_loc =
-        nffs_flash_loc(area_idx, area_offset);
+    return nffs_inode_write_version(&inode, new_filename, inline_data,
+                                    inline_len);
+}
 
-    return 0;
+/**
+ * Indicates whether a file's contents are stored in its inode.  This is the
+ * case if the inode carries inline data and the file has no data blocks.
+ */
+int
+nffs_inode_has_inline_data(const struct nffs_inode_entry *inode_entry)
+{
+    return nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id) &&
+           inode_entry->nie_last_block_entry == NULL &&
+           inode_entry->nie_inline_len > 0;
 }
 
-static int
-nffs_inode_read_filename_chunk(const struct nffs_inode *inode,
-                               uint8_t filename_offset, void *buf, int len)
+/**
+ * Reads file contents stored inline in the specified inode.  This is a
+ * single flash read.
+ *
+ * @param inode_entry           The file inode to read from.
+ * @param offset                The file offset to start reading at.
+ * @param len                   The number of bytes to read.
+ * @param dst                   The destination buffer.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_inode_read_inline(const struct nffs_inode_entry *inode_entry,
+                       uint32_t offset, uint32_t len, void *dst)
 {
     uint32_t area_offset;
     uint8_t area_idx;
-    int rc;
 
-    assert(filename_offset + len <= inode->ni_filename_len);
+    assert(offset + len <= inode_entry->nie_inline_len);
 
-    nffs_flash_loc_expand(inode->ni_inode_entry->nie_hash_entry.nhe_flash_loc,
+    nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
                           &area_idx, &area_offset);
-    area_offset += sizeof (struct nffs_disk_inode) + filename_offset;
+    area_offset += sizeof (struct nffs_disk_inode) + offset;
 
-    rc = nffs_flash_read(area_idx, area_offset, buf, len);
+    return nffs_flash_read(area_idx, area_offset, dst, len);
+}
+
+/**
+ * Replaces the contents of a file that has no data blocks by writing a new
+ * version of its inode.
+ *
+ * @param inode_entry           The file inode to rewrite.
+ * @param data                  The file's new contents.
+ * @param len                   The length of the new contents; at most
+ *                                  NFFS_INODE_INLINE_MAX.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_inode_write_inline(struct nffs_inode_entry *inode_entry,
+                        const void *data, uint8_t len)
+{
+    struct nffs_inode inode;
+    int rc;
+
+    assert(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
+    assert(inode_entry->nie_last_block_entry == NULL);
+    assert(len <= NFFS_INODE_INLINE_MAX);
+
+    rc = nffs_inode_from_entry(&inode, inode_entry);
     if (rc != 0) {
         return rc;
     }
 
-    return 0;
+    return nffs_inode_write_version(&inode, NULL, data, len);
 }
 
 /**
@@ -607,7 +780,9 @@ nffs_inode_read_filename(struct nffs_inode_entry *inode_entry, size_t max_len,
     int read_len;
     int rc;
 
+    nffs_cache_lock();
     rc = nffs_inode_from_entry(&inode, inode_entry);
+    nffs_cache_unlock();
     if (rc != 0) {
         return rc;
     }
@@ -872,7 +1047,10 @@ nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
 }
 
 /**
- * Reads data from the specified file inode.
+ * Reads data from the specified file inode.  A read that begins at the start
+ * of the file or where the previous read of the inode ended is considered
+ * sequential; block cache misses during such a read prefetch the following
+ * blocks (see nffs_cache_seek()).
  *
  * @param inode_entry           The inode to read from.
  * @param offset                The offset within the file to start the read
@@ -890,6 +1068,8 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
 {
     struct nffs_cache_inode *cache_inode;
     struct nffs_cache_block *cache_block;
+    struct nffs_block block;
+    uint32_t cache_gen;
     uint32_t block_end;
     uint32_t dst_off;
     uint32_t src_off;
@@ -906,8 +1086,11 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
         return 0;
     }
 
+    nffs_cache_lock();
+
     rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
     if (rc != 0) {
+        nffs_cache_unlock();
         return rc;
     }
 
@@ -916,6 +1099,22 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
         src_end = cache_inode->nci_file_size;
     }
 
+    if (nffs_inode_has_inline_data(inode_entry)) {
+        /* The entire file is stored in the inode; no blocks to cache. */
+        rc = nffs_inode_read_inline(inode_entry, offset, src_end - offset,
+                                    out_data);
+        nffs_cache_unlock();
+
+        if (rc == 0 && out_len != NULL) {
+            *out_len = src_end - offset;
+        }
+        return rc;
+    }
+
+    if (offset == 0 || offset == cache_inode->nci_read_end) {
+        cache_inode->nci_read_ahead = nffs_cache_read_ahead;
+    }
+
     /* Initialize variables for the first iteration. */
     dst_off = src_end - offset;
     src_off = src_end;
@@ -929,7 +1128,7 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
         if (cache_block == NULL) {
             rc = nffs_cache_seek(cache_inode, src_off - 1, &cache_block);
             if (rc != 0) {
-                return rc;
+                goto done;
             }
         }
 
@@ -949,20 +1148,154 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
         dst_off -= chunk_sz;
         src_off -= chunk_sz;
 
-        rc = nffs_block_read_data(&cache_block->ncb_block, block_off, chunk_sz,
-                                  dptr + dst_off);
+        /* Release the cache while reading from flash so that concurrent
+         * readers can proceed.  The block itself cannot change while the file
+         * system is locked for reading, so a copy of its descriptor remains
+         * valid.
+         */
+        block = cache_block->ncb_block;
+        cache_gen = nffs_cache_gen;
+        nffs_cache_unlock();
+
+        rc = nffs_block_read_data(&block, block_off, chunk_sz, dptr + dst_off);
+
+        nffs_cache_lock();
+        if (nffs_cache_gen != cache_gen) {
+            /* Another reader discarded cache entries; reacquire ours. */
+            cache_block = NULL;
+            if (rc == 0) {
+                rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
+            }
+            if (rc != 0) {
+                nffs_cache_unlock();
+                return rc;
+            }
+        }
         if (rc != 0) {
-            return rc;
+            goto done;
         }
 
-        cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list, ncb_link);
+        if (cache_block != NULL) {
+            cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list,
+                                     ncb_link);
+        }
     }
 
+    cache_inode->nci_read_end = src_end;
     if (out_len != NULL) {
         *out_len = src_end - offset;
     }
 
-    return 0;
+    rc = 0;
+
+done:
+    cache_inode->nci_read_ahead = 0;
+    nffs_cache_unlock();
+    return rc;
+}
+
+/**
+ * Retrieves a pointer to file data directly in flash, without copying.  The
+ * returned region never extends past the end of the data block containing
+ * the start offset, so fewer than the requested number of bytes may be
+ * returned even if the file contains more data.
+ *
+ * @param inode_entry           The inode to read from.
+ * @param offset                The offset within the file to start the read
+ *                                  at.
+ * @param len                   The maximum number of bytes to retrieve.
+ * @param out_data              On success, a pointer to the file data gets
+ *                                  written here.
+ * @param out_len               On success, the number of bytes available at
+ *                                  the returned pointer gets written here; 0
+ *                                  at end of file.
+ * @param out_area_idx          On success, the index of the area containing
+ *                                  the returned data gets written here.  Not
+ *                                  written at end of file.
+ *
+ * @return                      0 on success;
+ *                              FS_EUNSUPP if the flash is not memory mapped;
+ *                              other nonzero on failure.
+ */
+int
+nffs_inode_read_direct(struct nffs_inode_entry *inode_entry, uint32_t offset,
+                       uint32_t len, const void **out_data, uint32_t *out_len,
+                       uint8_t *out_area_idx)
+{
+    struct nffs_cache_inode *cache_inode;
+    struct nffs_cache_block *cache_block;
+    uint32_t area_offset;
+    uint32_t chunk_sz;
+    uint16_t block_off;
+    uint8_t area_idx;
+    int rc;
+
+    nffs_cache_lock();
+
+    rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
+    if (rc != 0) {
+        nffs_cache_unlock();
+        return rc;
+    }
+
+    if (len == 0 || offset >= cache_inode->nci_file_size) {
+        nffs_cache_unlock();
+        *out_data = NULL;
+        *out_len = 0;
+        return 0;
+    }
+
+    if (nffs_inode_has_inline_data(inode_entry)) {
+        chunk_sz = cache_inode->nci_file_size - offset;
+        if (chunk_sz > len) {
+            chunk_sz = len;
+        }
+
+        nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
+                              &area_idx, &area_offset);
+        rc = nffs_flash_mmap(area_idx,
+                             area_offset + sizeof (struct nffs_disk_inode) +
+                                 offset,
+                             chunk_sz, out_data);
+        nffs_cache_unlock();
+
+        if (rc == 0) {
+            *out_len = chunk_sz;
+            *out_area_idx = area_idx;
+        }
+        return rc;
+    }
+
+    if (offset == 0 || offset == cache_inode->nci_read_end) {
+        cache_inode->nci_read_ahead = nffs_cache_read_ahead;
+    }
+
+    rc = nffs_cache_seek(cache_inode, offset, &cache_block);
+    if (rc != 0) {
+        goto done;
+    }
+
+    block_off = offset - cache_block->ncb_file_offset;
+    chunk_sz = cache_block->ncb_block.nb_data_len - block_off;
+    if (chunk_sz > len) {
+        chunk_sz = len;
+    }
+
+    rc = nffs_block_mmap_data(&cache_block->ncb_block, block_off, chunk_sz,
+                              out_data);
+    if (rc != 0) {
+        goto done;
+    }
+
+    nffs_flash_loc_expand(cache_block->ncb_block.nb_hash_entry->nhe_flash_loc,
+                          out_area_idx, &area_offset);
+    cache_inode->nci_read_end = offset + chunk_sz;
+    *out_len = chunk_sz;
+
+done:
+    cache_inode->nci_read_ahead = 0;
+    nffs_cache_unlock();
+    return rc;
 }
 
 static int
@@ -21,7 +21,7 @@
 #include "os/os_malloc.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 /**
  * Determines if the file system contains a valid root directory.  For the root
@@ -208,9 +208,12 @@ nffs_misc_reserve_space(uint16_t space,
     int rc;
     int i;
 
-    /* Find the first area with sufficient free space. */
+    /* Find the first area with sufficient free space.  The source area of an
+     * in-progress garbage collection cycle is about to be erased, so it is
+     * not a candidate.
+     */
     for (i = 0; i < nffs_num_areas; i++) {
-        if (i != nffs_scratch_area_idx) {
+        if (i != nffs_scratch_area_idx && i != nffs_gc_from_area_idx) {
             rc = nffs_misc_reserve_space_area(i, space, out_area_offset);
             if (rc == 0) {
                 *out_area_idx = i;
@@ -355,9 +358,21 @@ nffs_misc_create_lost_found_dir(void)
 int
 nffs_misc_reset(void)
 {
+    struct nffs_file *file;
     int rc;
 
     nffs_cache_clear();
+    nffs_block_zbuf_clear();
+
+    /* Release the write buffers of any files that are still open; their
+     * contents are discarded along with the rest of the file system state.
+     */
+    while ((file = SLIST_FIRST(&nffs_wbuf_files)) != NULL) {
+        SLIST_REMOVE_HEAD(&nffs_wbuf_files, nf_wbuf_next);
+        free(file->nf_wbuf);
+        file->nf_wbuf = NULL;
+        file->nf_wbuf_len = 0;
+    }
 
     rc = os_mempool_init(&nffs_file_pool, nffs_config.nc_num_files,
                          sizeof (struct nffs_file), nffs_file_mem,
@@ -416,6 +431,7 @@ nffs_misc_reset(void)
     nffs_root_dir = NULL;
     nffs_lost_found_dir = NULL;
     nffs_scratch_area_idx = NFFS_AREA_ID_NONE;
+    nffs_gc_from_area_idx = NFFS_AREA_ID_NONE;
 
     nffs_hash_next_file_id = NFFS_ID_FILE_MIN;
     nffs_hash_next_dir_id = NFFS_ID_DIR_MIN;
@@ -326,7 +326,7 @@ nffs_path_new_dir(const char *path, struct nffs_inode_entry **out_inode_entry)
         return FS_ENOENT;
     }
 
-    rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len, 1, 
+    rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len, 1, 0,
                        &inode_entry);
     if (rc != 0) {
         return rc;
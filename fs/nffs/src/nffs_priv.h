@@ -22,12 +22,14 @@
 
 #include <inttypes.h>
 #include "log/log.h"
+#include "stats/stats.h"
 #include "os/queue.h"
 #include "os/os_mempool.h"
+#include "os/os_mutex.h"
+#include "os/os_time.h"
 #include "nffs/nffs.h"
 #include "fs/fs.h"
 
-#define NFFS_HASH_SIZE               256
 
 #define NFFS_ID_DIR_MIN              0
 #define NFFS_ID_DIR_MAX              0x10000000
@@ -44,23 +46,67 @@
 #define NFFS_AREA_MAGIC2             0xace08253
 #define NFFS_AREA_MAGIC3             0xb185fc8e
 #define NFFS_BLOCK_MAGIC             0x53ba23b9
+#define NFFS_BLOCK_MAGIC_COMPRESSED  0x53ba23ba
 #define NFFS_INODE_MAGIC             0x925f8bc0
+#define NFFS_INODE_MAGIC_INLINE      0x925f8a00
 
 #define NFFS_AREA_ID_NONE            0xff
-#define NFFS_AREA_VER                0
-#define NFFS_AREA_OFFSET_ID          23
+#define NFFS_AREA_VER                1
+#define NFFS_AREA_OFFSET_ID          31
+
+/**
+ * Version 0 area headers predate the erase count.  They are 24 bytes long,
+ * with the area ID in the last byte.  Such areas are still readable; they are
+ * rewritten in the current format the next time they are erased.
+ */
+#define NFFS_AREA_VER_0              0
+#define NFFS_AREA_OFFSET_ID_0        23
+#define NFFS_AREA_HDR_SZ_0           24
 
 #define NFFS_SHORT_FILENAME_LEN      3
 
 #define NFFS_BLOCK_MAX_DATA_SZ_MAX   2048
 
-/** On-disk representation of an area header. */
+#define NFFS_CACHE_READ_AHEAD_MAX    8
+
+/**
+ * Difference in erase counts at which garbage collection abandons
+ * round-robin order in favor of the less worn area.
+ */
+#define NFFS_GC_WEAR_DELTA           8
+
+/**
+ * The inode of a small file may hold the file's contents, stored between the
+ * inode header and the filename.  Such an inode's magic number is
+ * NFFS_INODE_MAGIC_INLINE with the data length in its low byte.  Inline data
+ * is only meaningful while the file has no data blocks.
+ */
+#define NFFS_INODE_INLINE_MAX        64
+
+/**
+ * Inode flags.  These are stored inverted on disk (ndi_flags) so that an
+ * erased flags byte means "no flags".
+ */
+#define NFFS_INODE_F_COMPRESS        0x01   /* Compress new data blocks. */
+
+/**
+ * A compressed data block (NFFS_BLOCK_MAGIC_COMPRESSED) begins with its
+ * uncompressed length, followed by the compressed stream.
+ */
+#define NFFS_BLOCK_COMPRESSED_HDR_SZ 2
+
+/**
+ * On-disk representation of an area header.  The version and GC sequence
+ * number keep their version 0 offsets; the ID must remain the last field.
+ */
 struct nffs_disk_area {
     uint32_t nda_magic[4];  /* NFFS_AREA_MAGIC{0,1,2,3} */
     uint32_t nda_length;    /* Total size of area, in bytes. */
-    uint8_t nda_ver;        /* Current nffs version: 0 */
+    uint8_t nda_ver;        /* Current nffs version: 1 */
     uint8_t nda_gc_seq;     /* Garbage collection count. */
-    uint8_t reserved8;
+    uint16_t reserved16;
+    uint32_t nda_erase_cnt; /* Number of times the area has been erased. */
+    uint8_t reserved8[3];
     uint8_t nda_id;         /* 0xff if scratch area. */
 };
 
@@ -71,7 +117,7 @@ struct nffs_disk_inode {
     uint32_t ndi_seq;           /* Sequence number; greater supersedes
                                    lesser. */
     uint32_t ndi_parent_id;     /* Object ID of parent directory inode. */
-    uint8_t reserved8;
+    uint8_t ndi_flags;          /* Inverted NFFS_INODE_F_[...] flags. */
     uint8_t ndi_filename_len;   /* Length of filename, in bytes. */
     uint16_t ndi_crc16;         /* Covers rest of header and filename. */
     /* Followed by filename. */
@@ -87,7 +133,8 @@ struct nffs_disk_block {
     uint32_t ndb_inode_id;  /* Object ID of owning inode. */
     uint32_t ndb_prev_id;   /* Object ID of previous block in file;
                                NFFS_ID_NONE if this is the first block. */
-    uint16_t ndb_data_len;  /* Length of data contents, in bytes. */
+    uint16_t ndb_data_len;  /* Length of data contents, in bytes (as stored;
+                               i.e., compressed if the block is). */
     uint16_t ndb_crc16;     /* Covers rest of header and data. */
     /* Followed by 'ndb_data_len' bytes of data. */
 };
@@ -117,6 +164,7 @@ struct nffs_inode_entry {
         struct nffs_hash_entry *nie_last_block_entry;    /* If file */
     };
     uint8_t nie_refcnt;
+    uint8_t nie_inline_len;     /* # of data bytes stored in the inode. */
 };
 
 /** Full inode representation; not stored permanently RAM. */
@@ -127,6 +175,8 @@ struct nffs_inode {
     struct nffs_inode_entry *ni_parent;      /* Points to parent directory. */
     uint8_t ni_filename_len;                 /* # chars in filename. */
     uint8_t ni_filename[NFFS_SHORT_FILENAME_LEN]; /* First 3 bytes. */
+    uint8_t ni_flags;                        /* NFFS_INODE_F_[...] */
+    uint8_t ni_inline_len;                   /* # of inline data bytes. */
 };
 
 /** Full data block representation; not stored permanently RAM. */
@@ -137,22 +187,39 @@ struct nffs_block {
     struct nffs_inode_entry *nb_inode_entry; /* Owning inode. */
     struct nffs_hash_entry *nb_prev;         /* Previous block in file. */
     uint16_t nb_data_len;                    /* # of data bytes in block. */
-    uint16_t reserved16;
+    uint16_t nb_disk_len;                    /* # of bytes stored on disk;
+                                                less than nb_data_len iff
+                                                block is compressed. */
 };
 
 struct nffs_file {
     struct nffs_inode_entry *nf_inode_entry;
     uint32_t nf_offset;
     uint8_t nf_access_flags;
+
+    /* Direct read in progress; see nffs_file_read_direct(). */
+    uint8_t nf_direct_area_idx;             /* Area of data, or none. */
+    uint32_t nf_direct_erase_cnt;           /* Area erase count at read. */
+
+    /* Write-back buffer; only used if opened with FS_ACCESS_BUFFERED. */
+    SLIST_ENTRY(nffs_file) nf_wbuf_next;    /* List of buffered files. */
+    uint8_t *nf_wbuf;                       /* Null if unbuffered. */
+    uint32_t nf_wbuf_off;                   /* File offset of buffer start. */
+    os_time_t nf_wbuf_time;                 /* When first byte was buffered. */
+    uint16_t nf_wbuf_len;                   /* # of bytes buffered. */
 };
 
+SLIST_HEAD(nffs_file_list, nffs_file);
+
 struct nffs_area {
     uint32_t na_offset;
     uint32_t na_length;
     uint32_t na_cur;
+    uint32_t na_erase_cnt;
     uint16_t na_id;
     uint8_t na_gc_seq;
     uint8_t na_flash_id;
+    uint8_t na_ver;
 };
 
 struct nffs_disk_object {
@@ -191,6 +258,7 @@ struct nffs_cache_block {
     TAILQ_ENTRY(nffs_cache_block) ncb_link; /* Next / prev cached block. */
     struct nffs_block ncb_block;            /* Full data block. */
     uint32_t ncb_file_offset;               /* File offset of this block. */
+    uint8_t ncb_prefetched;                 /* Read ahead; not yet used. */
 };
 
 TAILQ_HEAD(nffs_cache_block_list, nffs_cache_block);
@@ -201,6 +269,8 @@ struct nffs_cache_inode {
     struct nffs_inode nci_inode;                   /* Full inode. */
     struct nffs_cache_block_list nci_block_list;   /* List of cached blocks. */
     uint32_t nci_file_size;                        /* Total file size. */
+    uint32_t nci_read_end;                         /* End of last read. */
+    uint8_t nci_read_ahead;                        /* # blocks to prefetch. */
 };
 
 struct nffs_dirent {
@@ -224,6 +294,12 @@ extern struct os_mempool nffs_inode_entry_pool;
 extern struct os_mempool nffs_block_entry_pool;
 extern struct os_mempool nffs_cache_inode_pool;
 extern struct os_mempool nffs_cache_block_pool;
+extern uint32_t nffs_cache_block_budget;
+extern uint8_t nffs_cache_read_ahead;
+extern struct nffs_cache_stats nffs_cache_stats;
+extern struct os_mutex nffs_cache_mutex;
+extern uint32_t nffs_cache_gen;
+extern struct nffs_compress_stats nffs_compress_stats;
 extern uint32_t nffs_hash_next_file_id;
 extern uint32_t nffs_hash_next_dir_id;
 extern uint32_t nffs_hash_next_block_id;
@@ -232,22 +308,71 @@ extern uint8_t nffs_num_areas;
 extern uint8_t nffs_scratch_area_idx;
 extern uint16_t nffs_block_max_data_sz;
 extern unsigned int nffs_gc_count;
+extern uint8_t nffs_gc_from_area_idx;
 
 #define NFFS_FLASH_BUF_SZ        256
 extern uint8_t nffs_flash_buf[NFFS_FLASH_BUF_SZ];
 
 extern struct nffs_hash_list *nffs_hash;
+extern uint32_t nffs_hash_size;
 extern struct nffs_inode_entry *nffs_root_dir;
 extern struct nffs_inode_entry *nffs_lost_found_dir;
+extern struct nffs_file_list nffs_wbuf_files;
 
 extern struct log nffs_log;
 
+/**
+ * A latency histogram is a run of NFFS_STATS_HIST_BUCKETS counters.  Bucket
+ * n counts operations that took less than 16 * 4^n microseconds; the last
+ * bucket counts everything slower.
+ */
+#define NFFS_STATS_HIST_BUCKETS     8
+#define NFFS_STATS_HIST_ENTRIES(op)         \
+    STATS_SECT_ENTRY(op ## _us16)           \
+    STATS_SECT_ENTRY(op ## _us64)           \
+    STATS_SECT_ENTRY(op ## _us256)          \
+    STATS_SECT_ENTRY(op ## _ms1)            \
+    STATS_SECT_ENTRY(op ## _ms4)            \
+    STATS_SECT_ENTRY(op ## _ms16)           \
+    STATS_SECT_ENTRY(op ## _ms64)           \
+    STATS_SECT_ENTRY(op ## _slow)
+
+STATS_SECT_START(nffs_stats)
+    STATS_SECT_ENTRY(erases)        /* Area erases since boot. */
+    STATS_SECT_ENTRY(erase_min)     /* Lowest lifetime area erase count. */
+    STATS_SECT_ENTRY(erase_max)     /* Highest lifetime area erase count. */
+    STATS_SECT_ENTRY(erase_avg)     /* Mean lifetime area erase count. */
+    STATS_SECT_ENTRY(flash_reads)
+    STATS_SECT_ENTRY(flash_read_bytes)
+    STATS_SECT_ENTRY(flash_writes)
+    STATS_SECT_ENTRY(flash_write_bytes)
+    STATS_SECT_ENTRY(cache_hits)
+    STATS_SECT_ENTRY(cache_misses)
+    STATS_SECT_ENTRY(gc_runs)       /* Completed garbage collection cycles. */
+    STATS_SECT_ENTRY(gc_bytes)      /* Bytes copied by garbage collection. */
+    STATS_SECT_ENTRY(restores)
+    STATS_SECT_ENTRY(restore_ms)    /* Duration of the last restore. */
+    NFFS_STATS_HIST_ENTRIES(open)
+    NFFS_STATS_HIST_ENTRIES(read)
+    NFFS_STATS_HIST_ENTRIES(write)
+    NFFS_STATS_HIST_ENTRIES(gc)
+STATS_SECT_END
+extern STATS_SECT_DECL(nffs_stats) nffs_stats;
+
+/** Records the latency of an operation that started at cputime "start". */
+#define NFFS_STATS_LATENCY(op, start)                                       \
+    nffs_stats_latency(&nffs_stats.STATS_SECT_VAR(op ## _us16), (start))
+
 /* @area */
 int nffs_area_magic_is_set(const struct nffs_disk_area *disk_area);
 int nffs_area_is_scratch(const struct nffs_disk_area *disk_area);
+int nffs_area_from_disk(struct nffs_disk_area *disk_area,
+                        uint32_t *out_hdr_len);
 void nffs_area_to_disk(const struct nffs_area *area,
                        struct nffs_disk_area *out_disk_area);
+uint32_t nffs_area_hdr_len(const struct nffs_area *area);
 uint32_t nffs_area_free_space(const struct nffs_area *area);
+void nffs_area_wear_update(void);
 int nffs_area_find_corrupt_scratch(uint16_t *out_good_idx,
                                    uint16_t *out_bad_idx);
 
@@ -275,6 +400,14 @@ int nffs_block_from_hash_entry(struct nffs_block *out_block,
                                struct nffs_hash_entry *entry);
 int nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
                          uint16_t length, void *dst);
+int nffs_block_mmap_data(const struct nffs_block *block, uint16_t offset,
+                         uint16_t length, const void **out_ptr);
+int nffs_block_is_compressed(const struct nffs_block *block);
+uint8_t *nffs_block_zbuf_stage(void);
+void nffs_block_encode(struct nffs_disk_block *disk_block, const void *data,
+                       uint16_t data_len, int compress, void *dst,
+                       const void **out_payload);
+void nffs_block_zbuf_clear(void);
 
 /* @cache */
 void nffs_cache_inode_delete(const struct nffs_inode_entry *inode_entry);
@@ -286,6 +419,9 @@ void nffs_cache_inode_range(const struct nffs_cache_inode *cache_inode,
 int nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t to,
                     struct nffs_cache_block **out_cache_block);
 void nffs_cache_clear(void);
+int nffs_cache_set_block_budget(uint32_t num_blocks);
+void nffs_cache_lock(void);
+void nffs_cache_unlock(void);
 
 /* @crc */
 int nffs_crc_flash(uint16_t initial_crc, uint8_t area_idx,
@@ -298,7 +434,12 @@ void nffs_crc_disk_block_fill(struct nffs_disk_block *disk_block,
 int nffs_crc_disk_inode_validate(const struct nffs_disk_inode *disk_inode,
                                  uint8_t area_idx, uint32_t area_offset);
 void nffs_crc_disk_inode_fill(struct nffs_disk_inode *disk_inode,
-                              const char *filename);
+                              const void *inline_data, const char *filename);
+
+/* @compress */
+int nffs_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_len);
+int nffs_decompress(const uint8_t *src, int src_len, uint8_t *dst,
+                    int dst_len);
 
 /* @config */
 void nffs_config_init(void);
@@ -314,9 +455,12 @@ int nffs_file_open(struct nffs_file **out_file, const char *filename,
 int nffs_file_seek(struct nffs_file *file, uint32_t offset);
 int nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
                    uint32_t *out_len);
+int nffs_file_read_direct(struct nffs_file *file, uint32_t len,
+                          const void **out_data, uint32_t *out_len);
+int nffs_file_read_direct_release(struct nffs_file *file);
 int nffs_file_close(struct nffs_file *file);
 int nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
-                  uint8_t filename_len, int is_dir,
+                  uint8_t filename_len, int is_dir, uint8_t flags,
                   struct nffs_inode_entry **out_inode_entry);
 
 /* @format */
@@ -327,11 +471,17 @@ int nffs_format_full(const struct nffs_area_desc *area_descs);
 /* @gc */
 int nffs_gc(uint8_t *out_area_idx);
 int nffs_gc_until(uint32_t space, uint8_t *out_area_idx);
+int nffs_gc_in_progress(void);
+int nffs_gc_step(uint32_t max_bytes, int *out_done);
+uint32_t nffs_gc_free_space(void);
+int nffs_gc_background(void);
 
 /* @flash */
 struct nffs_area *nffs_flash_find_area(uint16_t logical_id);
 int nffs_flash_read(uint8_t area_idx, uint32_t offset,
                     void *data, uint32_t len);
+int nffs_flash_mmap(uint8_t area_idx, uint32_t area_offset, uint32_t len,
+                    const void **out_ptr);
 int nffs_flash_write(uint8_t area_idx, uint32_t offset,
                      const void *data, uint32_t len);
 int nffs_flash_copy(uint8_t area_id_from, uint32_t offset_from,
@@ -351,6 +501,8 @@ struct nffs_inode_entry *nffs_hash_find_inode(uint32_t id);
 struct nffs_hash_entry *nffs_hash_find_block(uint32_t id);
 void nffs_hash_insert(struct nffs_hash_entry *entry);
 void nffs_hash_remove(struct nffs_hash_entry *entry);
+void nffs_hash_grow(int max_splits);
+void nffs_hash_read_stats(struct nffs_hash_stats *out_stats, int reset);
 int nffs_hash_init(void);
 
 /* @inode */
@@ -371,11 +523,19 @@ int nffs_inode_rename(struct nffs_inode_entry *inode_entry,
                       const char *new_filename);
 void nffs_inode_insert_block(struct nffs_inode *inode,
                              struct nffs_block *block);
+uint32_t nffs_inode_disk_size(const struct nffs_inode *inode);
+int nffs_inode_magic_is_set(uint32_t magic);
+uint8_t nffs_inode_disk_inline_len(const struct nffs_disk_inode *disk_inode);
 int nffs_inode_read_disk(uint8_t area_idx, uint32_t offset,
                          struct nffs_disk_inode *out_disk_inode);
 int nffs_inode_write_disk(const struct nffs_disk_inode *disk_inode,
-                          const char *filename, uint8_t area_idx,
-                          uint32_t offset);
+                          const void *inline_data, const char *filename,
+                          uint8_t area_idx, uint32_t offset);
+int nffs_inode_has_inline_data(const struct nffs_inode_entry *inode_entry);
+int nffs_inode_read_inline(const struct nffs_inode_entry *inode_entry,
+                           uint32_t offset, uint32_t len, void *dst);
+int nffs_inode_write_inline(struct nffs_inode_entry *inode_entry,
+                            const void *data, uint8_t len);
 int nffs_inode_dec_refcnt(struct nffs_inode_entry *inode_entry);
 int nffs_inode_add_child(struct nffs_inode_entry *parent,
                          struct nffs_inode_entry *child);
@@ -392,6 +552,10 @@ int nffs_inode_filename_cmp_flash(const struct nffs_inode *inode1,
                                   int *result);
 int nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
                     uint32_t len, void *data, uint32_t *out_len);
+int nffs_inode_read_direct(struct nffs_inode_entry *inode_entry,
+                           uint32_t offset, uint32_t len,
+                           const void **out_data, uint32_t *out_len,
+                           uint8_t *out_area_idx);
 int nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
                     uint32_t length, struct nffs_seek_info *out_seek_info);
 int nffs_inode_from_entry(struct nffs_inode *out_inode,
@@ -430,12 +594,19 @@ int nffs_path_new_dir(const char *path,
 /* @restore */
 int nffs_restore_full(const struct nffs_area_desc *area_descs);
 
+/* @stats */
+int nffs_stats_init(void);
+int nffs_stats_elapsed(uint32_t start, uint32_t *out_usecs);
+void nffs_stats_latency(uint32_t *hist, uint32_t start);
+
 /* @write */
 int nffs_write_to_file(struct nffs_file *file, const void *data, int len);
+int nffs_write_buf_flush(struct nffs_file *file);
+int nffs_write_buf_flush_expired(void);
 
 
 #define NFFS_HASH_FOREACH(entry, i, next)                               \
-    for ((i) = 0; (i) < NFFS_HASH_SIZE; (i)++)                          \
+    for ((i) = 0; (i) < nffs_hash_size; (i)++)                          \
         for ((entry) = SLIST_FIRST(nffs_hash + (i));                    \
              (entry) && (((next)) = SLIST_NEXT((entry), nhe_next), 1);  \
              (entry) = ((next)))
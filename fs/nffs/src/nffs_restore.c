@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "hal/hal_flash.h"
+#include "hal/hal_cputime.h"
 #include "os/os_mempool.h"
 #include "os/os_malloc.h"
 #include "nffs/nffs.h"
@@ -317,7 +318,7 @@ nffs_restore_sweep(void)
     /* Iterate through every object in the hash table, deleting all inodes that
      * should be removed.
      */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         list = nffs_hash + i;
 
         entry = SLIST_FIRST(list);
@@ -511,6 +512,8 @@ nffs_restore_inode(const struct nffs_disk_inode *disk_inode, uint8_t area_idx,
  
             inode_entry->nie_hash_entry.nhe_flash_loc =
                 nffs_flash_loc(area_idx, area_offset);
+            inode_entry->nie_inline_len =
+                nffs_inode_disk_inline_len(disk_inode);
         }
     } else {
         inode_entry = nffs_inode_entry_alloc();
@@ -524,6 +527,7 @@ nffs_restore_inode(const struct nffs_disk_inode *disk_inode, uint8_t area_idx,
         inode_entry->nie_hash_entry.nhe_id = disk_inode->ndi_id;
         inode_entry->nie_hash_entry.nhe_flash_loc =
             nffs_flash_loc(area_idx, area_offset);
+        inode_entry->nie_inline_len = nffs_inode_disk_inline_len(disk_inode);
 
         nffs_hash_insert(&inode_entry->nie_hash_entry);
     }
@@ -770,6 +774,11 @@ nffs_restore_disk_object(int area_idx, uint32_t area_offset,
         return rc;
     }
 
+    if (nffs_inode_magic_is_set(magic)) {
+        /* Inline inodes have a range of magic numbers. */
+        magic = NFFS_INODE_MAGIC;
+    }
+
     switch (magic) {
     case NFFS_INODE_MAGIC:
         out_disk_object->ndo_type = NFFS_OBJECT_TYPE_INODE;
@@ -778,6 +787,7 @@ nffs_restore_disk_object(int area_idx, uint32_t area_offset,
         break;
 
     case NFFS_BLOCK_MAGIC:
+    case NFFS_BLOCK_MAGIC_COMPRESSED:
         out_disk_object->ndo_type = NFFS_OBJECT_TYPE_BLOCK;
         rc = nffs_block_read_disk(area_idx, area_offset,
                                  &out_disk_object->ndo_disk_block);
@@ -813,7 +823,8 @@ nffs_restore_disk_object_size(const struct nffs_disk_object *disk_object)
     switch (disk_object->ndo_type) {
     case NFFS_OBJECT_TYPE_INODE:
         return sizeof disk_object->ndo_disk_inode +
-                      disk_object->ndo_disk_inode.ndi_filename_len;
+               nffs_inode_disk_inline_len(&disk_object->ndo_disk_inode) +
+               disk_object->ndo_disk_inode.ndi_filename_len;
 
     case NFFS_OBJECT_TYPE_BLOCK:
         return sizeof disk_object->ndo_disk_block +
@@ -842,13 +853,14 @@ nffs_restore_area_contents(int area_idx)
 
     area = nffs_areas + area_idx;
 
-    area->na_cur = sizeof (struct nffs_disk_area);
+    area->na_cur = nffs_area_hdr_len(area);
     while (1) {
         rc = nffs_restore_disk_object(area_idx, area->na_cur,  &disk_object);
         switch (rc) {
         case 0:
             /* Valid object; restore it into the RAM representation. */
             nffs_restore_object(&disk_object);
+            nffs_hash_grow(1);
             area->na_cur += nffs_restore_disk_object_size(&disk_object);
             break;
 
@@ -896,7 +908,7 @@ nffs_restore_detect_one_area(uint8_t flash_id, uint32_t area_offset,
         return FS_ECORRUPT;
     }
 
-    return 0;
+    return nffs_area_from_disk(out_disk_area, NULL);
 }
 
 /**
@@ -935,7 +947,7 @@ nffs_restore_corrupt_scratch(void)
     }
 
     /* Invalidate all objects resident in the bad area. */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         entry = SLIST_FIRST(&nffs_hash[i]);
         while (entry != NULL) {
             next = SLIST_NEXT(entry, nhe_next);
@@ -967,6 +979,7 @@ nffs_restore_corrupt_scratch(void)
     }
 
     /* Convert the bad area into a scratch area. */
+    nffs_areas[bad_idx].na_ver = NFFS_AREA_VER;
     rc = nffs_format_area(bad_idx, 1);
     if (rc != 0) {
         return rc;
@@ -1053,11 +1066,15 @@ int
 nffs_restore_full(const struct nffs_area_desc *area_descs)
 {
     struct nffs_disk_area disk_area;
+    uint32_t start;
+    uint32_t usecs;
     int cur_area_idx;
     int use_area;
     int rc;
     int i;
 
+    start = cputime_get32();
+
     /* Start from a clean state. */
     rc = nffs_misc_reset();
     if (rc) {
@@ -1110,14 +1127,15 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
             nffs_areas[cur_area_idx].na_length = area_descs[i].nad_length;
             nffs_areas[cur_area_idx].na_flash_id = area_descs[i].nad_flash_id;
             nffs_areas[cur_area_idx].na_gc_seq = disk_area.nda_gc_seq;
+            nffs_areas[cur_area_idx].na_erase_cnt = disk_area.nda_erase_cnt;
             nffs_areas[cur_area_idx].na_id = disk_area.nda_id;
+            nffs_areas[cur_area_idx].na_ver = disk_area.nda_ver;
 
             if (disk_area.nda_id == NFFS_AREA_ID_NONE) {
-                nffs_areas[cur_area_idx].na_cur = NFFS_AREA_OFFSET_ID;
+                nffs_areas[cur_area_idx].na_cur =
+                    nffs_area_hdr_len(nffs_areas + cur_area_idx) - 1;
                 nffs_scratch_area_idx = cur_area_idx;
             } else {
-                nffs_areas[cur_area_idx].na_cur =
-                    sizeof (struct nffs_disk_area);
                 nffs_restore_area_contents(cur_area_idx);
             }
         }
@@ -1172,6 +1190,13 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
         goto err;
     }
 
+    nffs_area_wear_update();
+
+    STATS_INC(nffs_stats, restores);
+    if (nffs_stats_elapsed(start, &usecs) == 0) {
+        nffs_stats.srestore_ms = usecs / 1000;
+    }
+
     NFFS_LOG(DEBUG, "CONTENTS\n");
     nffs_log_contents();
 
@@ -0,0 +1,142 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stddef.h>
+#include "stats/stats.h"
+#include "hal/hal_cputime.h"
+#include "nffs_priv.h"
+
+STATS_SECT_DECL(nffs_stats) nffs_stats;
+
+#define NFFS_STATS_HIST_NAMES(op)                   \
+    STATS_NAME(nffs_stats, op ## _us16)             \
+    STATS_NAME(nffs_stats, op ## _us64)             \
+    STATS_NAME(nffs_stats, op ## _us256)            \
+    STATS_NAME(nffs_stats, op ## _ms1)              \
+    STATS_NAME(nffs_stats, op ## _ms4)              \
+    STATS_NAME(nffs_stats, op ## _ms16)             \
+    STATS_NAME(nffs_stats, op ## _ms64)             \
+    STATS_NAME(nffs_stats, op ## _slow)
+
+STATS_NAME_START(nffs_stats)
+    STATS_NAME(nffs_stats, erases)
+    STATS_NAME(nffs_stats, erase_min)
+    STATS_NAME(nffs_stats, erase_max)
+    STATS_NAME(nffs_stats, erase_avg)
+    STATS_NAME(nffs_stats, flash_reads)
+    STATS_NAME(nffs_stats, flash_read_bytes)
+    STATS_NAME(nffs_stats, flash_writes)
+    STATS_NAME(nffs_stats, flash_write_bytes)
+    STATS_NAME(nffs_stats, cache_hits)
+    STATS_NAME(nffs_stats, cache_misses)
+    STATS_NAME(nffs_stats, gc_runs)
+    STATS_NAME(nffs_stats, gc_bytes)
+    STATS_NAME(nffs_stats, restores)
+    STATS_NAME(nffs_stats, restore_ms)
+    NFFS_STATS_HIST_NAMES(open)
+    NFFS_STATS_HIST_NAMES(read)
+    NFFS_STATS_HIST_NAMES(write)
+    NFFS_STATS_HIST_NAMES(gc)
+STATS_NAME_END(nffs_stats)
+
+static uint8_t nffs_stats_registered;
+
+/**
+ * Registers the "nffs" statistics group.  The statistics persist across
+ * re-initialization of the file system.
+ *
+ * @return                  0 on success; FS_EOS on failure.
+ */
+int
+nffs_stats_init(void)
+{
+    int rc;
+
+    if (nffs_stats_registered) {
+        return 0;
+    }
+
+    rc = stats_init_and_reg(STATS_HDR(nffs_stats),
+                            STATS_SIZE_INIT_PARMS(nffs_stats, STATS_SIZE_32),
+                            STATS_NAME_INIT_PARMS(nffs_stats), "nffs");
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    nffs_stats_registered = 1;
+    return 0;
+}
+
+/**
+ * Calculates the time elapsed since the specified cputime.  cputime only
+ * runs if the application has called cputime_init(); until then, no time
+ * can be measured.
+ *
+ * @param start             The cputime at which the operation started.
+ * @param out_usecs         On success, the elapsed microseconds get written
+ *                              here.
+ *
+ * @return                  0 on success; FS_EUNINIT if cputime is not
+ *                              initialized.
+ */
+int
+nffs_stats_elapsed(uint32_t start, uint32_t *out_usecs)
+{
+    uint32_t ticks_per_usec;
+
+    /* Converting to ticks multiplies by the tick rate, which is 0 before
+     * cputime_init(); converting from ticks would divide by it.
+     */
+    ticks_per_usec = cputime_usecs_to_ticks(1);
+    if (ticks_per_usec == 0) {
+        return FS_EUNINIT;
+    }
+
+    *out_usecs = (cputime_get32() - start) / ticks_per_usec;
+    return 0;
+}
+
+/**
+ * Adds an operation to a latency histogram.  Nothing is recorded if cputime
+ * is not initialized.
+ *
+ * @param hist              The first bucket of the histogram.
+ * @param start             The cputime at which the operation started.
+ */
+void
+nffs_stats_latency(uint32_t *hist, uint32_t start)
+{
+    uint32_t usecs;
+    uint32_t limit;
+    int bucket;
+
+    if (nffs_stats_elapsed(start, &usecs) != 0) {
+        return;
+    }
+
+    limit = 16;
+    for (bucket = 0; bucket < NFFS_STATS_HIST_BUCKETS - 1; bucket++) {
+        if (usecs < limit) {
+            break;
+        }
+        limit *= 4;
+    }
+
+    hist[bucket]++;
+}
@@ -18,10 +18,12 @@
  */
 
 #include <assert.h>
+#include <string.h>
+#include "os/os.h"
 #include "testutil/testutil.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 static int
 nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
@@ -75,6 +77,69 @@ nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
     return 0;
 }
 
+/**
+ * Overwrites an existing data block by rebuilding its full contents in RAM.
+ * This is necessary when either the old or the new block is compressed, as
+ * compressed data cannot be spliced in flash.
+ *
+ * @param block                 The data block to overwrite.
+ * @param left_copy_len         The number of bytes of existing data to retain
+ *                                  before the new data begins.
+ * @param new_data              The new data to write to the block.
+ * @param new_data_len          The number of new bytes to write to the block.
+ * @param compress              Whether the new block should be compressed.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_over_block_buf(struct nffs_block *block, uint16_t left_copy_len,
+                          const void *new_data, uint16_t new_data_len,
+                          int compress)
+{
+    struct nffs_disk_block disk_block;
+    const void *payload;
+    uint32_t area_offset;
+    uint16_t data_len;
+    uint8_t area_idx;
+    uint8_t *data;
+    int rc;
+
+    data_len = left_copy_len + new_data_len;
+    if (data_len < block->nb_data_len) {
+        data_len = block->nb_data_len;
+    }
+
+    /* Assemble the new block in the staging buffer; it survives a garbage
+     * collection cycle triggered by the write below.
+     */
+    data = nffs_block_zbuf_stage();
+    if (data == NULL) {
+        return FS_ENOMEM;
+    }
+
+    rc = nffs_block_read_data(block, 0, block->nb_data_len, data);
+    if (rc != 0) {
+        return rc;
+    }
+    memcpy(data + left_copy_len, new_data, new_data_len);
+
+    block->nb_seq++;
+    block->nb_data_len = data_len;
+    nffs_block_to_disk(block, &disk_block);
+    nffs_block_encode(&disk_block, data, data_len, compress, data, &payload);
+    nffs_crc_disk_block_fill(&disk_block, payload);
+
+    rc = nffs_block_write_disk(&disk_block, payload, &area_idx, &area_offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    block->nb_hash_entry->nhe_flash_loc =
+        nffs_flash_loc(area_idx, area_offset);
+
+    return 0;
+}
+
 /**
  * Overwrites an existing data block.  The resulting block has the same ID as
  * the old one, but it supersedes it with a greater sequence number.
@@ -88,12 +153,14 @@ nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
  *                                  than the existing block's data length,
  *                                  previous data at the end of the block is
  *                                  retained.
+ * @param compress              Whether the block should be compressed.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
 nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
-                      const void *new_data, uint16_t new_data_len)
+                      const void *new_data, uint16_t new_data_len,
+                      int compress)
 {
     struct nffs_disk_block disk_block;
     struct nffs_block block;
@@ -112,6 +179,11 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
 
     assert(left_copy_len <= block.nb_data_len);
 
+    if (compress || nffs_block_is_compressed(&block)) {
+        return nffs_write_over_block_buf(&block, left_copy_len,
+                                         new_data, new_data_len, compress);
+    }
+
     /* Determine how much old data at the end of the block needs to be
      * retained.  If the new data doesn't extend to the end of the block, the
      * the rest of the block retains its old contents.
@@ -215,8 +287,10 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
     struct nffs_inode_entry *inode_entry;
     struct nffs_hash_entry *entry;
     struct nffs_disk_block disk_block;
+    const void *payload;
     uint32_t area_offset;
     uint8_t area_idx;
+    int compress;
     int rc;
 
     rc = nffs_block_entry_reserve(&entry);
@@ -235,10 +309,12 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
     } else {
         disk_block.ndb_prev_id = inode_entry->nie_last_block_entry->nhe_id;
     }
-    disk_block.ndb_data_len = len;
-    nffs_crc_disk_block_fill(&disk_block, data);
+    compress = cache_inode->nci_inode.ni_flags & NFFS_INODE_F_COMPRESS;
+    nffs_block_encode(&disk_block, data, len, compress,
+                      compress ? nffs_block_zbuf_stage() : NULL, &payload);
+    nffs_crc_disk_block_fill(&disk_block, payload);
 
-    rc = nffs_block_write_disk(&disk_block, data, &area_idx, &area_offset);
+    rc = nffs_block_write_disk(&disk_block, payload, &area_idx, &area_offset);
     if (rc != 0) {
         return rc;
     }
@@ -246,6 +322,7 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
     entry->nhe_id = disk_block.ndb_id;
     entry->nhe_flash_loc = nffs_flash_loc(area_idx, area_offset);
     nffs_hash_insert(entry);
+    nffs_hash_grow(1);
 
     inode_entry->nie_last_block_entry = entry;
 
@@ -258,6 +335,78 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
     return 0;
 }
 
+/**
+ * Writes to a file that has no data blocks.  If the resulting file fits in
+ * the configured inline limit, a new inode version carrying the complete
+ * contents is written.  Otherwise, any existing inline contents are moved
+ * into the file's first data block; the caller then performs the write
+ * normally.
+ *
+ * @param cache_inode           The file to write to; must not have any data
+ *                                  blocks.
+ * @param file_offset           The file offset to write at.
+ * @param data                  The new data to write.
+ * @param data_len              The number of bytes of new data to write.
+ * @param out_done              On success, indicates whether the write was
+ *                                  performed (1) or still needs to be (0).
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_inline(struct nffs_cache_inode *cache_inode, uint32_t file_offset,
+                  const void *data, uint16_t data_len, int *out_done)
+{
+    struct nffs_inode_entry *inode_entry;
+    uint8_t buf[NFFS_INODE_INLINE_MAX];
+    uint32_t old_len;
+    uint32_t new_len;
+    int rc;
+
+    inode_entry = cache_inode->nci_inode.ni_inode_entry;
+    old_len = cache_inode->nci_file_size;
+    new_len = file_offset + data_len;
+    if (new_len < old_len) {
+        new_len = old_len;
+    }
+
+    *out_done = 0;
+
+    if (old_len > 0) {
+        rc = nffs_inode_read_inline(inode_entry, 0, old_len, buf);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    if (new_len <= nffs_config.nc_inline_data_max) {
+        memcpy(buf + file_offset, data, data_len);
+        rc = nffs_inode_write_inline(inode_entry, buf, new_len);
+        if (rc != 0) {
+            return rc;
+        }
+
+        cache_inode->nci_file_size = new_len;
+        *out_done = 1;
+
+        /* Keep the cached copy of the inode in sync with the new version. */
+        return nffs_inode_from_entry(&cache_inode->nci_inode, inode_entry);
+    }
+
+    if (old_len > 0) {
+        /* The file outgrows its inode; its contents become the first block.
+         * The stale inline copy is ignored once the file has a block.
+         */
+        cache_inode->nci_file_size = 0;
+        rc = nffs_write_append(cache_inode, buf, old_len);
+        if (rc != 0) {
+            cache_inode->nci_file_size = old_len;
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Performs a single write operation.  The data written must be no greater
  * than the maximum block data length.  If old data gets overwritten, then
@@ -276,6 +425,7 @@ nffs_write_chunk(struct nffs_inode_entry *inode_entry, uint32_t file_offset,
 {
     struct nffs_cache_inode *cache_inode;
     struct nffs_cache_block *cache_block;
+    struct nffs_hash_entry *entry;
     unsigned int gc_count;
     uint32_t append_len;
     uint32_t data_offset;
@@ -283,6 +433,7 @@ nffs_write_chunk(struct nffs_inode_entry *inode_entry, uint32_t file_offset,
     uint32_t dst_off;
     uint16_t chunk_off;
     uint16_t chunk_sz;
+    int done;
     int rc;
 
     assert(data_len <= nffs_block_max_data_sz);
@@ -292,6 +443,17 @@ nffs_write_chunk(struct nffs_inode_entry *inode_entry, uint32_t file_offset,
         return rc;
     }
 
+    if (inode_entry->nie_last_block_entry == NULL &&
+        (nffs_config.nc_inline_data_max > 0 ||
+         inode_entry->nie_inline_len > 0)) {
+
+        rc = nffs_write_inline(cache_inode, file_offset, data, data_len,
+                               &done);
+        if (rc != 0 || done) {
+            return rc;
+        }
+    }
+
     /** Handle the simple append case first. */
     if (file_offset == cache_inode->nci_file_size) {
         rc = nffs_write_append(cache_inode, data, data_len);
@@ -339,7 +501,9 @@ nffs_write_chunk(struct nffs_inode_entry *inode_entry, uint32_t file_offset,
 
         data_offset = cache_block->ncb_file_offset + chunk_off - file_offset;
         rc = nffs_write_over_block(cache_block->ncb_block.nb_hash_entry,
-                                   chunk_off, data + data_offset, chunk_sz);
+                                   chunk_off, data + data_offset, chunk_sz,
+                                   cache_inode->nci_inode.ni_flags &
+                                       NFFS_INODE_F_COMPRESS);
         if (rc != 0) {
             return rc;
         }
@@ -352,6 +516,14 @@ nffs_write_chunk(struct nffs_inode_entry *inode_entry, uint32_t file_offset,
              */
             cache_block = NULL;
         } else {
+            /* The block's stored length may have changed (compression);
+             * keep the cached copy in sync with the new on-disk version.
+             */
+            entry = cache_block->ncb_block.nb_hash_entry;
+            rc = nffs_block_from_hash_entry(&cache_block->ncb_block, entry);
+            if (rc != 0) {
+                return rc;
+            }
             cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list,
                                      ncb_link);
         }
@@ -362,7 +534,169 @@ nffs_write_chunk(struct nffs_inode_entry *inode_entry, uint32_t file_offset,
 }
 
 /**
- * Writes a chunk of contiguous data to a file.
+ * Indicates whether the oldest byte in a file's write buffer has been waiting
+ * longer than the configured write buffer timeout.
+ */
+static int
+nffs_write_buf_expired(const struct nffs_file *file)
+{
+    os_time_t timeout;
+
+    timeout = nffs_config.nc_write_buf_timeout * OS_TICKS_PER_SEC / 1000;
+    return file->nf_wbuf_len > 0 &&
+           (os_time_t)(os_time_get() - file->nf_wbuf_time) >= timeout;
+}
+
+/**
+ * Commits the contents of a file's write buffer to flash.  If the file was
+ * opened in append mode, the buffered data is written to the current end of
+ * the file; otherwise it is written to the offset at which buffering started.
+ * On failure, the buffer is left intact so that the flush can be retried.
+ *
+ * @param file                  The file whose buffer should be flushed.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_write_buf_flush(struct nffs_file *file)
+{
+    uint32_t file_offset;
+    int rc;
+
+    if (file->nf_wbuf_len == 0) {
+        return 0;
+    }
+
+    if (file->nf_access_flags & FS_ACCESS_APPEND) {
+        rc = nffs_inode_data_len(file->nf_inode_entry, &file_offset);
+        if (rc != 0) {
+            return rc;
+        }
+    } else {
+        file_offset = file->nf_wbuf_off;
+    }
+
+    rc = nffs_write_chunk(file->nf_inode_entry, file_offset, file->nf_wbuf,
+                          file->nf_wbuf_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (file->nf_access_flags & FS_ACCESS_APPEND) {
+        file->nf_offset = file_offset + file->nf_wbuf_len;
+    }
+    file->nf_wbuf_len = 0;
+
+    return 0;
+}
+
+/**
+ * Flushes the write buffer of every open file whose buffered data has been
+ * waiting longer than the configured timeout.
+ *
+ * @return                      0 on success; the error of the last failed
+ *                                  flush on failure.
+ */
+int
+nffs_write_buf_flush_expired(void)
+{
+    struct nffs_file *file;
+    int flush_rc;
+    int rc;
+
+    rc = 0;
+    SLIST_FOREACH(file, &nffs_wbuf_files, nf_wbuf_next) {
+        if (nffs_write_buf_expired(file)) {
+            flush_rc = nffs_write_buf_flush(file);
+            if (flush_rc != 0) {
+                rc = flush_rc;
+            }
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Attempts to absorb a write into the file's write buffer.  Only writes which
+ * extend the file are buffered.  Any pending buffered data is flushed first
+ * if the new write does not directly follow it, would overflow the buffer, or
+ * if the buffer has expired.
+ *
+ * @param file                  The file to write to.
+ * @param data                  The data to write.
+ * @param len                   The length of data to write.
+ * @param out_buffered          On success, 1 is written here if the data was
+ *                                  buffered; 0 if it must be written directly.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_buf(struct nffs_file *file, const void *data, int len,
+               int *out_buffered)
+{
+    uint32_t file_len;
+    int rc;
+
+    *out_buffered = 0;
+
+    if (file->nf_wbuf_len > 0) {
+        if (file->nf_access_flags & FS_ACCESS_APPEND) {
+            file->nf_offset = file->nf_wbuf_off + file->nf_wbuf_len;
+        }
+
+        if (file->nf_offset != file->nf_wbuf_off + file->nf_wbuf_len ||
+            file->nf_wbuf_len + len > nffs_block_max_data_sz ||
+            nffs_write_buf_expired(file)) {
+
+            rc = nffs_write_buf_flush(file);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    if (file->nf_wbuf_len == 0) {
+        rc = nffs_inode_data_len(file->nf_inode_entry, &file_len);
+        if (rc != 0) {
+            return rc;
+        }
+
+        if (file->nf_access_flags & FS_ACCESS_APPEND) {
+            file->nf_offset = file_len;
+        }
+
+        /* Overwrites and writes too large to be coalesced go straight to
+         * flash.
+         */
+        if (file->nf_offset != file_len || len >= nffs_block_max_data_sz) {
+            return 0;
+        }
+
+        file->nf_wbuf_off = file->nf_offset;
+        file->nf_wbuf_time = os_time_get();
+    }
+
+    memcpy(file->nf_wbuf + file->nf_wbuf_len, data, len);
+    file->nf_wbuf_len += len;
+    file->nf_offset += len;
+    *out_buffered = 1;
+
+    /* A full buffer is committed right away as a single maximum-size block. */
+    if (file->nf_wbuf_len == nffs_block_max_data_sz) {
+        rc = nffs_write_buf_flush(file);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a chunk of contiguous data to a file.  If the file was opened with
+ * FS_ACCESS_BUFFERED, small appends are coalesced in the file's write buffer
+ * rather than being written to flash immediately.
  *
  * @param file                  The file to write to.
  * @param data                  The data to write.
@@ -376,6 +710,7 @@ nffs_write_to_file(struct nffs_file *file, const void *data, int len)
     struct nffs_cache_inode *cache_inode;
     const uint8_t *data_ptr;
     uint16_t chunk_size;
+    int buffered;
     int rc;
 
     if (!(file->nf_access_flags & FS_ACCESS_WRITE)) {
@@ -386,6 +721,13 @@ nffs_write_to_file(struct nffs_file *file, const void *data, int len)
         return 0;
     }
 
+    if (file->nf_wbuf != NULL) {
+        rc = nffs_write_buf(file, data, len, &buffered);
+        if (rc != 0 || buffered) {
+            return rc;
+        }
+    }
+
     rc = nffs_cache_inode_ensure(&cache_inode, file->nf_inode_entry);
     if (rc != 0) {
         return rc;
@@ -23,7 +23,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "hal/hal_flash.h"
+#include "hal/hal_cputime.h"
 #include "testutil/testutil.h"
+#include "os/os.h"
+#include "os/os_mbuf.h"
 #include "fs/fs.h"
 #include "nffs/nffs.h"
 #include "nffs/nffs_test.h"
@@ -279,6 +282,24 @@ nffs_test_util_create_file(const char *filename, const char *contents,
     nffs_test_util_create_file_blocks(filename, &block, 0);
 }
 
+static void
+nffs_test_util_read_blocks(struct fs_file *file, const char *data,
+                           int num_blocks)
+{
+    static char buf[NFFS_BLOCK_MAX_DATA_SZ_MAX];
+    uint32_t bytes_read;
+    int rc;
+    int i;
+
+    for (i = 0; i < num_blocks; i++) {
+        rc = fs_read(file, nffs_block_max_data_sz, buf, &bytes_read);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(bytes_read == nffs_block_max_data_sz);
+        TEST_ASSERT(memcmp(buf, data + i * nffs_block_max_data_sz,
+                           bytes_read) == 0);
+    }
+}
+
 static void
 nffs_test_util_append_file(const char *filename, const char *contents,
                            int contents_len)
@@ -1103,6 +1124,117 @@ TEST_CASE(nffs_test_read)
     TEST_ASSERT(rc == 0);
 }
 
+TEST_CASE(nffs_test_read_direct)
+{
+    struct nffs_test_block_desc *blocks = (struct nffs_test_block_desc[]) { {
+        .data = "abcdefgh",
+        .data_len = 8,
+    }, {
+        .data = "ijklmnop",
+        .data_len = 8,
+    } };
+    struct fs_file *file;
+    const void *data;
+    uint32_t bytes_read;
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_create_file_blocks("/myfile.txt", blocks, 2);
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == 0);
+
+    /* Partial block. */
+    rc = fs_read_direct(file, 3, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 3);
+    TEST_ASSERT(memcmp(data, "abc", 3) == 0);
+    TEST_ASSERT(fs_getpos(file) == 3);
+
+    /* Read stops at the end of the first block. */
+    rc = fs_read_direct(file, 100, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 5);
+    TEST_ASSERT(memcmp(data, "defgh", 5) == 0);
+    TEST_ASSERT(fs_getpos(file) == 8);
+
+    rc = fs_read_direct(file, 100, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 8);
+    TEST_ASSERT(memcmp(data, "ijklmnop", 8) == 0);
+    TEST_ASSERT(fs_getpos(file) == 16);
+
+    /* End of file. */
+    rc = fs_read_direct(file, 100, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 0);
+
+    /* Data left alone while it was held is reported intact. */
+    rc = fs_read_direct_release(file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_direct(file, 8, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 8);
+    rc = fs_read_direct_release(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Garbage collection does not wait for a held pointer; releasing it
+     * reports that the data was erased.  With two areas, every cycle collects
+     * the one holding the file.
+     */
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file_blocks("/myfile.txt", blocks, 2);
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_read_direct(file, 8, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 8);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_direct_release(file);
+    TEST_ASSERT(rc == FS_ESTALE);
+
+    /* A second release is a no-op. */
+    rc = fs_read_direct_release(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Reading again yields valid data. */
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_direct(file, 8, &data, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 8);
+    TEST_ASSERT(memcmp(data, "abcdefgh", 8) == 0);
+    rc = fs_read_direct_release(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Write-only handles cannot be read. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_direct(file, 100, &data, &bytes_read);
+    TEST_ASSERT(rc == FS_EACCESS);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
 TEST_CASE(nffs_test_open)
 {
     struct fs_file *file;
@@ -1861,6 +1993,14 @@ TEST_CASE(nffs_test_wear_level)
 
 
     /*** Setup. */
+
+    /* Start from blank flash so that all areas have equal erase counts. */
+    for (i = 0; area_descs_uniform[i].nad_length != 0; i++) {
+        rc = flash_native_memset(area_descs_uniform[i].nad_offset, 0xff,
+                                 sizeof (struct nffs_disk_area));
+        TEST_ASSERT(rc == 0);
+    }
+
     rc = nffs_format(area_descs_uniform);
     TEST_ASSERT(rc == 0);
 
@@ -1883,6 +2023,270 @@ TEST_CASE(nffs_test_wear_level)
     }
 }
 
+static void
+nffs_test_assert_erase_counts(const uint32_t *expected)
+{
+    struct nffs_disk_area disk_area;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+    int rc;
+    int i;
+
+    min = UINT32_MAX;
+    max = 0;
+    sum = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_flash_read(i, 0, &disk_area, sizeof disk_area);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(disk_area.nda_erase_cnt == nffs_areas[i].na_erase_cnt);
+        if (expected != NULL) {
+            TEST_ASSERT(nffs_areas[i].na_erase_cnt == expected[i]);
+        }
+
+        if (nffs_areas[i].na_erase_cnt < min) {
+            min = nffs_areas[i].na_erase_cnt;
+        }
+        if (nffs_areas[i].na_erase_cnt > max) {
+            max = nffs_areas[i].na_erase_cnt;
+        }
+        sum += nffs_areas[i].na_erase_cnt;
+    }
+
+    TEST_ASSERT(nffs_stats.serase_min == min);
+    TEST_ASSERT(nffs_stats.serase_max == max);
+    TEST_ASSERT(nffs_stats.serase_avg == sum / nffs_num_areas);
+}
+
+TEST_CASE(nffs_test_erase_count)
+{
+    uint32_t counts[4];
+    int worn_idx;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_uniform[] = {
+        { 0x00000000, 2 * 1024 },
+        { 0x00020000, 2 * 1024 },
+        { 0x00040000, 2 * 1024 },
+        { 0x00060000, 2 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Setup. */
+    for (i = 0; area_descs_uniform[i].nad_length != 0; i++) {
+        rc = flash_native_memset(area_descs_uniform[i].nad_offset, 0xff,
+                                 sizeof (struct nffs_disk_area));
+        TEST_ASSERT(rc == 0);
+        counts[i] = 1;
+    }
+
+    rc = nffs_format(area_descs_uniform);
+    TEST_ASSERT(rc == 0);
+    nffs_test_assert_erase_counts(counts);
+
+    /*** Garbage collection spreads erases evenly. */
+    for (i = 0; i < 8; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT(rc == 0);
+    }
+    nffs_test_assert_erase_counts(NULL);
+    TEST_ASSERT(nffs_stats.serase_min == 3);
+    TEST_ASSERT(nffs_stats.serase_max == 3);
+
+    /*** Counts survive a reboot and a reformat. */
+    for (i = 0; i < nffs_num_areas; i++) {
+        counts[i] = nffs_areas[i].na_erase_cnt;
+    }
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_uniform);
+    TEST_ASSERT(rc == 0);
+    nffs_test_assert_erase_counts(counts);
+
+    rc = nffs_format(area_descs_uniform);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < nffs_num_areas; i++) {
+        counts[i]++;
+    }
+    nffs_test_assert_erase_counts(counts);
+
+    /*** A heavily worn area is passed over. */
+    worn_idx = (nffs_scratch_area_idx + 1) % nffs_num_areas;
+    nffs_areas[worn_idx].na_erase_cnt += 100;
+    for (i = 0; i < 6; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(nffs_scratch_area_idx != worn_idx);
+    }
+}
+
+/**
+ * Rewrites an area with a version 0 header, moving its objects down to
+ * follow the shorter header.
+ */
+static void
+nffs_test_util_area_to_v0(uint8_t area_idx)
+{
+    static const uint32_t magic[4] = {
+        NFFS_AREA_MAGIC0, NFFS_AREA_MAGIC1, NFFS_AREA_MAGIC2, NFFS_AREA_MAGIC3,
+    };
+    static uint8_t buf[2 * 1024];
+    const struct nffs_area *area;
+    uint32_t len;
+    uint8_t id;
+    int rc;
+
+    area = nffs_areas + area_idx;
+    TEST_ASSERT(area->na_length <= sizeof buf);
+
+    rc = hal_flash_read(area->na_flash_id, area->na_offset, buf,
+                        area->na_length);
+    TEST_ASSERT(rc == 0);
+
+    id = buf[NFFS_AREA_OFFSET_ID];
+    len = area->na_length - sizeof (struct nffs_disk_area);
+    memmove(buf + NFFS_AREA_HDR_SZ_0, buf + sizeof (struct nffs_disk_area),
+            len);
+    len += NFFS_AREA_HDR_SZ_0;
+
+    memset(buf + sizeof magic, 0, NFFS_AREA_HDR_SZ_0 - sizeof magic);
+    memcpy(buf, magic, sizeof magic);
+    memcpy(buf + sizeof magic, &area->na_length, sizeof area->na_length);
+    buf[NFFS_AREA_OFFSET_ID_0] = id;
+
+    rc = flash_native_memset(area->na_offset, 0xff, area->na_length);
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_write(area->na_flash_id, area->na_offset, buf, len);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(nffs_test_area_v0)
+{
+    struct nffs_disk_area disk_area;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_v0[] = {
+        { 0x00000000, 2 * 1024 },
+        { 0x00020000, 2 * 1024 },
+        { 0x00040000, 2 * 1024 },
+        { 0x00060000, 2 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_v0);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file("/myfile.txt", "abcdefgh", 8);
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        nffs_test_util_area_to_v0(i);
+    }
+
+    /*** Version 0 areas are detected and written to. */
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_v0);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < nffs_num_areas; i++) {
+        TEST_ASSERT(nffs_areas[i].na_erase_cnt == 0);
+    }
+    nffs_test_util_assert_contents("/myfile.txt", "abcdefgh", 8);
+
+    nffs_test_util_create_file("/other.txt", "ijkl", 4);
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_v0);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", "abcdefgh", 8);
+    nffs_test_util_assert_contents("/other.txt", "ijkl", 4);
+
+    /*** Garbage collection rewrites every area in the current format. */
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT(rc == 0);
+    }
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_flash_read(i, 0, &disk_area, sizeof disk_area);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(disk_area.nda_ver == NFFS_AREA_VER);
+        TEST_ASSERT(nffs_areas[i].na_erase_cnt >= 1);
+    }
+    nffs_test_assert_erase_counts(NULL);
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_v0);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", "abcdefgh", 8);
+    nffs_test_util_assert_contents("/other.txt", "ijkl", 4);
+}
+
+static uint32_t
+nffs_test_hist_sum(const uint32_t *hist)
+{
+    uint32_t sum;
+    int i;
+
+    sum = 0;
+    for (i = 0; i < NFFS_STATS_HIST_BUCKETS; i++) {
+        sum += hist[i];
+    }
+    return sum;
+}
+
+TEST_CASE(nffs_test_stats)
+{
+    STATS_SECT_DECL(nffs_stats) before;
+    struct fs_file *file;
+    uint32_t len;
+    char buf[8];
+    int rc;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    before = nffs_stats;
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ | FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "abcdefgh", 8);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, sizeof buf, buf, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 8);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+
+    TEST_ASSERT(nffs_stats.sflash_writes > before.sflash_writes);
+    TEST_ASSERT(nffs_stats.sflash_write_bytes >= before.sflash_write_bytes + 8);
+    TEST_ASSERT(nffs_stats.sflash_reads > before.sflash_reads);
+    TEST_ASSERT(nffs_stats.sgc_runs == before.sgc_runs + 1);
+    TEST_ASSERT(nffs_stats.serases == before.serases + 1);
+
+    TEST_ASSERT(nffs_test_hist_sum(&nffs_stats.sopen_us16) ==
+                nffs_test_hist_sum(&before.sopen_us16) + 1);
+    TEST_ASSERT(nffs_test_hist_sum(&nffs_stats.swrite_us16) ==
+                nffs_test_hist_sum(&before.swrite_us16) + 1);
+    TEST_ASSERT(nffs_test_hist_sum(&nffs_stats.sread_us16) ==
+                nffs_test_hist_sum(&before.sread_us16) + 1);
+    TEST_ASSERT(nffs_test_hist_sum(&nffs_stats.sgc_us16) ==
+                nffs_test_hist_sum(&before.sgc_us16) + 1);
+
+    rc = nffs_detect(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_stats.srestores == before.srestores + 1);
+}
+
 TEST_CASE(nffs_test_corrupt_scratch)
 {
     int non_scratch_id;
@@ -2291,6 +2695,10 @@ TEST_CASE(nffs_test_cache_large_file)
     nffs_test_util_create_file("/myfile.txt", data, sizeof data);
     nffs_cache_clear();
 
+    /* Disable read-ahead; this test checks on-demand caching only. */
+    rc = nffs_cache_set_budget(nffs_config.nc_num_cache_blocks, 0);
+    TEST_ASSERT(rc == 0);
+
     /* Opening a file should not cause any blocks to get cached. */
     rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
     TEST_ASSERT(rc == 0);
@@ -2344,25 +2752,108 @@ TEST_CASE(nffs_test_cache_large_file)
 
     rc = fs_close(file);
     TEST_ASSERT(rc == 0);
+
+    rc = nffs_cache_set_budget(nffs_config.nc_num_cache_blocks,
+                               nffs_config.nc_read_ahead_blocks);
+    TEST_ASSERT(rc == 0);
 }
 
-TEST_CASE(nffs_test_readdir)
+TEST_CASE(nffs_test_cache_read_ahead)
 {
-    struct fs_dirent *dirent;
-    struct fs_dir *dir;
+    static char data[NFFS_BLOCK_MAX_DATA_SZ_MAX * 10];
+    struct nffs_cache_stats stats;
+    struct fs_file *file;
     int rc;
+    int i;
 
     /*** Setup. */
     rc = nffs_format(nffs_area_descs);
-    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(rc == 0);
 
-    rc = fs_mkdir("/mydir");
-    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i;
+    }
+    nffs_test_util_create_file("/myfile.txt", data,
+                               nffs_block_max_data_sz * 10);
+    nffs_cache_clear();
 
-    nffs_test_util_create_file("/mydir/b", "bbbb", 4);
-    nffs_test_util_create_file("/mydir/a", "aaaa", 4);
-    rc = fs_mkdir("/mydir/c");
-    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_cache_set_budget(nffs_config.nc_num_cache_blocks, 4);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == 0);
+    nffs_cache_get_stats(&stats, 1);
+
+    /* A read from the start of the file also caches the next four blocks. */
+    nffs_test_util_read_blocks(file, data, 1);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0,
+                                     nffs_block_max_data_sz * 5);
+
+    /* Streaming the rest of the file misses only once more. */
+    nffs_test_util_read_blocks(file, data + nffs_block_max_data_sz, 9);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0,
+                                     nffs_block_max_data_sz * 10);
+
+    nffs_cache_get_stats(&stats, 1);
+    TEST_ASSERT(stats.ncs_misses == 2);
+    TEST_ASSERT(stats.ncs_hits == 8);
+    TEST_ASSERT(stats.ncs_prefetches == 8);
+    TEST_ASSERT(stats.ncs_prefetch_hits == 8);
+    TEST_ASSERT(stats.ncs_evictions == 0);
+
+    /*** Budget must fit within the configured pool. */
+    rc = nffs_cache_set_budget(0, 4);
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = nffs_cache_set_budget(nffs_config.nc_num_cache_blocks + 1, 4);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    /*** Shrinking the budget evicts immediately. */
+    rc = nffs_cache_set_budget(2, 4);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0, 0);
+    nffs_cache_get_stats(&stats, 1);
+    TEST_ASSERT(stats.ncs_evictions == 10);
+
+    /* Read-ahead is limited by the budget. */
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_read_blocks(file, data, 10);
+    nffs_test_util_assert_cache_range("/myfile.txt",
+                                     nffs_block_max_data_sz * 8,
+                                     nffs_block_max_data_sz * 10);
+
+    nffs_cache_get_stats(&stats, 1);
+    TEST_ASSERT(stats.ncs_misses == 5);
+    TEST_ASSERT(stats.ncs_hits == 5);
+    TEST_ASSERT(stats.ncs_prefetches == 5);
+    TEST_ASSERT(stats.ncs_prefetch_hits == 5);
+    TEST_ASSERT(stats.ncs_evictions == 8);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = nffs_cache_set_budget(nffs_config.nc_num_cache_blocks,
+                               nffs_config.nc_read_ahead_blocks);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(nffs_test_readdir)
+{
+    struct fs_dirent *dirent;
+    struct fs_dir *dir;
+    int rc;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_mkdir("/mydir");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_util_create_file("/mydir/b", "bbbb", 4);
+    nffs_test_util_create_file("/mydir/a", "aaaa", 4);
+    rc = fs_mkdir("/mydir/c");
+    TEST_ASSERT_FATAL(rc == 0);
 
     /* Nonexistent directory. */
     rc = fs_opendir("/asdf", &dir);
@@ -2563,6 +3054,358 @@ TEST_CASE(nffs_test_gc_on_oom)
     nffs_test_assert_system(expected_system, area_descs_two);
 }
 
+TEST_CASE(nffs_test_gc_incremental)
+{
+    static const struct nffs_area_desc area_descs_three[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0x00060000, 128 * 1024 },
+        { 0, 0 },
+    };
+    char appended[64];
+    unsigned int gc_count;
+    int num_appends;
+    int done;
+    int rc;
+    int i;
+
+    /* Start from blank flash so that the area holding the data is the one
+     * selected for collection.
+     */
+    for (i = 0; area_descs_three[i].nad_length != 0; i++) {
+        rc = flash_native_memset(area_descs_three[i].nad_offset, 0xff,
+                                 sizeof (struct nffs_disk_area));
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    rc = nffs_format(area_descs_three);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Create some garbage by repeatedly rewriting a file. */
+    for (i = 0; i < 10; i++) {
+        nffs_test_util_create_file("/a.txt", "abcdefgh", 8);
+    }
+    nffs_test_util_create_file("/b.txt", "", 0);
+
+    /* Collect in small increments, modifying the file system in between. */
+    gc_count = nffs_gc_count;
+    num_appends = 0;
+    do {
+        rc = nffs_gc_step(1, &done);
+        TEST_ASSERT_FATAL(rc == 0);
+
+        if (!done) {
+            TEST_ASSERT(nffs_gc_in_progress());
+            TEST_ASSERT_FATAL(num_appends < sizeof appended);
+            appended[num_appends++] = 'x';
+            nffs_test_util_append_file("/b.txt", "x", 1);
+        }
+    } while (!done);
+
+    TEST_ASSERT(!nffs_gc_in_progress());
+    TEST_ASSERT(nffs_gc_count == gc_count + 1);
+    TEST_ASSERT(num_appends > 0);
+
+    nffs_test_util_assert_contents("/a.txt", "abcdefgh", 8);
+    nffs_test_util_assert_contents("/b.txt", appended, num_appends);
+
+    /* Simulate a reset in the middle of an incremental cycle. */
+    rc = nffs_gc_step(1, &done);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT_FATAL(!done);
+    appended[num_appends++] = 'y';
+    nffs_test_util_append_file("/b.txt", "y", 1);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "a.txt",
+                .contents = "abcdefgh",
+                .contents_len = 8,
+            }, {
+                .filename = "b.txt",
+                .contents = appended,
+                .contents_len = num_appends,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_detect(area_descs_three);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(!nffs_gc_in_progress());
+
+    nffs_test_assert_system(expected_system, area_descs_three);
+}
+
+TEST_CASE(nffs_test_gc_incremental_reset)
+{
+    static const struct nffs_area_desc area_descs_three[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0x00060000, 128 * 1024 },
+        { 0, 0 },
+    };
+    static const struct nffs_test_block_desc blocks[] = { {
+        .data = "abcd",
+        .data_len = 4,
+    }, {
+        .data = "efgh",
+        .data_len = 4,
+    }, {
+        .data = "ijkl",
+        .data_len = 4,
+    } };
+    struct nffs_inode_entry *inode_entry;
+    struct fs_file *file;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int done;
+    int rc;
+    int i;
+
+    for (i = 0; area_descs_three[i].nad_length != 0; i++) {
+        rc = flash_native_memset(area_descs_three[i].nad_offset, 0xff,
+                                 sizeof (struct nffs_disk_area));
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    rc = nffs_format(area_descs_three);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_util_create_file_blocks("/a.txt", blocks, 3);
+    rc = nffs_path_find_inode_entry("/a.txt", &inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Collect in small increments until the file's blocks have been moved
+     * into the destination area.
+     */
+    do {
+        rc = nffs_gc_step(1, &done);
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT_FATAL(!done);
+
+        nffs_flash_loc_expand(inode_entry->nie_last_block_entry->nhe_flash_loc,
+                              &area_idx, &area_offset);
+    } while (area_idx != nffs_scratch_area_idx);
+
+    /* Supersede the moved data before the cycle finishes; the new block lands
+     * in the third area.
+     */
+    rc = fs_open("/a.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, "X", 1);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "a.txt",
+                .contents = "Xbcdefghijkl",
+                .contents_len = 12,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    /* Simulate a reset before the cycle finishes. */
+    rc = nffs_misc_reset();
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_detect(area_descs_three);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(!nffs_gc_in_progress());
+
+    nffs_test_assert_system(expected_system, area_descs_three);
+}
+
+TEST_CASE(nffs_test_write_buffered)
+{
+    struct fs_file *file;
+    uint32_t len;
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_open("/log.txt",
+                 FS_ACCESS_WRITE | FS_ACCESS_APPEND | FS_ACCESS_BUFFERED,
+                 &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Small appends get coalesced; nothing reaches flash yet. */
+    for (i = 0; i < 10; i++) {
+        rc = fs_write(file, "abc", 3);
+        TEST_ASSERT(rc == 0);
+    }
+    nffs_test_util_assert_file_len(file, 30);
+    TEST_ASSERT(fs_getpos(file) == 30);
+    nffs_test_util_assert_block_count("/log.txt", 0);
+
+    /* An explicit flush commits a single block. */
+    rc = fs_flush(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/log.txt", 1);
+    nffs_test_util_assert_contents("/log.txt",
+                                   "abcabcabcabcabcabcabcabcabcabc", 30);
+
+    /* Close flushes any remaining data. */
+    for (i = 0; i < 4; i++) {
+        rc = fs_write(file, "de", 2);
+        TEST_ASSERT(rc == 0);
+    }
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/log.txt", 2);
+
+    /* Seeking flushes; overwrites are not buffered. */
+    rc = fs_open("/log.txt",
+                 FS_ACCESS_READ | FS_ACCESS_WRITE | FS_ACCESS_BUFFERED,
+                 &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 38);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "f", 1);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/log.txt", 3);
+    rc = fs_write(file, "X", 1);
+    TEST_ASSERT(rc == 0);
+    rc = fs_filelen(file, &len);
+    TEST_ASSERT(rc == 0 && len == 39);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "log.txt",
+                .contents = "Xbcabcabcabcabcabcabcabcabcabcdedededef",
+                .contents_len = 39,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    nffs_test_assert_system(expected_system, nffs_area_descs);
+}
+
+TEST_CASE(nffs_test_compress)
+{
+    static char data[1024];
+    static char expected[sizeof data * 2 + 16];
+    struct nffs_compress_stats stats;
+    struct fs_file *file;
+    const void *direct;
+    uint32_t len;
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    /* Log-like data; compresses well. */
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = "sensor=12 val=0034\n"[i % 19];
+    }
+
+    nffs_compress_get_stats(&stats, 1);
+
+    /* The flag requires write access. */
+    rc = fs_open("/log.txt", FS_ACCESS_READ | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    rc = fs_open("/log.txt", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, data, sizeof data);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data, sizeof data);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    nffs_compress_get_stats(&stats, 1);
+    TEST_ASSERT(stats.nzs_blocks_compressed == 2);
+    TEST_ASSERT(stats.nzs_blocks_raw == 0);
+    TEST_ASSERT(stats.nzs_bytes_in == sizeof data * 2);
+    TEST_ASSERT(stats.nzs_bytes_out * 4 < stats.nzs_bytes_in);
+
+    memcpy(expected, data, sizeof data);
+    memcpy(expected + sizeof data, data, sizeof data);
+    nffs_test_util_assert_contents("/log.txt", expected, sizeof data * 2);
+
+    /* Overwrite data spanning both blocks. */
+    rc = fs_open("/log.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, sizeof data - 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "ABCD", 4);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    memcpy(expected + sizeof data - 2, "ABCD", 4);
+    nffs_test_util_assert_contents("/log.txt", expected, sizeof data * 2);
+
+    /* Incompressible data is stored as is. */
+    nffs_compress_get_stats(&stats, 1);
+    nffs_test_util_append_file("/log.txt", "0123456789abcdef", 16);
+    nffs_compress_get_stats(&stats, 1);
+    TEST_ASSERT(stats.nzs_blocks_compressed == 0);
+    TEST_ASSERT(stats.nzs_blocks_raw == 1);
+    memcpy(expected + sizeof data * 2, "0123456789abcdef", 16);
+
+    /* Compressed data cannot be accessed directly. */
+    rc = fs_open("/log.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_read_direct(file, 16, &direct, &len);
+    TEST_ASSERT(rc == FS_EUNSUPP);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Files created without the flag are unaffected. */
+    nffs_test_util_create_file("/plain.txt", data, 64);
+    nffs_compress_get_stats(&stats, 1);
+    TEST_ASSERT(stats.nzs_bytes_in == 0);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "log.txt",
+                .contents = expected,
+                .contents_len = sizeof data * 2 + 16,
+            }, {
+                .filename = "plain.txt",
+                .contents = data,
+                .contents_len = 64,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    /* Compressed blocks survive garbage collection and a restore. */
+    nffs_test_assert_system(expected_system, nffs_area_descs);
+
+    /* The flag persists in the inode. */
+    nffs_compress_get_stats(&stats, 1);
+    nffs_test_util_append_file("/log.txt", data, 256);
+    nffs_compress_get_stats(&stats, 1);
+    TEST_ASSERT(stats.nzs_blocks_compressed == 1);
+}
+
 TEST_SUITE(nffs_suite_cache)
 {
     int rc;
@@ -2575,6 +3418,254 @@ TEST_SUITE(nffs_suite_cache)
     TEST_ASSERT(rc == 0);
 
     nffs_test_cache_large_file();
+    nffs_test_cache_read_ahead();
+
+    /* A zeroed setting selects the default; NFFS_READ_AHEAD_NONE disables
+     * prefetching.
+     */
+    TEST_ASSERT(nffs_cache_read_ahead == 4);
+    nffs_config.nc_read_ahead_blocks = NFFS_READ_AHEAD_NONE;
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_cache_read_ahead == 0);
+}
+
+TEST_CASE(nffs_test_hash_grow)
+{
+    static char expected[64 * 8];
+    struct nffs_hash_stats stats;
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    nffs_hash_get_stats(&stats, 1);
+    TEST_ASSERT(stats.nhs_num_buckets == 4);
+
+    /* Each small append creates a new data block. */
+    nffs_test_util_create_file("/myfile.txt", NULL, 0);
+    for (i = 0; i < 64; i++) {
+        memset(expected + i * 8, 'a' + i % 26, 8);
+        nffs_test_util_append_file("/myfile.txt", expected + i * 8, 8);
+    }
+    nffs_test_util_assert_contents("/myfile.txt", expected, sizeof expected);
+
+    nffs_hash_get_stats(&stats, 1);
+    TEST_ASSERT(stats.nhs_num_buckets > 4);
+    TEST_ASSERT(stats.nhs_splits == stats.nhs_num_buckets - 4);
+    TEST_ASSERT(stats.nhs_num_entries <= stats.nhs_num_buckets * 2);
+    TEST_ASSERT(stats.nhs_lookups > 0);
+    TEST_ASSERT(stats.nhs_probes >= stats.nhs_lookups);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "myfile.txt",
+                .contents = expected,
+                .contents_len = sizeof expected,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    /* The table is rebuilt and regrown during restore. */
+    nffs_test_assert_system(expected_system, nffs_area_descs);
+
+    nffs_hash_get_stats(&stats, 0);
+    TEST_ASSERT(stats.nhs_num_entries <= stats.nhs_num_buckets * 2);
+}
+
+TEST_SUITE(nffs_suite_hash)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_hash_buckets = 4;
+    nffs_config.nc_hash_max_load = 2;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_hash_grow();
+}
+
+TEST_CASE(nffs_test_readv_writev)
+{
+    static os_membuf_t membuf[OS_MEMPOOL_SIZE(16, 128)];
+    static struct os_mbuf_pool mbuf_pool;
+    static struct os_mempool mempool;
+    static char expected[600];
+    struct fs_iovec iov[3];
+    struct fs_file *file;
+    struct os_mbuf *om;
+    char buf[3][256];
+    uint32_t len;
+    int rc;
+    int i;
+
+    for (i = 0; i < sizeof expected; i++) {
+        expected[i] = i % 251;
+    }
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    /*** Vectored write. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    iov[0].fiv_base = expected;
+    iov[0].fiv_len = 10;
+    iov[1].fiv_base = expected + 10;
+    iov[1].fiv_len = 0;
+    iov[2].fiv_base = expected + 10;
+    iov[2].fiv_len = sizeof expected - 10;
+    rc = fs_writev(file, iov, 3);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", expected, sizeof expected);
+
+    /*** Vectored read; stops at end of file. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 3; i++) {
+        iov[i].fiv_base = buf[i];
+        iov[i].fiv_len = sizeof buf[i];
+    }
+    rc = fs_readv(file, iov, 3, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == sizeof expected);
+    TEST_ASSERT(memcmp(buf[0], expected, 256) == 0);
+    TEST_ASSERT(memcmp(buf[1], expected + 256, 256) == 0);
+    TEST_ASSERT(memcmp(buf[2], expected + 512, sizeof expected - 512) == 0);
+
+    /*** Read into an mbuf chain spanning several mbufs. */
+    if (mbuf_pool.omp_pool == NULL) {
+        /* The OS keeps a list of all mempools; only register this once. */
+        rc = os_mempool_init(&mempool, 16, 128, membuf, "nffs_test_mbuf");
+        TEST_ASSERT_FATAL(rc == 0);
+        rc = os_mbuf_pool_init(&mbuf_pool, &mempool, 128, 16);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    om = os_mbuf_get_pkthdr(&mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_mbuf(file, 1000, om, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == sizeof expected);
+    TEST_ASSERT(OS_MBUF_PKTHDR(om)->omp_len == sizeof expected);
+    TEST_ASSERT(os_mbuf_memcmp(om, 0, expected, sizeof expected) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Write an mbuf chain. */
+    rc = fs_open("/copy.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write_mbuf(file, om);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/copy.txt", expected, sizeof expected);
+
+    os_mbuf_free_chain(om);
+}
+
+TEST_CASE(nffs_test_inline)
+{
+    static const char big[] =
+        "abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz0123"
+        "456789";
+    char expected[sizeof big];
+    struct fs_file *file;
+    int rc;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT(rc == 0);
+
+    /* Small files don't use any data blocks. */
+    nffs_test_util_create_file("/myfile.txt", "abcdefgh", 8);
+    nffs_test_util_assert_contents("/myfile.txt", "abcdefgh", 8);
+    nffs_test_util_assert_block_count("/myfile.txt", 0);
+
+    nffs_test_util_append_file("/myfile.txt", "ijkl", 4);
+    nffs_test_util_assert_contents("/myfile.txt", "abcdefghijkl", 12);
+    nffs_test_util_assert_block_count("/myfile.txt", 0);
+
+    /* Overwrite in the middle of inline contents. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "XY", 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", "abXYefghijkl", 12);
+    nffs_test_util_assert_block_count("/myfile.txt", 0);
+
+    /* Renaming preserves the contents. */
+    rc = fs_rename("/myfile.txt", "/small.txt");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/small.txt", "abXYefghijkl", 12);
+    nffs_test_util_assert_block_count("/small.txt", 0);
+
+    /* A file at the limit is still inline; one byte more and it moves into
+     * data blocks.
+     */
+    nffs_test_util_create_file("/big.txt", big, 64);
+    nffs_test_util_assert_block_count("/big.txt", 0);
+    nffs_test_util_append_file("/big.txt", big + 64, sizeof big - 1 - 64);
+    nffs_test_util_assert_contents("/big.txt", big, sizeof big - 1);
+    nffs_test_util_assert_block_count("/big.txt", 2);
+
+    /* A write that exceeds the limit from the start bypasses the inode. */
+    nffs_test_util_create_file("/direct.txt", big, sizeof big - 1);
+    nffs_test_util_assert_block_count("/direct.txt", 1);
+
+    memcpy(expected, big, sizeof big);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "small.txt",
+                .contents = "abXYefghijkl",
+                .contents_len = 12,
+            }, {
+                .filename = "big.txt",
+                .contents = expected,
+                .contents_len = sizeof big - 1,
+            }, {
+                .filename = "direct.txt",
+                .contents = expected,
+                .contents_len = sizeof big - 1,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    nffs_test_assert_system(expected_system, nffs_area_descs);
+    nffs_test_util_assert_block_count("/small.txt", 0);
+}
+
+TEST_SUITE(nffs_suite_inline)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_inline_data_max = 64;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_inline();
 }
 
 static void
@@ -2591,6 +3682,7 @@ nffs_test_gen(void)
     nffs_test_truncate();
     nffs_test_append();
     nffs_test_read();
+    nffs_test_read_direct();
     nffs_test_open();
     nffs_test_overwrite_one();
     nffs_test_overwrite_two();
@@ -2601,6 +3693,9 @@ nffs_test_gen(void)
     nffs_test_many_children();
     nffs_test_gc();
     nffs_test_wear_level();
+    nffs_test_erase_count();
+    nffs_test_area_v0();
+    nffs_test_stats();
     nffs_test_corrupt_scratch();
     nffs_test_incomplete_block();
     nffs_test_corrupt_block();
@@ -2610,6 +3705,11 @@ nffs_test_gen(void)
     nffs_test_readdir();
     nffs_test_split_file();
     nffs_test_gc_on_oom();
+    nffs_test_gc_incremental();
+    nffs_test_gc_incremental_reset();
+    nffs_test_write_buffered();
+    nffs_test_compress();
+    nffs_test_readv_writev();
 }
 
 TEST_SUITE(gen_1_1)
@@ -2636,6 +3736,9 @@ TEST_SUITE(gen_32_1024)
 int
 nffs_test_all(void)
 {
+    /* Latencies are only recorded once cputime is running. */
+    cputime_init(1000000);
+
     nffs_config.nc_num_inodes = 1024 * 8;
     nffs_config.nc_num_blocks = 1024 * 20;
 
@@ -2643,6 +3746,8 @@ nffs_test_all(void)
     gen_4_32();
     gen_32_1024();
     nffs_suite_cache();
+    nffs_suite_hash();
+    nffs_suite_inline();
 
     return tu_any_failed;
 }
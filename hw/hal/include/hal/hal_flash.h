@@ -28,6 +28,8 @@ int hal_flash_write(uint8_t flash_id, uint32_t address, const void *src,
   uint32_t num_bytes);
 int hal_flash_erase_sector(uint8_t flash_id, uint32_t sector_address);
 int hal_flash_erase(uint8_t flash_id, uint32_t address, uint32_t num_bytes);
+int hal_flash_mmap(uint8_t flash_id, uint32_t address, uint32_t num_bytes,
+  const void **out_ptr);
 uint8_t hal_flash_align(uint8_t flash_id);
 int hal_flash_init(void);
 
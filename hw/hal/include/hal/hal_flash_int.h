@@ -30,6 +30,9 @@ struct hal_flash_funcs {
     int (*hff_erase_sector)(uint32_t sector_address);
     int (*hff_sector_info)(int idx, uint32_t *address, uint32_t *size);
     int (*hff_init)(void);
+    /* Optional; only for flash that is directly readable by the CPU. */
+    int (*hff_mmap)(uint32_t address, uint32_t num_bytes,
+      const void **out_ptr);
 };
 
 struct hal_flash {
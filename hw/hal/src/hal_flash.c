@@ -91,6 +91,27 @@ hal_flash_read(uint8_t id, uint32_t address, void *dst, uint32_t num_bytes)
     return hf->hf_itf->hff_read(address, dst, num_bytes);
 }
 
+/*
+ * Returns a pointer through which the specified range of flash can be read
+ * directly.  Fails if the flash is not memory mapped.
+ */
+int
+hal_flash_mmap(uint8_t id, uint32_t address, uint32_t num_bytes,
+  const void **out_ptr)
+{
+    const struct hal_flash *hf;
+
+    hf = bsp_flash_dev(id);
+    if (!hf || !hf->hf_itf->hff_mmap) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, address) ||
+      hal_flash_check_addr(hf, address + num_bytes)) {
+        return -1;
+    }
+    return hf->hf_itf->hff_mmap(address, num_bytes, out_ptr);
+}
+
 int
 hal_flash_write(uint8_t id, uint32_t address, const void *src,
   uint32_t num_bytes)
@@ -0,0 +1,87 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#ifndef H_NATIVE_FLASH_
+#define H_NATIVE_FLASH_
+
+#include <inttypes.h>
+
+/**
+ * Optional timing and wear model for the simulated flash.  When no model is
+ * installed, writes and erases complete instantly and overwriting programmed
+ * bytes triggers an assert, which is what the unit tests expect.
+ */
+struct native_flash_model {
+    /* Program time charged per byte written, in nanoseconds. */
+    uint32_t nfm_prog_ns_per_byte;
+
+    /* Erase time charged per sector erase, in microseconds. */
+    uint32_t nfm_erase_us;
+
+    /* Enforce NOR semantics: a write can only clear bits.  Writes which
+     * would set a bit are rejected with -1 and the flash keeps the AND of
+     * the old and new contents, as a real part would.
+     */
+    uint8_t nfm_nor;
+
+    /* Stall the calling thread for the charged time, so cputime based
+     * measurements see the latency.
+     */
+    uint8_t nfm_stall;
+
+    /* Flip one random bit per this many bytes programmed; 0 disables. */
+    uint32_t nfm_bit_error_rate;
+
+    /* Seed for the bit error generator. */
+    uint32_t nfm_seed;
+};
+
+/**
+ * Installs a flash model.  Passing NULL removes the model and restores the
+ * default instant, assert-on-overwrite behavior.  Erase counters and the
+ * virtual clock are not reset.
+ */
+void native_flash_model_set(const struct native_flash_model *model);
+
+/**
+ * @return                      Virtual time, in microseconds, charged by
+ *                                  writes and erases since the last reset.
+ */
+uint64_t native_flash_model_time_us(void);
+
+/**
+ * @return                      The number of bit errors injected since the
+ *                                  last reset.
+ */
+uint32_t native_flash_model_bit_errors(void);
+
+/**
+ * Returns the number of times a sector has been erased since the last reset.
+ *
+ * @param sector_idx            The index of the sector to query.
+ *
+ * @return                      The erase count; 0 for an invalid index.
+ */
+uint32_t native_flash_erase_cnt(int sector_idx);
+
+/**
+ * Clears the virtual clock, bit error count and erase counters.
+ */
+void native_flash_model_reset(void);
+
+#endif /* H_NATIVE_FLASH_ */
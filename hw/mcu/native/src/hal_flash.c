@@ -23,26 +23,37 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <time.h>
 #include "hal/hal_flash_int.h"
 #include "mcu/mcu_sim.h"
+#include "mcu/native_flash.h"
 
 char *native_flash_file;
 static int file;
 static void *file_loc;
 
+static struct native_flash_model native_flash_model;
+static int native_flash_model_on;
+static uint64_t native_flash_model_ns;
+static uint32_t native_flash_model_errs;
+static uint32_t native_flash_model_rand;
+
 static int native_flash_init(void);
 static int native_flash_read(uint32_t address, void *dst, uint32_t length);
 static int native_flash_write(uint32_t address, const void *src,
   uint32_t length);
 static int native_flash_erase_sector(uint32_t sector_address);
 static int native_flash_sector_info(int idx, uint32_t *address, uint32_t *size);
+static int native_flash_mmap(uint32_t address, uint32_t length,
+  const void **out_ptr);
 
 static const struct hal_flash_funcs native_flash_funcs = {
     .hff_read = native_flash_read,
     .hff_write = native_flash_write,
     .hff_erase_sector = native_flash_erase_sector,
     .hff_sector_info = native_flash_sector_info,
-    .hff_init = native_flash_init
+    .hff_init = native_flash_init,
+    .hff_mmap = native_flash_mmap
 };
 
 static const uint32_t native_flash_sectors[] = {
@@ -63,6 +74,8 @@ static const uint32_t native_flash_sectors[] = {
 #define FLASH_NUM_AREAS   (int)(sizeof native_flash_sectors /           \
                                 sizeof native_flash_sectors[0])
 
+static uint32_t native_flash_erase_cnts[FLASH_NUM_AREAS];
+
 const struct hal_flash native_flash_dev = {
     .hf_itf = &native_flash_funcs,
     .hf_base_addr = 0,
@@ -112,6 +125,70 @@ flash_native_ensure_file_open(void)
     }
 }
 
+/**
+ * Charges the specified number of nanoseconds against the virtual clock, and
+ * sleeps for that long if the model asks for stalls.
+ */
+static void
+flash_native_model_charge(uint64_t ns)
+{
+    struct timespec ts;
+
+    native_flash_model_ns += ns;
+    if (native_flash_model.nfm_stall && ns != 0) {
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static uint32_t
+flash_native_model_rand(void)
+{
+    /* xorshift32; the state must never be zero. */
+    native_flash_model_rand ^= native_flash_model_rand << 13;
+    native_flash_model_rand ^= native_flash_model_rand >> 17;
+    native_flash_model_rand ^= native_flash_model_rand << 5;
+    return native_flash_model_rand;
+}
+
+/**
+ * Applies the NOR and bit error parts of the model to a chunk about to be
+ * programmed.  On input, buf contains the current flash contents; on output,
+ * it contains what the flash will hold after the write.
+ *
+ * @return                      0 if the write only clears bits;
+ *                              -1 if it tried to set a programmed bit.
+ */
+static int
+flash_native_model_program(uint8_t *buf, const uint8_t *src, int len)
+{
+    uint32_t rate;
+    int rc;
+    int i;
+
+    rc = 0;
+    rate = native_flash_model.nfm_bit_error_rate;
+    for (i = 0; i < len; i++) {
+        if (native_flash_model.nfm_nor) {
+            if (src[i] & ~buf[i]) {
+                rc = -1;
+            }
+            buf[i] &= src[i];
+        } else {
+            assert(buf[i] == 0xff);
+            buf[i] = src[i];
+        }
+
+        if (rate != 0 && flash_native_model_rand() % rate == 0) {
+            buf[i] ^= 1 << (flash_native_model_rand() % 8);
+            native_flash_model_errs++;
+        }
+    }
+
+    return rc;
+}
+
 static int
 flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
                             int allow_overwrite)
@@ -120,6 +197,7 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
     uint32_t cur;
     uint32_t end;
     int chunk_sz;
+    int model_rc;
     int rc;
     int i;
 
@@ -131,6 +209,30 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
 
     flash_native_ensure_file_open();
 
+    if (native_flash_model_on && !allow_overwrite) {
+        model_rc = 0;
+        for (cur = address; cur < end; cur += chunk_sz) {
+            if (end - cur < sizeof buf) {
+                chunk_sz = end - cur;
+            } else {
+                chunk_sz = sizeof buf;
+            }
+
+            rc = native_flash_read(cur, buf, chunk_sz);
+            assert(rc == 0);
+            if (flash_native_model_program(buf,
+                                           (uint8_t *)src + (cur - address),
+                                           chunk_sz) != 0) {
+                model_rc = -1;
+            }
+            memcpy((char *)file_loc + cur, buf, chunk_sz);
+        }
+
+        flash_native_model_charge((uint64_t)length *
+                                  native_flash_model.nfm_prog_ns_per_byte);
+        return model_rc;
+    }
+
     cur = address;
     while (cur < end) {
         if (end - cur < sizeof buf) {
@@ -179,6 +281,15 @@ native_flash_read(uint32_t address, void *dst, uint32_t length)
     return 0;
 }
 
+static int
+native_flash_mmap(uint32_t address, uint32_t length, const void **out_ptr)
+{
+    flash_native_ensure_file_open();
+    *out_ptr = (char *)file_loc + address;
+
+    return 0;
+}
+
 static int
 find_area(uint32_t address)
 {
@@ -220,6 +331,11 @@ native_flash_erase_sector(uint32_t sector_address)
     }
     len = flash_sector_len(area_id);
     flash_native_erase(sector_address, len);
+    native_flash_erase_cnts[area_id]++;
+    if (native_flash_model_on) {
+        flash_native_model_charge(
+            (uint64_t)native_flash_model.nfm_erase_us * 1000);
+    }
     return 0;
 }
 
@@ -242,3 +358,48 @@ native_flash_init(void)
     return 0;
 }
 
+void
+native_flash_model_set(const struct native_flash_model *model)
+{
+    if (model == NULL) {
+        native_flash_model_on = 0;
+        memset(&native_flash_model, 0, sizeof native_flash_model);
+        return;
+    }
+
+    native_flash_model = *model;
+    native_flash_model_rand = model->nfm_seed;
+    if (native_flash_model_rand == 0) {
+        native_flash_model_rand = 1;
+    }
+    native_flash_model_on = 1;
+}
+
+uint64_t
+native_flash_model_time_us(void)
+{
+    return native_flash_model_ns / 1000;
+}
+
+uint32_t
+native_flash_model_bit_errors(void)
+{
+    return native_flash_model_errs;
+}
+
+uint32_t
+native_flash_erase_cnt(int sector_idx)
+{
+    if (sector_idx < 0 || sector_idx >= FLASH_NUM_AREAS) {
+        return 0;
+    }
+    return native_flash_erase_cnts[sector_idx];
+}
+
+void
+native_flash_model_reset(void)
+{
+    native_flash_model_ns = 0;
+    native_flash_model_errs = 0;
+    memset(native_flash_erase_cnts, 0, sizeof native_flash_erase_cnts);
+}
@@ -79,6 +79,14 @@ typedef enum os_error os_error_t;
 void os_init(void);
 void os_start(void);
 
+/**
+ * If set, gets called with interrupts disabled when system is about to be
+ * reset due to a failed assert or an unhandled fault. E.g. for flushing
+ * logs to storage.
+ */
+typedef void (*os_fault_hook_t)(void);
+extern os_fault_hook_t os_fault_hook;
+
 /* XXX: Not sure if this should go here; I want to differentiate API that
  * should be called by application developers as those that should not. */
 void os_init_idle_task(void);
@@ -40,6 +40,9 @@ __assert_func(const char *file, int line, const char *func, const char *e)
     os_die_module = file;
     console_blocking_mode();
     console_printf("Assert %s; failed in %s:%d\n", e ? e : "", file, line);
+    if (os_fault_hook) {
+        os_fault_hook();
+    }
     system_reset();
 }
 
@@ -82,6 +85,9 @@ os_default_irq(struct trap_frame *tf)
     console_printf("r12:0x%08lx  lr:0x%08lx  pc:0x%08lx psr:0x%08lx\n",
       tf->ef->r12, tf->ef->lr, tf->ef->pc, tf->ef->psr);
     console_printf("ICSR:0x%08lx\n", SCB->ICSR);
+    if (os_fault_hook) {
+        os_fault_hook();
+    }
     system_reset();
 }
 
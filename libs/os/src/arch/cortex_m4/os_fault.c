@@ -40,6 +40,9 @@ __assert_func(const char *file, int line, const char *func, const char *e)
     os_die_module = file;
     console_blocking_mode();
     console_printf("Assert %s; failed in %s:%d\n", e ? e : "", file, line);
+    if (os_fault_hook) {
+        os_fault_hook();
+    }
     system_reset();
 }
 
@@ -84,5 +87,8 @@ os_default_irq(struct trap_frame *tf)
     console_printf("ICSR:0x%08lx HFSR:0x%08lx CFSR:0x%08lx\n",
       SCB->ICSR, SCB->HFSR, SCB->CFSR);
     console_printf("BFAR:0x%08lx MMFAR:0x%08lx\n", SCB->BFAR, SCB->MMFAR);
+    if (os_fault_hook) {
+        os_fault_hook();
+    }
     system_reset();
 }
@@ -30,5 +30,8 @@ __assert_func(const char *file, int line, const char *func, const char *e)
 
     snprintf(msg, sizeof(msg), "assert at %s:%d\n", file, line);
     write(1, msg, strlen(msg));
+    if (os_fault_hook) {
+        os_fault_hook();
+    }
     _exit(1);
 }
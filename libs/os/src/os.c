@@ -32,6 +32,9 @@ uint32_t g_os_idle_ctr;
  */
 int g_os_started; 
 
+/* Called by the architecture specific code before reset on a fault. */
+os_fault_hook_t os_fault_hook;
+
 #ifdef ARCH_sim
 #define MIN_IDLE_TICKS  1
 #else
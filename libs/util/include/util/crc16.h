@@ -25,11 +25,39 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#ifndef _CRC16_H_
-#define _CRC16_H_
+#ifndef H_UTIL_CRC16_
+#define H_UTIL_CRC16_
 
 #include <inttypes.h>
 
-unsigned short crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
+/*
+ * CRC16-CCITT (polynomial 0x1021, MSB first, no reflection or final xor).
+ *
+ * The software kernel processes CRC16_SLICE_BY bytes per step using that
+ * many 512-byte lookup tables.  The default is 8; builds short on flash can
+ * define CRC16_SLICE_BY as 4 or 1 (the classic byte-at-a-time table).
+ */
+#ifndef CRC16_SLICE_BY
+#define CRC16_SLICE_BY  8
+#endif
+
+/**
+ * Signature of a hardware CRC16-CCITT implementation; must produce the same
+ * result as crc16_ccitt_sw().
+ */
+typedef uint16_t crc16_hw_func_t(uint16_t initial_crc, const void *buf,
+                                 int len);
+
+uint16_t crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
+uint16_t crc16_ccitt_sw(uint16_t initial_crc, const void *buf, int len);
+uint16_t crc16_ccitt_bytewise(uint16_t initial_crc, const void *buf, int len);
+
+/**
+ * Routes crc16_ccitt() calls to an MCU CRC peripheral.  Buffers shorter than
+ * min_len still use the software kernel, since starting the peripheral
+ * usually costs more than a few table lookups.  Pass NULL to remove the
+ * hook.
+ */
+void crc16_ccitt_hw_register(crc16_hw_func_t *fn, int min_len);
 
-#endif /* _CRC16_H_ */
+#endif /* H_UTIL_CRC16_ */
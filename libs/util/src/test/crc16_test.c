@@ -0,0 +1,94 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include <string.h>
+
+#include "testutil/testutil.h"
+#include "util/crc16.h"
+
+static uint8_t crc16_test_buf[1031];
+
+static uint16_t crc16_test_hw_calls;
+
+static uint16_t
+crc16_test_hw(uint16_t initial_crc, const void *buf, int len)
+{
+    crc16_test_hw_calls++;
+    return crc16_ccitt_bytewise(initial_crc, buf, len);
+}
+
+TEST_CASE(crc16_test_check_value)
+{
+    /* The standard check value for CRC16-CCITT with a zero seed. */
+    TEST_ASSERT(crc16_ccitt(0, "123456789", 9) == 0x31c3);
+    TEST_ASSERT(crc16_ccitt_bytewise(0, "123456789", 9) == 0x31c3);
+    TEST_ASSERT(crc16_ccitt(0x1234, NULL, 0) == 0x1234);
+}
+
+TEST_CASE(crc16_test_slices)
+{
+    uint16_t expected;
+    int off;
+    int len;
+    int i;
+
+    for (i = 0; i < sizeof crc16_test_buf; i++) {
+        crc16_test_buf[i] = i * 31 + (i >> 3);
+    }
+
+    /* Every length and alignment must agree with the byte-wise kernel. */
+    for (off = 0; off < 8; off++) {
+        for (len = 0; len < 64; len++) {
+            expected = crc16_ccitt_bytewise(0xffff, crc16_test_buf + off, len);
+            TEST_ASSERT(crc16_ccitt_sw(0xffff, crc16_test_buf + off, len) ==
+                        expected);
+        }
+    }
+
+    /* Checksumming in pieces must match checksumming all at once. */
+    expected = crc16_ccitt(0, crc16_test_buf, sizeof crc16_test_buf);
+    TEST_ASSERT(crc16_ccitt(crc16_ccitt(0, crc16_test_buf, 13),
+                            crc16_test_buf + 13,
+                            sizeof crc16_test_buf - 13) == expected);
+}
+
+TEST_CASE(crc16_test_hw_hook)
+{
+    uint16_t crc;
+
+    crc16_ccitt_hw_register(crc16_test_hw, 16);
+
+    crc = crc16_ccitt(0, crc16_test_buf, 8);
+    TEST_ASSERT(crc16_test_hw_calls == 0);
+    TEST_ASSERT(crc == crc16_ccitt_sw(0, crc16_test_buf, 8));
+
+    crc = crc16_ccitt(0, crc16_test_buf, 100);
+    TEST_ASSERT(crc16_test_hw_calls == 1);
+    TEST_ASSERT(crc == crc16_ccitt_sw(0, crc16_test_buf, 100));
+
+    crc16_ccitt_hw_register(NULL, 0);
+    crc16_ccitt(0, crc16_test_buf, 100);
+    TEST_ASSERT(crc16_test_hw_calls == 1);
+}
+
+TEST_SUITE(crc16_test_suite)
+{
+    crc16_test_check_value();
+    crc16_test_slices();
+    crc16_test_hw_hook();
+}
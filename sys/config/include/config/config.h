@@ -50,6 +50,22 @@ struct conf_handler {
     int (*ch_commit)(void);
     int (*ch_export)(void (*export_func)(struct conf_handler *ch,
         char *name, char *val));
+
+    /*
+     * Optional typed access. If ch_get_raw is present, conf_save() asks it
+     * for the value of every exported name and stores it in binary form;
+     * *len is the size of val on entry, and length of the value on exit.
+     * ch_set_raw gets called for values loaded from binary records;
+     * *val may not be aligned. ch_set is still used for text records.
+     */
+    int (*ch_get_raw)(int argc, char **argv, enum conf_type *type, void *val,
+        int *len);
+    int (*ch_set_raw)(int argc, char **argv, enum conf_type type, void *val,
+        int len);
+
+    /* Maintained by conf_register(). */
+    struct conf_handler *ch_hash_next;
+    uint32_t ch_name_hash;
 };
 
 int conf_init(void);
@@ -58,6 +74,8 @@ int conf_load(void);
 
 int conf_save(void);
 int conf_save_one(const struct conf_handler *, const char *name, char *var);
+int conf_save_one_raw(const struct conf_handler *, const char *name,
+  enum conf_type type, const void *val, int len);
 
 /*
   XXXX for later
@@ -66,7 +84,11 @@ int conf_save_one(const struct conf_handler *, const char *name, char *var);
 */
 
 int conf_set_value(char *name, char *val_str);
+int conf_set_value_raw(char *name, enum conf_type type, void *val, int len);
 char *conf_get_value(char *name, char *buf, int buf_len);
+int conf_set_values(int cnt, char *names[], char *vals[]);
+int conf_get_values(int cnt, char *names[], char *vals[], char *buf,
+  int buf_len);
 int conf_commit(char *name);
 
 int conf_value_from_str(char *val_str, enum conf_type type, void *vp,
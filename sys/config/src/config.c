@@ -28,11 +28,18 @@
 
 struct conf_handler_head conf_handlers = SLIST_HEAD_INITIALIZER(&conf_handlers);
 
+/*
+ * Handlers hashed by name; chained through ch_hash_next.
+ */
+#define CONF_HANDLER_HASH_SIZE  16      /* Must be a power of two. */
+static struct conf_handler *conf_handler_hash[CONF_HANDLER_HASH_SIZE];
+
 int
 conf_init(void)
 {
     int rc = 0;
 
+    conf_stats_register();
 #ifdef SHELL_PRESENT
     rc = conf_cli_register();
 #endif
@@ -45,20 +52,27 @@ conf_init(void)
 int
 conf_register(struct conf_handler *handler)
 {
+    struct conf_handler **bucket;
+
+    handler->ch_name_hash = conf_name_hash(handler->ch_name);
+    bucket = &conf_handler_hash[handler->ch_name_hash &
+      (CONF_HANDLER_HASH_SIZE - 1)];
+    handler->ch_hash_next = *bucket;
+    *bucket = handler;
+
     SLIST_INSERT_HEAD(&conf_handlers, handler, ch_list);
     return 0;
 }
 
-/*
- * Find conf_handler based on name.
- */
-struct conf_handler *
-conf_handler_lookup(char *name)
+static struct conf_handler *
+conf_handler_find(const char *name, uint32_t hash)
 {
     struct conf_handler *ch;
 
-    SLIST_FOREACH(ch, &conf_handlers, ch_list) {
-        if (!strcmp(name, ch->ch_name)) {
+    for (ch = conf_handler_hash[hash & (CONF_HANDLER_HASH_SIZE - 1)];
+         ch;
+         ch = ch->ch_hash_next) {
+        if (ch->ch_name_hash == hash && !strcmp(name, ch->ch_name)) {
             return ch;
         }
     }
@@ -66,38 +80,67 @@ conf_handler_lookup(char *name)
 }
 
 /*
- * Separate string into argv array.
+ * Find conf_handler based on name.
+ */
+struct conf_handler *
+conf_handler_lookup(char *name)
+{
+    return conf_handler_find(name, conf_name_hash(name));
+}
+
+/*
+ * Separate name into argv array. Name is copied into cn, so it is not
+ * modified. Empty elements are skipped.
  */
 int
-conf_parse_name(char *name, int *name_argc, char *name_argv[])
+conf_name_parse(const char *name, struct conf_name *cn)
 {
-    char *tok;
-    char *tok_ptr;
-    char *sep = CONF_NAME_SEPARATOR;
+    int start;
+    int len;
     int i;
 
-    tok = strtok_r(name, sep, &tok_ptr);
-
-    i = 0;
-    while (tok) {
-        name_argv[i++] = tok;
-        tok = strtok_r(NULL, sep, &tok_ptr);
+    len = strlen(name);
+    if (len >= sizeof(cn->cn_buf)) {
+        return OS_INVALID_PARM;
+    }
+    cn->cn_argc = 0;
+    start = 1;
+    for (i = 0; i <= len; i++) {
+        if (name[i] == CONF_NAME_SEPARATOR[0] || name[i] == '\0') {
+            cn->cn_buf[i] = '\0';
+            start = 1;
+            continue;
+        }
+        cn->cn_buf[i] = name[i];
+        if (start) {
+            if (cn->cn_argc == CONF_MAX_DIR_DEPTH) {
+                return OS_INVALID_PARM;
+            }
+            cn->cn_argv[cn->cn_argc++] = &cn->cn_buf[i];
+            start = 0;
+        }
+    }
+    if (cn->cn_argc == 0) {
+        return OS_INVALID_PARM;
     }
-    *name_argc = i;
-
     return 0;
 }
 
+/*
+ * Parse name, and find the handler for it. If prev is given, and the name
+ * belongs to the same handler, no lookup is done.
+ */
 static struct conf_handler *
-conf_parse_and_lookup(char *name, int *name_argc, char *name_argv[])
+conf_name_lookup(const char *name, struct conf_name *cn,
+  struct conf_handler *prev)
 {
-    int rc;
-
-    rc = conf_parse_name(name, name_argc, name_argv);
-    if (rc) {
+    if (conf_name_parse(name, cn)) {
         return NULL;
     }
-    return conf_handler_lookup(name_argv[0]);
+    if (prev && !strcmp(cn->cn_argv[0], prev->ch_name)) {
+        return prev;
+    }
+    return conf_handler_lookup(cn->cn_argv[0]);
 }
 
 int
@@ -205,16 +248,83 @@ conf_str_from_bytes(void *vp, int vp_len, char *buf, int buf_len)
 int
 conf_set_value(char *name, char *val_str)
 {
-    int name_argc;
-    char *name_argv[CONF_MAX_DIR_DEPTH];
+    struct conf_name cn;
     struct conf_handler *ch;
 
-    ch = conf_parse_and_lookup(name, &name_argc, name_argv);
+    ch = conf_name_lookup(name, &cn, NULL);
     if (!ch) {
         return OS_INVALID_PARM;
     }
 
-    return ch->ch_set(name_argc - 1, &name_argv[1], val_str);
+    return ch->ch_set(cn.cn_argc - 1, &cn.cn_argv[1], val_str);
+}
+
+/*
+ * Set several values. Names belonging to the same handler as the previous
+ * one don't need another handler lookup. Returns the first error, but
+ * attempts to set all values.
+ */
+int
+conf_set_values(int cnt, char *names[], char *vals[])
+{
+    struct conf_name cn;
+    struct conf_handler *ch;
+    int rc;
+    int rc2;
+    int i;
+
+    rc = 0;
+    ch = NULL;
+    for (i = 0; i < cnt; i++) {
+        ch = conf_name_lookup(names[i], &cn, ch);
+        if (!ch) {
+            rc2 = OS_INVALID_PARM;
+        } else {
+            rc2 = ch->ch_set(cn.cn_argc - 1, &cn.cn_argv[1], vals[i]);
+        }
+        if (!rc) {
+            rc = rc2;
+        }
+    }
+    return rc;
+}
+
+/*
+ * Set typed value. Handlers without ch_set_raw get the value in string
+ * form.
+ */
+int
+conf_set_value_raw(char *name, enum conf_type type, void *val, int len)
+{
+    struct conf_name cn;
+    struct conf_handler *ch;
+    union {
+        uint64_t u64;
+        double d;
+        char buf[CONF_MAX_VAL_LEN];
+    } tmp;
+    char *val_str;
+    int rc;
+
+    if (len < 0 || len > sizeof(tmp)) {
+        return OS_INVALID_PARM;
+    }
+    ch = conf_name_lookup(name, &cn, NULL);
+    if (!ch) {
+        return OS_INVALID_PARM;
+    }
+
+    if (ch->ch_set_raw) {
+        /* Hand it over aligned. */
+        memcpy(&tmp, val, len);
+        return ch->ch_set_raw(cn.cn_argc - 1, &cn.cn_argv[1], type, &tmp,
+          len);
+    }
+    rc = conf_bin_str(type, val, len, tmp.buf, sizeof(tmp.buf), &val_str);
+    if (rc) {
+        return rc;
+    }
+    return ch->ch_set(cn.cn_argc - 1, &cn.cn_argv[1], val_str);
 }
 
 /*
@@ -226,29 +336,66 @@ conf_set_value(char *name, char *val_str)
 char *
 conf_get_value(char *name, char *buf, int buf_len)
 {
-    int name_argc;
-    char *name_argv[CONF_MAX_DIR_DEPTH];
+    struct conf_name cn;
     struct conf_handler *ch;
 
-    ch = conf_parse_and_lookup(name, &name_argc, name_argv);
+    ch = conf_name_lookup(name, &cn, NULL);
     if (!ch) {
         return NULL;
     }
 
-    return ch->ch_get(name_argc - 1, &name_argv[1], buf, buf_len);
+    return ch->ch_get(cn.cn_argc - 1, &cn.cn_argv[1], buf, buf_len);
+}
+
+/*
+ * Get several values in printable string form. Values which are formatted
+ * by the handler are packed one after another in buf. vals[i] is set to
+ * NULL for names which were not found, or did not fit. Returns the number
+ * of values found.
+ */
+int
+conf_get_values(int cnt, char *names[], char *vals[], char *buf, int buf_len)
+{
+    struct conf_name cn;
+    struct conf_handler *ch;
+    char *val;
+    int found;
+    int off;
+    int i;
+
+    found = 0;
+    off = 0;
+    ch = NULL;
+    for (i = 0; i < cnt; i++) {
+        vals[i] = NULL;
+        ch = conf_name_lookup(names[i], &cn, ch);
+        if (!ch || off >= buf_len) {
+            continue;
+        }
+        val = ch->ch_get(cn.cn_argc - 1, &cn.cn_argv[1], buf + off,
+          buf_len - off);
+        if (!val) {
+            continue;
+        }
+        if (val == buf + off) {
+            off += strlen(val) + 1;
+        }
+        vals[i] = val;
+        found++;
+    }
+    return found;
 }
 
 int
 conf_commit(char *name)
 {
-    int name_argc;
-    char *name_argv[CONF_MAX_DIR_DEPTH];
+    struct conf_name cn;
     struct conf_handler *ch;
     int rc;
     int rc2;
 
     if (name) {
-        ch = conf_parse_and_lookup(name, &name_argc, name_argv);
+        ch = conf_name_lookup(name, &cn, NULL);
         if (!ch) {
             return OS_INVALID_PARM;
         }
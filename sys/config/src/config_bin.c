@@ -0,0 +1,198 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include <os/os.h>
+
+#include "config/config.h"
+#include "config_priv.h"
+
+/*
+ * Binary config record:
+ *   struct conf_bin_hdr
+ *   name, "handler/var", including the terminating '\0'
+ *   value; integers and floats in native byte order, strings without '\0'
+ *
+ * First byte of a text record is always printable, so the two kinds can be
+ * mixed in the same store.
+ */
+
+uint32_t
+conf_name_hash(const char *name)
+{
+    uint32_t hash;
+
+    /* FNV-1a */
+    hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+int
+conf_bin_make(char *dst, int dlen, const struct conf_handler *ch,
+  const char *name, enum conf_type type, const void *val, int vlen)
+{
+    struct conf_bin_hdr hdr;
+    int clen;
+    int nlen;
+    int off;
+
+    if (type == CONF_NONE) {
+        vlen = 0;
+    }
+    clen = strlen(ch->ch_name);
+    nlen = strlen(name);
+    if (clen + nlen + 2 > CONF_MAX_NAME_LEN || vlen < 0 ||
+      vlen > CONF_BIN_MAX_VAL_LEN) {
+        return -1;
+    }
+    if (sizeof(hdr) + clen + nlen + 2 + vlen > dlen) {
+        return -1;
+    }
+    off = sizeof(hdr);
+    memcpy(dst + off, ch->ch_name, clen);
+    off += clen;
+    dst[off++] = '/';
+    memcpy(dst + off, name, nlen);
+    off += nlen;
+    dst[off++] = '\0';
+
+    hdr.cbh_magic = CONF_BIN_MAGIC;
+    hdr.cbh_type = type;
+    hdr.cbh_name_len = off - sizeof(hdr);
+    hdr.cbh_val_len = vlen;
+    hdr.cbh_name_hash = conf_name_hash(dst + sizeof(hdr));
+    memcpy(dst, &hdr, sizeof(hdr));
+
+    memcpy(dst + off, val, vlen);
+    off += vlen;
+
+    return off;
+}
+
+/*
+ * Returns the length of the record at the start of buf, or -1 if it is
+ * not a complete, well formed binary record.
+ */
+int
+conf_bin_parse(char *buf, int len, struct conf_bin_hdr *hdr, char **namep,
+  void **valp)
+{
+    int rlen;
+
+    if (len < sizeof(*hdr)) {
+        return -1;
+    }
+    memcpy(hdr, buf, sizeof(*hdr));
+    if (hdr->cbh_magic != CONF_BIN_MAGIC || hdr->cbh_name_len < 2 ||
+      hdr->cbh_name_len > CONF_MAX_NAME_LEN) {
+        return -1;
+    }
+    rlen = sizeof(*hdr) + hdr->cbh_name_len + hdr->cbh_val_len;
+    if (rlen > len) {
+        return -1;
+    }
+    *namep = buf + sizeof(*hdr);
+    if ((*namep)[hdr->cbh_name_len - 1] != '\0') {
+        return -1;
+    }
+    *valp = *namep + hdr->cbh_name_len;
+    return rlen;
+}
+
+/*
+ * Convert typed value to string form accepted by ch_set(). Value of
+ * type CONF_NONE is a deleted one, and converts to NULL.
+ */
+int
+conf_bin_str(enum conf_type type, const void *val, int vlen, char *buf,
+  int buf_len, char **strp)
+{
+    union {
+        int8_t i8;
+        int16_t i16;
+        int32_t i32;
+    } tmp;
+
+    switch (type) {
+    case CONF_NONE:
+        *strp = NULL;
+        return 0;
+    case CONF_INT8:
+    case CONF_INT16:
+    case CONF_INT32:
+        if ((type == CONF_INT8 && vlen != sizeof(tmp.i8)) ||
+          (type == CONF_INT16 && vlen != sizeof(tmp.i16)) ||
+          (type == CONF_INT32 && vlen != sizeof(tmp.i32))) {
+            return OS_INVALID_PARM;
+        }
+        memcpy(&tmp, val, vlen);
+        *strp = conf_str_from_value(type, &tmp, buf, buf_len);
+        break;
+    case CONF_STRING:
+        if (vlen + 1 > buf_len) {
+            return OS_INVALID_PARM;
+        }
+        memcpy(buf, val, vlen);
+        buf[vlen] = '\0';
+        *strp = buf;
+        break;
+    case CONF_BYTES:
+        *strp = conf_str_from_bytes((void *)val, vlen, buf, buf_len);
+        break;
+    default:
+        return OS_INVALID_PARM;
+    }
+    if (!*strp) {
+        return OS_INVALID_PARM;
+    }
+    return 0;
+}
+
+/*
+ * Pass a binary record read from storage to load callbacks. Returns the
+ * length of the record, or -1 if it's corrupt.
+ */
+int
+conf_bin_load_one(char *buf, int len, load_cb cb, load_raw_cb raw_cb,
+  void *cb_arg)
+{
+    struct conf_bin_hdr hdr;
+    char str[CONF_MAX_VAL_LEN];
+    char *name;
+    char *val_str;
+    void *val;
+    int rlen;
+
+    rlen = conf_bin_parse(buf, len, &hdr, &name, &val);
+    if (rlen < 0) {
+        return -1;
+    }
+    if (raw_cb) {
+        raw_cb(name, hdr.cbh_type, val, hdr.cbh_val_len, cb_arg);
+    } else if (!conf_bin_str(hdr.cbh_type, val, hdr.cbh_val_len, str,
+        sizeof(str), &val_str)) {
+        cb(name, val_str, cb_arg);
+    }
+    return rlen;
+}
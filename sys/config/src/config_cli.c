@@ -65,7 +65,7 @@ conf_dump_saved(void)
     struct conf_store *cs;
 
     SLIST_FOREACH(cs, &conf_load_srcs, cs_next) {
-        cs->cs_itf->csi_load(cs, conf_saved_one, NULL);
+        cs->cs_itf->csi_load(cs, conf_saved_one, NULL, NULL);
     }
 }
 
@@ -19,7 +19,9 @@
 
 #ifdef FCB_PRESENT
 #include <os/os.h>
+#include <os/os_malloc.h>
 #include <fcb/fcb.h>
+#include <stats/stats.h>
 #include <string.h>
 
 #include "config/config.h"
@@ -29,22 +31,72 @@
 #define CONF_FCB_MAGIC		0xc0ffeeee
 #define CONF_FCB_VERS		1
 
+#define CONF_FCB_HASH_BUCKETS	32
+#define CONF_FCB_ENT_CHUNK	16
+#define CONF_FCB_ENT_NONE	0xffff
+
 struct conf_fcb_load_cb_arg {
+    struct conf_fcb *cf;
     load_cb cb;
+    load_raw_cb raw_cb;
     void *cb_arg;
 };
 
-static int conf_fcb_load(struct conf_store *, load_cb cb, void *cb_arg);
+/*
+ * One setting name found in the sector being compacted, with the location
+ * of its latest value within that sector.
+ */
+struct conf_fcb_compress_ent {
+    uint32_t cce_hash;
+    uint32_t cce_data_off;
+    uint16_t cce_data_len;
+    uint16_t cce_next;          /* Next entry in the same hash bucket. */
+    uint8_t cce_superseded;     /* Newer value exists in a later sector. */
+};
+
+struct conf_fcb_compress_tbl {
+    struct conf_fcb_compress_ent *cct_ents;
+    uint16_t cct_cnt;
+    uint16_t cct_max;
+    uint16_t cct_total;         /* Entries in the sector, incl. repeats. */
+    uint16_t cct_buckets[CONF_FCB_HASH_BUCKETS];
+};
+
+STATS_SECT_START(conf_fcb_stats)
+    STATS_SECT_ENTRY(compressions)
+    STATS_SECT_ENTRY(compress_ms)       /* Duration of the last one. */
+    STATS_SECT_ENTRY(entries_copied)
+    STATS_SECT_ENTRY(entries_dropped)
+STATS_SECT_END
+static STATS_SECT_DECL(conf_fcb_stats) conf_fcb_stats;
+
+STATS_NAME_START(conf_fcb_stats)
+    STATS_NAME(conf_fcb_stats, compressions)
+    STATS_NAME(conf_fcb_stats, compress_ms)
+    STATS_NAME(conf_fcb_stats, entries_copied)
+    STATS_NAME(conf_fcb_stats, entries_dropped)
+STATS_NAME_END(conf_fcb_stats)
+
+static uint8_t conf_fcb_stats_registered;
+
+static int conf_fcb_load(struct conf_store *, load_cb cb, load_raw_cb raw_cb,
+  void *cb_arg);
 static int conf_fcb_save_start(struct conf_store *);
 static int conf_fcb_save(struct conf_store *, const struct conf_handler *,
   const char *name, const char *value);
+static int conf_fcb_save_raw(struct conf_store *, const struct conf_handler *,
+  const char *name, enum conf_type type, const void *val, int len);
 static int conf_fcb_save_end(struct conf_store *);
+static int conf_fcb_load_one(struct conf_store *, uint32_t loc, load_cb cb,
+  load_raw_cb raw_cb, void *cb_arg);
 
 static struct conf_store_itf conf_fcb_itf = {
     .csi_load = conf_fcb_load,
     .csi_save_start = conf_fcb_save_start,
     .csi_save = conf_fcb_save,
-    .csi_save_end = conf_fcb_save_end
+    .csi_save_raw = conf_fcb_save_raw,
+    .csi_save_end = conf_fcb_save_end,
+    .csi_load_one = conf_fcb_load_one
 };
 
 int
@@ -74,6 +126,15 @@ conf_fcb_src(struct conf_fcb *cf)
         }
     }
 
+    if (!conf_fcb_stats_registered) {
+        rc = stats_init_and_reg(STATS_HDR(conf_fcb_stats),
+          STATS_SIZE_INIT_PARMS(conf_fcb_stats, STATS_SIZE_32),
+          STATS_NAME_INIT_PARMS(conf_fcb_stats), "conf_fcb");
+        if (rc == 0) {
+            conf_fcb_stats_registered = 1;
+        }
+    }
+
     cf->cf_store.cs_itf = &conf_fcb_itf;
     conf_src_register(&cf->cf_store);
 
@@ -89,6 +150,16 @@ conf_fcb_dst(struct conf_fcb *cf)
     return OS_OK;
 }
 
+/*
+ * Record locations reported to config store: sector index in the top byte,
+ * entry offset within the sector in the rest.
+ */
+static uint32_t
+conf_fcb_loc(struct conf_fcb *cf, struct fcb_entry *loc)
+{
+    return ((loc->fe_area - cf->cf_fcb.f_sectors) << 24) | loc->fe_elem_off;
+}
+
 static int
 conf_fcb_load_cb(struct fcb_entry *loc, void *arg)
 {
@@ -110,6 +181,11 @@ conf_fcb_load_cb(struct fcb_entry *loc, void *arg)
     if (rc) {
         return 0;
     }
+    conf_store_loc = conf_fcb_loc(argp->cf, loc);
+    if ((uint8_t)buf[0] == CONF_BIN_MAGIC) {
+        conf_bin_load_one(buf, len, argp->cb, argp->raw_cb, argp->cb_arg);
+        return 0;
+    }
     buf[len] = '\0';
 
     rc = conf_line_parse(buf, &name_str, &val_str);
@@ -121,13 +197,16 @@ conf_fcb_load_cb(struct fcb_entry *loc, void *arg)
 }
 
 static int
-conf_fcb_load(struct conf_store *cs, load_cb cb, void *cb_arg)
+conf_fcb_load(struct conf_store *cs, load_cb cb, load_raw_cb raw_cb,
+  void *cb_arg)
 {
     struct conf_fcb *cf = (struct conf_fcb *)cs;
     struct conf_fcb_load_cb_arg arg;
     int rc;
 
+    arg.cf = cf;
     arg.cb = cb;
+    arg.raw_cb = raw_cb;
     arg.cb_arg = cb_arg;
     rc = fcb_walk(&cf->cf_fcb, 0, conf_fcb_load_cb, &arg);
     if (rc) {
@@ -136,22 +215,213 @@ conf_fcb_load(struct conf_store *cs, load_cb cb, void *cb_arg)
     return OS_OK;
 }
 
+/*
+ * Load the record at loc, as reported earlier in conf_store_loc.
+ */
 static int
-conf_fcb_var_read(struct fcb_entry *loc, char *buf, char **name, char **val)
+conf_fcb_load_one(struct conf_store *cs, uint32_t loc, load_cb cb,
+  load_raw_cb raw_cb, void *cb_arg)
 {
+    struct conf_fcb *cf = (struct conf_fcb *)cs;
+    struct conf_fcb_load_cb_arg arg;
+    struct fcb_entry entry;
+
+    if ((loc >> 24) >= cf->cf_fcb.f_sector_cnt) {
+        return OS_EINVAL;
+    }
+    entry.fe_area = &cf->cf_fcb.f_sectors[loc >> 24];
+    entry.fe_elem_off = loc & 0xffffff;
+    if (fcb_elem_info(&cf->cf_fcb, &entry)) {
+        return OS_EINVAL;
+    }
+    arg.cf = cf;
+    arg.cb = cb;
+    arg.raw_cb = raw_cb;
+    arg.cb_arg = cb_arg;
+    conf_fcb_load_cb(&entry, &arg);
+    return OS_OK;
+}
+
+/*
+ * Reads a record, and finds its name. Value is returned for text records
+ * only. hashp, if given, is filled with conf_name_hash() of the name.
+ */
+static int
+conf_fcb_var_read(struct fcb_entry *loc, char *buf, char **name, char **val,
+  uint32_t *hashp)
+{
+    struct conf_bin_hdr hdr;
+    void *raw_val;
     int rc;
 
     rc = flash_area_read(loc->fe_area, loc->fe_data_off, buf, loc->fe_data_len);
     if (rc) {
         return rc;
     }
+    if ((uint8_t)buf[0] == CONF_BIN_MAGIC) {
+        if (conf_bin_parse(buf, loc->fe_data_len, &hdr, name, &raw_val) < 0) {
+            return -1;
+        }
+        *val = NULL;
+        if (hashp) {
+            *hashp = hdr.cbh_name_hash;
+        }
+        return 0;
+    }
     buf[loc->fe_data_len] = '\0';
     rc = conf_line_parse(buf, name, val);
+    if (!rc && hashp) {
+        *hashp = conf_name_hash(*name);
+    }
     return rc;
 }
 
 static void
-conf_fcb_compress(struct conf_fcb *cf)
+conf_fcb_compress_loc(struct conf_fcb *cf, struct conf_fcb_compress_ent *ent,
+  struct fcb_entry *loc)
+{
+    loc->fe_area = cf->cf_fcb.f_oldest;
+    loc->fe_data_off = ent->cce_data_off;
+    loc->fe_data_len = ent->cce_data_len;
+}
+
+/*
+ * Finds the table entry for a name, confirming hash matches by reading
+ * the stored name back from flash.
+ */
+static struct conf_fcb_compress_ent *
+conf_fcb_compress_find(struct conf_fcb *cf, struct conf_fcb_compress_tbl *tbl,
+  uint32_t hash, const char *name)
+{
+    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
+    struct conf_fcb_compress_ent *ent;
+    struct fcb_entry loc;
+    char *name2, *val2;
+    uint16_t idx;
+
+    for (idx = tbl->cct_buckets[hash % CONF_FCB_HASH_BUCKETS];
+         idx != CONF_FCB_ENT_NONE;
+         idx = ent->cce_next) {
+        ent = &tbl->cct_ents[idx];
+        if (ent->cce_hash != hash) {
+            continue;
+        }
+        conf_fcb_compress_loc(cf, ent, &loc);
+        if (conf_fcb_var_read(&loc, buf, &name2, &val2, NULL)) {
+            continue;
+        }
+        if (!strcmp(name, name2)) {
+            return ent;
+        }
+    }
+    return NULL;
+}
+
+static int
+conf_fcb_compress_add(struct conf_fcb_compress_tbl *tbl, uint32_t hash,
+  struct fcb_entry *loc)
+{
+    struct conf_fcb_compress_ent *ents;
+    struct conf_fcb_compress_ent *ent;
+    int bucket;
+
+    if (tbl->cct_cnt == tbl->cct_max) {
+        if (tbl->cct_max + CONF_FCB_ENT_CHUNK >= CONF_FCB_ENT_NONE) {
+            return OS_ENOMEM;
+        }
+        ents = realloc(tbl->cct_ents,
+          (tbl->cct_max + CONF_FCB_ENT_CHUNK) * sizeof(*ents));
+        if (!ents) {
+            return OS_ENOMEM;
+        }
+        tbl->cct_ents = ents;
+        tbl->cct_max += CONF_FCB_ENT_CHUNK;
+    }
+    bucket = hash % CONF_FCB_HASH_BUCKETS;
+    ent = &tbl->cct_ents[tbl->cct_cnt];
+    ent->cce_hash = hash;
+    ent->cce_data_off = loc->fe_data_off;
+    ent->cce_data_len = loc->fe_data_len;
+    ent->cce_superseded = 0;
+    ent->cce_next = tbl->cct_buckets[bucket];
+    tbl->cct_buckets[bucket] = tbl->cct_cnt++;
+    return 0;
+}
+
+/*
+ * Builds a table of the settings in the oldest sector, and marks the ones
+ * which have a newer value later in the FCB. Every entry is read once.
+ */
+static int
+conf_fcb_compress_scan(struct conf_fcb *cf, struct conf_fcb_compress_tbl *tbl)
+{
+    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
+    struct conf_fcb_compress_ent *ent;
+    struct fcb_entry loc;
+    char *name, *val;
+    uint32_t hash;
+    int rc;
+
+    memset(tbl, 0, sizeof(*tbl));
+    memset(tbl->cct_buckets, 0xff, sizeof(tbl->cct_buckets));
+
+    loc.fe_area = NULL;
+    loc.fe_elem_off = 0;
+    while (fcb_getnext(&cf->cf_fcb, &loc) == 0) {
+        if (conf_fcb_var_read(&loc, buf, &name, &val, &hash)) {
+            continue;
+        }
+        ent = conf_fcb_compress_find(cf, tbl, hash, name);
+        if (loc.fe_area == cf->cf_fcb.f_oldest) {
+            tbl->cct_total++;
+            if (ent) {
+                /* Later value within the same sector. */
+                ent->cce_data_off = loc.fe_data_off;
+                ent->cce_data_len = loc.fe_data_len;
+            } else {
+                rc = conf_fcb_compress_add(tbl, hash, &loc);
+                if (rc) {
+                    return rc;
+                }
+            }
+        } else if (ent) {
+            ent->cce_superseded = 1;
+        }
+    }
+    return 0;
+}
+
+static int
+conf_fcb_compress_copy(struct conf_fcb *cf, struct fcb_entry *loc1)
+{
+    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
+    struct fcb_entry loc2;
+    int rc;
+
+    rc = flash_area_read(loc1->fe_area, loc1->fe_data_off, buf,
+      loc1->fe_data_len);
+    if (rc) {
+        return rc;
+    }
+    rc = fcb_append(&cf->cf_fcb, loc1->fe_data_len, &loc2);
+    if (rc) {
+        return rc;
+    }
+    rc = flash_area_write(loc2.fe_area, loc2.fe_data_off, buf,
+      loc1->fe_data_len);
+    if (rc) {
+        return rc;
+    }
+    fcb_append_finish(&cf->cf_fcb, &loc2);
+    return 0;
+}
+
+/*
+ * Fallback when there is no memory for the table: for each entry in the
+ * oldest sector, walk the rest of the FCB looking for a newer value.
+ */
+static void
+conf_fcb_compress_slow(struct conf_fcb *cf)
 {
     int rc;
     char buf1[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
@@ -162,25 +432,20 @@ conf_fcb_compress(struct conf_fcb *cf)
     char *name2, *val2;
     int copy;
 
-    rc = fcb_append_to_scratch(&cf->cf_fcb);
-    if (rc) {
-        return; /* XXX */
-    }
-
     loc1.fe_area = NULL;
     loc1.fe_elem_off = 0;
     while (fcb_getnext(&cf->cf_fcb, &loc1) == 0) {
         if (loc1.fe_area != cf->cf_fcb.f_oldest) {
             break;
         }
-        rc = conf_fcb_var_read(&loc1, buf1, &name1, &val1);
+        rc = conf_fcb_var_read(&loc1, buf1, &name1, &val1, NULL);
         if (rc) {
             continue;
         }
         loc2 = loc1;
         copy = 1;
         while (fcb_getnext(&cf->cf_fcb, &loc2) == 0) {
-            rc = conf_fcb_var_read(&loc2, buf2, &name2, &val2);
+            rc = conf_fcb_var_read(&loc2, buf2, &name2, &val2, NULL);
             if (rc) {
                 continue;
             }
@@ -190,33 +455,67 @@ conf_fcb_compress(struct conf_fcb *cf)
             }
         }
         if (!copy) {
+            STATS_INC(conf_fcb_stats, entries_dropped);
             continue;
         }
 
         /*
          * Can't find one. Must copy.
          */
-        rc = flash_area_read(loc1.fe_area, loc1.fe_data_off, buf1,
-          loc1.fe_data_len);
-        if (rc) {
-            continue;
+        if (conf_fcb_compress_copy(cf, &loc1) == 0) {
+            STATS_INC(conf_fcb_stats, entries_copied);
         }
-        rc = fcb_append(&cf->cf_fcb, loc1.fe_data_len, &loc2);
-        if (rc) {
-            continue;
-        }
-        rc = flash_area_write(loc2.fe_area, loc2.fe_data_off, buf1,
-          loc1.fe_data_len);
-        if (rc) {
-            continue;
+    }
+}
+
+static void
+conf_fcb_compress(struct conf_fcb *cf)
+{
+    struct conf_fcb_compress_tbl tbl;
+    struct conf_fcb_compress_ent *ent;
+    struct fcb_entry loc;
+    os_time_t start;
+    int copied;
+    int rc;
+    int i;
+
+    start = os_time_get();
+    STATS_INC(conf_fcb_stats, compressions);
+
+    rc = fcb_append_to_scratch(&cf->cf_fcb);
+    if (rc) {
+        return; /* XXX */
+    }
+
+    rc = conf_fcb_compress_scan(cf, &tbl);
+    if (rc) {
+        conf_fcb_compress_slow(cf);
+    } else {
+        copied = 0;
+        for (i = 0; i < tbl.cct_cnt; i++) {
+            ent = &tbl.cct_ents[i];
+            if (ent->cce_superseded) {
+                continue;
+            }
+            conf_fcb_compress_loc(cf, ent, &loc);
+            if (conf_fcb_compress_copy(cf, &loc) == 0) {
+                copied++;
+            }
         }
-        fcb_append_finish(&cf->cf_fcb, &loc2);
+        STATS_INCN(conf_fcb_stats, entries_copied, copied);
+        STATS_INCN(conf_fcb_stats, entries_dropped, tbl.cct_total - copied);
     }
+    free(tbl.cct_ents);
+
     rc = fcb_rotate(&cf->cf_fcb);
     if (rc) {
         /* XXXX */
         ;
     }
+    conf_index_invalidate();
+
+    conf_fcb_stats.STATS_SECT_VAR(compress_ms) =
+      (os_time_get() - start) * 1000 / OS_TICKS_PER_SEC;
 }
 
 static int
@@ -247,6 +546,7 @@ conf_fcb_append(struct conf_fcb *cf, char *buf, int len)
         return OS_EINVAL;
     }
     fcb_append_finish(&cf->cf_fcb, &loc);
+    conf_store_loc = conf_fcb_loc(cf, &loc);
     return OS_OK;
 }
 
@@ -269,6 +569,25 @@ conf_fcb_save(struct conf_store *cs, const struct conf_handler *ch,
     return conf_fcb_append(cf, buf, len);
 }
 
+static int
+conf_fcb_save_raw(struct conf_store *cs, const struct conf_handler *ch,
+  const char *name, enum conf_type type, const void *val, int vlen)
+{
+    struct conf_fcb *cf = (struct conf_fcb *)cs;
+    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
+    int len;
+
+    if (!name) {
+        return OS_INVALID_PARM;
+    }
+
+    len = conf_bin_make(buf, sizeof(buf), ch, name, type, val, vlen);
+    if (len < 0) {
+        return OS_INVALID_PARM;
+    }
+    return conf_fcb_append(cf, buf, len);
+}
+
 static int
 conf_fcb_save_end(struct conf_store *cs)
 {
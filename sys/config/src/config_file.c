@@ -29,17 +29,23 @@
 #include "config/config_file.h"
 #include "config_priv.h"
 
-static int conf_file_load(struct conf_store *, load_cb cb, void *cb_arg);
+static int conf_file_load(struct conf_store *, load_cb cb, load_raw_cb raw_cb,
+  void *cb_arg);
 static int conf_file_save_start(struct conf_store *);
 static int conf_file_save(struct conf_store *, const struct conf_handler *ch,
   const char *name, const char *value);
+static int conf_file_save_raw(struct conf_store *,
+  const struct conf_handler *ch, const char *name, enum conf_type type,
+  const void *val, int len);
 static int conf_file_save_end(struct conf_store *);
 
 static struct conf_store_itf conf_file_itf = {
     .csi_load = conf_file_load,
     .csi_save_start = conf_file_save_start,
     .csi_save = conf_file_save,
-    .csi_save_end = conf_file_save_end
+    .csi_save_raw = conf_file_save_raw,
+    .csi_save_end = conf_file_save_end,
+    .csi_rewrite = 1
 };
 
 /*
@@ -70,12 +76,21 @@ conf_file_dst(struct conf_file *cf)
     return OS_OK;
 }
 
+/*
+ * Read the next record from file; either a line of text, or a binary
+ * record. Returns the length of the record, and advances *loc past it.
+ * *loc is set to 0 at the end of file, or when a binary record is
+ * truncated.
+ */
 int
 conf_getnext_line(struct fs_file *file, char *buf, int blen, uint32_t *loc)
 {
     int rc;
     char *end;
     uint32_t len;
+    struct conf_bin_hdr hdr;
+    char *name;
+    void *val;
 
     rc = fs_seek(file, *loc);
     if (rc < 0) {
@@ -87,6 +102,15 @@ conf_getnext_line(struct fs_file *file, char *buf, int blen, uint32_t *loc)
         *loc = 0;
         return -1;
     }
+    if ((uint8_t)buf[0] == CONF_BIN_MAGIC) {
+        blen = conf_bin_parse(buf, len, &hdr, &name, &val);
+        if (blen < 0) {
+            *loc = 0;
+            return -1;
+        }
+        *loc += blen;
+        return blen;
+    }
     if (len == blen) {
         len--;
     }
@@ -108,7 +132,8 @@ conf_getnext_line(struct fs_file *file, char *buf, int blen, uint32_t *loc)
  * item found.
  */
 static int
-conf_file_load(struct conf_store *cs, load_cb cb, void *cb_arg)
+conf_file_load(struct conf_store *cs, load_cb cb, load_raw_cb raw_cb,
+  void *cb_arg)
 {
     struct conf_file *cf = (struct conf_file *)cs;
     struct fs_file *file;
@@ -132,6 +157,10 @@ conf_file_load(struct conf_store *cs, load_cb cb, void *cb_arg)
         if (rc < 0) {
             continue;
         }
+        if ((uint8_t)tmpbuf[0] == CONF_BIN_MAGIC) {
+            conf_bin_load_one(tmpbuf, rc, cb, raw_cb, cb_arg);
+            continue;
+        }
         rc = conf_line_parse(tmpbuf, &name_str, &val_str);
         if (rc != 0) {
             continue;
@@ -178,25 +207,11 @@ conf_file_save_start(struct conf_store *cs)
 }
 
 static int
-conf_file_save(struct conf_store *cs, const struct conf_handler *ch,
-  const char *name, const char *value)
+conf_file_write(struct conf_file *cf, char *buf, int len)
 {
-    struct conf_file *cf = (struct conf_file *)cs;
     struct fs_file *file;
-    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
-    int len;
     int rc;
 
-    if (!name) {
-        return OS_INVALID_PARM;
-    }
-
-    len = conf_line_make(buf, sizeof(buf), ch, name, value);
-    if (len < 0 || len + 2 > sizeof(buf)) {
-        return OS_INVALID_PARM;
-    }
-    buf[len++] = '\n';
-
     if (cf->cf_save_fp) {
         file = cf->cf_save_fp;
     } else {
@@ -218,6 +233,46 @@ conf_file_save(struct conf_store *cs, const struct conf_handler *ch,
     return rc;
 }
 
+static int
+conf_file_save(struct conf_store *cs, const struct conf_handler *ch,
+  const char *name, const char *value)
+{
+    struct conf_file *cf = (struct conf_file *)cs;
+    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
+    int len;
+
+    if (!name) {
+        return OS_INVALID_PARM;
+    }
+
+    len = conf_line_make(buf, sizeof(buf), ch, name, value);
+    if (len < 0 || len + 2 > sizeof(buf)) {
+        return OS_INVALID_PARM;
+    }
+    buf[len++] = '\n';
+
+    return conf_file_write(cf, buf, len);
+}
+
+static int
+conf_file_save_raw(struct conf_store *cs, const struct conf_handler *ch,
+  const char *name, enum conf_type type, const void *val, int vlen)
+{
+    struct conf_file *cf = (struct conf_file *)cs;
+    char buf[CONF_MAX_NAME_LEN + CONF_MAX_VAL_LEN + 32];
+    int len;
+
+    if (!name) {
+        return OS_INVALID_PARM;
+    }
+
+    len = conf_bin_make(buf, sizeof(buf), ch, name, type, val, vlen);
+    if (len < 0) {
+        return OS_INVALID_PARM;
+    }
+    return conf_file_write(cf, buf, len);
+}
+
 static int
 conf_file_save_end(struct conf_store *cs)
 {
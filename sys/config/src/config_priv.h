@@ -27,22 +27,82 @@ struct json_buffer;
 int conf_json_line(struct json_buffer *jb, char *name, int nlen, char *value,
   int vlen);
 
+/*
+ * Name split into its elements.
+ */
+struct conf_name {
+    char cn_buf[CONF_MAX_NAME_LEN];
+    char *cn_argv[CONF_MAX_DIR_DEPTH];
+    int cn_argc;
+};
+
+int conf_name_parse(const char *name, struct conf_name *cn);
+
 int conf_line_parse(char *buf, char **namep, char **valp);
 int conf_line_make(char *dst, int dlen, const struct conf_handler *ch,
   const char *name, const char *val);
 
 /*
- * API for config storage.
+ * Callbacks for reading config storage. Text records are always passed to
+ * load_cb. Binary records go to load_raw_cb if one is given, otherwise
+ * their value is converted to string and passed to load_cb.
  */
 typedef void (*load_cb)(char *name, char *val, void *cb_arg);
+typedef void (*load_raw_cb)(char *name, enum conf_type type, void *val,
+  int len, void *cb_arg);
+
+/*
+ * Binary record format.
+ */
+#define CONF_BIN_MAGIC          0xcb
+#define CONF_BIN_MAX_VAL_LEN    (CONF_MAX_VAL_LEN - 1)
+
+struct conf_bin_hdr {
+    uint8_t cbh_magic;
+    uint8_t cbh_type;           /* enum conf_type, CONF_NONE if deleted */
+    uint8_t cbh_name_len;       /* including the terminating '\0' */
+    uint8_t cbh_val_len;
+    uint32_t cbh_name_hash;     /* conf_name_hash() of the name */
+};
+
+uint32_t conf_name_hash(const char *name);
+int conf_bin_make(char *dst, int dlen, const struct conf_handler *ch,
+  const char *name, enum conf_type type, const void *val, int vlen);
+int conf_bin_parse(char *buf, int len, struct conf_bin_hdr *hdr, char **namep,
+  void **valp);
+int conf_bin_str(enum conf_type type, const void *val, int vlen, char *buf,
+  int buf_len, char **strp);
+int conf_bin_load_one(char *buf, int len, load_cb cb, load_raw_cb raw_cb,
+  void *cb_arg);
+
+/*
+ * API for config storage.
+ */
 struct conf_store_itf {
-    int (*csi_load)(struct conf_store *cs, load_cb cb, void *cb_arg);
+    int (*csi_load)(struct conf_store *cs, load_cb cb, load_raw_cb raw_cb,
+      void *cb_arg);
     int (*csi_save_start)(struct conf_store *cs);
     int (*csi_save)(struct conf_store *cs, const struct conf_handler *ch,
       const char *name, const char *value);
+    int (*csi_save_raw)(struct conf_store *cs, const struct conf_handler *ch,
+      const char *name, enum conf_type type, const void *val, int len);
     int (*csi_save_end)(struct conf_store *cs);
+    int (*csi_load_one)(struct conf_store *cs, uint32_t loc, load_cb cb,
+      load_raw_cb raw_cb, void *cb_arg);
+    uint8_t csi_rewrite;        /* conf_save() replaces all stored values */
 };
 
+/*
+ * Stores with csi_load_one set conf_store_loc to the location of the
+ * record while calling load callbacks, and after saving a record.
+ * conf_index_invalidate() has to be called when records move.
+ */
+#define CONF_STORE_LOC_NONE     0xffffffff
+extern uint32_t conf_store_loc;
+void conf_index_invalidate(void);
+
+int conf_stats_register(void);
+
 void conf_src_register(struct conf_store *cs);
 void conf_dst_register(struct conf_store *cs);
 
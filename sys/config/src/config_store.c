@@ -21,6 +21,8 @@
 #include <stdio.h>
 
 #include <os/os.h>
+#include <os/os_malloc.h>
+#include <stats/stats.h>
 
 #include "config/config.h"
 #include "config_priv.h"
@@ -28,11 +30,69 @@
 struct conf_dup_check_arg {
     const char *name;
     const char *val;
+    int is_raw;
+    enum conf_type type;
+    const void *raw_val;
+    int raw_len;
     int is_dup;
 };
 
+/*
+ * Index of the newest persisted record for every config name, built by
+ * conf_load(). A name is identified by two independent 32-bit hashes;
+ * the value only by its hash. Index stays resident afterwards so that
+ * conf_save_one() can tell whether a value is already stored without
+ * reading the whole store back. Hash matches are confirmed by reading
+ * the record back, from its location if the store reports one.
+ */
+struct conf_index_ent {
+    uint32_t cie_name_hash;
+    uint32_t cie_name_hash2;
+    uint32_t cie_val_hash;
+    uint32_t cie_last;          /* ordinal of newest record with this name */
+    uint32_t cie_loc;           /* where it is in conf_save_dst, if known */
+};
+
+#define CONF_INDEX_MIN_SIZE     32      /* Must be a power of two. */
+
+static struct conf_index_ent *conf_index;
+static int conf_index_size;
+static int conf_index_cnt;
+static int conf_index_valid;
+static struct conf_store *conf_index_dst; /* Store which saves can trust
+                                           * the index about. */
+static int conf_save_all;               /* Don't skip unchanged values. */
+
+STATS_SECT_START(conf_stats)
+    STATS_SECT_ENTRY(saves)
+    STATS_SECT_ENTRY(records_written)
+    STATS_SECT_ENTRY(records_skipped)   /* Unchanged, not written again. */
+STATS_SECT_END
+static STATS_SECT_DECL(conf_stats) conf_stats;
+
+STATS_NAME_START(conf_stats)
+    STATS_NAME(conf_stats, saves)
+    STATS_NAME(conf_stats, records_written)
+    STATS_NAME(conf_stats, records_skipped)
+STATS_NAME_END(conf_stats)
+
+struct conf_index_load_arg {
+    struct conf_store *cila_cs;         /* Store being loaded from. */
+    uint32_t cila_ord;
+    int cila_err;
+};
+
 struct conf_store_head conf_load_srcs = SLIST_HEAD_INITIALIZER(&conf_load_srcs);
 struct conf_store *conf_save_dst;
+uint32_t conf_store_loc = CONF_STORE_LOC_NONE;
+
+int
+conf_stats_register(void)
+{
+    return stats_init_and_reg(STATS_HDR(conf_stats),
+      STATS_SIZE_INIT_PARMS(conf_stats, STATS_SIZE_32),
+      STATS_NAME_INIT_PARMS(conf_stats), "conf");
+}
 
 void
 conf_src_register(struct conf_store *cs)
@@ -48,12 +108,238 @@ conf_src_register(struct conf_store *cs)
     } else {
         SLIST_INSERT_AFTER(prev, cs, cs_next);
     }
+    conf_index_valid = 0;
 }
 
 void
 conf_dst_register(struct conf_store *cs)
 {
     conf_save_dst = cs;
+    conf_index_valid = 0;
+}
+
+static void
+conf_index_name_hash(const char *name, uint32_t *h1, uint32_t *h2)
+{
+    uint32_t b;
+
+    *h1 = conf_name_hash(name);
+
+    /* djb2 */
+    b = 5381;
+    while (*name) {
+        b = (b << 5) + b + (uint8_t)*name++;
+    }
+    *h2 = b;
+}
+
+static uint32_t
+conf_index_val_hash(const char *val)
+{
+    uint32_t hash;
+
+    if (!val) {
+        return 0;
+    }
+    hash = 2166136261u;
+    while (*val) {
+        hash = (hash ^ (uint8_t)*val++) * 16777619u;
+    }
+    /* 0 is reserved for "no value". */
+    return hash ? hash : 1;
+}
+
+/*
+ * Hash of a typed value. Type is included, so a text record never matches
+ * a binary one.
+ */
+static uint32_t
+conf_index_raw_hash(enum conf_type type, const void *val, int len)
+{
+    const uint8_t *p;
+    uint32_t hash;
+
+    if (type == CONF_NONE) {
+        return 0;
+    }
+    hash = (2166136261u ^ (0x80 | type)) * 16777619u;
+    for (p = val; len > 0; len--) {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static void
+conf_index_reset(void)
+{
+    conf_index_valid = 0;
+    conf_index_cnt = 0;
+    if (conf_index) {
+        memset(conf_index, 0, conf_index_size * sizeof(*conf_index));
+    }
+}
+
+/*
+ * Find the slot for a name. Returns the matching entry, or the empty slot
+ * where it would be inserted. Slot with cie_last == 0 is empty; record
+ * ordinals start from 1.
+ */
+static struct conf_index_ent *
+conf_index_slot(struct conf_index_ent *tbl, int size, uint32_t h1, uint32_t h2)
+{
+    struct conf_index_ent *ent;
+    int i;
+
+    i = h1 & (size - 1);
+    while (1) {
+        ent = &tbl[i];
+        if (ent->cie_last == 0 ||
+          (ent->cie_name_hash == h1 && ent->cie_name_hash2 == h2)) {
+            return ent;
+        }
+        i = (i + 1) & (size - 1);
+    }
+}
+
+static int
+conf_index_grow(void)
+{
+    struct conf_index_ent *tbl;
+    struct conf_index_ent *ent;
+    int size;
+    int i;
+
+    size = conf_index_size ? conf_index_size * 2 : CONF_INDEX_MIN_SIZE;
+    tbl = malloc(size * sizeof(*tbl));
+    if (!tbl) {
+        return OS_ENOMEM;
+    }
+    memset(tbl, 0, size * sizeof(*tbl));
+    for (i = 0; i < conf_index_size; i++) {
+        if (conf_index[i].cie_last == 0) {
+            continue;
+        }
+        ent = conf_index_slot(tbl, size, conf_index[i].cie_name_hash,
+          conf_index[i].cie_name_hash2);
+        *ent = conf_index[i];
+    }
+    free(conf_index);
+    conf_index = tbl;
+    conf_index_size = size;
+    return 0;
+}
+
+static struct conf_index_ent *
+conf_index_find(uint32_t h1, uint32_t h2)
+{
+    struct conf_index_ent *ent;
+
+    if (!conf_index) {
+        return NULL;
+    }
+    ent = conf_index_slot(conf_index, conf_index_size, h1, h2);
+    if (ent->cie_last == 0) {
+        return NULL;
+    }
+    return ent;
+}
+
+/*
+ * Insert or update the index entry for a name.
+ */
+static int
+conf_index_set(uint32_t h1, uint32_t h2, uint32_t vh, uint32_t ord,
+  uint32_t loc)
+{
+    struct conf_index_ent *ent;
+    int rc;
+
+    ent = conf_index_find(h1, h2);
+    if (!ent) {
+        /* Keep load factor under 3/4. */
+        if ((conf_index_cnt + 1) * 4 > conf_index_size * 3) {
+            rc = conf_index_grow();
+            if (rc) {
+                return rc;
+            }
+        }
+        ent = conf_index_slot(conf_index, conf_index_size, h1, h2);
+        ent->cie_name_hash = h1;
+        ent->cie_name_hash2 = h2;
+        conf_index_cnt++;
+    }
+    ent->cie_val_hash = vh;
+    ent->cie_last = ord;
+    ent->cie_loc = loc;
+    return 0;
+}
+
+/*
+ * First pass: remember where the newest record for each name is.
+ */
+static void
+conf_index_build_one(struct conf_index_load_arg *cila, char *name,
+  uint32_t vh)
+{
+    uint32_t h1, h2;
+    uint32_t loc;
+
+    cila->cila_ord++;
+    if (cila->cila_err) {
+        return;
+    }
+    conf_index_name_hash(name, &h1, &h2);
+    if (cila->cila_cs == conf_save_dst) {
+        loc = conf_store_loc;
+    } else {
+        loc = CONF_STORE_LOC_NONE;
+    }
+    cila->cila_err = conf_index_set(h1, h2, vh, cila->cila_ord, loc);
+}
+
+static void
+conf_index_build_cb(char *name, char *val, void *cb_arg)
+{
+    conf_index_build_one(cb_arg, name, conf_index_val_hash(val));
+}
+
+static void
+conf_index_build_raw_cb(char *name, enum conf_type type, void *val, int len,
+  void *cb_arg)
+{
+    conf_index_build_one(cb_arg, name, conf_index_raw_hash(type, val, len));
+}
+
+/*
+ * Second pass: apply only the newest record for each name.
+ */
+static int
+conf_index_is_newest(struct conf_index_load_arg *cila, char *name)
+{
+    struct conf_index_ent *ent;
+    uint32_t h1, h2;
+
+    cila->cila_ord++;
+    conf_index_name_hash(name, &h1, &h2);
+    ent = conf_index_find(h1, h2);
+    return ent && ent->cie_last == cila->cila_ord;
+}
+
+static void
+conf_index_apply_cb(char *name, char *val, void *cb_arg)
+{
+    if (conf_index_is_newest(cb_arg, name)) {
+        conf_set_value(name, val);
+    }
+}
+
+static void
+conf_index_apply_raw_cb(char *name, enum conf_type type, void *val, int len,
+  void *cb_arg)
+{
+    if (conf_index_is_newest(cb_arg, name)) {
+        conf_set_value_raw(name, type, val, len);
+    }
 }
 
 static void
@@ -62,20 +348,110 @@ conf_load_cb(char *name, char *val, void *cb_arg)
     conf_set_value(name, val);
 }
 
+static void
+conf_load_raw_cb(char *name, enum conf_type type, void *val, int len,
+  void *cb_arg)
+{
+    conf_set_value_raw(name, type, val, len);
+}
+
+/*
+ * Index the newest value of every name in the load sources. When indexing
+ * for saving, and conf_save_dst is not one of the sources, index only
+ * conf_save_dst.
+ */
+static int
+conf_index_build(int for_save)
+{
+    struct conf_store *cs;
+    struct conf_index_load_arg cila;
+    int dst_is_src;
+
+    conf_index_reset();
+    cila.cila_ord = 0;
+    cila.cila_err = 0;
+    dst_is_src = 0;
+    SLIST_FOREACH(cs, &conf_load_srcs, cs_next) {
+        if (cs == conf_save_dst) {
+            dst_is_src = 1;
+        }
+    }
+    if (for_save && !dst_is_src) {
+        cs = conf_save_dst;
+        cila.cila_cs = cs;
+        conf_store_loc = CONF_STORE_LOC_NONE;
+        cs->cs_itf->csi_load(cs, conf_index_build_cb, conf_index_build_raw_cb,
+          &cila);
+    } else {
+        SLIST_FOREACH(cs, &conf_load_srcs, cs_next) {
+            cila.cila_cs = cs;
+            conf_store_loc = CONF_STORE_LOC_NONE;
+            cs->cs_itf->csi_load(cs, conf_index_build_cb,
+              conf_index_build_raw_cb, &cila);
+        }
+    }
+    if (cila.cila_err) {
+        conf_index_reset();
+        return cila.cila_err;
+    }
+    conf_index_valid = 1;
+    conf_index_dst = (for_save || dst_is_src) ? conf_save_dst : NULL;
+    return 0;
+}
+
+void
+conf_index_invalidate(void)
+{
+    conf_index_valid = 0;
+}
+
+/*
+ * Returns 1 if the index tells what's stored in conf_save_dst, building
+ * it if needed.
+ */
+static int
+conf_index_usable(void)
+{
+    if (!conf_save_dst) {
+        return 0;
+    }
+    if (conf_index_valid && conf_index_dst == conf_save_dst) {
+        return 1;
+    }
+    return conf_index_build(1) == 0;
+}
+
 int
 conf_load(void)
 {
     struct conf_store *cs;
+    struct conf_index_load_arg cila;
+    int rc;
 
     /*
      * for every config store
-     *    load config
-     *    apply config
-     *    commit all
+     *    index config
+     * for every config store
+     *    apply newest value for every name
+     * commit all
+     *
+     * Ordinals run across all the stores, so a value in a later store
+     * overrides one in an earlier store.
      */
-
-    SLIST_FOREACH(cs, &conf_load_srcs, cs_next) {
-        cs->cs_itf->csi_load(cs, conf_load_cb, NULL);
+    rc = conf_index_build(0);
+    if (rc) {
+        /*
+         * Out of memory; apply every record in order like before.
+         */
+        SLIST_FOREACH(cs, &conf_load_srcs, cs_next) {
+            cs->cs_itf->csi_load(cs, conf_load_cb, conf_load_raw_cb, NULL);
+        }
+    } else {
+        cila.cila_ord = 0;
+        SLIST_FOREACH(cs, &conf_load_srcs, cs_next) {
+            cs->cs_itf->csi_load(cs, conf_index_apply_cb,
+              conf_index_apply_raw_cb, &cila);
+        }
     }
     return conf_commit(NULL);
 }
@@ -88,7 +464,9 @@ conf_dup_check_cb(char *name, char *val, void *cb_arg)
     if (strcmp(name, cdca->name)) {
         return;
     }
-    if (!val) {
+    if (cdca->is_raw) {
+        cdca->is_dup = 0;
+    } else if (!val) {
         if (!cdca->val) {
             cdca->is_dup = 1;
         } else {
@@ -103,25 +481,68 @@ conf_dup_check_cb(char *name, char *val, void *cb_arg)
     }
 }
 
+static void
+conf_dup_check_raw_cb(char *name, enum conf_type type, void *val, int len,
+  void *cb_arg)
+{
+    struct conf_dup_check_arg *cdca = (struct conf_dup_check_arg *)cb_arg;
+
+    if (strcmp(name, cdca->name)) {
+        return;
+    }
+    if (cdca->is_raw && type == cdca->type &&
+      (type == CONF_NONE ||
+        (len == cdca->raw_len && !memcmp(val, cdca->raw_val, len)))) {
+        cdca->is_dup = 1;
+    } else {
+        cdca->is_dup = 0;
+    }
+}
+
 /*
- * Append a single value to persisted config. Don't store duplicate value.
+ * Index says the value in cdca is stored already. Make sure by reading
+ * the record back; hashes can collide.
  */
-int
-conf_save_one(const struct conf_handler *ch, const char *name, char *value)
+static int
+conf_index_confirm(struct conf_index_ent *ent, char *name,
+  struct conf_dup_check_arg *cdca)
 {
     struct conf_store *cs;
-    struct conf_dup_check_arg cdca;
+
+    cs = conf_save_dst;
+    cdca->name = name;
+    cdca->is_dup = 0;
+    if (ent->cie_loc != CONF_STORE_LOC_NONE && cs->cs_itf->csi_load_one) {
+        cs->cs_itf->csi_load_one(cs, ent->cie_loc, conf_dup_check_cb,
+          conf_dup_check_raw_cb, cdca);
+    } else {
+        cs->cs_itf->csi_load(cs, conf_dup_check_cb, conf_dup_check_raw_cb,
+          cdca);
+    }
+    return cdca->is_dup == 1;
+}
+
+/*
+ * Store a single value, text or binary, unless it is already the latest
+ * one persisted.
+ */
+static int
+conf_save_rec(const struct conf_handler *ch, const char *name,
+  struct conf_dup_check_arg *cdca)
+{
+    struct conf_store *cs;
+    struct conf_index_ent *ent;
     char name_str[CONF_MAX_NAME_LEN];
+    uint32_t h1, h2, vh;
+    int use_index;
     int clen, nlen;
+    int rc;
 
     cs = conf_save_dst;
     if (!cs) {
         return OS_ENOENT;
     }
 
-    /*
-     * Check if we're writing the same value again.
-     */
     clen = strlen(ch->ch_name);
     nlen = strlen(name);
     if (clen + nlen + 1 > sizeof(name_str)) {
@@ -132,23 +553,116 @@ conf_save_one(const struct conf_handler *ch, const char *name, char *value)
     memcpy(name_str + clen, name, nlen);
     name_str[clen + nlen] = '\0';
 
-    cdca.name = name_str;
+    /*
+     * Check if we're writing the same value again. Not when the store
+     * is being rewritten; everything must go in then.
+     */
+    use_index = !conf_save_all && conf_index_usable();
+    if (conf_save_all) {
+        ;
+    } else if (use_index) {
+        conf_index_name_hash(name_str, &h1, &h2);
+        if (cdca->is_raw) {
+            vh = conf_index_raw_hash(cdca->type, cdca->raw_val,
+              cdca->raw_len);
+        } else {
+            vh = conf_index_val_hash(cdca->val);
+        }
+        ent = conf_index_find(h1, h2);
+        if (ent && ent->cie_val_hash == vh &&
+          conf_index_confirm(ent, name_str, cdca)) {
+            STATS_INC(conf_stats, records_skipped);
+            return 0;
+        }
+    } else {
+        cdca->name = name_str;
+        cdca->is_dup = 0;
+        cs->cs_itf->csi_load(cs, conf_dup_check_cb, conf_dup_check_raw_cb,
+          cdca);
+        if (cdca->is_dup == 1) {
+            STATS_INC(conf_stats, records_skipped);
+            return 0;
+        }
+    }
+
+    conf_store_loc = CONF_STORE_LOC_NONE;
+    if (cdca->is_raw) {
+        rc = cs->cs_itf->csi_save_raw(cs, ch, name, cdca->type,
+          cdca->raw_val, cdca->raw_len);
+    } else {
+        rc = cs->cs_itf->csi_save(cs, ch, name, cdca->val);
+    }
+    if (rc) {
+        return rc;
+    }
+    STATS_INC(conf_stats, records_written);
+    if (use_index && conf_index_set(h1, h2, vh, UINT32_MAX, conf_store_loc)) {
+        /* Could not record it; index must be rebuilt. */
+        conf_index_valid = 0;
+    }
+    return 0;
+}
+
+/*
+ * Append a single value to persisted config. Don't store duplicate value.
+ */
+int
+conf_save_one(const struct conf_handler *ch, const char *name, char *value)
+{
+    struct conf_dup_check_arg cdca;
+
     cdca.val = value;
-    cdca.is_dup = 0;
-    cs->cs_itf->csi_load(cs, conf_dup_check_cb, &cdca);
-    if (cdca.is_dup == 1) {
-        return 0;
+    cdca.is_raw = 0;
+    return conf_save_rec(ch, name, &cdca);
+}
+
+/*
+ * Append a single typed value to persisted config, in binary form.
+ * Type CONF_NONE deletes the value.
+ */
+int
+conf_save_one_raw(const struct conf_handler *ch, const char *name,
+  enum conf_type type, const void *val, int len)
+{
+    struct conf_dup_check_arg cdca;
+
+    if (type == CONF_NONE) {
+        len = 0;
     }
-    return cs->cs_itf->csi_save(cs, ch, name, value);
+    if (len < 0 || len > CONF_BIN_MAX_VAL_LEN) {
+        return OS_INVALID_PARM;
+    }
+    cdca.is_raw = 1;
+    cdca.type = type;
+    cdca.raw_val = val;
+    cdca.raw_len = len;
+    return conf_save_rec(ch, name, &cdca);
 }
 
 /*
  * Walk through all registered subsystems, and ask them to export their
- * config variables. Persist these settings.
+ * config variables. Persist these settings. Handlers which provide
+ * ch_get_raw get their values stored in binary form.
  */
 static void
 conf_store_one(struct conf_handler *ch, char *name, char *value)
 {
+    struct conf_name cn;
+    union {
+        uint64_t u64;
+        double d;
+        char buf[CONF_BIN_MAX_VAL_LEN];
+    } val;
+    enum conf_type type;
+    int len;
+
+    if (ch->ch_get_raw && !conf_name_parse(name, &cn)) {
+        len = sizeof(val);
+        if (!ch->ch_get_raw(cn.cn_argc, cn.cn_argv, &type, &val, &len)) {
+            conf_save_one_raw(ch, name, type, &val, len);
+            return;
+        }
+    }
     conf_save_one(ch, name, value);
 }
 
@@ -165,7 +679,9 @@ conf_save(void)
         return OS_ENOENT;
     }
 
+    STATS_INC(conf_stats, saves);
     cs->cs_itf->csi_save_start(cs);
+    conf_save_all = cs->cs_itf->csi_rewrite;
     rc = 0;
     SLIST_FOREACH(ch, &conf_handlers, ch_list) {
         if (ch->ch_export) {
@@ -176,6 +692,13 @@ conf_save(void)
         }
     }
     cs->cs_itf->csi_save_end(cs);
+    if (conf_save_all) {
+        /*
+         * Store now holds only what was exported; index has to be rebuilt.
+         */
+        conf_save_all = 0;
+        conf_index_valid = 0;
+    }
 
     return rc;
 }
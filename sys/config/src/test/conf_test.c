@@ -17,6 +17,7 @@
  * under the License.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <os/os.h>
@@ -83,7 +84,7 @@ ctest_handle_set(int argc, char **argv, char *val)
     uint8_t newval;
     int rc;
 
-    test_set_called = 1;
+    test_set_called++;
     if (argc == 1 && !strcmp(argv[0], "mybar")) {
         rc = CONF_VALUE_SET(val, CONF_INT8, newval);
         TEST_ASSERT(rc == 0);
@@ -235,6 +236,146 @@ c3_handle_export(void (*cb)(struct conf_handler *, char *name, char *value))
     return 0;
 }
 
+/*
+ * Handler with typed access.
+ */
+static int32_t c4_int;
+static uint8_t c4_bytes[40];
+static int c4_set_cnt;
+static int c4_set_raw_cnt;
+static int c4_export_block;
+
+static char *c4_handle_get(int argc, char **argv, char *val,
+  int val_len_max);
+static int c4_handle_set(int argc, char **argv, char *val);
+static int c4_handle_export(void (*cb)(struct conf_handler *, char *name,
+    char *value));
+static int c4_handle_get_raw(int argc, char **argv, enum conf_type *type,
+  void *val, int *len);
+static int c4_handle_set_raw(int argc, char **argv, enum conf_type type,
+  void *val, int len);
+
+struct conf_handler c4_test_handler = {
+    .ch_name = "raw",
+    .ch_get = c4_handle_get,
+    .ch_set = c4_handle_set,
+    .ch_commit = NULL,
+    .ch_export = c4_handle_export,
+    .ch_get_raw = c4_handle_get_raw,
+    .ch_set_raw = c4_handle_set_raw
+};
+
+static char *
+c4_handle_get(int argc, char **argv, char *val, int val_len_max)
+{
+    if (argc == 1 && !strcmp(argv[0], "int")) {
+        return conf_str_from_value(CONF_INT32, &c4_int, val, val_len_max);
+    }
+    if (argc == 1 && !strcmp(argv[0], "bytes")) {
+        return conf_str_from_bytes(c4_bytes, sizeof(c4_bytes), val,
+          val_len_max);
+    }
+    return NULL;
+}
+
+static int
+c4_handle_set(int argc, char **argv, char *val)
+{
+    int len;
+    int rc;
+
+    c4_set_cnt++;
+    if (argc == 1 && !strcmp(argv[0], "int")) {
+        rc = CONF_VALUE_SET(val, CONF_INT32, c4_int);
+        TEST_ASSERT(rc == 0);
+        return 0;
+    }
+    if (argc == 1 && !strcmp(argv[0], "bytes")) {
+        len = sizeof(c4_bytes);
+        rc = conf_bytes_from_str(val, c4_bytes, &len);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(len == sizeof(c4_bytes));
+        return 0;
+    }
+    return OS_ENOENT;
+}
+
+static int
+c4_handle_export(void (*cb)(struct conf_handler *, char *name, char *value))
+{
+    char value[CONF_STR_FROM_BYTES_LEN(sizeof(c4_bytes))];
+
+    if (c4_export_block) {
+        return 0;
+    }
+    cb(&c4_test_handler, "int",
+      conf_str_from_value(CONF_INT32, &c4_int, value, sizeof(value)));
+    cb(&c4_test_handler, "bytes",
+      conf_str_from_bytes(c4_bytes, sizeof(c4_bytes), value, sizeof(value)));
+    return 0;
+}
+
+static int
+c4_handle_get_raw(int argc, char **argv, enum conf_type *type, void *val,
+  int *len)
+{
+    if (argc == 1 && !strcmp(argv[0], "int")) {
+        TEST_ASSERT(*len >= sizeof(c4_int));
+        *type = CONF_INT32;
+        memcpy(val, &c4_int, sizeof(c4_int));
+        *len = sizeof(c4_int);
+        return 0;
+    }
+    if (argc == 1 && !strcmp(argv[0], "bytes")) {
+        TEST_ASSERT(*len >= sizeof(c4_bytes));
+        *type = CONF_BYTES;
+        memcpy(val, c4_bytes, sizeof(c4_bytes));
+        *len = sizeof(c4_bytes);
+        return 0;
+    }
+    return OS_ENOENT;
+}
+
+static int
+c4_handle_set_raw(int argc, char **argv, enum conf_type type, void *val,
+  int len)
+{
+    c4_set_raw_cnt++;
+    if (argc == 1 && !strcmp(argv[0], "int")) {
+        TEST_ASSERT(type == CONF_INT32 && len == sizeof(c4_int));
+        memcpy(&c4_int, val, len);
+        return 0;
+    }
+    if (argc == 1 && !strcmp(argv[0], "bytes")) {
+        TEST_ASSERT(type == CONF_BYTES && len == sizeof(c4_bytes));
+        memcpy(c4_bytes, val, len);
+        return 0;
+    }
+    return OS_ENOENT;
+}
+
+static void
+c4_fill(int seed)
+{
+    int i;
+
+    c4_int = -1000 * seed;
+    for (i = 0; i < sizeof(c4_bytes); i++) {
+        c4_bytes[i] = seed + i;
+    }
+}
+
+static void
+c4_check(int seed)
+{
+    int i;
+
+    TEST_ASSERT(c4_int == -1000 * seed);
+    for (i = 0; i < sizeof(c4_bytes); i++) {
+        TEST_ASSERT(c4_bytes[i] == (uint8_t)(seed + i));
+    }
+}
+
 static void
 ctest_clear_call_state(void)
 {
@@ -382,6 +523,46 @@ TEST_CASE(config_test_commit)
     ctest_clear_call_state();
 }
 
+TEST_CASE(config_test_bulk)
+{
+    char name1[] = "myfoo/mybar";
+    char name2[] = "/myfoo//mybar/";
+    char *names[] = { name1, "foo/bar", name2 };
+    char *vals[3];
+    char buf[16];
+    int rc;
+
+    /*
+     * Names must not be modified.
+     */
+    vals[0] = "12";
+    vals[1] = "1";
+    vals[2] = "13";
+    rc = conf_set_values(3, names, vals);
+    TEST_ASSERT(rc != 0);
+    TEST_ASSERT(test_set_called == 2);
+    TEST_ASSERT(val8 == 13);
+    TEST_ASSERT(!strcmp(name1, "myfoo/mybar"));
+    TEST_ASSERT(!strcmp(name2, "/myfoo//mybar/"));
+    ctest_clear_call_state();
+
+    rc = conf_get_values(3, names, vals, buf, sizeof(buf));
+    TEST_ASSERT(rc == 2);
+    TEST_ASSERT(test_get_called == 1);
+    TEST_ASSERT(vals[0] && !strcmp(vals[0], "13"));
+    TEST_ASSERT(vals[1] == NULL);
+    TEST_ASSERT(vals[2] && !strcmp(vals[2], "13"));
+    TEST_ASSERT(vals[0] != vals[2]);
+    ctest_clear_call_state();
+
+    /*
+     * Too deep.
+     */
+    rc = conf_set_value("myfoo/1/2/3/4/5/6/7/8", "1");
+    TEST_ASSERT(rc != 0);
+    TEST_ASSERT(test_set_called == 0);
+}
+
 static const struct nffs_area_desc config_nffs[] = {
     { 0x00000000, 16 * 1024 },
     { 0x00004000, 16 * 1024 },
@@ -585,6 +766,15 @@ TEST_CASE(config_test_save_in_file)
 
     rc = conf_test_file_strstr(cf.cf_name, "myfoo/mybar=43\n");
     TEST_ASSERT(rc == 0);
+
+    /*
+     * File is rewritten; unchanged values must be kept.
+     */
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+
+    rc = conf_test_file_strstr(cf.cf_name, "myfoo/mybar=43\n");
+    TEST_ASSERT(rc == 0);
 }
 
 TEST_CASE(config_test_save_one_file)
@@ -905,6 +1095,400 @@ TEST_CASE(config_test_save_one_fcb)
     TEST_ASSERT(val8 == 44);
 }
 
+#define CONFIG_TEST_FILL_NAMES  64
+
+static int config_test_fill_last[CONFIG_TEST_FILL_NAMES];
+
+static void
+config_test_fill_cb(char *name, char *val, void *cb_arg)
+{
+    int idx;
+
+    if (sscanf(name, "myfoo/fill%d", &idx) == 1) {
+        TEST_ASSERT(idx >= 0 && idx < CONFIG_TEST_FILL_NAMES);
+        config_test_fill_last[idx] = atoi(val);
+    }
+}
+
+TEST_CASE(config_test_compress_latest)
+{
+    int rc;
+    struct conf_fcb cf;
+    char name[16];
+    char val[16];
+    int i;
+
+    config_wipe_srcs();
+    config_wipe_fcb(fcb_areas, sizeof(fcb_areas) / sizeof(fcb_areas[0]));
+
+    cf.cf_fcb.f_sectors = fcb_areas;
+    cf.cf_fcb.f_sector_cnt = sizeof(fcb_areas) / sizeof(fcb_areas[0]);
+
+    rc = conf_fcb_src(&cf);
+    TEST_ASSERT(rc == 0);
+
+    rc = conf_fcb_dst(&cf);
+    TEST_ASSERT(rc == 0);
+
+    /*
+     * Two values for the same name in one sector; only the second may
+     * survive compaction.
+     */
+    rc = conf_save_one(&config_test_handler, "mybar", "1");
+    TEST_ASSERT(rc == 0);
+    rc = conf_save_one(&config_test_handler, "mybar", "2");
+    TEST_ASSERT(rc == 0);
+
+    /*
+     * Overwrite a set of other names enough times to rotate through all
+     * sectors repeatedly.
+     */
+    for (i = 0; i < 4096; i++) {
+        snprintf(name, sizeof(name), "fill%d", i % CONFIG_TEST_FILL_NAMES);
+        snprintf(val, sizeof(val), "%d", i);
+        rc = conf_save_one(&config_test_handler, name, val);
+        TEST_ASSERT(rc == 0);
+    }
+
+    val8 = 0;
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(val8 == 2);
+
+    memset(config_test_fill_last, 0xff, sizeof(config_test_fill_last));
+    rc = cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_fill_cb,
+      NULL, NULL);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < CONFIG_TEST_FILL_NAMES; i++) {
+        TEST_ASSERT(config_test_fill_last[i] ==
+          4096 - CONFIG_TEST_FILL_NAMES + i);
+    }
+}
+
+static int config_test_record_cnt;
+
+static void
+config_test_count_cb(char *name, char *val, void *cb_arg)
+{
+    config_test_record_cnt++;
+}
+
+TEST_CASE(config_test_load_newest)
+{
+    int rc;
+    struct conf_fcb cf;
+    char val[16];
+    int i;
+
+    config_wipe_srcs();
+    config_wipe_fcb(fcb_areas, sizeof(fcb_areas) / sizeof(fcb_areas[0]));
+
+    cf.cf_fcb.f_sectors = fcb_areas;
+    cf.cf_fcb.f_sector_cnt = sizeof(fcb_areas) / sizeof(fcb_areas[0]);
+
+    rc = conf_fcb_src(&cf);
+    TEST_ASSERT(rc == 0);
+
+    rc = conf_fcb_dst(&cf);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 1; i <= 10; i++) {
+        snprintf(val, sizeof(val), "%d", i);
+        rc = conf_save_one(&config_test_handler, "mybar", val);
+        TEST_ASSERT(rc == 0);
+    }
+
+    /*
+     * History has 10 values for mybar; only the last one gets applied.
+     */
+    ctest_clear_call_state();
+    val8 = 0;
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(val8 == 10);
+    TEST_ASSERT(test_set_called == 1);
+
+    /*
+     * Saving the same value again must not add a record.
+     */
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_record_cnt == 10);
+
+    rc = conf_save_one(&config_test_handler, "mybar", "10");
+    TEST_ASSERT(rc == 0);
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_record_cnt == 10);
+
+    /*
+     * New value gets written, and is known to the index afterwards.
+     */
+    rc = conf_save_one(&config_test_handler, "mybar", "11");
+    TEST_ASSERT(rc == 0);
+    rc = conf_save_one(&config_test_handler, "mybar", "11");
+    TEST_ASSERT(rc == 0);
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_record_cnt == 11);
+
+    rc = conf_save_one(&config_test_handler, "mybar", "10");
+    TEST_ASSERT(rc == 0);
+    ctest_clear_call_state();
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(val8 == 10);
+    TEST_ASSERT(test_set_called == 1);
+}
+
+static int config_test_bin_cnt;
+static int config_test_text_cnt;
+
+static void
+config_test_fmt_cb(char *name, char *val, void *cb_arg)
+{
+    if (!strncmp(name, "raw/", 4)) {
+        config_test_text_cnt++;
+    }
+}
+
+static void
+config_test_fmt_raw_cb(char *name, enum conf_type type, void *val, int len,
+  void *cb_arg)
+{
+    if (!strncmp(name, "raw/", 4)) {
+        config_test_bin_cnt++;
+    }
+}
+
+static void
+config_test_count_fmt(struct conf_store *cs)
+{
+    config_test_bin_cnt = 0;
+    config_test_text_cnt = 0;
+    cs->cs_itf->csi_load(cs, config_test_fmt_cb, config_test_fmt_raw_cb, NULL);
+}
+
+/*
+ * Old text values get replaced by binary ones on conf_save(). Values are
+ * read back from the binary records.
+ */
+static void
+config_test_raw_migrate(struct conf_store *cs)
+{
+    int rc;
+
+    /*
+     * Values stored through the string interface.
+     */
+    c4_fill(1);
+    rc = conf_save_one(&c4_test_handler, "int", "-1000");
+    TEST_ASSERT(rc == 0);
+    rc = conf_save_one(&c4_test_handler, "bytes",
+      "AQIDBAUGBwgJCgsMDQ4PEBESExQVFhcYGRobHB0eHyAhIiMkJSYnKA==");
+    TEST_ASSERT(rc == 0);
+
+    c4_fill(0);
+    c4_set_cnt = 0;
+    c4_set_raw_cnt = 0;
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    c4_check(1);
+    TEST_ASSERT(c4_set_cnt == 2 && c4_set_raw_cnt == 0);
+
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+    config_test_count_fmt(cs);
+    TEST_ASSERT(config_test_bin_cnt == 2);
+
+    c4_fill(0);
+    c4_set_cnt = 0;
+    c4_set_raw_cnt = 0;
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    c4_check(1);
+    TEST_ASSERT(c4_set_cnt == 0 && c4_set_raw_cnt == 2);
+
+    /*
+     * Same values again are not stored; new ones are.
+     */
+    rc = conf_save_one_raw(&c4_test_handler, "int", CONF_INT32, &c4_int,
+      sizeof(c4_int));
+    TEST_ASSERT(rc == 0);
+    config_test_count_fmt(cs);
+    TEST_ASSERT(config_test_bin_cnt == 2);
+
+    c4_fill(2);
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+
+    c4_fill(0);
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    c4_check(2);
+}
+
+TEST_CASE(config_test_raw_fcb)
+{
+    int rc;
+    struct conf_fcb cf;
+
+    config_wipe_srcs();
+    config_wipe_fcb(fcb_areas, sizeof(fcb_areas) / sizeof(fcb_areas[0]));
+
+    cf.cf_fcb.f_sectors = fcb_areas;
+    cf.cf_fcb.f_sector_cnt = sizeof(fcb_areas) / sizeof(fcb_areas[0]);
+
+    rc = conf_fcb_src(&cf);
+    TEST_ASSERT(rc == 0);
+
+    rc = conf_fcb_dst(&cf);
+    TEST_ASSERT(rc == 0);
+
+    c4_export_block = 0;
+    config_test_raw_migrate(&cf.cf_store);
+    c4_export_block = 1;
+}
+
+TEST_CASE(config_test_raw_file)
+{
+    int rc;
+    struct conf_file cf;
+
+    config_wipe_srcs();
+    rc = fs_mkdir("/config");
+    TEST_ASSERT(rc == 0 || rc == FS_EEXIST);
+    fs_unlink("/config/raw");
+
+    cf.cf_name = "/config/raw";
+    rc = conf_file_src(&cf);
+    TEST_ASSERT(rc == 0);
+    rc = conf_file_dst(&cf);
+    TEST_ASSERT(rc == 0);
+
+    rc = conf_register(&c4_test_handler);
+    TEST_ASSERT(rc == 0);
+
+    c4_export_block = 0;
+    config_test_raw_migrate(&cf.cf_store);
+
+    /*
+     * Text line appended after binary records.
+     */
+    rc = conf_save_one(&c4_test_handler, "int", "7");
+    TEST_ASSERT(rc == 0);
+    c4_set_cnt = 0;
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(c4_int == 7);
+    TEST_ASSERT(c4_set_cnt == 1);
+
+    /*
+     * Handler stays registered, but does not add to conf_save() from now on.
+     */
+    c4_export_block = 1;
+}
+
+static uint32_t config_test_loc;
+static char config_test_loc_val[16];
+
+static void
+config_test_loc_cb(char *name, char *val, void *cb_arg)
+{
+    if (!strcmp(name, "3/v")) {
+        config_test_loc = conf_store_loc;
+    }
+}
+
+static void
+config_test_loc_val_cb(char *name, char *val, void *cb_arg)
+{
+    if (!strcmp(name, "3/v")) {
+        strncpy(config_test_loc_val, val, sizeof(config_test_loc_val) - 1);
+    }
+}
+
+TEST_CASE(config_test_save_unchanged)
+{
+    int rc;
+    struct conf_fcb cf;
+    int cnt;
+
+    config_wipe_srcs();
+    config_wipe_fcb(fcb_areas, sizeof(fcb_areas) / sizeof(fcb_areas[0]));
+
+    cf.cf_fcb.f_sectors = fcb_areas;
+    cf.cf_fcb.f_sector_cnt = sizeof(fcb_areas) / sizeof(fcb_areas[0]);
+
+    rc = conf_fcb_src(&cf);
+    TEST_ASSERT(rc == 0);
+
+    rc = conf_fcb_dst(&cf);
+    TEST_ASSERT(rc == 0);
+
+    val32 = 21;
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    cnt = config_test_record_cnt;
+    TEST_ASSERT(cnt > 0);
+
+    /*
+     * Nothing changed, nothing gets written. Also without conf_load()
+     * in between.
+     */
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_record_cnt == cnt);
+
+    rc = conf_fcb_dst(&cf);
+    TEST_ASSERT(rc == 0);
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_record_cnt == cnt);
+
+    /*
+     * Only the changed one is written.
+     */
+    val32 = 22;
+    rc = conf_save();
+    TEST_ASSERT(rc == 0);
+    config_test_record_cnt = 0;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_count_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_record_cnt == cnt + 1);
+
+    val32 = 0;
+    rc = conf_load();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(val32 == 22);
+
+    /*
+     * Newest record can be read back from where the store says it is.
+     */
+    config_test_loc = CONF_STORE_LOC_NONE;
+    cf.cf_store.cs_itf->csi_load(&cf.cf_store, config_test_loc_cb, NULL,
+      NULL);
+    TEST_ASSERT(config_test_loc != CONF_STORE_LOC_NONE);
+    memset(config_test_loc_val, 0, sizeof(config_test_loc_val));
+    rc = cf.cf_store.cs_itf->csi_load_one(&cf.cf_store, config_test_loc,
+      config_test_loc_val_cb, NULL, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(!strcmp(config_test_loc_val, "22"));
+}
+
 TEST_SUITE(config_test_all)
 {
     /*
@@ -917,6 +1501,7 @@ TEST_SUITE(config_test_all)
     config_test_getset_bytes();
 
     config_test_commit();
+    config_test_bulk();
 
     /*
      * NFFS as backing storage.
@@ -929,6 +1514,7 @@ TEST_SUITE(config_test_all)
     config_test_save_in_file();
 
     config_test_save_one_file();
+    config_test_raw_file();
 
     /*
      * FCB as backing storage.
@@ -946,5 +1532,9 @@ TEST_SUITE(config_test_all)
     config_test_compress_reset();
 
     config_test_save_one_fcb();
+    config_test_compress_latest();
+    config_test_load_newest();
+    config_test_save_unchanged();
+    config_test_raw_fcb();
 }
 
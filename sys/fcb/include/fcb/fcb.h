@@ -42,6 +42,18 @@ struct fcb_entry {
     uint16_t fe_data_len;	/* size of data area */
 };
 
+/*
+ * Checkpoint in the optional entry index. Sequence numbers are given to
+ * entries in the order they are laid out in flash, i.e. the order in which
+ * fcb_append() reserved space for them.
+ */
+struct fcb_index_ent {
+    uint32_t fie_seq;
+    uint32_t fie_elem_off;
+    uint8_t fie_sector;		/* index into fcb->f_sectors */
+    uint8_t fie_first;		/* first entry in the sector */
+};
+
 struct fcb {
     /* Caller of fcb_init fills this in */
     uint32_t f_magic;		/* As placed on the disk */
@@ -56,6 +68,14 @@ struct fcb {
     struct fcb_entry f_active;
     uint16_t f_active_id;
     uint8_t f_align;		/* writes to flash have to aligned to this */
+
+    /* Optional entry index, see fcb_index_init() */
+    struct fcb_index_ent *f_index;
+    uint16_t f_index_max;	/* Number of slots in f_index */
+    uint16_t f_index_cnt;	/* Number of checkpoints in use */
+    uint16_t f_index_start;	/* Oldest checkpoint; f_index is a ring */
+    uint16_t f_index_stride;	/* Entries between checkpoints */
+    uint32_t f_index_seq;	/* Sequence number for next entry */
 };
 
 /*
@@ -81,6 +101,25 @@ int fcb_init(struct fcb *fcb);
 int fcb_append(struct fcb *, uint16_t len, struct fcb_entry *loc);
 int fcb_append_finish(struct fcb *, struct fcb_entry *append_loc);
 
+/*
+ * fcb_append_batch() appends cnt entries, taking data from ents. Entries
+ * are packed with their headers and crcs into buf, and buf is written to
+ * flash with a single flash_area_write() whenever it fills up, or the
+ * entries continue in the next sector. Each entry is checksummed on its
+ * own, so if writing is interrupted only the entry being written at the
+ * time is lost. buf_len has to be large enough for the largest entry and
+ * its overhead.
+ *
+ * Returns the number of entries appended. If none were, returns an error
+ * code; e.g. FCB_ERR_NOSPACE when fcb_rotate() has to be called first.
+ */
+struct fcb_batch_ent {
+    void *fbe_data;
+    uint16_t fbe_len;
+};
+int fcb_append_batch(struct fcb *, struct fcb_batch_ent *ents, int cnt,
+  uint8_t *buf, int buf_len);
+
 /*
  * Walk over all log entries in FCB, or entries in a given flash_area.
  * cb gets called for every entry. If cb wants to stop the walk, it should
@@ -93,6 +132,43 @@ typedef int (*fcb_walk_cb)(struct fcb_entry *loc, void *arg);
 int fcb_walk(struct fcb *, struct flash_area *, fcb_walk_cb cb, void *cb_arg);
 int fcb_getnext(struct fcb *, struct fcb_entry *loc);
 
+/*
+ * Given loc->fe_area and loc->fe_elem_off of an entry found earlier, fill
+ * in the rest of loc. Returns FCB_ERR_CRC if the entry is not valid.
+ */
+int fcb_elem_info(struct fcb *, struct fcb_entry *loc);
+
+/*
+ * Optional in-RAM index of entries. Keeps a checkpoint (sector, offset,
+ * sequence number) at the start of every sector, and every
+ * f_index_stride entries in between. Stride doubles when ents fills up,
+ * so cnt bounds the memory used, not the number of entries covered; cnt
+ * has to be at least twice the number of sectors.
+ *
+ * fcb_index_init() builds the index by walking the FCB once, numbering the
+ * oldest entry 0. After that it is kept up to date by fcb_append(),
+ * fcb_append_batch() and fcb_rotate(). fcb_init() drops the index.
+ * Entries which were reserved but not (yet) finished keep their numbers,
+ * so appends from several tasks can complete in any order.
+ *
+ * fcb_index_seek() sets loc to entry with sequence number *seq. If that
+ * entry has been rotated out, loc is set to the oldest entry, and *seq is
+ * updated to match. Likewise if the entry has not been finished, loc is
+ * set to the next one which has. loc can be passed to fcb_getnext() to
+ * continue from there.
+ *
+ * fcb_index_seek_cmp() finds the last checkpoint whose entry cmp() reports
+ * as being before the searched key (cmp() returns < 0), assuming entries
+ * are ordered by the key, e.g. by timestamp. loc is set so that
+ * fcb_getnext() on it returns the first entry after that checkpoint,
+ * or the oldest entry if there is no such checkpoint.
+ */
+int fcb_index_init(struct fcb *, struct fcb_index_ent *ents, int cnt);
+int fcb_index_seek(struct fcb *, uint32_t *seq, struct fcb_entry *loc);
+typedef int (*fcb_index_cmp_cb)(struct fcb_entry *loc, void *arg);
+int fcb_index_seek_cmp(struct fcb *, fcb_index_cmp_cb cmp, void *arg,
+  struct fcb_entry *loc);
+
 /*
  * Erases the data from oldest sector.
  */
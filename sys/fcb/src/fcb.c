@@ -22,6 +22,47 @@
 #include "fcb/fcb.h"
 #include "fcb_priv.h"
 
+/*
+ * Find where the next entry in the area should go. Only the length
+ * headers are read; entries with bad crc would be skipped over by their
+ * length in any case, so there is no need to checksum the data.
+ *
+ * If the chain of entries ends with something else than an erased header,
+ * e.g. because writing of a header was interrupted, the rest of the area
+ * cannot be safely written to. Then the next append moves to a new area.
+ */
+static int
+fcb_find_end(struct fcb *fcb, struct fcb_entry *loc)
+{
+    uint8_t tmp_str[2];
+    uint16_t len;
+    uint32_t off;
+    uint32_t next;
+    int cnt;
+    int rc;
+
+    off = sizeof(struct fcb_disk_area);
+    while (off + sizeof(tmp_str) <= loc->fe_area->fa_size) {
+        rc = flash_area_read(loc->fe_area, off, tmp_str, sizeof(tmp_str));
+        if (rc) {
+            return FCB_ERR_FLASH;
+        }
+        cnt = fcb_get_len(tmp_str, &len);
+        if (cnt < 0) {
+            break;
+        }
+        next = off + fcb_len_in_flash(fcb, cnt) + fcb_len_in_flash(fcb, len) +
+          fcb_len_in_flash(fcb, FCB_CRC_SZ);
+        if (len >= FCB_MAX_LEN || next > loc->fe_area->fa_size) {
+            off = loc->fe_area->fa_size;
+            break;
+        }
+        off = next;
+    }
+    loc->fe_elem_off = off;
+    return 0;
+}
+
 int
 fcb_init(struct fcb *fcb)
 {
@@ -78,12 +119,11 @@ fcb_init(struct fcb *fcb)
     fcb->f_active.fe_area = newest_fap;
     fcb->f_active.fe_elem_off = sizeof(struct fcb_disk_area);
     fcb->f_active_id = newest;
+    fcb->f_index = NULL;
 
-    while (1) {
-        rc = fcb_getnext_in_area(fcb, &fcb->f_active);
-        if (rc == FCB_ERR_NOVAR) {
-            break;
-        }
+    rc = fcb_find_end(fcb, &fcb->f_active);
+    if (rc) {
+        return rc;
     }
     os_mutex_init(&fcb->f_mtx);
     return FCB_OK;
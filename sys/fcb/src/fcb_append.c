@@ -17,6 +17,7 @@
  * under the License.
  */
 #include <stddef.h>
+#include <string.h>
 
 #include "fcb/fcb.h"
 #include "fcb_priv.h"
@@ -66,11 +67,34 @@ fcb_append_to_scratch(struct fcb *fcb)
     return FCB_OK;
 }
 
+/*
+ * Move writing to next sector, which has to be able to hold len bytes of
+ * entries. Called with the mutex held.
+ */
+static int
+fcb_append_new_area(struct fcb *fcb, int len)
+{
+    struct flash_area *fa;
+    int rc;
+
+    fa = fcb_new_area(fcb, fcb->f_scratch_cnt);
+    if (!fa || (fa->fa_size < sizeof(struct fcb_disk_area) + len)) {
+        return FCB_ERR_NOSPACE;
+    }
+    rc = fcb_sector_hdr_init(fcb, fa, fcb->f_active_id + 1);
+    if (rc) {
+        return rc;
+    }
+    fcb->f_active.fe_area = fa;
+    fcb->f_active.fe_elem_off = sizeof(struct fcb_disk_area);
+    fcb->f_active_id++;
+    return FCB_OK;
+}
+
 int
 fcb_append(struct fcb *fcb, uint16_t len, struct fcb_entry *append_loc)
 {
     struct fcb_entry *active;
-    struct flash_area *fa;
     uint8_t tmp_str[2];
     int cnt;
     int rc;
@@ -88,19 +112,10 @@ fcb_append(struct fcb *fcb, uint16_t len, struct fcb_entry *append_loc)
     }
     active = &fcb->f_active;
     if (active->fe_elem_off + len + cnt > active->fe_area->fa_size) {
-        fa = fcb_new_area(fcb, fcb->f_scratch_cnt);
-        if (!fa || (fa->fa_size <
-            sizeof(struct fcb_disk_area) + len + cnt)) {
-            rc = FCB_ERR_NOSPACE;
-            goto err;
-        }
-        rc = fcb_sector_hdr_init(fcb, fa, fcb->f_active_id + 1);
+        rc = fcb_append_new_area(fcb, len + cnt);
         if (rc) {
             goto err;
         }
-        fcb->f_active.fe_area = fa;
-        fcb->f_active.fe_elem_off = sizeof(struct fcb_disk_area);
-        fcb->f_active_id++;
     }
 
     rc = flash_area_write(active->fe_area, active->fe_elem_off, tmp_str, cnt);
@@ -113,6 +128,9 @@ fcb_append(struct fcb *fcb, uint16_t len, struct fcb_entry *append_loc)
     append_loc->fe_data_off = active->fe_elem_off + cnt;
 
     active->fe_elem_off = append_loc->fe_data_off + len;
+    if (fcb->f_index) {
+        fcb_index_add(fcb, append_loc);
+    }
 
     os_mutex_release(&fcb->f_mtx);
 
@@ -141,3 +159,141 @@ fcb_append_finish(struct fcb *fcb, struct fcb_entry *loc)
     }
     return 0;
 }
+
+/*
+ * Size of entry with data_len bytes of data in flash. Length of the
+ * header is returned in hdr_len.
+ */
+static int
+fcb_batch_elem_len(struct fcb *fcb, uint16_t data_len, int *hdr_len)
+{
+    uint8_t tmp_str[2];
+    int cnt;
+
+    cnt = fcb_put_len(tmp_str, data_len);
+    if (cnt < 0) {
+        return cnt;
+    }
+    *hdr_len = cnt;
+    return fcb_len_in_flash(fcb, cnt) + fcb_len_in_flash(fcb, data_len) +
+      fcb_len_in_flash(fcb, FCB_CRC_SZ);
+}
+
+/*
+ * Write out the entries packed into buf, starting from ents[0].
+ * Called with the mutex held.
+ */
+static int
+fcb_batch_flush(struct fcb *fcb, struct fcb_batch_ent *ents, uint8_t *buf,
+  int len)
+{
+    struct fcb_entry *active;
+    struct fcb_entry loc;
+    int hdr_len;
+    int off;
+    int rc;
+
+    active = &fcb->f_active;
+    rc = flash_area_write(active->fe_area, active->fe_elem_off, buf, len);
+    if (rc) {
+        return FCB_ERR_FLASH;
+    }
+    for (off = 0; off < len; ents++) {
+        loc.fe_area = active->fe_area;
+        loc.fe_elem_off = active->fe_elem_off + off;
+        off += fcb_batch_elem_len(fcb, ents->fbe_len, &hdr_len);
+        if (fcb->f_index) {
+            fcb_index_add(fcb, &loc);
+        }
+    }
+    active->fe_elem_off += len;
+    return FCB_OK;
+}
+
+int
+fcb_append_batch(struct fcb *fcb, struct fcb_batch_ent *ents, int cnt,
+  uint8_t *buf, int buf_len)
+{
+    struct fcb_entry *active;
+    uint8_t *p;
+    uint8_t crc8;
+    int hdr_len;
+    int elem_len;
+    int first;
+    int off;
+    int rc;
+    int i;
+
+    rc = os_mutex_pend(&fcb->f_mtx, OS_WAIT_FOREVER);
+    if (rc && rc != OS_NOT_STARTED) {
+        return FCB_ERR_ARGS;
+    }
+    rc = FCB_OK;
+    active = &fcb->f_active;
+    first = 0;
+    off = 0;
+    for (i = 0; i < cnt; ) {
+        elem_len = fcb_batch_elem_len(fcb, ents[i].fbe_len, &hdr_len);
+        if (elem_len < 0) {
+            rc = elem_len;
+            break;
+        }
+        if (elem_len > buf_len) {
+            rc = FCB_ERR_ARGS;
+            break;
+        }
+        if (off + elem_len > buf_len ||
+          active->fe_elem_off + off + elem_len > active->fe_area->fa_size) {
+            /*
+             * Buffer full, or the entry does not fit in this sector.
+             * Write out what has been packed so far, or if there is
+             * nothing, move to the next sector.
+             */
+            if (off) {
+                rc = fcb_batch_flush(fcb, &ents[first], buf, off);
+                if (rc) {
+                    break;
+                }
+                first = i;
+                off = 0;
+            } else {
+                rc = fcb_append_new_area(fcb, elem_len);
+                if (rc) {
+                    break;
+                }
+            }
+            continue;
+        }
+
+        /*
+         * Same layout as fcb_append() and fcb_append_finish() produce;
+         * length, data and crc, each padded to alignment.
+         */
+        p = buf + off;
+        memset(p, 0xff, elem_len);
+        fcb_put_len(p, ents[i].fbe_len);
+        crc8 = crc8_init();
+        crc8 = crc8_calc(crc8, p, hdr_len);
+        p += fcb_len_in_flash(fcb, hdr_len);
+        memcpy(p, ents[i].fbe_data, ents[i].fbe_len);
+        crc8 = crc8_calc(crc8, p, ents[i].fbe_len);
+        p += fcb_len_in_flash(fcb, ents[i].fbe_len);
+        *p = crc8;
+
+        off += elem_len;
+        i++;
+    }
+    if (off) {
+        if (fcb_batch_flush(fcb, &ents[first], buf, off) == 0) {
+            first = i;
+        } else {
+            rc = FCB_ERR_FLASH;
+        }
+    }
+    os_mutex_release(&fcb->f_mtx);
+
+    if (first) {
+        return first;
+    }
+    return rc;
+}
@@ -50,6 +50,14 @@ fcb_elem_crc8(struct fcb *fcb, struct fcb_entry *loc, uint8_t *c8p)
     }
     loc->fe_data_off = loc->fe_elem_off + fcb_len_in_flash(fcb, cnt);
     loc->fe_data_len = len;
+    if (loc->fe_data_off + fcb_len_in_flash(fcb, len) +
+      fcb_len_in_flash(fcb, FCB_CRC_SZ) > loc->fe_area->fa_size) {
+        /*
+         * Damaged header; entry would not fit in the area. Treat it as
+         * the end of the area.
+         */
+        return FCB_ERR_NOVAR;
+    }
 
     crc8 = crc8_init();
     crc8 = crc8_calc(crc8, tmp_str, cnt);
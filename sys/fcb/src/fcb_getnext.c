@@ -84,6 +84,9 @@ fcb_getnext_nolock(struct fcb *fcb, struct fcb_entry *loc)
         if (rc == FCB_ERR_NOVAR) {
             goto next_sector;
         }
+        if (rc != FCB_ERR_CRC) {
+            return rc;
+        }
     }
     while (rc == FCB_ERR_CRC) {
         rc = fcb_getnext_in_area(fcb, loc);
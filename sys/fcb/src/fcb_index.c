@@ -0,0 +1,306 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stddef.h>
+
+#include "fcb/fcb.h"
+#include "fcb_priv.h"
+
+#define FCB_SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+
+static struct fcb_index_ent *
+fcb_index_at(struct fcb *fcb, int i)
+{
+    return &fcb->f_index[(fcb->f_index_start + i) % fcb->f_index_max];
+}
+
+/*
+ * Double the stride; drop every other checkpoint, except ones at the start
+ * of a sector.
+ */
+static void
+fcb_index_compact(struct fcb *fcb)
+{
+    struct fcb_index_ent *ent;
+    int keep;
+    int cnt;
+    int i;
+
+    cnt = 0;
+    keep = 0;
+    for (i = 0; i < fcb->f_index_cnt; i++) {
+        ent = fcb_index_at(fcb, i);
+        if (!ent->fie_first) {
+            keep = !keep;
+            if (!keep) {
+                continue;
+            }
+        }
+        *fcb_index_at(fcb, cnt++) = *ent;
+    }
+    fcb->f_index_cnt = cnt;
+    fcb->f_index_stride *= 2;
+}
+
+/*
+ * Called with f_mtx held, when space for entry at loc has been reserved.
+ * Entries are numbered in the order they are laid out in flash, which
+ * with concurrent appenders is not necessarily the order in which they
+ * are finished.
+ */
+void
+fcb_index_add(struct fcb *fcb, struct fcb_entry *loc)
+{
+    struct fcb_index_ent *ent;
+    uint32_t seq;
+    int sector;
+    int first;
+
+    seq = fcb->f_index_seq++;
+    if (!fcb->f_index) {
+        return;
+    }
+    sector = loc->fe_area - fcb->f_sectors;
+    first = 1;
+    if (fcb->f_index_cnt) {
+        ent = fcb_index_at(fcb, fcb->f_index_cnt - 1);
+        if (ent->fie_sector == sector) {
+            if (seq - ent->fie_seq < fcb->f_index_stride) {
+                return;
+            }
+            first = 0;
+        }
+    }
+    if (fcb->f_index_cnt == fcb->f_index_max) {
+        fcb_index_compact(fcb);
+        if (fcb->f_index_cnt == fcb->f_index_max) {
+            return;
+        }
+    }
+    ent = fcb_index_at(fcb, fcb->f_index_cnt++);
+    ent->fie_seq = seq;
+    ent->fie_elem_off = loc->fe_elem_off;
+    ent->fie_sector = sector;
+    ent->fie_first = first;
+}
+
+/*
+ * Called with f_mtx held, when sector fap has been erased.
+ */
+void
+fcb_index_rotate(struct fcb *fcb, struct flash_area *fap)
+{
+    int sector;
+
+    if (!fcb->f_index) {
+        return;
+    }
+    sector = fap - fcb->f_sectors;
+    while (fcb->f_index_cnt &&
+      fcb_index_at(fcb, 0)->fie_sector == sector) {
+        fcb->f_index_start = (fcb->f_index_start + 1) % fcb->f_index_max;
+        fcb->f_index_cnt--;
+    }
+}
+
+/*
+ * Move loc to the next entry in flash, starting from the oldest one if
+ * loc->fe_area is NULL. Unlike fcb_getnext(), entries without a valid
+ * crc are not skipped, so that every reserved entry has a sequence number;
+ * FCB_ERR_CRC is returned for those.
+ */
+static int
+fcb_index_step(struct fcb *fcb, struct fcb_entry *loc)
+{
+    int rc;
+
+    if (loc->fe_area == NULL) {
+        loc->fe_area = fcb->f_oldest;
+        loc->fe_elem_off = sizeof(struct fcb_disk_area);
+    } else {
+        loc->fe_elem_off = loc->fe_data_off +
+          fcb_len_in_flash(fcb, loc->fe_data_len) +
+          fcb_len_in_flash(fcb, FCB_CRC_SZ);
+    }
+    while (1) {
+        rc = fcb_elem_info(fcb, loc);
+        if (rc == 0 || rc == FCB_ERR_CRC) {
+            return rc;
+        }
+        if (loc->fe_area == fcb->f_active.fe_area) {
+            return FCB_ERR_NOVAR;
+        }
+        loc->fe_area = fcb_getnext_area(fcb, loc->fe_area);
+        loc->fe_elem_off = sizeof(struct fcb_disk_area);
+    }
+}
+
+int
+fcb_index_init(struct fcb *fcb, struct fcb_index_ent *ents, int cnt)
+{
+    struct fcb_entry loc;
+    int rc;
+
+    if (!ents || cnt < 2 * fcb->f_sector_cnt || cnt > UINT16_MAX) {
+        return FCB_ERR_ARGS;
+    }
+    rc = os_mutex_pend(&fcb->f_mtx, OS_WAIT_FOREVER);
+    if (rc && rc != OS_NOT_STARTED) {
+        return FCB_ERR_ARGS;
+    }
+    fcb->f_index = ents;
+    fcb->f_index_max = cnt;
+    fcb->f_index_cnt = 0;
+    fcb->f_index_start = 0;
+    fcb->f_index_stride = 1;
+    fcb->f_index_seq = 0;
+
+    loc.fe_area = NULL;
+    while (1) {
+        rc = fcb_index_step(fcb, &loc);
+        if (rc != 0 && rc != FCB_ERR_CRC) {
+            break;
+        }
+        fcb_index_add(fcb, &loc);
+    }
+    os_mutex_release(&fcb->f_mtx);
+    return FCB_OK;
+}
+
+/*
+ * Returns FCB_ERR_CRC if the entry has not been finished (yet).
+ */
+static int
+fcb_index_loc(struct fcb *fcb, struct fcb_index_ent *ent,
+  struct fcb_entry *loc)
+{
+    loc->fe_area = &fcb->f_sectors[ent->fie_sector];
+    loc->fe_elem_off = ent->fie_elem_off;
+    return fcb_elem_info(fcb, loc);
+}
+
+int
+fcb_index_seek(struct fcb *fcb, uint32_t *seq, struct fcb_entry *loc)
+{
+    struct fcb_index_ent *ent;
+    uint32_t target;
+    int lo, hi, mid;
+    int rc;
+
+    rc = os_mutex_pend(&fcb->f_mtx, OS_WAIT_FOREVER);
+    if (rc && rc != OS_NOT_STARTED) {
+        return FCB_ERR_ARGS;
+    }
+    if (!fcb->f_index) {
+        rc = FCB_ERR_ARGS;
+        goto out;
+    }
+    target = *seq;
+    if (fcb->f_index_cnt == 0 || !FCB_SEQ_GT(fcb->f_index_seq, target)) {
+        rc = FCB_ERR_NOVAR;
+        goto out;
+    }
+    if (FCB_SEQ_GT(fcb_index_at(fcb, 0)->fie_seq, target)) {
+        target = fcb_index_at(fcb, 0)->fie_seq;
+    }
+
+    /*
+     * Last checkpoint at or before target.
+     */
+    lo = 0;
+    hi = fcb->f_index_cnt - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (FCB_SEQ_GT(fcb_index_at(fcb, mid)->fie_seq, target)) {
+            hi = mid - 1;
+        } else {
+            lo = mid;
+        }
+    }
+    ent = fcb_index_at(fcb, lo);
+    rc = fcb_index_loc(fcb, ent, loc);
+    *seq = ent->fie_seq;
+
+    /*
+     * Count unfinished entries too, but don't stop on one.
+     */
+    while (rc == FCB_ERR_CRC || (rc == 0 && FCB_SEQ_GT(target, *seq))) {
+        rc = fcb_index_step(fcb, loc);
+        (*seq)++;
+    }
+out:
+    os_mutex_release(&fcb->f_mtx);
+    return rc;
+}
+
+int
+fcb_index_seek_cmp(struct fcb *fcb, fcb_index_cmp_cb cmp, void *arg,
+  struct fcb_entry *loc)
+{
+    struct fcb_entry tmp;
+    int lo, hi, mid;
+    int rc;
+
+    rc = os_mutex_pend(&fcb->f_mtx, OS_WAIT_FOREVER);
+    if (rc && rc != OS_NOT_STARTED) {
+        return FCB_ERR_ARGS;
+    }
+    if (!fcb->f_index) {
+        rc = FCB_ERR_ARGS;
+        goto out;
+    }
+
+    /*
+     * lo is the number of checkpoints known to be before the key.
+     */
+    lo = 0;
+    hi = fcb->f_index_cnt;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        rc = fcb_index_loc(fcb, fcb_index_at(fcb, mid), &tmp);
+        if (rc == FCB_ERR_CRC) {
+            /*
+             * Unfinished entry; compare against the next one instead.
+             */
+            rc = fcb_getnext_nolock(fcb, &tmp);
+            if (rc == FCB_ERR_NOVAR) {
+                hi = mid;
+                rc = 0;
+                continue;
+            }
+        }
+        if (rc) {
+            goto out;
+        }
+        if (cmp(&tmp, arg) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        loc->fe_area = NULL;
+        loc->fe_elem_off = 0;
+    } else {
+        rc = fcb_index_loc(fcb, fcb_index_at(fcb, lo - 1), loc);
+    }
+out:
+    os_mutex_release(&fcb->f_mtx);
+    return rc;
+}
@@ -49,6 +49,7 @@ fcb_rotate(struct fcb *fcb)
         rc = FCB_ERR_FLASH;
         goto out;
     }
+    fcb_index_rotate(fcb, fcb->f_oldest);
     fcb->f_oldest = fcb_getnext_area(fcb, fcb->f_oldest);
 out:
     os_mutex_release(&fcb->f_mtx);
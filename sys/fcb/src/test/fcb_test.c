@@ -257,6 +257,15 @@ fcb_test_cnt_elems_cb(struct fcb_entry *loc, void *arg)
     return 0;
 }
 
+static int
+fcb_test_cnt_len_cb(struct fcb_entry *loc, void *arg)
+{
+    int *len = (int *)arg;
+
+    *len += loc->fe_data_len;
+    return 0;
+}
+
 TEST_CASE(fcb_test_append_fill)
 {
     struct fcb *fcb;
@@ -328,6 +337,98 @@ TEST_CASE(fcb_test_append_fill)
 
 }
 
+TEST_CASE(fcb_test_append_batch)
+{
+    int rc;
+    struct fcb *fcb;
+    struct fcb_batch_ent ents[16];
+    uint8_t test_data[16][128];
+    uint8_t buf[256];
+    int elem_cnt = 0;
+    int aa_cnts[2];
+    struct append_arg aa_arg = {
+        .elem_cnts = aa_cnts
+    };
+    int var_cnt;
+    int i;
+    int j;
+    int len;
+
+    fcb_test_wipe();
+    fcb = &test_fcb;
+    memset(fcb, 0, sizeof(*fcb));
+    fcb->f_sector_cnt = 2;
+    fcb->f_sectors = test_fcb_area;
+
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+
+    /*
+     * Entries of growing length, several buffer flushes per batch.
+     */
+    for (len = 0; len < sizeof(test_data[0]); len += 16) {
+        for (i = 0; i < 16; i++) {
+            for (j = 0; j < len + i; j++) {
+                test_data[i][j] = fcb_test_append_data(len + i, j);
+            }
+            ents[i].fbe_data = test_data[i];
+            ents[i].fbe_len = len + i;
+        }
+        rc = fcb_append_batch(fcb, ents, 16, buf, sizeof(buf));
+        TEST_ASSERT(rc == 16);
+    }
+
+    var_cnt = 0;
+    rc = fcb_walk(fcb, 0, fcb_test_data_walk_cb, &var_cnt);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(var_cnt == sizeof(test_data[0]));
+
+    /*
+     * Too small buffer.
+     */
+    rc = fcb_append_batch(fcb, ents, 16, buf, 64);
+    TEST_ASSERT(rc == FCB_ERR_ARGS);
+
+    /*
+     * Fill up both sectors.
+     */
+    fcb_test_wipe();
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < sizeof(test_data[0]); j++) {
+            test_data[i][j] = fcb_test_append_data(sizeof(test_data[0]), j);
+        }
+        ents[i].fbe_data = test_data[i];
+        ents[i].fbe_len = sizeof(test_data[0]);
+    }
+    while (1) {
+        rc = fcb_append_batch(fcb, ents, 16, buf, sizeof(buf));
+        if (rc == FCB_ERR_NOSPACE) {
+            break;
+        }
+        TEST_ASSERT_FATAL(rc > 0);
+        elem_cnt += rc;
+    }
+    memset(aa_cnts, 0, sizeof(aa_cnts));
+    rc = fcb_walk(fcb, NULL, fcb_test_cnt_elems_cb, &aa_arg);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(aa_cnts[0] > 0);
+    TEST_ASSERT(aa_cnts[0] == aa_cnts[1]);
+    TEST_ASSERT(aa_cnts[0] + aa_cnts[1] == elem_cnt);
+
+    /*
+     * Entries survive reinit.
+     */
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+    memset(aa_cnts, 0, sizeof(aa_cnts));
+    rc = fcb_walk(fcb, NULL, fcb_test_cnt_elems_cb, &aa_arg);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(aa_cnts[0] + aa_cnts[1] == elem_cnt);
+}
+
 TEST_CASE(fcb_test_reset)
 {
     struct fcb *fcb;
@@ -454,6 +555,96 @@ TEST_CASE(fcb_test_reset)
     TEST_ASSERT(var_cnt == 35);
 }
 
+TEST_CASE(fcb_test_reset_partial)
+{
+    struct fcb *fcb;
+    int rc;
+    int i;
+    struct fcb_entry loc;
+    uint8_t test_data[128];
+    int var_cnt;
+
+    fcb_test_wipe();
+    fcb = &test_fcb;
+    memset(fcb, 0, sizeof(*fcb));
+    fcb->f_sector_cnt = 2;
+    fcb->f_sectors = test_fcb_area;
+
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < sizeof(test_data); i++) {
+        test_data[i] = fcb_test_append_data(sizeof(test_data), i);
+    }
+    for (i = 0; i < 4; i++) {
+        rc = fcb_append(fcb, i, &loc);
+        TEST_ASSERT(rc == 0);
+        rc = flash_area_write(loc.fe_area, loc.fe_data_off, test_data, i);
+        TEST_ASSERT(rc == 0);
+        if (i != 2) {
+            /*
+             * Leave out crc from entry 2, that one gets skipped.
+             */
+            rc = fcb_append_finish(fcb, &loc);
+            TEST_ASSERT(rc == 0);
+        }
+    }
+    rc = fcb_append(fcb, sizeof(test_data), &loc);
+    TEST_ASSERT(rc == 0);
+    rc = flash_area_write(loc.fe_area, loc.fe_data_off, test_data,
+      sizeof(test_data));
+    TEST_ASSERT(rc == 0);
+    rc = fcb_append_finish(fcb, &loc);
+    TEST_ASSERT(rc == 0);
+
+    /*
+     * Pretend reset. Append continues right after the last entry.
+     */
+    memset(fcb, 0, sizeof(*fcb));
+    fcb->f_sector_cnt = 2;
+    fcb->f_sectors = test_fcb_area;
+
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(fcb->f_active.fe_area == loc.fe_area);
+    TEST_ASSERT(fcb->f_active.fe_elem_off == loc.fe_data_off +
+      sizeof(test_data) + 1);
+
+    /*
+     * Interrupted write of a 2 byte length header. The rest of the sector
+     * must not be used after reset.
+     */
+    test_data[0] = 0x85;
+    rc = flash_area_write(loc.fe_area, fcb->f_active.fe_elem_off, test_data,
+      1);
+    TEST_ASSERT(rc == 0);
+
+    memset(fcb, 0, sizeof(*fcb));
+    fcb->f_sector_cnt = 2;
+    fcb->f_sectors = test_fcb_area;
+
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(fcb->f_active.fe_elem_off == loc.fe_area->fa_size);
+
+    for (i = 0; i < sizeof(test_data); i++) {
+        test_data[i] = fcb_test_append_data(sizeof(test_data), i);
+    }
+    rc = fcb_append(fcb, sizeof(test_data), &loc);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(loc.fe_area == &test_fcb_area[1]);
+    rc = flash_area_write(loc.fe_area, loc.fe_data_off, test_data,
+      sizeof(test_data));
+    TEST_ASSERT(rc == 0);
+    rc = fcb_append_finish(fcb, &loc);
+    TEST_ASSERT(rc == 0);
+
+    var_cnt = 0;
+    rc = fcb_walk(fcb, 0, fcb_test_cnt_len_cb, &var_cnt);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(var_cnt == 0 + 1 + 3 + sizeof(test_data) * 2);
+}
+
 TEST_CASE(fcb_test_rotate)
 {
     struct fcb *fcb;
@@ -634,6 +825,213 @@ TEST_CASE(fcb_test_multiple_scratch)
     TEST_ASSERT(rc != 0);
 }
 
+static int
+fcb_test_index_cmp(struct fcb_entry *loc, void *arg)
+{
+    uint32_t val;
+    int rc;
+
+    rc = flash_area_read(loc->fe_area, loc->fe_data_off, &val, sizeof(val));
+    TEST_ASSERT(rc == 0);
+    if (val < *(uint32_t *)arg) {
+        return -1;
+    }
+    return val > *(uint32_t *)arg;
+}
+
+static void
+fcb_test_index_check(struct fcb *fcb, uint32_t first, uint32_t cnt)
+{
+    struct fcb_entry loc;
+    uint32_t seq;
+    uint32_t val;
+    uint32_t i;
+    int rc;
+
+    for (i = 0; i < cnt; i++) {
+        seq = i;
+        rc = fcb_index_seek(fcb, &seq, &loc);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(seq == i);
+        rc = flash_area_read(loc.fe_area, loc.fe_data_off, &val, sizeof(val));
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(val == first + i);
+
+        /*
+         * Entry after the one found by key comparison is the first one
+         * not before the key.
+         */
+        val = first + i;
+        rc = fcb_index_seek_cmp(fcb, fcb_test_index_cmp, &val, &loc);
+        TEST_ASSERT(rc == 0);
+        while (1) {
+            rc = fcb_getnext(fcb, &loc);
+            TEST_ASSERT(rc == 0);
+            rc = flash_area_read(loc.fe_area, loc.fe_data_off, &val,
+              sizeof(val));
+            TEST_ASSERT(rc == 0);
+            TEST_ASSERT(val <= first + i);
+            if (val == first + i) {
+                break;
+            }
+        }
+    }
+    seq = cnt;
+    rc = fcb_index_seek(fcb, &seq, &loc);
+    TEST_ASSERT(rc == FCB_ERR_NOVAR);
+}
+
+TEST_CASE(fcb_test_index)
+{
+    struct fcb *fcb;
+    struct fcb_index_ent ents[12];
+    struct fcb_entry loc;
+    uint8_t test_data[64];
+    uint32_t first;
+    uint32_t seq;
+    uint32_t i;
+    int rc;
+
+    fcb_test_wipe();
+    fcb = &test_fcb;
+    memset(fcb, 0, sizeof(*fcb));
+    fcb->f_sector_cnt = 4;
+    fcb->f_scratch_cnt = 1;
+    fcb->f_sectors = test_fcb_area;
+
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+
+    rc = fcb_index_init(fcb, ents, 4);
+    TEST_ASSERT(rc == FCB_ERR_ARGS);
+    rc = fcb_index_init(fcb, ents, sizeof(ents) / sizeof(ents[0]));
+    TEST_ASSERT(rc == 0);
+
+    /*
+     * Append enough to go around a few times. First 4 bytes of data is
+     * the running count.
+     */
+    memset(test_data, 0, sizeof(test_data));
+    first = 0;
+    for (i = 0; i < 2000; i++) {
+        while (1) {
+            rc = fcb_append(fcb, sizeof(test_data), &loc);
+            if (rc != FCB_ERR_NOSPACE) {
+                break;
+            }
+            rc = fcb_rotate(fcb);
+            TEST_ASSERT(rc == 0);
+
+            /*
+             * First entry is now the one after the rotated out sector.
+             */
+            seq = 0;
+            rc = fcb_index_seek(fcb, &seq, &loc);
+            TEST_ASSERT(rc == 0);
+            rc = flash_area_read(loc.fe_area, loc.fe_data_off, &first,
+              sizeof(first));
+            TEST_ASSERT(rc == 0);
+            TEST_ASSERT(seq == first);
+        }
+        TEST_ASSERT(rc == 0);
+        memcpy(test_data, &i, sizeof(i));
+        rc = flash_area_write(loc.fe_area, loc.fe_data_off, test_data,
+          sizeof(test_data));
+        TEST_ASSERT(rc == 0);
+        rc = fcb_append_finish(fcb, &loc);
+        TEST_ASSERT(rc == 0);
+    }
+    TEST_ASSERT(first > 0);
+    TEST_ASSERT(fcb->f_index_stride > 1);
+
+    /*
+     * Sequence numbers are absolute here, oldest entry is not 0.
+     */
+    for (i = first; i < 2000; i += 37) {
+        seq = i;
+        rc = fcb_index_seek(fcb, &seq, &loc);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(seq == i);
+        rc = flash_area_read(loc.fe_area, loc.fe_data_off, &seq, sizeof(seq));
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(seq == i);
+    }
+
+    /*
+     * Rebuilt index numbers oldest entry as 0.
+     */
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+    rc = fcb_index_init(fcb, ents, sizeof(ents) / sizeof(ents[0]));
+    TEST_ASSERT(rc == 0);
+    fcb_test_index_check(fcb, first, 2000 - first);
+}
+
+TEST_CASE(fcb_test_index_interleaved)
+{
+    struct fcb *fcb;
+    struct fcb_index_ent ents[12];
+    struct fcb_entry loc[4];
+    struct fcb_entry tmp;
+    uint32_t val;
+    uint32_t seq;
+    int rc;
+    int i;
+
+    fcb_test_wipe();
+    fcb = &test_fcb;
+    memset(fcb, 0, sizeof(*fcb));
+    fcb->f_sector_cnt = 4;
+    fcb->f_scratch_cnt = 1;
+    fcb->f_sectors = test_fcb_area;
+
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+    rc = fcb_index_init(fcb, ents, sizeof(ents) / sizeof(ents[0]));
+    TEST_ASSERT(rc == 0);
+
+    /*
+     * Reserve 4 entries, finish them out of order, and leave entry 2
+     * unfinished.
+     */
+    for (i = 0; i < 4; i++) {
+        rc = fcb_append(fcb, sizeof(val), &loc[i]);
+        TEST_ASSERT(rc == 0);
+        val = i;
+        rc = flash_area_write(loc[i].fe_area, loc[i].fe_data_off, &val,
+          sizeof(val));
+        TEST_ASSERT(rc == 0);
+    }
+    rc = fcb_append_finish(fcb, &loc[3]);
+    TEST_ASSERT(rc == 0);
+    rc = fcb_append_finish(fcb, &loc[1]);
+    TEST_ASSERT(rc == 0);
+    rc = fcb_append_finish(fcb, &loc[0]);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < 4; i++) {
+        seq = i;
+        rc = fcb_index_seek(fcb, &seq, &tmp);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(seq == (i == 2 ? 3 : i));
+        rc = flash_area_read(tmp.fe_area, tmp.fe_data_off, &val,
+          sizeof(val));
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(val == seq);
+    }
+
+    /*
+     * Numbering stays the same once it is finished, and after a rebuild.
+     */
+    rc = fcb_append_finish(fcb, &loc[2]);
+    TEST_ASSERT(rc == 0);
+    rc = fcb_init(fcb);
+    TEST_ASSERT(rc == 0);
+    rc = fcb_index_init(fcb, ents, sizeof(ents) / sizeof(ents[0]));
+    TEST_ASSERT(rc == 0);
+    fcb_test_index_check(fcb, 0, 4);
+}
+
 TEST_SUITE(fcb_test_all)
 {
     fcb_test_len();
@@ -648,11 +1046,18 @@ TEST_SUITE(fcb_test_all)
 
     fcb_test_append_fill();
 
+    fcb_test_append_batch();
+
     fcb_test_reset();
 
+    fcb_test_reset_partial();
+
     fcb_test_rotate();
 
     fcb_test_multiple_scratch();
+
+    fcb_test_index();
+    fcb_test_index_interleaved();
 }
 
 #ifdef MYNEWT_SELFTEST
@@ -22,6 +22,7 @@
 #include "log/ignore.h"
 #include "util/cbmem.h"
 
+#include <os/os.h>
 #include <os/queue.h>
 
 struct log;
@@ -46,6 +47,8 @@ struct log_handler {
     lh_append_func_t log_append;
     lh_walk_func_t log_walk;
     lh_flush_func_t log_flush;
+    /* Optional; appends without blocking, after a system fault. */
+    lh_append_func_t log_append_fault;
     void *log_arg;
 };
 
@@ -74,6 +77,9 @@ struct log_entry_hdr {
 #define LOG_MODULE_NFFS             (5)
 #define LOG_MODULE_PERUSER          (64)
 
+/* Not a module; set in ue_module of entries written with LOG_DICT(). */
+#define LOG_MODULE_F_DICT           (0x8000)
+
 /* UTC Timestamnp for Jan 2016 00:00:00 */
 #define UTC01_01_2016    1451606400
 
@@ -140,6 +146,40 @@ int log_walk(struct log *log, log_walk_func_t walk_func,
         void *arg);
 int log_flush(struct log *log);
 
+/*
+ * Dictionary logging. LOG_DICT() places the format string in section
+ * "log_dict_fmt", and stores only the string's offset within that section,
+ * followed by the arguments as 32-bit words. Format strings are not needed
+ * on target; linker scripts keep the section out of the image, and the
+ * host tool sys/log/scripts/log_dict.py formats entries using a copy of
+ * the section from the ELF file.
+ *
+ * Arguments have to be integers, at most LOG_DICT_MAX_ARGS of them.
+ * Entries are marked with LOG_MODULE_F_DICT in ue_module; ue_level holds
+ * the level as is. Like the other LOG_ macros, entries below LOG_LEVEL
+ * are compiled out, format string included.
+ */
+#define LOG_DICT_MAX_ARGS   (8)
+
+extern const char __start_log_dict_fmt[] __attribute__((weak));
+
+#define LOG_DICT(__l, __mod, __level, __fmt, ...) do {                  \
+    if ((__level) >= LOG_LEVEL) {                                       \
+        static const char __log_dict_fmt[]                              \
+            __attribute__((section("log_dict_fmt"))) = __fmt;           \
+        uint32_t __log_dict_args[] = { 0, ##__VA_ARGS__ };              \
+                                                                        \
+        log_dict(__l, __mod, __level, __log_dict_fmt,                   \
+            &__log_dict_args[1],                                        \
+            sizeof(__log_dict_args) / sizeof(__log_dict_args[0]) - 1);  \
+    }                                                                   \
+} while (0)
+
+int log_dict(struct log *log, uint16_t module, uint16_t level,
+        const char *fmt, uint32_t *args, int cnt);
+int log_dict_read(struct log *log, void *dptr, uint16_t len,
+        uint32_t *id, uint32_t *args);
+
 
 
 /* Handler exports */
@@ -148,6 +188,38 @@ int log_console_handler_init(struct log_handler *);
 struct fcb;
 int log_fcb_handler_init(struct log_handler *handler, struct fcb *fcb);
 
+/*
+ * Asynchronous handler. log_append() copies entries to a RAM ring, and
+ * returns; log_async task passes them on to the backing handler later.
+ * Appending never blocks, and can be done from interrupts. If the ring is
+ * full, entry is dropped and counted in la_drops.
+ *
+ * log_async_init() starts the task. Unless os_fault_hook has been set
+ * already, it also sets a hook which passes queued entries on if the
+ * system faults; only backing handlers with log_append_fault take part.
+ * log_async_flush() passes all queued entries to backing handlers in the
+ * caller's context, waiting for the task if it is draining the same ring.
+ */
+struct log_async {
+    struct log la_log;          /* Given to backing handler */
+    uint8_t *la_buf;
+    uint16_t la_size;
+    volatile uint16_t la_head;  /* Where next entry goes */
+    volatile uint16_t la_tail;  /* Oldest entry */
+    volatile uint16_t la_used;  /* Bytes in use, including padding */
+    uint32_t la_drops;          /* Entries dropped, ring was full */
+    uint32_t la_errs;           /* Entries backing handler failed to take */
+    volatile uint8_t la_draining;
+    struct os_sem la_sem;       /* Held while draining */
+    struct os_event la_ev;
+    SLIST_ENTRY(log_async) la_next;
+};
+
+int log_async_handler_init(struct log_handler *handler, struct log_async *la,
+        struct log_handler *backing, void *buf, uint16_t size);
+int log_async_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size);
+void log_async_flush(void);
+
 /* Private */
 #ifdef NEWTMGR_PRESENT
 int log_nmgr_register_group(void);
@@ -0,0 +1,153 @@
+#!/usr/bin/env python
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+# Formats dictionary log entries (see LOG_DICT() in sys/log) on host.
+#
+# Format strings are in section log_dict_fmt of the application ELF file; it
+# is extracted with objcopy. Entries are read from the JSON response of the
+# newtmgr log read command, e.g.
+#
+#   log_dict.py -e app.elf logs.json
+#   log_dict.py -e app.elf -s app.dict      (save dictionary only)
+#   log_dict.py -d app.dict < logs.json
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+SECTION = "log_dict_fmt"
+
+# printf conversion; flags, width, precision, length and conversion.
+CONV_RE = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?"
+                     r"(hh|h|ll|l|j|z|t|L)?([diouxXcsp%])")
+
+
+def load_dict_from_elf(elf, objcopy):
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    try:
+        subprocess.check_call([objcopy, "--dump-section",
+                               SECTION + "=" + path, elf, os.devnull])
+        with open(path, "rb") as f:
+            return f.read()
+    finally:
+        os.remove(path)
+
+
+def dict_fmt(dictionary, msg_id):
+    if msg_id >= len(dictionary):
+        return None
+    end = dictionary.find(b"\0", msg_id)
+    if end < 0:
+        end = len(dictionary)
+    return dictionary[msg_id:end].decode("ascii", "replace")
+
+
+def to_signed(val):
+    val &= 0xffffffff
+    if val & 0x80000000:
+        val -= 0x100000000
+    return val
+
+
+def format_entry(fmt, args):
+    """Formats args, which are 32-bit words, like printf() would."""
+    args = list(args)
+
+    def conv(m):
+        flags, width, prec, _, c = m.groups()
+        if c == "%":
+            return "%"
+        if width == "*":
+            width = str(to_signed(args.pop(0))) if args else ""
+        if prec == "*":
+            prec = str(to_signed(args.pop(0))) if args else ""
+        if not args:
+            return "<?>"
+        val = args.pop(0) & 0xffffffff
+        if c in "di":
+            val = to_signed(val)
+        elif c == "u":
+            c = "d"
+        elif c == "p":
+            return "0x%x" % val
+        elif c == "s":
+            # Strings are not stored; show the pointer value.
+            return "<str 0x%x>" % val
+        spec = "%" + (flags or "") + (width or "")
+        if prec:
+            spec += "." + prec
+        return (spec + c) % val
+
+    return CONV_RE.sub(conv, fmt)
+
+
+def decode_logs(dictionary, logs, out):
+    for log in logs.get("logs", []):
+        out.write("Log %s\n" % log.get("name"))
+        for ent in log.get("entries", []):
+            if "dict" in ent:
+                fmt = dict_fmt(dictionary, ent["dict"])
+                if fmt is None:
+                    msg = "<unknown id %d> %s" % (ent["dict"], ent["args"])
+                else:
+                    msg = format_entry(fmt, ent.get("args", []))
+            else:
+                msg = ent.get("msg", "")
+            out.write("[%d] %s\n" % (ent.get("ts", 0), msg.rstrip("\n")))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Format dictionary log entries.")
+    parser.add_argument("-e", "--elf", help="application ELF file")
+    parser.add_argument("-d", "--dict", help="dictionary saved with -s")
+    parser.add_argument("-s", "--save", help="write dictionary to file")
+    parser.add_argument("--objcopy", default="arm-none-eabi-objcopy",
+                        help="objcopy to use with -e")
+    parser.add_argument("logs", nargs="?",
+                        help="newtmgr log read response, default stdin")
+    args = parser.parse_args()
+
+    if args.elf:
+        dictionary = load_dict_from_elf(args.elf, args.objcopy)
+    elif args.dict:
+        with open(args.dict, "rb") as f:
+            dictionary = f.read()
+    else:
+        parser.error("either --elf or --dict is needed")
+
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(dictionary)
+        return
+
+    if args.logs:
+        with open(args.logs) as f:
+            logs = json.load(f)
+    else:
+        logs = json.load(sys.stdin)
+    decode_logs(dictionary, logs, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
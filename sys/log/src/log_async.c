@@ -0,0 +1,296 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+
+#include <os/os.h>
+
+#include "log/log.h"
+
+#define LOG_ASYNC_EVENT_T_DRAIN     OS_EVENT_T_PERUSER
+
+#define LOG_ASYNC_REC_READY         0x01    /* Entry has been copied in */
+#define LOG_ASYNC_REC_SKIP          0x02    /* Unused space at end of ring */
+
+/*
+ * Header of an entry in the ring. Entries are padded to 4 byte boundary.
+ */
+struct log_async_rec {
+    uint16_t lar_len;
+    volatile uint8_t lar_flags;
+    uint8_t _pad;
+};
+
+static struct os_task log_async_task;
+static struct os_eventq log_async_evq;
+static int log_async_started;
+static SLIST_HEAD(, log_async) log_async_list =
+    SLIST_HEAD_INITIALIZER(&log_async_list);
+
+static int
+log_async_rec_len(int len)
+{
+    return OS_ALIGN(sizeof(struct log_async_rec) + len, 4);
+}
+
+/*
+ * Reserves space from the ring with interrupts disabled, then copies the
+ * entry with interrupts enabled. Entry is handed to the backing handler
+ * only after it has been marked ready.
+ */
+static int
+log_async_append(struct log *log, void *buf, int len)
+{
+    struct log_async *la;
+    struct log_async_rec *rec;
+    uint16_t off;
+    uint16_t skip;
+    int rlen;
+    os_sr_t sr;
+
+    la = (struct log_async *)log->l_log->log_arg;
+    rlen = log_async_rec_len(len);
+
+    OS_ENTER_CRITICAL(sr);
+    off = la->la_head;
+    skip = 0;
+    if (off + rlen > la->la_size) {
+        skip = la->la_size - off;
+    }
+    if (rlen > la->la_size || la->la_used + skip + rlen > la->la_size) {
+        la->la_drops++;
+        OS_EXIT_CRITICAL(sr);
+        return (OS_ENOMEM);
+    }
+    if (skip) {
+        rec = (struct log_async_rec *)(la->la_buf + off);
+        rec->lar_len = 0;
+        rec->lar_flags = LOG_ASYNC_REC_READY | LOG_ASYNC_REC_SKIP;
+        off = 0;
+    }
+    rec = (struct log_async_rec *)(la->la_buf + off);
+    rec->lar_len = len;
+    rec->lar_flags = 0;
+    la->la_head = (off + rlen) % la->la_size;
+    la->la_used += skip + rlen;
+    OS_EXIT_CRITICAL(sr);
+
+    memcpy(rec + 1, buf, len);
+    rec->lar_flags = LOG_ASYNC_REC_READY;
+
+    if (log_async_started) {
+        os_eventq_put(&log_async_evq, &la->la_ev);
+    }
+
+    return (0);
+}
+
+/*
+ * Pass ready entries to backing handler using the given append function,
+ * stopping at the first one which is still being copied in. Producer of
+ * that one will post another event.
+ */
+static void
+log_async_drain_entries(struct log_async *la, lh_append_func_t append)
+{
+    struct log_async_rec *rec;
+    int rlen;
+    int rc;
+    os_sr_t sr;
+
+    while (la->la_used) {
+        rec = (struct log_async_rec *)(la->la_buf + la->la_tail);
+        if (!(rec->lar_flags & LOG_ASYNC_REC_READY)) {
+            break;
+        }
+        if (rec->lar_flags & LOG_ASYNC_REC_SKIP) {
+            rlen = la->la_size - la->la_tail;
+        } else {
+            rlen = log_async_rec_len(rec->lar_len);
+            rc = append(&la->la_log, rec + 1, rec->lar_len);
+            if (rc != 0) {
+                la->la_errs++;
+            }
+        }
+
+        OS_ENTER_CRITICAL(sr);
+        la->la_tail = (la->la_tail + rlen) % la->la_size;
+        la->la_used -= rlen;
+        OS_EXIT_CRITICAL(sr);
+    }
+}
+
+/*
+ * If another task is draining the ring, wait for it to finish. This way
+ * everything queued before the call has been passed on when it returns.
+ */
+static void
+log_async_drain(struct log_async *la)
+{
+    os_sem_pend(&la->la_sem, OS_WAIT_FOREVER);
+    la->la_draining = 1;
+
+    log_async_drain_entries(la, la->la_log.l_log->log_append);
+
+    la->la_draining = 0;
+    os_sem_release(&la->la_sem);
+}
+
+static int
+log_async_read(struct log *log, void *dptr, void *buf, uint16_t offset,
+        uint16_t len)
+{
+    struct log_async *la;
+
+    la = (struct log_async *)log->l_log->log_arg;
+
+    return (la->la_log.l_log->log_read(&la->la_log, dptr, buf, offset, len));
+}
+
+static int
+log_async_walk(struct log *log, log_walk_func_t walk_func, void *arg)
+{
+    struct log_async *la;
+
+    la = (struct log_async *)log->l_log->log_arg;
+    log_async_drain(la);
+
+    return (la->la_log.l_log->log_walk(&la->la_log, walk_func, arg));
+}
+
+static int
+log_async_flush_log(struct log *log)
+{
+    struct log_async *la;
+
+    la = (struct log_async *)log->l_log->log_arg;
+    log_async_drain(la);
+
+    return (la->la_log.l_log->log_flush(&la->la_log));
+}
+
+/*
+ * Called on fault, with interrupts disabled. Only backing handlers which
+ * can take entries without blocking are used. Rings which were being
+ * drained are skipped; their backing handler was interrupted mid-append.
+ */
+static void
+log_async_fault(void)
+{
+    struct log_async *la;
+    lh_append_func_t append;
+
+    SLIST_FOREACH(la, &log_async_list, la_next) {
+        append = la->la_log.l_log->log_append_fault;
+        if (la->la_draining || !append) {
+            continue;
+        }
+        log_async_drain_entries(la, append);
+    }
+}
+
+void
+log_async_flush(void)
+{
+    struct log_async *la;
+
+    SLIST_FOREACH(la, &log_async_list, la_next) {
+        log_async_drain(la);
+    }
+}
+
+static void
+log_async_task_handler(void *arg)
+{
+    struct os_event *ev;
+
+    while (1) {
+        ev = os_eventq_get(&log_async_evq);
+        log_async_drain(ev->ev_arg);
+    }
+}
+
+/**
+ * Sets up an asynchronous handler in front of the backing handler.
+ *
+ * @param handler           The handler to set up.
+ * @param la                State of the handler.
+ * @param backing           Handler entries are passed to.
+ * @param buf               Ring buffer, 4 byte aligned.
+ * @param size              Size of buf.
+ *
+ * @return                  0 on success; OS_EINVAL if size is too small.
+ */
+int
+log_async_handler_init(struct log_handler *handler, struct log_async *la,
+        struct log_handler *backing, void *buf, uint16_t size)
+{
+    size &= ~3;
+    if (size < log_async_rec_len(LOG_ENTRY_HDR_SIZE)) {
+        return (OS_EINVAL);
+    }
+
+    memset(la, 0, sizeof(*la));
+    la->la_log.l_log = backing;
+    la->la_buf = buf;
+    la->la_size = size;
+    os_sem_init(&la->la_sem, 1);
+    la->la_ev.ev_type = LOG_ASYNC_EVENT_T_DRAIN;
+    la->la_ev.ev_arg = la;
+    SLIST_INSERT_HEAD(&log_async_list, la, la_next);
+
+    handler->log_type = backing->log_type;
+    handler->log_read = log_async_read;
+    handler->log_append = log_async_append;
+    handler->log_walk = log_async_walk;
+    handler->log_flush = log_async_flush_log;
+    handler->log_append_fault = NULL;
+    handler->log_arg = la;
+
+    return (0);
+}
+
+/**
+ * Starts the task which passes entries to backing handlers.
+ *
+ * @param prio              The priority of the task; should be low.
+ * @param stack             The task's stack.
+ * @param stack_size        The size of the stack, in os_stack_t units.
+ *
+ * @return                  0 on success; OS error code on failure.
+ */
+int
+log_async_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size)
+{
+    int rc;
+
+    os_eventq_init(&log_async_evq);
+
+    rc = os_task_init(&log_async_task, "log_async", log_async_task_handler,
+            NULL, prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return (rc);
+    }
+    if (!os_fault_hook) {
+        os_fault_hook = log_async_fault;
+    }
+
+    log_async_started = 1;
+    return (0);
+}
@@ -96,6 +96,23 @@ err:
     return (rc);
 }
 
+/*
+ * Append after a system fault, with interrupts disabled. Entry is copied
+ * only if no task was in the middle of updating the buffer.
+ */
+static int
+log_cbmem_append_fault(struct log *log, void *buf, int len)
+{
+    struct cbmem *cbmem;
+
+    cbmem = (struct cbmem *) log->l_log->log_arg;
+    if (cbmem->c_lock.mu_level != 0) {
+        return (OS_TIMEOUT);
+    }
+
+    return (log_cbmem_append(log, buf, len));
+}
+
 static int
 log_cbmem_flush(struct log *log)
 {
@@ -122,6 +139,7 @@ log_cbmem_handler_init(struct log_handler *handler, struct cbmem *cbmem)
     handler->log_append = log_cbmem_append;
     handler->log_walk = log_cbmem_walk;
     handler->log_flush = log_cbmem_flush;
+    handler->log_append_fault = log_cbmem_append_fault;
     handler->log_arg = (void *) cbmem;
 
     return (0);
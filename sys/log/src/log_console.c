@@ -19,6 +19,8 @@
 
 #include <os/os.h>
 
+#include <string.h>
+
 #include <util/cbmem.h>
 
 #include <console/console.h>
@@ -26,6 +28,25 @@
 #include "log/log.h"
 
 
+/*
+ * Dictionary entry; print message id and arguments.
+ */
+static void
+log_console_dict(void *buf, int len)
+{
+    uint8_t *data;
+    uint32_t val;
+    int off;
+
+    data = (uint8_t *) buf + LOG_ENTRY_HDR_SIZE;
+    len -= LOG_ENTRY_HDR_SIZE;
+    for (off = 0; off + sizeof(val) <= len; off += sizeof(val)) {
+        memcpy(&val, data + off, sizeof(val));
+        console_printf(off ? " %lx" : "dict %lu", (unsigned long) val);
+    }
+    console_printf("\n");
+}
+
 static int
 log_console_append(struct log *log, void *buf, int len)
 {
@@ -35,14 +56,19 @@ log_console_append(struct log *log, void *buf, int len)
         return (0);
     }
 
+    hdr = (struct log_entry_hdr *) buf;
     if (!console_is_midline) {
-        hdr = (struct log_entry_hdr *) buf;
         console_printf("[ts=%lussb, mod=%u level=%u] ",
-                (unsigned long) hdr->ue_ts, hdr->ue_module,
-                hdr->ue_level);
+                (unsigned long) hdr->ue_ts,
+                hdr->ue_module & ~LOG_MODULE_F_DICT, hdr->ue_level);
     }
 
-    console_write((char *) buf + LOG_ENTRY_HDR_SIZE, len - LOG_ENTRY_HDR_SIZE);
+    if (hdr->ue_module & LOG_MODULE_F_DICT) {
+        log_console_dict(buf, len);
+    } else {
+        console_write((char *) buf + LOG_ENTRY_HDR_SIZE,
+                len - LOG_ENTRY_HDR_SIZE);
+    }
 
     return (0);
 }
@@ -77,6 +103,8 @@ log_console_handler_init(struct log_handler *handler)
     handler->log_append = log_console_append;
     handler->log_walk = log_console_walk;
     handler->log_flush = log_console_flush;
+    /* Console is in blocking mode after a fault. */
+    handler->log_append_fault = log_console_append;
     handler->log_arg = NULL;
 
     return (0);
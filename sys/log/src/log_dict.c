@@ -0,0 +1,84 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <os/os.h>
+
+#include <string.h>
+
+#include "log/log.h"
+
+/*
+ * Entry payload of a dictionary log entry; id is offset of the format
+ * string within section log_dict_fmt, followed by the arguments.
+ */
+struct log_dict_entry {
+    uint32_t ld_id;
+    uint32_t ld_args[LOG_DICT_MAX_ARGS];
+} __attribute__((__packed__));
+
+int
+log_dict(struct log *log, uint16_t module, uint16_t level, const char *fmt,
+        uint32_t *args, int cnt)
+{
+    uint8_t buf[LOG_ENTRY_HDR_SIZE + sizeof(struct log_dict_entry)];
+    struct log_dict_entry *ld;
+    int rc;
+
+    if (cnt > LOG_DICT_MAX_ARGS) {
+        cnt = LOG_DICT_MAX_ARGS;
+    }
+
+    ld = (struct log_dict_entry *) &buf[LOG_ENTRY_HDR_SIZE];
+    ld->ld_id = fmt - __start_log_dict_fmt;
+    memcpy(ld->ld_args, args, cnt * sizeof(uint32_t));
+
+    rc = log_append(log, module | LOG_MODULE_F_DICT, level, buf,
+            sizeof(ld->ld_id) + cnt * sizeof(uint32_t));
+
+    return (rc);
+}
+
+/*
+ * Reads the message id and arguments of a dictionary log entry. Returns the
+ * number of arguments, or -1 if entry could not be read. args has to have
+ * room for LOG_DICT_MAX_ARGS values.
+ */
+int
+log_dict_read(struct log *log, void *dptr, uint16_t len, uint32_t *id,
+        uint32_t *args)
+{
+    struct log_dict_entry ld;
+    int dlen;
+    int rc;
+
+    dlen = len - LOG_ENTRY_HDR_SIZE;
+    if (dlen < sizeof(ld.ld_id) || dlen > sizeof(ld) ||
+            dlen % sizeof(uint32_t)) {
+        return (-1);
+    }
+
+    rc = log_read(log, dptr, &ld, LOG_ENTRY_HDR_SIZE, dlen);
+    if (rc != dlen) {
+        return (-1);
+    }
+    *id = ld.ld_id;
+    memcpy(args, ld.ld_args, dlen - sizeof(ld.ld_id));
+
+    return (dlen / sizeof(uint32_t) - 1);
+}
@@ -56,6 +56,23 @@ log_fcb_append(struct log *log, void *buf, int len)
     return 0;
 }
 
+/*
+ * Append after a system fault, with interrupts disabled. Entry is written
+ * only if no task was in the middle of an FCB operation; then taking the
+ * mutex does not block.
+ */
+static int
+log_fcb_append_fault(struct log *log, void *buf, int len)
+{
+    struct fcb *fcb;
+
+    fcb = (struct fcb *)log->l_log->log_arg;
+    if (fcb->f_mtx.mu_level != 0) {
+        return OS_TIMEOUT;
+    }
+    return log_fcb_append(log, buf, len);
+}
+
 static int
 log_fcb_read(struct log *log, void *dptr, void *buf, uint16_t offset,
   uint16_t len)
@@ -122,6 +139,7 @@ log_fcb_handler_init(struct log_handler *handler, struct fcb *fcb)
     handler->log_append = log_fcb_append;
     handler->log_walk = log_fcb_walk;
     handler->log_flush = log_fcb_flush;
+    handler->log_append_fault = log_fcb_append_fault;
     handler->log_arg = fcb;
 
     return 0;
@@ -48,6 +48,70 @@ static struct nmgr_handler log_nmgr_group_handlers[] = {
     [LOGS_NMGR_OP_CLEAR] = {log_nmgr_clear, log_nmgr_clear}
 };
 
+/*
+ * Dictionary entries are sent with message id and arguments; host formats
+ * them using the dictionary.
+ */
+static int
+log_nmgr_add_dict_entry(struct log *log, void *arg, void *dptr, uint16_t len,
+        struct log_entry_hdr *ueh)
+{
+    uint32_t args[LOG_DICT_MAX_ARGS];
+    uint32_t id;
+    int cnt;
+    int i;
+    struct json_encoder *encoder;
+    struct json_value jv;
+    int rc;
+
+    cnt = log_dict_read(log, dptr, len, &id, args);
+    if (cnt < 0) {
+        return (0);
+    }
+
+    encoder = (struct json_encoder *) arg;
+
+    json_encode_object_start(encoder);
+
+    JSON_VALUE_UINT(&jv, id);
+    rc = json_encode_object_entry(encoder, "dict", &jv);
+    if (rc != 0) {
+        goto err;
+    }
+
+    json_encode_array_name(encoder, "args");
+    json_encode_array_start(encoder);
+    for (i = 0; i < cnt; i++) {
+        JSON_VALUE_UINT(&jv, args[i]);
+        json_encode_array_value(encoder, &jv);
+    }
+    json_encode_array_finish(encoder);
+
+    JSON_VALUE_INT(&jv, ueh->ue_ts);
+    rc = json_encode_object_entry(encoder, "ts", &jv);
+    if (rc != 0) {
+        goto err;
+    }
+
+    JSON_VALUE_UINT(&jv, ueh->ue_level);
+    rc = json_encode_object_entry(encoder, "level", &jv);
+    if (rc != 0) {
+        goto err;
+    }
+
+    JSON_VALUE_UINT(&jv, ueh->ue_index);
+    rc = json_encode_object_entry(encoder, "index", &jv);
+    if (rc != 0) {
+        goto err;
+    }
+
+    json_encode_object_finish(encoder);
+
+    return (0);
+err:
+    return (rc);
+}
+
 static int
 log_nmgr_add_entry(struct log *log, void *arg, void *dptr, uint16_t len)
 {
@@ -63,6 +127,10 @@ log_nmgr_add_entry(struct log *log, void *arg, void *dptr, uint16_t len)
         goto err;
     }
 
+    if (ueh.ue_module & LOG_MODULE_F_DICT) {
+        return (log_nmgr_add_dict_entry(log, arg, dptr, len, &ueh));
+    }
+
     dlen = min(len-sizeof(ueh), 128);
 
     rc = log_read(log, dptr, data, sizeof(ueh), dlen);
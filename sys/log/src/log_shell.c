@@ -36,6 +36,34 @@
 #include <shell/shell.h>
 #include <console/console.h> 
 
+/*
+ * Format strings are not on target, print message id and arguments. These
+ * can be formatted on host with sys/log/scripts/log_dict.py.
+ */
+static int
+shell_log_dump_dict_entry(struct log *log, void *dptr, uint16_t len,
+        struct log_entry_hdr *ueh)
+{
+    uint32_t args[LOG_DICT_MAX_ARGS];
+    uint32_t id;
+    int cnt;
+    int i;
+
+    cnt = log_dict_read(log, dptr, len, &id, args);
+    if (cnt < 0) {
+        return (0);
+    }
+
+    console_printf("[%lu] dict %lu", (unsigned long) ueh->ue_ts,
+            (unsigned long) id);
+    for (i = 0; i < cnt; i++) {
+        console_printf(" %lx", (unsigned long) args[i]);
+    }
+    console_printf("\n");
+
+    return (0);
+}
+
 static int 
 shell_log_dump_entry(struct log *log, void *arg, void *dptr, uint16_t len) 
 {
@@ -49,6 +77,10 @@ shell_log_dump_entry(struct log *log, void *arg, void *dptr, uint16_t len)
         goto err;
     }
 
+    if (ueh.ue_module & LOG_MODULE_F_DICT) {
+        return (shell_log_dump_dict_entry(log, dptr, len, &ueh));
+    }
+
     dlen = min(len-sizeof(ueh), 128);
 
     rc = log_read(log, dptr, data, sizeof(ueh), dlen);
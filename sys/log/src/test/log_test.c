@@ -137,12 +137,159 @@ TEST_CASE(log_flush_fcb)
     TEST_ASSERT(rc == 0);
 }
 
+static int dict_idx;
+
+TEST_CASE(log_append_dict)
+{
+    LOG_DICT(&my_log, 5, LOG_LEVEL_INFO, "dict %d %x", -1, 0xabcd);
+    LOG_DICT(&my_log, 5, LOG_LEVEL_DEBUG, "dict no args");
+}
+
+static int
+log_test_walk_dict(struct log *log, void *arg, void *dptr, uint16_t len)
+{
+    struct log_entry_hdr ueh;
+    uint32_t args[LOG_DICT_MAX_ARGS];
+    uint32_t id;
+    int rc;
+
+    rc = log_read(log, dptr, &ueh, 0, sizeof(ueh));
+    TEST_ASSERT(rc == sizeof(ueh));
+    TEST_ASSERT(ueh.ue_module == (5 | LOG_MODULE_F_DICT));
+
+    rc = log_dict_read(log, dptr, len, &id, args);
+    switch (dict_idx) {
+    case 0:
+        TEST_ASSERT(ueh.ue_level == LOG_LEVEL_INFO);
+        TEST_ASSERT(rc == 2);
+        TEST_ASSERT(!strcmp(&__start_log_dict_fmt[id], "dict %d %x"));
+        TEST_ASSERT(args[0] == (uint32_t)-1);
+        TEST_ASSERT(args[1] == 0xabcd);
+        break;
+    case 1:
+        TEST_ASSERT(ueh.ue_level == LOG_LEVEL_DEBUG);
+        TEST_ASSERT(rc == 0);
+        TEST_ASSERT(len == sizeof(ueh) + sizeof(id));
+        TEST_ASSERT(!strcmp(&__start_log_dict_fmt[id], "dict no args"));
+        break;
+    default:
+        TEST_ASSERT(0);
+        break;
+    }
+    dict_idx++;
+
+    return 0;
+}
+
+TEST_CASE(log_walk_dict)
+{
+    int rc;
+
+    dict_idx = 0;
+
+    rc = log_walk(&my_log, log_test_walk_dict, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(dict_idx == 2);
+}
+
+static struct log_handler log_async_handler;
+static struct log_async my_log_async;
+static uint32_t log_async_buf[21];
+static struct log my_async_log;
+static int async_cnt;
+
+static int
+log_test_walk_async(struct log *log, void *arg, void *dptr, uint16_t len)
+{
+    struct log_entry_hdr ueh;
+    char data[16];
+    int rc;
+
+    rc = log_read(log, dptr, &ueh, 0, sizeof(ueh));
+    TEST_ASSERT(rc == sizeof(ueh));
+    rc = log_read(log, dptr, data, sizeof(ueh), len - sizeof(ueh));
+    TEST_ASSERT(rc == 4);
+    TEST_ASSERT(!memcmp(data, "ent", 4));
+    async_cnt++;
+
+    return 0;
+}
+
+TEST_CASE(log_async_fcb)
+{
+    uint8_t buf[LOG_ENTRY_HDR_SIZE + 4];
+    int appended;
+    int rc;
+    int i;
+
+    rc = log_flush(&my_log);
+    TEST_ASSERT(rc == 0);
+
+    rc = log_async_handler_init(&log_async_handler, &my_log_async,
+            &log_fcb_handler, log_async_buf, sizeof(log_async_buf));
+    TEST_ASSERT(rc == 0);
+    log_register("async", &my_async_log, &log_async_handler);
+
+    /*
+     * Entries stay in RAM until flushed. Ring takes 4 entries.
+     */
+    memcpy(&buf[LOG_ENTRY_HDR_SIZE], "ent", 4);
+    appended = 0;
+    for (i = 0; i < 6; i++) {
+        rc = log_append(&my_async_log, 0, 0, buf, 4);
+        if (rc == 0) {
+            appended++;
+        }
+    }
+    TEST_ASSERT(appended == 4);
+    TEST_ASSERT(my_log_async.la_drops == 2);
+
+    async_cnt = 0;
+    rc = log_walk(&my_log, log_test_walk_async, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(async_cnt == 0);
+
+    log_async_flush();
+    TEST_ASSERT(my_log_async.la_used == 0);
+
+    async_cnt = 0;
+    rc = log_walk(&my_log, log_test_walk_async, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(async_cnt == 4);
+
+    /*
+     * Wrap around the end of ring. Walking the async log passes queued
+     * entries on first.
+     */
+    for (i = 0; i < 10; i++) {
+        rc = log_append(&my_async_log, 0, 0, buf, 4);
+        TEST_ASSERT(rc == 0);
+        rc = log_append(&my_async_log, 0, 0, buf, 4);
+        TEST_ASSERT(rc == 0);
+        rc = log_append(&my_async_log, 0, 0, buf, 4);
+        TEST_ASSERT(rc == 0);
+        log_async_flush();
+    }
+    rc = log_append(&my_async_log, 0, 0, buf, 4);
+    TEST_ASSERT(rc == 0);
+
+    async_cnt = 0;
+    rc = log_walk(&my_async_log, log_test_walk_async, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(async_cnt == 4 + 31);
+    TEST_ASSERT(my_log_async.la_drops == 2);
+    TEST_ASSERT(my_log_async.la_errs == 0);
+}
+
 TEST_SUITE(log_test_all)
 {
     log_setup_fcb();
     log_append_fcb();
     log_walk_fcb();
     log_flush_fcb();
+    log_append_dict();
+    log_walk_dict();
+    log_async_fcb();
 }
 
 #ifdef MYNEWT_SELFTEST